@@ -51,6 +51,14 @@ def load_deps(ocpdiag_package_name = "ocpdiag/"):
         sha256 = "e7c605119f5aefdf3cd0159f2cbc439c2f7d614c99758be32e0258d49201fc4e",
     )
 
+    maybe(
+        http_archive,
+        "com_github_google_benchmark",
+        url = "https://github.com/google/benchmark/archive/refs/tags/v1.7.1.tar.gz",
+        strip_prefix = "benchmark-1.7.1",
+        sha256 = "6430e4092653380d9dc4ccb45a1e2dc9259d581f4866dc0759713126056bc1d7",
+    )
+
     maybe(
         http_archive,
         "com_google_absl_py",
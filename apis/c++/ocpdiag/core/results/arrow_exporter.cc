@@ -0,0 +1,413 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/arrow_exporter.h"
+
+#include <sys/time.h>
+
+#include <cstdint>
+#include <filesystem>  //
+#include <limits>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/arrow_ipc_writer.h"
+#include "ocpdiag/core/results/output_iterator.h"
+#include "ocpdiag/core/results/structs.h"
+#include "ocpdiag/core/results/variant.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+using ::ocpdiag::results::internal::ArrowField;
+using ::ocpdiag::results::internal::ArrowIpcWriter;
+using ::ocpdiag::results::internal::ArrowType;
+
+// Columns of each table, in schema order.
+enum MeasurementColumn {
+  kMeasurementTestStepId,
+  kMeasurementName,
+  kMeasurementUnit,
+  kMeasurementHardwareInfoId,
+  kMeasurementSubcomponent,
+  kMeasurementNumberValue,
+  kMeasurementStringValue,
+  kMeasurementBoolValue,
+  kMeasurementIntegerValue,
+  kMeasurementTimestamp,
+};
+
+enum SeriesElementColumn {
+  kElementTestStepId,
+  kElementSeriesId,
+  kElementName,
+  kElementUnit,
+  kElementHardwareInfoId,
+  kElementIndex,
+  kElementNumberValue,
+  kElementStringValue,
+  kElementBoolValue,
+  kElementIntegerValue,
+  kElementTimestamp,
+};
+
+enum DiagnosisColumn {
+  kDiagnosisTestStepId,
+  kDiagnosisVerdict,
+  kDiagnosisType,
+  kDiagnosisMessage,
+  kDiagnosisHardwareInfoId,
+  kDiagnosisSubcomponent,
+  kDiagnosisTimestamp,
+};
+
+enum ErrorColumn {
+  kErrorTestStepId,
+  kErrorSymptom,
+  kErrorMessage,
+  kErrorSoftwareInfoIds,
+  kErrorTimestamp,
+};
+
+enum HardwareInfoColumn {
+  kHardwareDutInfoId,
+  kHardwareDutName,
+  kHardwareInfoId,
+  kHardwareName,
+  kHardwareComputerSystem,
+  kHardwareLocation,
+  kHardwareOdataId,
+  kHardwarePartNumber,
+  kHardwareSerialNumber,
+  kHardwareManager,
+  kHardwareManufacturer,
+  kHardwareManufacturerPartNumber,
+  kHardwarePartType,
+  kHardwareVersion,
+  kHardwareRevision,
+};
+
+std::unique_ptr<ArrowIpcWriter> CreateTable(absl::string_view output_dir,
+                                            absl::string_view file_name,
+                                            std::vector<ArrowField> fields,
+                                            const ArrowExportOptions& options) {
+  return std::make_unique<ArrowIpcWriter>(
+      (std::filesystem::path(std::string(output_dir)) / std::string(file_name))
+          .string(),
+      std::move(fields), options.batch_size);
+}
+
+// Appends a value that is null when empty, for optional string fields.
+void AppendOptionalString(ArrowIpcWriter& writer, int column,
+                          absl::string_view value) {
+  if (value.empty()) {
+    writer.AppendNull(column);
+  } else {
+    writer.AppendString(column, value);
+  }
+}
+
+void AppendSubcomponent(ArrowIpcWriter& writer, int column,
+                        const std::optional<SubcomponentOutput>& subcomponent) {
+  if (subcomponent.has_value()) {
+    writer.AppendString(column, subcomponent->name);
+  } else {
+    writer.AppendNull(column);
+  }
+}
+
+// Appends the value to the number, string, bool and integer columns that
+// start at `first_column`. Integers are also appended to the number column, as
+// doubles, and only those that fit in an int64 to the integer column.
+void AppendVariant(ArrowIpcWriter& writer, int first_column,
+                   const Variant& value) {
+  int number_column = first_column;
+  int string_column = first_column + 1;
+  int bool_column = first_column + 2;
+  int integer_column = first_column + 3;
+  if (IsNumeric(value)) {
+    writer.AppendDouble(number_column, NumericAsDouble(value));
+  } else {
+    writer.AppendNull(number_column);
+  }
+  if (const std::string* str = std::get_if<std::string>(&value);
+      str != nullptr) {
+    writer.AppendString(string_column, *str);
+  } else {
+    writer.AppendNull(string_column);
+  }
+  if (const bool* b = std::get_if<bool>(&value); b != nullptr) {
+    writer.AppendBool(bool_column, *b);
+  } else {
+    writer.AppendNull(bool_column);
+  }
+  if (const int64_t* i = std::get_if<int64_t>(&value); i != nullptr) {
+    writer.AppendInt64(integer_column, *i);
+  } else if (const uint64_t* u = std::get_if<uint64_t>(&value);
+             u != nullptr && *u <= std::numeric_limits<int64_t>::max()) {
+    writer.AppendInt64(integer_column, static_cast<int64_t>(*u));
+  } else {
+    writer.AppendNull(integer_column);
+  }
+}
+
+void AppendTimestamp(ArrowIpcWriter& writer, int column,
+                     const timeval& timestamp) {
+  writer.AppendInt64(column, int64_t{timestamp.tv_sec} * 1'000'000 +
+                                 timestamp.tv_usec);
+}
+
+const char* DiagnosisTypeName(DiagnosisType type) {
+  switch (type) {
+    case DiagnosisType::kPass:
+      return "PASS";
+    case DiagnosisType::kFail:
+      return "FAIL";
+    default:
+      return "UNKNOWN";
+  }
+}
+
+}  // namespace
+
+ArrowExporter::ArrowExporter(absl::string_view output_dir,
+                             ArrowExportOptions options) {
+  measurements_ = CreateTable(
+      output_dir, kArrowMeasurementsFile,
+      {
+          {"test_step_id", ArrowType::kDictionaryUtf8},
+          {"name", ArrowType::kDictionaryUtf8},
+          {"unit", ArrowType::kDictionaryUtf8},
+          {"hardware_info_id", ArrowType::kDictionaryUtf8},
+          {"subcomponent", ArrowType::kDictionaryUtf8},
+          {"number_value", ArrowType::kFloat64},
+          {"string_value", ArrowType::kUtf8},
+          {"bool_value", ArrowType::kBool},
+          {"integer_value", ArrowType::kInt64},
+          {"timestamp", ArrowType::kTimestampMicros},
+      },
+      options);
+  series_elements_ = CreateTable(
+      output_dir, kArrowSeriesElementsFile,
+      {
+          {"test_step_id", ArrowType::kDictionaryUtf8},
+          {"measurement_series_id", ArrowType::kDictionaryUtf8},
+          {"name", ArrowType::kDictionaryUtf8},
+          {"unit", ArrowType::kDictionaryUtf8},
+          {"hardware_info_id", ArrowType::kDictionaryUtf8},
+          {"index", ArrowType::kInt64},
+          {"number_value", ArrowType::kFloat64},
+          {"string_value", ArrowType::kUtf8},
+          {"bool_value", ArrowType::kBool},
+          {"integer_value", ArrowType::kInt64},
+          {"timestamp", ArrowType::kTimestampMicros},
+      },
+      options);
+  diagnoses_ = CreateTable(
+      output_dir, kArrowDiagnosesFile,
+      {
+          {"test_step_id", ArrowType::kDictionaryUtf8},
+          {"verdict", ArrowType::kDictionaryUtf8},
+          {"type", ArrowType::kDictionaryUtf8},
+          {"message", ArrowType::kUtf8},
+          {"hardware_info_id", ArrowType::kDictionaryUtf8},
+          {"subcomponent", ArrowType::kDictionaryUtf8},
+          {"timestamp", ArrowType::kTimestampMicros},
+      },
+      options);
+  errors_ = CreateTable(
+      output_dir, kArrowErrorsFile,
+      {
+          {"test_step_id", ArrowType::kDictionaryUtf8},
+          {"symptom", ArrowType::kDictionaryUtf8},
+          {"message", ArrowType::kUtf8},
+          {"software_info_ids", ArrowType::kUtf8},
+          {"timestamp", ArrowType::kTimestampMicros},
+      },
+      options);
+  hardware_infos_ = CreateTable(
+      output_dir, kArrowHardwareInfosFile,
+      {
+          {"dut_info_id", ArrowType::kDictionaryUtf8},
+          {"dut_name", ArrowType::kDictionaryUtf8},
+          {"hardware_info_id", ArrowType::kUtf8},
+          {"name", ArrowType::kUtf8},
+          {"computer_system", ArrowType::kDictionaryUtf8},
+          {"location", ArrowType::kUtf8},
+          {"odata_id", ArrowType::kUtf8},
+          {"part_number", ArrowType::kDictionaryUtf8},
+          {"serial_number", ArrowType::kUtf8},
+          {"manager", ArrowType::kDictionaryUtf8},
+          {"manufacturer", ArrowType::kDictionaryUtf8},
+          {"manufacturer_part_number", ArrowType::kDictionaryUtf8},
+          {"part_type", ArrowType::kDictionaryUtf8},
+          {"version", ArrowType::kDictionaryUtf8},
+          {"revision", ArrowType::kDictionaryUtf8},
+      },
+      options);
+}
+
+absl::Status ArrowExporter::Add(const OutputArtifact& artifact) {
+  if (auto* test_step = std::get_if<TestStepArtifact>(&artifact.artifact);
+      test_step != nullptr) {
+    return AddTestStepArtifact(*test_step, artifact.timestamp);
+  }
+  if (auto* test_run = std::get_if<TestRunArtifact>(&artifact.artifact);
+      test_run != nullptr) {
+    if (auto* start = std::get_if<TestRunStartOutput>(&test_run->artifact);
+        start != nullptr) {
+      return AddDutInfo(start->dut_info);
+    }
+    if (auto* error = std::get_if<ErrorOutput>(&test_run->artifact);
+        error != nullptr) {
+      return AddError(*error, /*test_step_id=*/"", artifact.timestamp);
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ArrowExporter::AddTestStepArtifact(
+    const TestStepArtifact& artifact, const timeval& timestamp) {
+  const std::string& step_id = artifact.test_step_id;
+  if (auto* measurement = std::get_if<MeasurementOutput>(&artifact.artifact);
+      measurement != nullptr) {
+    ArrowIpcWriter& table = *measurements_;
+    table.AppendString(kMeasurementTestStepId, step_id);
+    table.AppendString(kMeasurementName, measurement->name);
+    AppendOptionalString(table, kMeasurementUnit, measurement->unit);
+    AppendOptionalString(table, kMeasurementHardwareInfoId,
+                         measurement->hardware_info_id);
+    AppendSubcomponent(table, kMeasurementSubcomponent,
+                       measurement->subcomponent);
+    AppendVariant(table, kMeasurementNumberValue, measurement->value);
+    AppendTimestamp(table, kMeasurementTimestamp, timestamp);
+    return table.EndRow();
+  }
+  if (auto* series_start =
+          std::get_if<MeasurementSeriesStartOutput>(&artifact.artifact);
+      series_start != nullptr) {
+    series_[series_start->measurement_series_id] = {
+        .name = series_start->name,
+        .unit = series_start->unit,
+        .hardware_info_id = series_start->hardware_info_id,
+    };
+    return absl::OkStatus();
+  }
+  if (auto* element =
+          std::get_if<MeasurementSeriesElementOutput>(&artifact.artifact);
+      element != nullptr) {
+    ArrowIpcWriter& table = *series_elements_;
+    table.AppendString(kElementTestStepId, step_id);
+    table.AppendString(kElementSeriesId, element->measurement_series_id);
+    auto series = series_.find(element->measurement_series_id);
+    if (series != series_.end()) {
+      table.AppendString(kElementName, series->second.name);
+      AppendOptionalString(table, kElementUnit, series->second.unit);
+      AppendOptionalString(table, kElementHardwareInfoId,
+                           series->second.hardware_info_id);
+    } else {
+      table.AppendNull(kElementName);
+      table.AppendNull(kElementUnit);
+      table.AppendNull(kElementHardwareInfoId);
+    }
+    table.AppendInt64(kElementIndex, element->index);
+    AppendVariant(table, kElementNumberValue, element->value);
+    AppendTimestamp(table, kElementTimestamp, element->timestamp);
+    return table.EndRow();
+  }
+  if (auto* series_end =
+          std::get_if<MeasurementSeriesEndOutput>(&artifact.artifact);
+      series_end != nullptr) {
+    series_.erase(series_end->measurement_series_id);
+    return absl::OkStatus();
+  }
+  if (auto* diagnosis = std::get_if<DiagnosisOutput>(&artifact.artifact);
+      diagnosis != nullptr) {
+    ArrowIpcWriter& table = *diagnoses_;
+    table.AppendString(kDiagnosisTestStepId, step_id);
+    table.AppendString(kDiagnosisVerdict, diagnosis->verdict);
+    table.AppendString(kDiagnosisType, DiagnosisTypeName(diagnosis->type));
+    AppendOptionalString(table, kDiagnosisMessage, diagnosis->message);
+    AppendOptionalString(table, kDiagnosisHardwareInfoId,
+                         diagnosis->hardware_info_id);
+    AppendSubcomponent(table, kDiagnosisSubcomponent, diagnosis->subcomponent);
+    AppendTimestamp(table, kDiagnosisTimestamp, timestamp);
+    return table.EndRow();
+  }
+  if (auto* error = std::get_if<ErrorOutput>(&artifact.artifact);
+      error != nullptr) {
+    return AddError(*error, step_id, timestamp);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ArrowExporter::AddError(const ErrorOutput& error,
+                                     absl::string_view test_step_id,
+                                     const timeval& timestamp) {
+  ArrowIpcWriter& table = *errors_;
+  AppendOptionalString(table, kErrorTestStepId, test_step_id);
+  table.AppendString(kErrorSymptom, error.symptom);
+  AppendOptionalString(table, kErrorMessage, error.message);
+  AppendOptionalString(table, kErrorSoftwareInfoIds,
+                       absl::StrJoin(error.software_info_ids, ","));
+  AppendTimestamp(table, kErrorTimestamp, timestamp);
+  return table.EndRow();
+}
+
+absl::Status ArrowExporter::AddDutInfo(const DutInfoOutput& dut_info) {
+  ArrowIpcWriter& table = *hardware_infos_;
+  for (const HardwareInfoOutput& info : dut_info.hardware_infos) {
+    table.AppendString(kHardwareDutInfoId, dut_info.dut_info_id);
+    table.AppendString(kHardwareDutName, dut_info.name);
+    table.AppendString(kHardwareInfoId, info.hardware_info_id);
+    table.AppendString(kHardwareName, info.name);
+    AppendOptionalString(table, kHardwareComputerSystem, info.computer_system);
+    AppendOptionalString(table, kHardwareLocation, info.location);
+    AppendOptionalString(table, kHardwareOdataId, info.odata_id);
+    AppendOptionalString(table, kHardwarePartNumber, info.part_number);
+    AppendOptionalString(table, kHardwareSerialNumber, info.serial_number);
+    AppendOptionalString(table, kHardwareManager, info.manager);
+    AppendOptionalString(table, kHardwareManufacturer, info.manufacturer);
+    AppendOptionalString(table, kHardwareManufacturerPartNumber,
+                         info.manufacturer_part_number);
+    AppendOptionalString(table, kHardwarePartType, info.part_type);
+    AppendOptionalString(table, kHardwareVersion, info.version);
+    AppendOptionalString(table, kHardwareRevision, info.revision);
+    if (absl::Status status = table.EndRow(); !status.ok()) return status;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ArrowExporter::Close() {
+  absl::Status status;
+  for (ArrowIpcWriter* table :
+       {measurements_.get(), series_elements_.get(), diagnoses_.get(),
+        errors_.get(), hardware_infos_.get()}) {
+    status.Update(table->Close());
+  }
+  return status;
+}
+
+absl::Status ExportResultsToArrow(absl::string_view results_path,
+                                  absl::string_view output_dir,
+                                  ArrowExportOptions options) {
+  ArrowExporter exporter(output_dir, options);
+  for (const OutputArtifact& artifact : OutputContainer(results_path)) {
+    if (absl::Status status = exporter.Add(artifact); !status.ok())
+      return status;
+  }
+  return exporter.Close();
+}
+
+}  // namespace ocpdiag::results
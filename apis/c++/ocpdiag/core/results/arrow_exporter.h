@@ -0,0 +1,86 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_ARROW_EXPORTER_H_
+#define OCPDIAG_CORE_RESULTS_ARROW_EXPORTER_H_
+
+#include <memory>
+#include <string>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/arrow_ipc_writer.h"
+#include "ocpdiag/core/results/structs.h"
+
+namespace ocpdiag::results {
+
+// Names of the Arrow IPC files written by the ArrowExporter.
+inline constexpr char kArrowMeasurementsFile[] = "measurements.arrow";
+inline constexpr char kArrowSeriesElementsFile[] =
+    "measurement_series_elements.arrow";
+inline constexpr char kArrowDiagnosesFile[] = "diagnoses.arrow";
+inline constexpr char kArrowErrorsFile[] = "errors.arrow";
+inline constexpr char kArrowHardwareInfosFile[] = "hardware_infos.arrow";
+
+struct ArrowExportOptions {
+  // Maximum number of rows in each record batch of the tables.
+  int batch_size = internal::ArrowIpcWriter::kDefaultBatchSize;
+};
+
+// Exports the artifacts of a test run as typed columnar tables, one Arrow IPC
+// file per table in the output directory:
+//  - measurements, with the value split into number, string, bool and integer
+//    columns.
+//  - measurement series elements, with the name, unit and hardware info of
+//    their series.
+//  - diagnoses and errors, including the test run errors.
+//  - hardware infos of the DUT, which the other tables join against on
+//    hardware_info_id.
+// Names, units, verdicts and other repeated strings are dictionary-encoded.
+// This class is not thread-safe.
+class ArrowExporter {
+ public:
+  explicit ArrowExporter(absl::string_view output_dir,
+                         ArrowExportOptions options = {});
+
+  absl::Status Add(const OutputArtifact& artifact);
+
+  // Finishes the tables. Must be called before the files are read.
+  absl::Status Close();
+
+ private:
+  struct SeriesInfo {
+    std::string name;
+    std::string unit;
+    std::string hardware_info_id;
+  };
+
+  absl::Status AddTestStepArtifact(const TestStepArtifact& artifact,
+                                   const timeval& timestamp);
+  absl::Status AddError(const ErrorOutput& error,
+                        absl::string_view test_step_id,
+                        const timeval& timestamp);
+  absl::Status AddDutInfo(const DutInfoOutput& dut_info);
+
+  std::unique_ptr<internal::ArrowIpcWriter> measurements_;
+  std::unique_ptr<internal::ArrowIpcWriter> series_elements_;
+  std::unique_ptr<internal::ArrowIpcWriter> diagnoses_;
+  std::unique_ptr<internal::ArrowIpcWriter> errors_;
+  std::unique_ptr<internal::ArrowIpcWriter> hardware_infos_;
+  absl::flat_hash_map<std::string, SeriesInfo> series_;
+};
+
+// Exports the results file to Arrow IPC files in the output directory, see
+// ArrowExporter. It crashes if the results file cannot be read, like the
+// OutputContainer.
+absl::Status ExportResultsToArrow(absl::string_view results_path,
+                                  absl::string_view output_dir,
+                                  ArrowExportOptions options = {});
+
+}  // namespace ocpdiag::results
+
+#endif  // OCPDIAG_CORE_RESULTS_ARROW_EXPORTER_H_
@@ -0,0 +1,48 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+// Exports an OCPDiag results file as Arrow IPC tables for columnar analytics
+// engines, e.g.
+//   export_arrow --output_dir=/tmp/tables results.riegeli
+
+#include <cstdlib>
+#include <filesystem>  //
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "ocpdiag/core/results/arrow_exporter.h"
+
+ABSL_FLAG(std::string, output_dir, ".",
+          "Directory where the Arrow IPC files are written.");
+ABSL_FLAG(int, batch_size,
+          ocpdiag::results::internal::ArrowIpcWriter::kDefaultBatchSize,
+          "Maximum number of rows in each record batch.");
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Exports an OCPDiag results file as Arrow IPC tables.\n"
+      "Usage: export_arrow [flags] FILE");
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  if (args.size() != 2) {
+    std::cerr << "Expected exactly one input file" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::string output_dir = absl::GetFlag(FLAGS_output_dir);
+  std::filesystem::create_directories(output_dir);
+  if (absl::Status status = ocpdiag::results::ExportResultsToArrow(
+          args[1], output_dir, {.batch_size = absl::GetFlag(FLAGS_batch_size)});
+      !status.ok()) {
+    std::cerr << "Failed to export results: " << status.ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/arrow_exporter.h"
+
+#include <filesystem>  //
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/log/check.h"
+#include "absl/strings/match.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/testing/file_utils.h"
+#include "ocpdiag/core/testing/parse_text_proto.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+
+namespace ocpdiag::results {
+
+using ::ocpdiag::testing::IsOk;
+using ::ocpdiag::testing::ParseTextProtoOrDie;
+
+namespace {
+
+std::string ReadFile(const std::filesystem::path& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+int CountOccurrences(absl::string_view haystack, absl::string_view needle) {
+  int count = 0;
+  for (size_t pos = haystack.find(needle); pos != absl::string_view::npos;
+       pos = haystack.find(needle, pos + 1)) {
+    count++;
+  }
+  return count;
+}
+
+class ArrowExporterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    results_path_ = testutils::MkTempFileOrDie("arrow_exporter");
+    CHECK(std::filesystem::remove(results_path_));
+    output_dir_ = std::filesystem::path(results_path_).parent_path() /
+                  "arrow_exporter_output";
+    std::filesystem::create_directories(output_dir_);
+  }
+
+  std::string results_path_;
+  std::filesystem::path output_dir_;
+};
+
+TEST_F(ArrowExporterTest, TablesAreWritten) {
+  {
+    internal::ArtifactWriter writer(results_path_, /*output_stream=*/nullptr,
+                                    {.flush_each_minute = false});
+    ocpdiag_results_v2_pb::TestRunArtifact start = ParseTextProtoOrDie(R"pb(
+      test_run_start {
+        name: "test"
+        dut_info {
+          dut_info_id: "dut"
+          name: "host"
+          hardware_infos { hardware_info_id: "0" name: "dimm0" }
+          hardware_infos { hardware_info_id: "1" name: "dimm1" }
+        }
+      }
+    )pb");
+    writer.Write(start);
+    for (int i = 0; i < 2; i++) {
+      ocpdiag_results_v2_pb::TestStepArtifact measurement =
+          ParseTextProtoOrDie(R"pb(
+            test_step_id: "0"
+            measurement {
+              name: "dimm-temperature"
+              unit: "C"
+              hardware_info_id: "0"
+              value { number_value: 40 }
+            }
+          )pb");
+      writer.Write(measurement);
+    }
+    ocpdiag_results_v2_pb::TestStepArtifact diagnosis = ParseTextProtoOrDie(
+        R"pb(
+          test_step_id: "0"
+          diagnosis {
+            verdict: "dimm-overheated"
+            type: FAIL
+            hardware_info_id: "1"
+          }
+        )pb");
+    writer.Write(diagnosis);
+  }
+
+  ASSERT_THAT(ExportResultsToArrow(results_path_, output_dir_.string()),
+              IsOk());
+  for (const char* file :
+       {kArrowMeasurementsFile, kArrowSeriesElementsFile, kArrowDiagnosesFile,
+        kArrowErrorsFile, kArrowHardwareInfosFile}) {
+    EXPECT_TRUE(std::filesystem::exists(output_dir_ / file)) << file;
+  }
+  // Repeated names are stored once, in the dictionary of the column.
+  std::string measurements = ReadFile(output_dir_ / kArrowMeasurementsFile);
+  EXPECT_EQ(CountOccurrences(measurements, "dimm-temperature"), 1);
+  EXPECT_TRUE(absl::StrContains(ReadFile(output_dir_ / kArrowDiagnosesFile),
+                                "dimm-overheated"));
+  std::string hardware_infos = ReadFile(output_dir_ / kArrowHardwareInfosFile);
+  EXPECT_TRUE(absl::StrContains(hardware_infos, "dimm0"));
+  EXPECT_TRUE(absl::StrContains(hardware_infos, "dimm1"));
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results
@@ -0,0 +1,565 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/arrow_ipc_writer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/config.h"
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "riegeli/bytes/fd_writer.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+// Arrow IPC metadata is encoded as flatbuffers, see
+// https://github.com/apache/arrow/blob/main/format/Message.fbs. This builder
+// covers the handful of flatbuffer features the metadata needs. Like the
+// flatbuffers library, it builds the buffer back to front, so that objects
+// are created before the tables that refer to them.
+class FlatBufferBuilder {
+ public:
+  // Position of an object, counted from the end of the buffer.
+  using Offset = uint32_t;
+
+  Offset CreateString(absl::string_view value) {
+    Align(sizeof(uint32_t), value.size() + 1);
+    buffer_.insert(0, 1, '\0');
+    buffer_.insert(0, value.data(), value.size());
+    PrependLittleEndian<uint32_t>(value.size());
+    return Size();
+  }
+
+  Offset CreateVector(absl::Span<const Offset> offsets) {
+    Align(sizeof(uint32_t), offsets.size() * sizeof(uint32_t));
+    for (auto it = offsets.rbegin(); it != offsets.rend(); ++it)
+      PrependOffset(*it);
+    PrependLittleEndian<uint32_t>(offsets.size());
+    return Size();
+  }
+
+  // Creates a vector of structs that are laid out as `words_per_struct`
+  // 64-bit words each.
+  Offset CreateStructVector(absl::Span<const int64_t> words,
+                            size_t words_per_struct) {
+    Align(sizeof(int64_t), words.size() * sizeof(int64_t));
+    for (auto it = words.rbegin(); it != words.rend(); ++it)
+      PrependLittleEndian(*it);
+    PrependLittleEndian<uint32_t>(words.size() / words_per_struct);
+    return Size();
+  }
+
+  // Tables are built by adding their fields between StartTable and EndTable.
+  // Nested objects must be created before the table is started.
+  void StartTable() {
+    table_fields_.clear();
+    table_start_ = Size();
+  }
+
+  template <typename T>
+  void AddScalar(int slot, T value) {
+    Align(sizeof(T));
+    PrependLittleEndian(value);
+    table_fields_.push_back({slot, Size()});
+  }
+
+  void AddOffset(int slot, Offset target) {
+    PrependOffset(target);
+    table_fields_.push_back({slot, Size()});
+  }
+
+  Offset EndTable() {
+    // The table starts with the offset to its vtable, which is filled in once
+    // the vtable is written in front of the table.
+    Align(sizeof(int32_t));
+    PrependLittleEndian<int32_t>(0);
+    Offset table = Size();
+    int num_slots = 0;
+    for (const auto& [slot, position] : table_fields_)
+      num_slots = std::max(num_slots, slot + 1);
+    std::vector<uint16_t> slots(num_slots, 0);
+    for (const auto& [slot, position] : table_fields_)
+      slots[slot] = table - position;
+    for (auto it = slots.rbegin(); it != slots.rend(); ++it)
+      PrependLittleEndian(*it);
+    PrependLittleEndian<uint16_t>(table - table_start_);
+    PrependLittleEndian<uint16_t>(sizeof(uint16_t) * (2 + num_slots));
+    Offset vtable = Size();
+    StoreLittleEndian<int32_t>(vtable - table, &buffer_[Size() - table]);
+    return table;
+  }
+
+  std::string Finish(Offset root) {
+    Align(max_alignment_, sizeof(uint32_t));
+    PrependOffset(root);
+    return std::move(buffer_);
+  }
+
+ private:
+  Offset Size() const { return buffer_.size(); }
+
+  // Pads the front of the buffer so that it is aligned to `alignment` once
+  // `additional` bytes are prepended. Alignment is relative to the end of the
+  // buffer, which is aligned to the largest alignment when it is finished.
+  void Align(size_t alignment, size_t additional = 0) {
+    max_alignment_ = std::max(max_alignment_, alignment);
+    size_t unaligned = (Size() + additional) % alignment;
+    buffer_.insert(0, (alignment - unaligned) % alignment, '\0');
+  }
+
+  template <typename T>
+  static void StoreLittleEndian(T value, char* dest) {
+    auto bits = static_cast<std::make_unsigned_t<T>>(value);
+    for (size_t i = 0; i < sizeof(T); i++) dest[i] = (bits >> (8 * i)) & 0xff;
+  }
+
+  template <typename T>
+  void PrependLittleEndian(T value) {
+    char bytes[sizeof(T)];
+    StoreLittleEndian(value, bytes);
+    buffer_.insert(0, bytes, sizeof(T));
+  }
+
+  // Offsets are relative to their own position and point towards the end.
+  void PrependOffset(Offset target) {
+    Align(sizeof(uint32_t));
+    PrependLittleEndian<uint32_t>(Size() + sizeof(uint32_t) - target);
+  }
+
+  // The metadata messages are small, so prepending to a string is cheap
+  // enough.
+  std::string buffer_;
+  size_t max_alignment_ = 1;
+  Offset table_start_ = 0;
+  struct TableField {
+    int slot;
+    Offset position;
+  };
+  std::vector<TableField> table_fields_;
+};
+
+using Offset = FlatBufferBuilder::Offset;
+
+constexpr absl::string_view kMagic("ARROW1\0\0", 8);
+constexpr int16_t kMetadataVersionV5 = 4;
+constexpr uint32_t kContinuation = 0xFFFFFFFF;
+constexpr int64_t kMaxBatchDataBytes = 64 << 20;
+
+// Enum values and field slots from Schema.fbs and Message.fbs.
+enum MessageHeader : uint8_t {
+  kSchemaHeader = 1,
+  kDictionaryBatchHeader = 2,
+  kRecordBatchHeader = 3,
+};
+
+enum TypeTag : uint8_t {
+  kIntType = 2,
+  kFloatingPointType = 3,
+  kUtf8Type = 5,
+  kBoolType = 6,
+  kTimestampType = 10,
+};
+
+constexpr int16_t kLittleEndian = 0;
+constexpr int16_t kBigEndian = 1;
+constexpr int16_t kDoublePrecision = 2;
+constexpr int16_t kMicrosecond = 2;
+
+int64_t PaddedSize(int64_t size) { return (size + 7) / 8 * 8; }
+
+void AppendBit(std::string& bitmap, int64_t index, bool value) {
+  if (index % 8 == 0) bitmap.push_back('\0');
+  if (value) bitmap.back() |= 1 << (index % 8);
+}
+
+template <typename T>
+void AppendRaw(std::string& buffer, T value) {
+  buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+Offset CreateIntType(FlatBufferBuilder& fbb, int32_t bit_width) {
+  fbb.StartTable();
+  fbb.AddScalar<int32_t>(0, bit_width);
+  fbb.AddScalar<uint8_t>(1, /*is_signed=*/1);
+  return fbb.EndTable();
+}
+
+Offset CreateField(FlatBufferBuilder& fbb, const ArrowField& field,
+                   int64_t dictionary_id) {
+  Offset name = fbb.CreateString(field.name);
+  Offset children = fbb.CreateVector({});
+  TypeTag type_tag;
+  Offset type;
+  switch (field.type) {
+    case ArrowType::kInt64:
+      type_tag = kIntType;
+      type = CreateIntType(fbb, 64);
+      break;
+    case ArrowType::kFloat64:
+      type_tag = kFloatingPointType;
+      fbb.StartTable();
+      fbb.AddScalar<int16_t>(0, kDoublePrecision);
+      type = fbb.EndTable();
+      break;
+    case ArrowType::kBool:
+      type_tag = kBoolType;
+      fbb.StartTable();
+      type = fbb.EndTable();
+      break;
+    case ArrowType::kUtf8:
+    case ArrowType::kDictionaryUtf8:
+      type_tag = kUtf8Type;
+      fbb.StartTable();
+      type = fbb.EndTable();
+      break;
+    case ArrowType::kTimestampMicros: {
+      type_tag = kTimestampType;
+      Offset timezone = fbb.CreateString("UTC");
+      fbb.StartTable();
+      fbb.AddScalar<int16_t>(0, kMicrosecond);
+      fbb.AddOffset(1, timezone);
+      type = fbb.EndTable();
+      break;
+    }
+  }
+  Offset dictionary = 0;
+  if (field.type == ArrowType::kDictionaryUtf8) {
+    Offset index_type = CreateIntType(fbb, 32);
+    fbb.StartTable();
+    fbb.AddScalar<int64_t>(0, dictionary_id);
+    fbb.AddOffset(1, index_type);
+    dictionary = fbb.EndTable();
+  }
+
+  fbb.StartTable();
+  fbb.AddOffset(0, name);
+  fbb.AddScalar<uint8_t>(1, /*nullable=*/1);
+  fbb.AddScalar<uint8_t>(2, type_tag);
+  fbb.AddOffset(3, type);
+  if (dictionary != 0) fbb.AddOffset(4, dictionary);
+  fbb.AddOffset(5, children);
+  return fbb.EndTable();
+}
+
+// Dictionary ids are the indexes of the columns.
+Offset CreateSchema(FlatBufferBuilder& fbb,
+                    const std::vector<ArrowField>& fields) {
+  std::vector<Offset> field_offsets;
+  for (int i = 0; i < fields.size(); i++)
+    field_offsets.push_back(CreateField(fbb, fields[i], i));
+  Offset fields_vector = fbb.CreateVector(field_offsets);
+  fbb.StartTable();
+  fbb.AddScalar<int16_t>(0, ABSL_IS_LITTLE_ENDIAN ? kLittleEndian : kBigEndian);
+  fbb.AddOffset(1, fields_vector);
+  return fbb.EndTable();
+}
+
+// Buffers of a record batch body, each padded to 8 bytes.
+struct Body {
+  void AddBuffer(absl::string_view buffer) {
+    buffers.push_back(data.size());
+    buffers.push_back(buffer.size());
+    data.append(buffer.data(), buffer.size());
+    data.resize(PaddedSize(data.size()), '\0');
+  }
+
+  std::string data;
+  // Offset and length of each buffer.
+  std::vector<int64_t> buffers;
+  // Length and null count of each column.
+  std::vector<int64_t> nodes;
+};
+
+Offset CreateRecordBatch(FlatBufferBuilder& fbb, int64_t length,
+                         const Body& body) {
+  Offset nodes = fbb.CreateStructVector(body.nodes, 2);
+  Offset buffers = fbb.CreateStructVector(body.buffers, 2);
+  fbb.StartTable();
+  fbb.AddScalar<int64_t>(0, length);
+  fbb.AddOffset(1, nodes);
+  fbb.AddOffset(2, buffers);
+  return fbb.EndTable();
+}
+
+std::string CreateMessage(FlatBufferBuilder& fbb, MessageHeader header_type,
+                          Offset header, int64_t body_length) {
+  fbb.StartTable();
+  fbb.AddScalar<int16_t>(0, kMetadataVersionV5);
+  fbb.AddScalar<uint8_t>(1, header_type);
+  fbb.AddOffset(2, header);
+  fbb.AddScalar<int64_t>(3, body_length);
+  return fbb.Finish(fbb.EndTable());
+}
+
+}  // namespace
+
+ArrowIpcWriter::ArrowIpcWriter(absl::string_view path,
+                               std::vector<ArrowField> fields, int batch_size)
+    : file_(path), batch_size_(batch_size) {
+  CHECK_GT(batch_size, 0) << "Batch size must be positive";
+  for (ArrowField& field : fields) {
+    Column& column = columns_.emplace_back();
+    column.field = std::move(field);
+    AppendRaw<int32_t>(column.offsets, 0);
+    AppendRaw<int32_t>(column.dictionary_offsets, 0);
+  }
+
+  std::vector<ArrowField> schema;
+  for (const Column& column : columns_) schema.push_back(column.field);
+  FlatBufferBuilder fbb;
+  Offset schema_offset = CreateSchema(fbb, schema);
+  std::vector<Block> schema_block;
+  if (!file_.Write(kMagic)) {
+    status_ = file_.status();
+    return;
+  }
+  status_ = WriteMessage(
+      CreateMessage(fbb, kSchemaHeader, schema_offset, /*body_length=*/0),
+      /*body=*/"", &schema_block);
+}
+
+ArrowIpcWriter::~ArrowIpcWriter() {
+  if (closed_) return;
+  if (absl::Status status = Close(); !status.ok())
+    LOG(ERROR) << "Failed to close Arrow IPC file: " << status;
+}
+
+ArrowIpcWriter::Column& ArrowIpcWriter::ColumnForAppend(int column,
+                                                        bool valid) {
+  CHECK(!closed_) << "Cannot append to a closed writer";
+  CHECK(column >= 0 && column < columns_.size()) << "Invalid column";
+  Column& col = columns_[column];
+  CHECK_EQ(col.length, batch_rows_)
+      << "Column " << col.field.name << " already has a value in this row";
+  AppendBit(col.validity, col.length, valid);
+  col.length++;
+  if (!valid) col.null_count++;
+  return col;
+}
+
+void ArrowIpcWriter::AppendNull(int column) {
+  Column& col = ColumnForAppend(column, /*valid=*/false);
+  switch (col.field.type) {
+    case ArrowType::kInt64:
+    case ArrowType::kTimestampMicros:
+      AppendRaw<int64_t>(col.values, 0);
+      break;
+    case ArrowType::kFloat64:
+      AppendRaw<double>(col.values, 0);
+      break;
+    case ArrowType::kBool:
+      AppendBit(col.values, col.length - 1, false);
+      break;
+    case ArrowType::kUtf8:
+      AppendRaw<int32_t>(col.offsets, col.data.size());
+      break;
+    case ArrowType::kDictionaryUtf8:
+      AppendRaw<int32_t>(col.values, 0);
+      break;
+  }
+}
+
+void ArrowIpcWriter::AppendInt64(int column, int64_t value) {
+  Column& col = ColumnForAppend(column, /*valid=*/true);
+  CHECK(col.field.type == ArrowType::kInt64 ||
+        col.field.type == ArrowType::kTimestampMicros)
+      << "Column " << col.field.name << " is not an integer column";
+  AppendRaw(col.values, value);
+}
+
+void ArrowIpcWriter::AppendDouble(int column, double value) {
+  Column& col = ColumnForAppend(column, /*valid=*/true);
+  CHECK(col.field.type == ArrowType::kFloat64)
+      << "Column " << col.field.name << " is not a float column";
+  AppendRaw(col.values, value);
+}
+
+void ArrowIpcWriter::AppendBool(int column, bool value) {
+  Column& col = ColumnForAppend(column, /*valid=*/true);
+  CHECK(col.field.type == ArrowType::kBool)
+      << "Column " << col.field.name << " is not a bool column";
+  AppendBit(col.values, col.length - 1, value);
+}
+
+void ArrowIpcWriter::AppendString(int column, absl::string_view value) {
+  Column& col = ColumnForAppend(column, /*valid=*/true);
+  if (col.field.type == ArrowType::kUtf8) {
+    col.data.append(value.data(), value.size());
+    CHECK_LE(col.data.size(), std::numeric_limits<int32_t>::max())
+        << "Column " << col.field.name << " is too large";
+    AppendRaw<int32_t>(col.offsets, col.data.size());
+    return;
+  }
+  CHECK(col.field.type == ArrowType::kDictionaryUtf8)
+      << "Column " << col.field.name << " is not a string column";
+  auto [it, inserted] = col.dictionary_indexes.try_emplace(
+      value, col.dictionary_indexes.size());
+  if (inserted) {
+    col.dictionary_data.append(value.data(), value.size());
+    CHECK_LE(col.dictionary_data.size(), std::numeric_limits<int32_t>::max())
+        << "Dictionary of column " << col.field.name << " is too large";
+    AppendRaw<int32_t>(col.dictionary_offsets, col.dictionary_data.size());
+  }
+  AppendRaw(col.values, it->second);
+}
+
+absl::Status ArrowIpcWriter::EndRow() {
+  for (const Column& col : columns_) {
+    CHECK_EQ(col.length, batch_rows_ + 1)
+        << "Column " << col.field.name << " has no value in this row";
+  }
+  batch_rows_++;
+  num_rows_++;
+  if (!status_.ok()) return status_;
+  bool full = batch_rows_ >= batch_size_;
+  for (const Column& col : columns_)
+    full = full || col.data.size() >= kMaxBatchDataBytes;
+  if (full) status_ = WriteRecordBatch();
+  return status_;
+}
+
+absl::Status ArrowIpcWriter::WriteRecordBatch() {
+  if (batch_rows_ == 0) return absl::OkStatus();
+  Body body;
+  for (Column& col : columns_) {
+    body.nodes.push_back(col.length);
+    body.nodes.push_back(col.null_count);
+    // The validity bitmap may be omitted when there are no nulls.
+    body.AddBuffer(col.null_count == 0 ? "" : col.validity);
+    if (col.field.type == ArrowType::kUtf8) body.AddBuffer(col.offsets);
+    body.AddBuffer(col.field.type == ArrowType::kUtf8 ? col.data : col.values);
+
+    col.validity.clear();
+    col.length = 0;
+    col.null_count = 0;
+    col.values.clear();
+    col.offsets.clear();
+    col.data.clear();
+    AppendRaw<int32_t>(col.offsets, 0);
+  }
+  FlatBufferBuilder fbb;
+  Offset record_batch = CreateRecordBatch(fbb, batch_rows_, body);
+  batch_rows_ = 0;
+  return WriteMessage(CreateMessage(fbb, kRecordBatchHeader, record_batch,
+                                    body.data.size()),
+                      body.data, &record_batch_blocks_);
+}
+
+absl::Status ArrowIpcWriter::WriteDictionaries() {
+  for (int i = 0; i < columns_.size(); i++) {
+    const Column& col = columns_[i];
+    if (col.field.type != ArrowType::kDictionaryUtf8) continue;
+    int64_t length = col.dictionary_indexes.size();
+    Body body;
+    body.nodes = {length, /*null_count=*/0};
+    body.AddBuffer("");
+    body.AddBuffer(col.dictionary_offsets);
+    body.AddBuffer(col.dictionary_data);
+
+    FlatBufferBuilder fbb;
+    Offset record_batch = CreateRecordBatch(fbb, length, body);
+    fbb.StartTable();
+    fbb.AddScalar<int64_t>(0, /*id=*/i);
+    fbb.AddOffset(1, record_batch);
+    Offset dictionary_batch = fbb.EndTable();
+    if (absl::Status status = WriteMessage(
+            CreateMessage(fbb, kDictionaryBatchHeader, dictionary_batch,
+                          body.data.size()),
+            body.data, &dictionary_blocks_);
+        !status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ArrowIpcWriter::WriteMessage(absl::string_view metadata,
+                                          absl::string_view body,
+                                          std::vector<Block>* blocks) {
+  // The metadata is padded so that the body starts on an 8-byte boundary.
+  int32_t padded_length = PaddedSize(metadata.size());
+  std::string prefix;
+  AppendRaw(prefix, kContinuation);
+  AppendRaw(prefix, padded_length);
+  blocks->push_back({
+      .offset = static_cast<int64_t>(file_.pos()),
+      .metadata_length = static_cast<int32_t>(prefix.size() + padded_length),
+      .body_length = static_cast<int64_t>(body.size()),
+  });
+  std::string padding(padded_length - metadata.size(), '\0');
+  if (!file_.Write(prefix) || !file_.Write(metadata) ||
+      !file_.Write(padding) || !file_.Write(body)) {
+    return file_.status();
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ArrowIpcWriter::WriteFooter() {
+  // End-of-stream marker.
+  std::string end;
+  AppendRaw(end, kContinuation);
+  AppendRaw<int32_t>(end, 0);
+  if (!file_.Write(end)) return file_.status();
+
+  std::vector<ArrowField> fields;
+  for (const Column& col : columns_) fields.push_back(col.field);
+  auto block_words = [](const std::vector<Block>& blocks) {
+    std::vector<int64_t> words;
+    for (const Block& block : blocks) {
+      words.push_back(block.offset);
+      // The 32-bit metadata length is followed by 4 bytes of padding.
+      words.push_back(block.metadata_length);
+      words.push_back(block.body_length);
+    }
+    return words;
+  };
+  FlatBufferBuilder fbb;
+  Offset schema = CreateSchema(fbb, fields);
+  Offset dictionaries =
+      fbb.CreateStructVector(block_words(dictionary_blocks_), 3);
+  Offset record_batches =
+      fbb.CreateStructVector(block_words(record_batch_blocks_), 3);
+  fbb.StartTable();
+  fbb.AddScalar<int16_t>(0, kMetadataVersionV5);
+  fbb.AddOffset(1, schema);
+  fbb.AddOffset(2, dictionaries);
+  fbb.AddOffset(3, record_batches);
+  std::string footer = fbb.Finish(fbb.EndTable());
+
+  std::string trailer;
+  AppendRaw<int32_t>(trailer, footer.size());
+  trailer.append(kMagic.data(), 6);
+  if (!file_.Write(footer) || !file_.Write(trailer)) return file_.status();
+  return absl::OkStatus();
+}
+
+absl::Status ArrowIpcWriter::Close() {
+  CHECK(!closed_) << "Writer is already closed";
+  CHECK_EQ(columns_.empty() ? 0 : columns_[0].length, batch_rows_)
+      << "Cannot close the writer in the middle of a row";
+  closed_ = true;
+  // Readers of the file format look dictionaries up through the footer, so
+  // they may follow the record batches that use them.
+  if (status_.ok()) status_ = WriteRecordBatch();
+  if (status_.ok()) status_ = WriteDictionaries();
+  if (status_.ok()) status_ = WriteFooter();
+  if (!file_.Close() && status_.ok()) status_ = file_.status();
+  return status_;
+}
+
+}  // namespace ocpdiag::results::internal
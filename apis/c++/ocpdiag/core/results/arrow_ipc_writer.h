@@ -0,0 +1,122 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_ARROW_IPC_WRITER_H_
+#define OCPDIAG_CORE_RESULTS_ARROW_IPC_WRITER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/bytes/fd_writer.h"
+
+namespace ocpdiag::results::internal {
+
+// Column types supported by the ArrowIpcWriter. Every column is nullable.
+enum class ArrowType {
+  kInt64,
+  kFloat64,
+  kBool,
+  kUtf8,
+  // UTF-8 strings stored as 32-bit indexes into a dictionary of the distinct
+  // values, for columns with few distinct values like names and units.
+  kDictionaryUtf8,
+  // Microseconds since the Unix epoch, in UTC.
+  kTimestampMicros,
+};
+
+struct ArrowField {
+  std::string name;
+  ArrowType type;
+};
+
+// Writes a table to a file in the Arrow IPC file format, which columnar
+// engines like Arrow, DuckDB and Polars read without conversion. Rows are
+// appended one value per column at a time and written out as record batches
+// of at most `batch_size` rows, so memory is bounded by one batch plus the
+// dictionaries, which are written when the writer is closed.
+//
+// This is a minimal writer of the subset of the format needed for results
+// tables: flat schemas of the types above, without compression. It is not
+// thread-safe.
+class ArrowIpcWriter {
+ public:
+  static constexpr int kDefaultBatchSize = 64 * 1024;
+
+  ArrowIpcWriter(absl::string_view path, std::vector<ArrowField> fields,
+                 int batch_size = kDefaultBatchSize);
+  ArrowIpcWriter(const ArrowIpcWriter&) = delete;
+  ArrowIpcWriter& operator=(const ArrowIpcWriter&) = delete;
+  // Closes the writer if needed, logging any error.
+  ~ArrowIpcWriter();
+
+  // Appends a value to the column of the current row. The value must match
+  // the type of the column: AppendInt64 is used for kInt64 and
+  // kTimestampMicros columns, AppendString for kUtf8 and kDictionaryUtf8.
+  void AppendNull(int column);
+  void AppendInt64(int column, int64_t value);
+  void AppendDouble(int column, double value);
+  void AppendBool(int column, bool value);
+  void AppendString(int column, absl::string_view value);
+
+  // Ends the current row, to which every column must have had exactly one
+  // value appended, and writes a record batch if it is full.
+  absl::Status EndRow();
+
+  // Writes the last record batch, the dictionaries and the file footer.
+  absl::Status Close();
+
+  int64_t num_rows() const { return num_rows_; }
+
+ private:
+  struct Block {
+    int64_t offset;
+    int32_t metadata_length;
+    int64_t body_length;
+  };
+
+  struct Column {
+    ArrowField field;
+    // Validity bitmap and value count of the pending batch.
+    std::string validity;
+    int64_t length = 0;
+    int64_t null_count = 0;
+    // Fixed-width values, bitmap for kBool or dictionary indexes.
+    std::string values;
+    // Offsets into `data` for kUtf8.
+    std::string offsets;
+    std::string data;
+    // Distinct values of a kDictionaryUtf8 column in index order, stored like
+    // a kUtf8 column.
+    absl::flat_hash_map<std::string, int32_t> dictionary_indexes;
+    std::string dictionary_offsets;
+    std::string dictionary_data;
+  };
+
+  Column& ColumnForAppend(int column, bool valid);
+  absl::Status WriteRecordBatch();
+  absl::Status WriteDictionaries();
+  absl::Status WriteMessage(absl::string_view metadata, absl::string_view body,
+                            std::vector<Block>* blocks);
+  absl::Status WriteFooter();
+
+  riegeli::FdWriter<> file_;
+  absl::Status status_;
+  bool closed_ = false;
+  const int batch_size_;
+  std::vector<Column> columns_;
+  int64_t batch_rows_ = 0;
+  int64_t num_rows_ = 0;
+  std::vector<Block> dictionary_blocks_;
+  std::vector<Block> record_batch_blocks_;
+};
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_ARROW_IPC_WRITER_H_
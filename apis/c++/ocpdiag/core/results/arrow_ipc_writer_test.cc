@@ -0,0 +1,369 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/arrow_ipc_writer.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>  //
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/log/check.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/testing/file_utils.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+
+namespace ocpdiag::results::internal {
+
+using ::ocpdiag::testing::IsOk;
+using ::testing::ElementsAre;
+using ::testing::EndsWith;
+using ::testing::StartsWith;
+
+namespace {
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+// Reads the tables of a FlatBuffer, the encoding of the Arrow metadata, just
+// far enough to check what the writer encoded. Fields are numbered in the
+// order of the Arrow schema files, from 0.
+class FlatTable {
+ public:
+  // Returns the root table of `buffer`.
+  static FlatTable Root(absl::string_view buffer) {
+    return FlatTable(buffer, Read<uint32_t>(buffer, 0));
+  }
+
+  bool Has(int field) const { return FieldPos(field) != 0; }
+
+  template <typename T>
+  T Scalar(int field, T default_value = T()) const {
+    size_t pos = FieldPos(field);
+    return pos == 0 ? default_value : Read<T>(buffer_, pos);
+  }
+
+  FlatTable Table(int field) const {
+    return FlatTable(buffer_, Deref(FieldPos(field)));
+  }
+
+  std::string String(int field) const {
+    size_t pos = Deref(FieldPos(field));
+    return std::string(buffer_.substr(pos + 4, Read<uint32_t>(buffer_, pos)));
+  }
+
+  int VectorSize(int field) const {
+    return Read<uint32_t>(buffer_, Deref(FieldPos(field)));
+  }
+
+  // Returns the table at `index` of a vector of tables.
+  FlatTable TableAt(int field, int index) const {
+    size_t element = Deref(FieldPos(field)) + 4 + 4 * index;
+    return FlatTable(buffer_, Deref(element));
+  }
+
+  // Returns the scalar at `offset` of the struct at `index` of a vector of
+  // structs of `struct_size` bytes.
+  template <typename T>
+  T StructAt(int field, int index, size_t struct_size, size_t offset) const {
+    return Read<T>(buffer_, Deref(FieldPos(field)) + 4 +
+                                struct_size * index + offset);
+  }
+
+ private:
+  FlatTable(absl::string_view buffer, size_t pos)
+      : buffer_(buffer), pos_(pos) {}
+
+  template <typename T>
+  static T Read(absl::string_view buffer, size_t pos) {
+    T value;
+    CHECK_LE(pos + sizeof(T), buffer.size());
+    std::memcpy(&value, buffer.data() + pos, sizeof(T));
+    return value;
+  }
+
+  // Returns the position of the field, or 0 if it is not set.
+  size_t FieldPos(int field) const {
+    size_t vtable = pos_ - Read<int32_t>(buffer_, pos_);
+    size_t entry = 4 + 2 * field;
+    if (entry >= Read<uint16_t>(buffer_, vtable)) return 0;
+    uint16_t offset = Read<uint16_t>(buffer_, vtable + entry);
+    return offset == 0 ? 0 : pos_ + offset;
+  }
+
+  size_t Deref(size_t pos) const {
+    CHECK_NE(pos, 0) << "Missing field";
+    return pos + Read<uint32_t>(buffer_, pos);
+  }
+
+  absl::string_view buffer_;
+  size_t pos_;
+};
+
+// A record batch or dictionary batch of the file, with its body.
+struct Batch {
+  FlatTable header;
+  absl::string_view body;
+
+  int64_t length() const { return header.Scalar<int64_t>(0); }
+  int64_t NullCount(int column) const {
+    return header.StructAt<int64_t>(1, column, 16, 8);
+  }
+  absl::string_view Buffer(int index) const {
+    return body.substr(header.StructAt<int64_t>(2, index, 16, 0),
+                       header.StructAt<int64_t>(2, index, 16, 8));
+  }
+  template <typename T>
+  T Value(int buffer, int row) const {
+    T value;
+    std::memcpy(&value, Buffer(buffer).data() + sizeof(T) * row, sizeof(T));
+    return value;
+  }
+  bool Bit(int buffer, int row) const {
+    return (Buffer(buffer)[row / 8] >> (row % 8)) & 1;
+  }
+  std::string String(int offsets_buffer, int row) const {
+    int32_t begin = Value<int32_t>(offsets_buffer, row);
+    int32_t end = Value<int32_t>(offsets_buffer, row + 1);
+    return std::string(Buffer(offsets_buffer + 1).substr(begin, end - begin));
+  }
+};
+
+// Arrow metadata enums, from Schema.fbs and Message.fbs.
+constexpr uint8_t kIntType = 2;
+constexpr uint8_t kFloatingPointType = 3;
+constexpr uint8_t kUtf8Type = 5;
+constexpr uint8_t kBoolType = 6;
+constexpr uint8_t kTimestampType = 10;
+constexpr uint8_t kDictionaryBatchHeader = 2;
+constexpr uint8_t kRecordBatchHeader = 3;
+// The size of a Block struct of the footer: offset, metadata length, padding
+// and body length.
+constexpr size_t kBlockSize = 24;
+
+// Reads the message of the footer `blocks` vector at `index`, whose header
+// must be of `header_type`.
+Batch ReadBatch(absl::string_view contents, const FlatTable& footer,
+                int blocks, int index, uint8_t header_type) {
+  int64_t offset = footer.StructAt<int64_t>(blocks, index, kBlockSize, 0);
+  int32_t metadata_length =
+      footer.StructAt<int32_t>(blocks, index, kBlockSize, 8);
+  int64_t body_length =
+      footer.StructAt<int64_t>(blocks, index, kBlockSize, 16);
+  // The metadata is preceded by the continuation marker and its length.
+  FlatTable message = FlatTable::Root(contents.substr(offset + 8));
+  EXPECT_EQ(message.Scalar<uint8_t>(1), header_type);
+  EXPECT_EQ(message.Scalar<int64_t>(3), body_length);
+  FlatTable header = message.Table(2);
+  if (header_type == kDictionaryBatchHeader) header = header.Table(1);
+  return {.header = header,
+          .body = contents.substr(offset + metadata_length, body_length)};
+}
+
+TEST(ArrowIpcWriterTest, FooterSchemaAndBatchesDecode) {
+  std::string path = testutils::MkTempFileOrDie("arrow_ipc_decode");
+  ArrowIpcWriter writer(
+      path,
+      {{.name = "id", .type = ArrowType::kInt64},
+       {.name = "value", .type = ArrowType::kFloat64},
+       {.name = "ok", .type = ArrowType::kBool},
+       {.name = "message", .type = ArrowType::kUtf8},
+       {.name = "unit", .type = ArrowType::kDictionaryUtf8},
+       {.name = "timestamp", .type = ArrowType::kTimestampMicros}},
+      /*batch_size=*/2);
+  for (int row = 0; row < 3; row++) {
+    if (row == 1) {
+      writer.AppendNull(0);
+    } else {
+      writer.AppendInt64(0, row * 10);
+    }
+    writer.AppendDouble(1, row + 0.5);
+    writer.AppendBool(2, row == 0);
+    writer.AppendString(3, row == 1 ? "" : absl::StrCat("log ", row));
+    if (row == 0) {
+      writer.AppendNull(4);
+    } else {
+      writer.AppendString(4, row == 1 ? "RPM" : "C");
+    }
+    writer.AppendInt64(5, row * 1'000'000);
+    ASSERT_THAT(writer.EndRow(), IsOk());
+  }
+  ASSERT_THAT(writer.Close(), IsOk());
+  std::string contents = ReadFile(path);
+  int32_t footer_length;
+  std::memcpy(&footer_length, &contents[contents.size() - 10],
+              sizeof(footer_length));
+  FlatTable footer = FlatTable::Root(absl::string_view(contents).substr(
+      contents.size() - 10 - footer_length, footer_length));
+
+  // The schema.
+  FlatTable schema = footer.Table(1);
+  ASSERT_EQ(schema.VectorSize(1), 6);
+  std::vector<std::string> names;
+  for (int i = 0; i < 6; i++) {
+    names.push_back(schema.TableAt(1, i).String(0));
+    EXPECT_TRUE(schema.TableAt(1, i).Scalar<bool>(1)) << "not nullable";
+  }
+  EXPECT_THAT(names, ElementsAre("id", "value", "ok", "message", "unit",
+                                 "timestamp"));
+  FlatTable id = schema.TableAt(1, 0);
+  ASSERT_EQ(id.Scalar<uint8_t>(2), kIntType);
+  EXPECT_EQ(id.Table(3).Scalar<int32_t>(0), 64);
+  EXPECT_TRUE(id.Table(3).Scalar<bool>(1));
+  FlatTable value = schema.TableAt(1, 1);
+  ASSERT_EQ(value.Scalar<uint8_t>(2), kFloatingPointType);
+  EXPECT_EQ(value.Table(3).Scalar<int16_t>(0), 2) << "not DOUBLE";
+  EXPECT_EQ(schema.TableAt(1, 2).Scalar<uint8_t>(2), kBoolType);
+  EXPECT_EQ(schema.TableAt(1, 3).Scalar<uint8_t>(2), kUtf8Type);
+  EXPECT_FALSE(schema.TableAt(1, 3).Has(4));
+  FlatTable unit = schema.TableAt(1, 4);
+  EXPECT_EQ(unit.Scalar<uint8_t>(2), kUtf8Type);
+  ASSERT_TRUE(unit.Has(4));
+  FlatTable encoding = unit.Table(4);
+  EXPECT_EQ(encoding.Table(1).Scalar<int32_t>(0), 32);
+  FlatTable timestamp = schema.TableAt(1, 5);
+  ASSERT_EQ(timestamp.Scalar<uint8_t>(2), kTimestampType);
+  EXPECT_EQ(timestamp.Table(3).Scalar<int16_t>(0), 2) << "not MICROSECOND";
+  EXPECT_EQ(timestamp.Table(3).String(1), "UTC");
+
+  // The first record batch. Each column has a validity buffer, then its
+  // values, or its offsets and data for strings.
+  ASSERT_EQ(footer.VectorSize(3), 2);
+  Batch batch = ReadBatch(contents, footer, 3, 0, kRecordBatchHeader);
+  EXPECT_EQ(batch.length(), 2);
+  EXPECT_EQ(batch.NullCount(0), 1);
+  EXPECT_TRUE(batch.Bit(0, 0));
+  EXPECT_FALSE(batch.Bit(0, 1));
+  EXPECT_EQ(batch.Value<int64_t>(1, 0), 0);
+  EXPECT_EQ(batch.NullCount(1), 0);
+  EXPECT_EQ(batch.Value<double>(3, 0), 0.5);
+  EXPECT_EQ(batch.Value<double>(3, 1), 1.5);
+  EXPECT_TRUE(batch.Bit(5, 0));
+  EXPECT_FALSE(batch.Bit(5, 1));
+  EXPECT_EQ(batch.String(7, 0), "log 0");
+  EXPECT_EQ(batch.String(7, 1), "");
+  EXPECT_EQ(batch.NullCount(4), 1);
+  EXPECT_FALSE(batch.Bit(9, 0));
+  EXPECT_TRUE(batch.Bit(9, 1));
+  EXPECT_EQ(batch.Value<int32_t>(10, 1), 0);
+  EXPECT_EQ(batch.Value<int64_t>(12, 1), 1'000'000);
+  Batch last = ReadBatch(contents, footer, 3, 1, kRecordBatchHeader);
+  EXPECT_EQ(last.length(), 1);
+  EXPECT_EQ(last.Value<int64_t>(1, 0), 20);
+  EXPECT_EQ(last.Value<int32_t>(10, 0), 1);
+
+  // The dictionary of the unit column, in the order the values were seen.
+  ASSERT_EQ(footer.VectorSize(2), 1);
+  Batch dictionary = ReadBatch(contents, footer, 2, 0, kDictionaryBatchHeader);
+  EXPECT_EQ(dictionary.length(), 2);
+  EXPECT_EQ(dictionary.String(1, 0), "RPM");
+  EXPECT_EQ(dictionary.String(1, 1), "C");
+}
+
+TEST(ArrowIpcWriterTest, FileHasArrowFraming) {
+  std::string path = testutils::MkTempFileOrDie("arrow_ipc_writer");
+  ArrowIpcWriter writer(path, {{.name = "id", .type = ArrowType::kInt64},
+                               {.name = "name", .type = ArrowType::kUtf8},
+                               {.name = "ok", .type = ArrowType::kBool}});
+  for (int i = 0; i < 3; i++) {
+    writer.AppendInt64(0, i);
+    writer.AppendString(1, "name");
+    if (i == 1) {
+      writer.AppendNull(2);
+    } else {
+      writer.AppendBool(2, true);
+    }
+    ASSERT_THAT(writer.EndRow(), IsOk());
+  }
+  ASSERT_THAT(writer.Close(), IsOk());
+  EXPECT_EQ(writer.num_rows(), 3);
+
+  std::string contents = ReadFile(path);
+  EXPECT_THAT(contents, StartsWith(absl::string_view("ARROW1\0\0", 8)));
+  EXPECT_THAT(contents, EndsWith("ARROW1"));
+  // The footer ends with its length, right before the trailing magic, and
+  // follows the end-of-stream marker.
+  int32_t footer_length;
+  std::memcpy(&footer_length, &contents[contents.size() - 10],
+              sizeof(footer_length));
+  ASSERT_GT(footer_length, 0);
+  size_t footer_start = contents.size() - 10 - footer_length;
+  EXPECT_EQ(contents.substr(footer_start - 8, 8),
+            absl::string_view("\xff\xff\xff\xff\0\0\0\0", 8));
+  EXPECT_EQ(footer_start % 8, 0);
+}
+
+TEST(ArrowIpcWriterTest, DictionaryStoresRepeatedValuesOnce) {
+  std::string plain_path = testutils::MkTempFileOrDie("arrow_ipc_plain");
+  std::string dictionary_path =
+      testutils::MkTempFileOrDie("arrow_ipc_dictionary");
+  {
+    ArrowIpcWriter plain(plain_path,
+                         {{.name = "name", .type = ArrowType::kUtf8}});
+    ArrowIpcWriter dictionary(
+        dictionary_path,
+        {{.name = "name", .type = ArrowType::kDictionaryUtf8}});
+    for (int i = 0; i < 1000; i++) {
+      plain.AppendString(0, "a-fairly-long-measurement-name");
+      ASSERT_THAT(plain.EndRow(), IsOk());
+      dictionary.AppendString(0, "a-fairly-long-measurement-name");
+      ASSERT_THAT(dictionary.EndRow(), IsOk());
+    }
+  }
+  EXPECT_LT(std::filesystem::file_size(dictionary_path),
+            std::filesystem::file_size(plain_path) / 4);
+}
+
+TEST(ArrowIpcWriterTest, RowsAreWrittenInBatches) {
+  std::string path = testutils::MkTempFileOrDie("arrow_ipc_batches");
+  ArrowIpcWriter writer(path, {{.name = "value", .type = ArrowType::kFloat64}},
+                        /*batch_size=*/10);
+  for (int i = 0; i < 25; i++) {
+    writer.AppendDouble(0, i);
+    ASSERT_THAT(writer.EndRow(), IsOk());
+  }
+  // Two full batches have been written, the rest is pending.
+  EXPECT_GT(std::filesystem::file_size(path), 20 * sizeof(double));
+  ASSERT_THAT(writer.Close(), IsOk());
+  EXPECT_EQ(writer.num_rows(), 25);
+}
+
+TEST(ArrowIpcWriterDeathTest, TwoValuesInOneColumnCrash) {
+  std::string path = testutils::MkTempFileOrDie("arrow_ipc_death");
+  EXPECT_DEATH(
+      {
+        ArrowIpcWriter writer(path,
+                              {{.name = "id", .type = ArrowType::kInt64}});
+        writer.AppendInt64(0, 1);
+        writer.AppendInt64(0, 2);
+      },
+      "already has a value");
+}
+
+TEST(ArrowIpcWriterDeathTest, MismatchedTypeCrashes) {
+  std::string path = testutils::MkTempFileOrDie("arrow_ipc_death");
+  EXPECT_DEATH(
+      {
+        ArrowIpcWriter writer(path,
+                              {{.name = "id", .type = ArrowType::kInt64}});
+        writer.AppendString(0, "1");
+      },
+      "not a string column");
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
@@ -0,0 +1,35 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/artifact_sink.h"
+
+#include <cstddef>
+
+#include "absl/synchronization/mutex.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+void InMemoryArtifactSink::Write(
+    const ocpdiag_results_v2_pb::OutputArtifact& artifact) {
+  absl::MutexLock lock(&mutex_);
+  artifacts_.push_back(artifact);
+}
+
+size_t InMemoryArtifactSink::size() const {
+  absl::MutexLock lock(&mutex_);
+  return artifacts_.size();
+}
+
+bool InMemoryArtifactSink::Read(
+    size_t index, ocpdiag_results_v2_pb::OutputArtifact& artifact) const {
+  absl::MutexLock lock(&mutex_);
+  if (index >= artifacts_.size()) return false;
+  artifact = artifacts_[index];
+  return true;
+}
+
+}  // namespace ocpdiag::results::internal
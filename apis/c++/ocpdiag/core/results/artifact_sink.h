@@ -0,0 +1,57 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_ARTIFACT_SINK_H_
+#define OCPDIAG_CORE_RESULTS_ARTIFACT_SINK_H_
+
+#include <cstddef>
+#include <deque>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+// A destination for fully formed output artifacts, in addition to the file
+// and stream outputs built into the ArtifactWriter. Sinks are called with the
+// writer's mutex held, in sequence number order.
+class ArtifactSink {
+ public:
+  virtual ~ArtifactSink() = default;
+
+  virtual void Write(const ocpdiag_results_v2_pb::OutputArtifact& artifact) = 0;
+
+  // Called whenever the ArtifactWriter is flushed.
+  virtual void Flush() {}
+};
+
+// Keeps every artifact in memory, skipping serialization and disk I/O
+// entirely. This is intended for unit tests, which only need to read back what
+// was written. This class is thread-safe, and artifacts can be read while they
+// are still being written.
+class InMemoryArtifactSink : public ArtifactSink {
+ public:
+  void Write(const ocpdiag_results_v2_pb::OutputArtifact& artifact) override
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Returns the number of artifacts written so far.
+  size_t size() const ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Copies the artifact at `index` into `artifact`. Returns false if fewer than
+  // `index + 1` artifacts have been written.
+  bool Read(size_t index, ocpdiag_results_v2_pb::OutputArtifact& artifact) const
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+ private:
+  mutable absl::Mutex mutex_;
+  std::deque<ocpdiag_results_v2_pb::OutputArtifact> artifacts_
+      ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_ARTIFACT_SINK_H_
@@ -0,0 +1,54 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/artifact_sink.h"
+
+#include <thread>  //
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+TEST(InMemoryArtifactSinkTest, ArtifactsAreReadBackInOrder) {
+  InMemoryArtifactSink sink;
+  EXPECT_EQ(sink.size(), 0);
+  for (int i = 0; i < 3; i++) {
+    ocpdiag_results_v2_pb::OutputArtifact artifact;
+    artifact.set_sequence_number(i);
+    sink.Write(artifact);
+  }
+
+  EXPECT_EQ(sink.size(), 3);
+  ocpdiag_results_v2_pb::OutputArtifact got;
+  for (int i = 0; i < 3; i++) {
+    ASSERT_TRUE(sink.Read(i, got));
+    EXPECT_EQ(got.sequence_number(), i);
+  }
+  EXPECT_FALSE(sink.Read(3, got));
+}
+
+TEST(InMemoryArtifactSinkTest, ConcurrentWritesAreAllKept) {
+  constexpr int kThreads = 8;
+  constexpr int kArtifactsPerThread = 200;
+  InMemoryArtifactSink sink;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kThreads; i++) {
+    threads.emplace_back([&sink] {
+      for (int j = 0; j < kArtifactsPerThread; j++)
+        sink.Write(ocpdiag_results_v2_pb::OutputArtifact());
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  EXPECT_EQ(sink.size(), kThreads * kArtifactsPerThread);
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
@@ -6,74 +6,218 @@
 
 #include "ocpdiag/core/results/artifact_writer.h"
 
+#include <chrono>
 #include <cstdint>
 #include <iostream>
+#include <memory>
 #include <ostream>
 #include <string>
 #include <thread>  //
+#include <utility>
+#include <vector>
 
 #include "absl/log/check.h"
 #include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "google/protobuf/arena.h"
 #include "google/protobuf/util/json_util.h"
 #ifdef EXPAND_JSONL
 #include "absl/strings/str_replace.h"
 #endif
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
 #include "absl/time/time.h"
+#include "absl/types/span.h"
 #include "ocpdiag/core/compat/status_converters.h"
+#include "ocpdiag/core/results/artifact_sink.h"
+#include "ocpdiag/core/results/async_file_writer.h"
+#include "ocpdiag/core/results/bounded_artifact_sink.h"
+#include "ocpdiag/core/results/clock.h"
+#include "ocpdiag/core/results/crash_journal.h"
+#include "ocpdiag/core/results/interned_records.h"
+#include "ocpdiag/core/results/interned_results.pb.h"
+#include "ocpdiag/core/results/json_validator.h"
 #include "ocpdiag/core/results/results.pb.h"
-#include "google/protobuf/util/time_util.h"
+#include "ocpdiag/core/results/results_dictionary.h"
 #include "riegeli/bytes/fd_writer.h"
+#include "riegeli/bytes/writer.h"
 #include "riegeli/records/records_metadata.pb.h"
 
 namespace ocpdiag::results::internal {
 
-constexpr absl::Duration kFlushFreq = absl::Minutes(1);
+namespace {
+
+// The writer's own work is timed by the monotonic clock, rather than by the
+// clock of the timestamps, which may be coarse, fake or step back.
+using MonotonicTime = std::chrono::steady_clock::time_point;
+
+MonotonicTime MonotonicNow() { return std::chrono::steady_clock::now(); }
+
+absl::Duration Since(MonotonicTime start) {
+  return absl::FromChrono(MonotonicNow() - start);
+}
+
+// Writes the artifacts to a stream as ArtifactWriter::WriteToStream does, for
+// a BoundedArtifactSink.
+class JsonStreamSink : public ArtifactSink {
+ public:
+  explicit JsonStreamSink(std::ostream& stream) : stream_(stream) {}
+
+  void Write(const ocpdiag_results_v2_pb::OutputArtifact& artifact) override {
+    if (absl::Status status = ArtifactToJson(artifact, json_); !status.ok()) {
+      std::cerr << "Failed to serialize message: " << status.ToString()
+                << std::endl;
+      return;
+    }
+    json_.push_back('\n');
+    stream_.write(json_.data(), json_.size());
+  }
+
+  void Flush() override { stream_.flush(); }
+
+ private:
+  std::ostream& stream_;
+  std::string json_;
+};
+
+}  // namespace
 
 ArtifactWriter::ArtifactWriter(absl::string_view output_filepath,
                                std::ostream* output_stream,
-                               bool flush_each_minute)
+                               const Options& options)
     : output_filepath_(output_filepath),
       output_stream_(output_stream),
-      flush_each_minute_(flush_each_minute) {
+      flush_each_minute_(options.flush_each_minute),
+      flush_scheduler_(options.flush_policy),
+      clock_(options.clock != nullptr ? *options.clock
+                                      : GetClockByName("realtime")),
+      interner_(options.intern_strings && !output_filepath.empty()
+                    ? std::make_unique<ArtifactInterner>()
+                    : nullptr),
+      compressor_(options.dictionary != nullptr && !output_filepath.empty()
+                      ? std::make_unique<RecordCompressor>(options.dictionary)
+                      : nullptr) {
   CHECK(!output_filepath.empty() || output_stream_ != nullptr)
       << "Must specify a valid filepath or output stream (or both) when "
          "creating an artifact writer.";
-  SetupRecordWriter();
+  SetupRecordWriter(options.async_file_io);
+  if (options.crash_journal && !output_filepath.empty()) {
+    absl::MutexLock lock(&mutex_);
+    journal_ = std::make_unique<CrashJournal>(
+        absl::StrCat(output_filepath, CrashJournal::kFileSuffix));
+    journal_->Activate();
+  }
+  SetupBoundedOutputs(options.output_budget_bytes);
   SetupPeriodicFlush();
 }
 
-void ArtifactWriter::SetupRecordWriter() {
-  if (output_filepath_.empty()) return;
-  riegeli::RecordsMetadata metadata;
-  riegeli::SetRecordType(*ocpdiag_results_v2_pb::OutputArtifact::GetDescriptor(),
-                         metadata);
+ArtifactWriter::ArtifactWriter(std::shared_ptr<ArtifactSink> sink,
+                               std::ostream* output_stream,
+                               const Options& options)
+    : output_stream_(output_stream),
+      flush_each_minute_(options.flush_each_minute),
+      flush_scheduler_(options.flush_policy),
+      clock_(options.clock != nullptr ? *options.clock
+                                      : GetClockByName("realtime")),
+      sink_(std::move(sink)) {
+  CHECK(sink_ != nullptr) << "Must specify a valid sink when creating an "
+                             "artifact writer without a filepath.";
+  SetupBoundedOutputs(options.output_budget_bytes);
+  SetupPeriodicFlush();
+}
 
+void ArtifactWriter::SetupRecordWriter(bool async_file_io) {
+  if (output_filepath_.empty()) return;
   absl::MutexLock lock(&mutex_);
-  output_file_writer_.Reset(
-      riegeli::FdWriter(output_filepath_),
-      riegeli::RecordWriterBase::Options().set_metadata(std::move(metadata)));
+  riegeli::RecordsMetadata metadata;
+  riegeli::SetRecordType(
+      interner_ != nullptr
+          ? *InternedRecord::GetDescriptor()
+          : *ocpdiag_results_v2_pb::OutputArtifact::GetDescriptor(),
+      metadata);
+  riegeli::RecordWriterBase::Options options;
+  if (compressor_ != nullptr) {
+    SetResultsDictionary(*compressor_->dictionary(), metadata);
+    RegisterResultsDictionary(compressor_->dictionary());
+    // Compressing the compressed records again would only cost time.
+    options.set_uncompressed();
+  }
+  std::unique_ptr<riegeli::Writer> dest;
+  if (async_file_io) {
+    absl::StatusOr<std::unique_ptr<AsyncFileWriter>> file =
+        AsyncFileWriter::Open(output_filepath_);
+    CHECK(file.ok()) << "File writer error: " << file.status().ToString();
+    dest = std::make_unique<AsyncFdWriter>(*std::move(file));
+  } else {
+    dest = std::make_unique<riegeli::FdWriter<>>(output_filepath_);
+  }
+  options.set_metadata(std::move(metadata));
+  output_file_writer_.Reset(std::move(dest), std::move(options));
   CHECK(output_file_writer_.ok())
       << "File writer error: " << output_file_writer_.status().ToString();
 }
 
+void ArtifactWriter::SetupBoundedOutputs(size_t output_budget_bytes) {
+  if (output_budget_bytes == 0) return;
+  absl::MutexLock lock(&mutex_);
+  if (output_stream_ != nullptr) {
+    bounded_stream_ = std::make_unique<BoundedArtifactSink>(
+        std::make_shared<JsonStreamSink>(*output_stream_), output_budget_bytes);
+    output_stream_ = nullptr;
+  }
+  if (sink_ != nullptr) {
+    auto bounded_sink = std::make_shared<BoundedArtifactSink>(
+        std::move(sink_), output_budget_bytes);
+    bounded_sink_ = bounded_sink.get();
+    sink_ = std::move(bounded_sink);
+  }
+}
+
 void ArtifactWriter::SetupPeriodicFlush() {
-  if (output_filepath_.empty() || !flush_each_minute_) return;
-  flush_thread_ = std::thread(&ArtifactWriter::FlushEveryMinute, this);
+  if ((output_filepath_.empty() && output_stream_ == nullptr &&
+       bounded_stream_ == nullptr && sink_ == nullptr) ||
+      !flush_each_minute_) {
+    return;
+  }
+  flush_thread_ = std::thread(&ArtifactWriter::FlushWhenDue, this);
 }
 
-void ArtifactWriter::FlushEveryMinute() {
+void ArtifactWriter::FlushWhenDue() {
   absl::MutexLock lock(&mutex_);
-  while (!mutex_.AwaitWithTimeout(absl::Condition(&stop_flush_routine_),
-                                  kFlushFreq)) {
-    FlushLocked();
+  while (!stop_flush_routine_) {
+    // Waits for the deadline, unless it is moved up in the meantime.
+    absl::Time deadline = flush_scheduler_.deadline();
+    auto deadline_moved_up = [this, deadline]() {
+      mutex_.AssertReaderHeld();
+      return stop_flush_routine_ || flush_scheduler_.deadline() < deadline;
+    };
+    if (!mutex_.AwaitWithDeadline(absl::Condition(&deadline_moved_up),
+                                  deadline) &&
+        flush_scheduler_.deadline() <= absl::Now()) {
+      FlushLocked();
+    }
   }
 }
 
 void ArtifactWriter::FlushLocked() {
-  if (output_filepath_.empty()) return;
-  output_file_writer_.Flush(riegeli::FlushType::kFromMachine);
+  if (output_filepath_.empty() && output_stream_ == nullptr &&
+      bounded_stream_ == nullptr && sink_ == nullptr) {
+    return;
+  }
+  MonotonicTime start = MonotonicNow();
+  if (output_stream_ != nullptr) output_stream_->flush();
+  if (bounded_stream_ != nullptr) bounded_stream_->Flush();
+  if (!output_filepath_.empty() &&
+      output_file_writer_.Flush(flush_scheduler_.policy().fsync
+                                    ? riegeli::FlushType::kFromMachine
+                                    : riegeli::FlushType::kFromProcess) &&
+      journal_ != nullptr) {
+    journal_->Reset();
+  }
+  if (sink_ != nullptr) sink_->Flush();
+  metrics_.RecordFlush(Since(start));
+  flush_scheduler_.RecordFlush(absl::Now());
 }
 
 void ArtifactWriter::Flush() {
@@ -81,6 +225,15 @@ void ArtifactWriter::Flush() {
   return FlushLocked();
 }
 
+void ArtifactWriter::FlushAtBoundary() {
+  absl::MutexLock lock(&mutex_);
+  // Without the flush thread, nothing would make the flush once it is due.
+  if (flush_scheduler_.RequestBoundaryFlush(absl::Now()) ||
+      !flush_thread_.joinable()) {
+    FlushLocked();
+  }
+}
+
 void ArtifactWriter::Write(
     const ocpdiag_results_v2_pb::TestRunArtifact& artifact) {
   ocpdiag_results_v2_pb::OutputArtifact proto;
@@ -88,6 +241,12 @@ void ArtifactWriter::Write(
   Write(proto);
 }
 
+void ArtifactWriter::Write(ocpdiag_results_v2_pb::TestRunArtifact&& artifact) {
+  ocpdiag_results_v2_pb::OutputArtifact proto;
+  *proto.mutable_test_run_artifact() = std::move(artifact);
+  Write(proto);
+}
+
 void ArtifactWriter::Write(
     const ocpdiag_results_v2_pb::TestStepArtifact& artifact) {
   ocpdiag_results_v2_pb::OutputArtifact proto;
@@ -95,6 +254,21 @@ void ArtifactWriter::Write(
   Write(proto);
 }
 
+void ArtifactWriter::Write(
+    ocpdiag_results_v2_pb::TestStepArtifact&& artifact) {
+  // Messages are only moved within an arena, and copied between arenas.
+  if (google::protobuf::Arena* arena = artifact.GetArena(); arena != nullptr) {
+    auto* proto = google::protobuf::Arena::CreateMessage<
+        ocpdiag_results_v2_pb::OutputArtifact>(arena);
+    *proto->mutable_test_step_artifact() = std::move(artifact);
+    Write(*proto);
+    return;
+  }
+  ocpdiag_results_v2_pb::OutputArtifact proto;
+  *proto.mutable_test_step_artifact() = std::move(artifact);
+  Write(proto);
+}
+
 void ArtifactWriter::Write(
     const ocpdiag_results_v2_pb::SchemaVersion& artifact) {
   ocpdiag_results_v2_pb::OutputArtifact proto;
@@ -103,27 +277,325 @@ void ArtifactWriter::Write(
 }
 
 void ArtifactWriter::Write(ocpdiag_results_v2_pb::OutputArtifact& artifact) {
+  MonotonicTime start = MonotonicNow();
   absl::MutexLock lock(&mutex_);
-  *artifact.mutable_timestamp() = google::protobuf::util::TimeUtil::GetCurrentTime();
+  metrics_.RecordMutexWait(Since(start));
+  *artifact.mutable_timestamp() = TimeToTimestamp(clock_.Now());
   artifact.set_sequence_number(sequence_number_.Next());
-  WriteToFile(artifact);
-  WriteToStream(artifact);
+  absl::Duration serialization_time;
+  int64_t binary_bytes = WriteToFile(artifact, serialization_time);
+  int64_t json_bytes = WriteToStream(artifact, serialization_time);
+  if (bounded_stream_ != nullptr) bounded_stream_->Write(artifact);
+  if (sink_ != nullptr) sink_->Write(artifact);
+  metrics_.RecordArtifact(artifact, binary_bytes, json_bytes);
+  metrics_.RecordSerialization(serialization_time);
+  metrics_.RecordWrite(Since(start));
+  if (flush_scheduler_.RecordArtifact(artifact, binary_bytes + json_bytes,
+                                      absl::Now())) {
+    FlushLocked();
+  }
 }
 
-void ArtifactWriter::WriteToFile(
+ArtifactWriterMetrics ArtifactWriter::GetMetrics() {
+  absl::MutexLock lock(&mutex_);
+  int64_t compressed_bytes = 0;
+  if (!output_filepath_.empty())
+    compressed_bytes = output_file_writer_.dest().pos();
+  return metrics_.Snapshot(compressed_bytes);
+}
+
+std::vector<std::string> ArtifactWriter::DescribeDroppedArtifacts() {
+  absl::MutexLock lock(&mutex_);
+  std::vector<std::string> descriptions;
+  std::pair<absl::string_view, BoundedArtifactSink*> outputs[] = {
+      {"The output stream", bounded_stream_.get()},
+      {"The artifact sink", bounded_sink_}};
+  for (const auto& [output, bounded] : outputs) {
+    if (bounded == nullptr) continue;
+    DroppedArtifacts dropped = bounded->dropped();
+    if (dropped.total() > 0) {
+      descriptions.push_back(
+          internal::DescribeDroppedArtifacts(output, dropped));
+    }
+  }
+  reported_drops_ = descriptions;
+  return descriptions;
+}
+
+int64_t ArtifactWriter::WriteToFile(
+    ocpdiag_results_v2_pb::OutputArtifact& artifact,
+    absl::Duration& serialization_time) {
+  if (output_filepath_.empty()) return 0;
+  // Serialize up front rather than letting the record writer do it, so that
+  // serialization is timed separately from the record writer's own work.
+  MonotonicTime start = MonotonicNow();
+  std::string record;
+  if (interner_ == nullptr) {
+    artifact.SerializeToString(&record);
+    serialization_time += Since(start);
+    if (!WriteRecord(record, artifact)) return 0;
+    JournalRecord(record);
+    return record.size();
+  }
+
+  // The records are reused across writes to save their allocations.
+  Dictionary& dictionary = *dictionary_record_.mutable_dictionary();
+  InternedArtifact& interned = *interned_record_.mutable_artifact();
+  interner_->Intern(artifact, interned, dictionary);
+  interned_record_.SerializeToString(&record);
+  interner_->Restore(interned, artifact);
+  interned.Clear();
+  int64_t bytes = 0;
+  if (dictionary.strings_size() > 0 || dictionary.subcomponents_size() > 0) {
+    std::string dictionary_record = dictionary_record_.SerializeAsString();
+    dictionary.Clear();
+    serialization_time += Since(start);
+    if (!WriteRecord(dictionary_record, artifact)) return 0;
+    bytes += dictionary_record.size();
+  } else {
+    serialization_time += Since(start);
+  }
+  if (!WriteRecord(record, artifact)) return bytes;
+  // The journal holds plain artifacts, so that it can be read without the
+  // dictionaries that were written to the file.
+  if (journal_ != nullptr) JournalRecord(artifact.SerializeAsString());
+  return bytes + record.size();
+}
+
+bool ArtifactWriter::WriteRecord(
+    const std::string& record,
     const ocpdiag_results_v2_pb::OutputArtifact& artifact) {
-  if (output_filepath_.empty()) return;
-  if (!output_file_writer_.WriteRecord(artifact)) {
-    std::cerr << "Failed to write proto record to file: "
-              << "\"" << artifact.DebugString() << "\"" << std::endl
-              << "File writer error: "
-              << output_file_writer_.status().ToString() << std::endl;
+  if (compressor_ != nullptr) {
+    if (absl::Status status = compressor_->Compress(record, compressed_record_);
+        !status.ok()) {
+      std::cerr << "Failed to compress proto record: " << status.ToString()
+                << std::endl;
+      return false;
+    }
+    if (output_file_writer_.WriteRecord(compressed_record_)) return true;
+  } else if (output_file_writer_.WriteRecord(record)) {
+    return true;
   }
+  std::cerr << "Failed to write proto record to file: "
+            << "\"" << artifact.DebugString() << "\"" << std::endl
+            << "File writer error: " << output_file_writer_.status().ToString()
+            << std::endl;
+  return false;
 }
 
-void ArtifactWriter::WriteToStream(
+void ArtifactWriter::JournalRecord(absl::string_view record) {
+  if (journal_ == nullptr || journal_->Append(record)) return;
+  // The journal is full, so its records, and this one, are made durable by
+  // flushing the file instead, which empties the journal.
+  FlushLocked();
+}
+
+int64_t ArtifactWriter::WriteToStream(
+    const ocpdiag_results_v2_pb::OutputArtifact& artifact,
+    absl::Duration& serialization_time) {
+  if (output_stream_ == nullptr) return 0;
+  MonotonicTime start = MonotonicNow();
+  std::string json;
+  if (absl::Status status = ArtifactToJson(artifact, json); !status.ok()) {
+    std::cerr << "Failed to serialize message: " << status.ToString()
+              << std::endl;
+    return 0;
+  }
+  serialization_time += Since(start);
+
+  // Written in one piece, without flushing the stream, so that buffered
+  // streams write whole lines at once; see BufferedLineWriter.
+  int64_t bytes = json.size();
+  json.push_back('\n');
+  output_stream_->write(json.data(), json.size());
+  return bytes;
+}
+
+namespace {
+
+// A Struct field of an artifact that was kept as raw JSON, with
+// --ocpdiag_results_raw_json, by the JSON name of the field.
+struct RawJsonField {
+  absl::string_view name;
+  absl::string_view json;
+};
+
+// Returns the raw JSON fields of the artifact in the order they are printed.
+std::vector<RawJsonField> RawJsonFields(
     const ocpdiag_results_v2_pb::OutputArtifact& artifact) {
-  if (output_stream_ == nullptr) return;
+  std::vector<RawJsonField> fields;
+  auto add_metadata = [&fields](const auto& proto) {
+    if (proto.has_metadata_raw_json())
+      fields.push_back({"metadata", proto.metadata_raw_json()});
+  };
+  const ocpdiag_results_v2_pb::TestStepArtifact& step =
+      artifact.test_step_artifact();
+  if (artifact.test_run_artifact().has_test_run_start()) {
+    const ocpdiag_results_v2_pb::TestRunStart& start =
+        artifact.test_run_artifact().test_run_start();
+    add_metadata(start.dut_info());
+    if (start.has_parameters_raw_json())
+      fields.push_back({"parameters", start.parameters_raw_json()});
+    add_metadata(start);
+  } else if (step.has_measurement()) {
+    add_metadata(step.measurement());
+  } else if (step.has_measurement_series_start()) {
+    add_metadata(step.measurement_series_start());
+  } else if (step.has_measurement_series_element()) {
+    add_metadata(step.measurement_series_element());
+  } else if (step.extension().has_content_raw_json()) {
+    fields.push_back({"content", step.extension().content_raw_json()});
+  }
+  return fields;
+}
+
+// Replaces the "<name>RawJson" string members that the raw JSON fields are
+// printed as with "<name>" members that hold the JSON itself, so that the
+// output is what printing the JSON as Struct fields would give. A member is
+// only replaced if it holds the next raw JSON field, so that Struct keys of
+// the same name are left alone. The raw JSON was validated, so its only line
+// breaks are whitespace, which are replaced to keep the artifact on one line.
+absl::Status SpliceRawJson(absl::Span<const RawJsonField> fields,
+                           std::string& json) {
+  constexpr absl::string_view kSuffix = "RawJson\"";
+  std::string spliced;
+  spliced.reserve(json.size());
+  std::string value;
+  size_t copied = 0;
+  size_t pos = 0;
+  while (!fields.empty() &&
+         (pos = json.find(kSuffix.data(), pos, kSuffix.size())) !=
+             std::string::npos) {
+    absl::string_view name = fields.front().name;
+    size_t name_end = pos;
+    pos += kSuffix.size();
+    if (name_end < name.size() + 1 || json[name_end - name.size() - 1] != '"' ||
+        absl::string_view(json).substr(name_end - name.size(), name.size()) !=
+            name) {
+      continue;
+    }
+    // Pretty printing puts a space after the colon.
+    size_t value_start = json.find_first_not_of(' ', pos);
+    if (value_start == std::string::npos || json[value_start] != ':') continue;
+    value_start = json.find_first_not_of(' ', value_start + 1);
+    if (value_start == std::string::npos || json[value_start] != '"') continue;
+    value.clear();
+    size_t value_end = UnescapeJsonString(json, value_start + 1, value);
+    if (value_end == std::string::npos) {
+      return absl::InternalError("Invalid string in the JSON output");
+    }
+    if (value != fields.front().json) continue;
+    spliced.append(json, copied, name_end - copied);
+    spliced.append("\":");
+    if (fields.front().json.empty()) spliced.append("{}");
+    for (char c : fields.front().json)
+      spliced.push_back(c == '\n' || c == '\r' ? ' ' : c);
+    copied = pos = value_end;
+    fields.remove_prefix(1);
+  }
+  if (!fields.empty()) {
+    return absl::InternalError(absl::StrCat(
+        "The ", fields.front().name, "RawJson field is missing from the JSON "
+        "output"));
+  }
+  spliced.append(json, copied);
+  json = std::move(spliced);
+  return absl::OkStatus();
+}
+
+// The members of a JSON object that SpliceIntegerValue edits, by position.
+struct IntegerValueMembers {
+  size_t value_number = std::string::npos;
+  size_t integer_member = std::string::npos;
+};
+
+// Replaces the number that the value of an integer measurement or series
+// element is printed as, which is rounded to a double, with the exact digits
+// of its integer value, and drops the integerValue member, which the output
+// specification has no field for. The object is the last one to end with an
+// integerValue member, since metadata Struct objects are nested in it.
+absl::Status SpliceIntegerValue(std::string& json) {
+  std::vector<IntegerValueMembers> objects;
+  IntegerValueMembers members;
+  std::string key;
+  for (size_t pos = 0; pos < json.size();) {
+    char c = json[pos];
+    if (c == '{') {
+      objects.emplace_back();
+    } else if (c == '}' && !objects.empty()) {
+      if (objects.back().integer_member != std::string::npos)
+        members = objects.back();
+      objects.pop_back();
+    } else if (c == '"') {
+      key.clear();
+      size_t end = UnescapeJsonString(json, pos + 1, key);
+      if (end == std::string::npos) {
+        return absl::InternalError("Invalid string in the JSON output");
+      }
+      size_t colon = json.find_first_not_of(' ', end);
+      if (colon != std::string::npos && json[colon] == ':' &&
+          !objects.empty()) {
+        if (key == "value") {
+          objects.back().value_number = json.find_first_not_of(' ', colon + 1);
+        } else if (key == "integerValue") {
+          objects.back().integer_member = pos;
+        }
+      }
+      pos = end;
+      continue;
+    }
+    pos++;
+  }
+  if (members.integer_member == std::string::npos) {
+    return absl::InternalError(
+        "The integerValue field is missing from the JSON output");
+  }
+  if (members.value_number == std::string::npos) {
+    return absl::InternalError(
+        "The value of an integer is missing from the JSON output");
+  }
+  size_t number_end =
+      json.find_first_not_of("+-.0123456789Ee", members.value_number);
+  if (number_end == members.value_number) {
+    return absl::InternalError(
+        "The value of an integer is not a number in the JSON output");
+  }
+  // The integer is printed as {"int64Value":"<digits>"}, or uint64Value,
+  // since 64-bit integers are printed as strings. The member is removed with
+  // the comma that separates it from its neighbor.
+  size_t member_start = members.integer_member;
+  size_t member_end = json.find('}', member_start);
+  size_t digits_start = json.find(':', json.find('{', member_start));
+  digits_start = json.find('"', digits_start);
+  size_t digits_end = json.find('"', digits_start + 1);
+  if (member_end == std::string::npos || digits_end > member_end) {
+    return absl::InternalError("Invalid integerValue in the JSON output");
+  }
+  std::string digits =
+      json.substr(digits_start + 1, digits_end - digits_start - 1);
+  member_end++;
+  size_t previous = json.find_last_not_of(" \n", member_start - 1);
+  if (json[previous] == ',') {
+    member_start = previous;
+  } else {
+    member_end = json.find_first_not_of(" \n", member_end);
+    if (json[member_end] == ',') member_end++;
+  }
+  // The later edit is made first, so that the other position stays valid.
+  auto replace_number = [&] {
+    json.replace(members.value_number, number_end - members.value_number,
+                 digits);
+  };
+  if (members.value_number > member_start) replace_number();
+  json.erase(member_start, member_end - member_start);
+  if (members.value_number < member_start) replace_number();
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::Status ArtifactToJson(
+    const ocpdiag_results_v2_pb::OutputArtifact& artifact, std::string& json) {
   google::protobuf::util::JsonPrintOptions opts;
   opts.always_print_primitive_fields = true;
 #ifdef EXPAND_JSONL
@@ -131,13 +603,23 @@ void ArtifactWriter::WriteToStream(
   opts.add_whitespace = true;
 #endif
 
-  std::string json;
+  json.clear();
   if (absl::Status status = AsAbslStatus(
           google::protobuf::util::MessageToJsonString(artifact, &json, opts));
       !status.ok()) {
-    std::cerr << "Failed to serialize message: " << status.ToString()
-              << std::endl;
-    return;
+    return status;
+  }
+  const ocpdiag_results_v2_pb::TestStepArtifact& step =
+      artifact.test_step_artifact();
+  if (step.measurement().has_integer_value() ||
+      step.measurement_series_element().has_integer_value()) {
+    if (absl::Status status = SpliceIntegerValue(json); !status.ok())
+      return status;
+  }
+  if (std::vector<RawJsonField> fields = RawJsonFields(artifact);
+      !fields.empty()) {
+    if (absl::Status status = SpliceRawJson(fields, json); !status.ok())
+      return status;
   }
 
 #ifdef EXPAND_JSONL
@@ -145,18 +627,32 @@ void ArtifactWriter::WriteToStream(
   absl::StrReplaceAll({{R"(\\n)", R"(\n)"}}, &json);
   absl::StrReplaceAll({{R"(\n)", R"(\\n)"}}, &json);
 #endif
-
-  *output_stream_ << json << std::endl;
+  return absl::OkStatus();
 }
 
 ArtifactWriter::~ArtifactWriter() {
   absl::ReleasableMutexLock releasable_lock(&mutex_);
   stop_flush_routine_ = true;
-  if (output_filepath_.empty()) return;
-  output_file_writer_.Close();
-  if (!flush_each_minute_) return;
+  if (output_stream_ != nullptr) output_stream_->flush();
+  if (bounded_stream_ != nullptr) bounded_stream_->Flush();
+  if (!output_filepath_.empty()) output_file_writer_.Close();
+  if (sink_ != nullptr) sink_->Flush();
+  std::vector<std::string> reported_drops = reported_drops_;
   releasable_lock.Release();
-  flush_thread_.join();
+  if (flush_thread_.joinable()) flush_thread_.join();
+
+  // The bounded outputs drop what they cannot write before their drain
+  // timeout, after the drops were last reported, e.g. by TestRun::End. They
+  // drain at the same time, so they share the timeout.
+  absl::Time deadline =
+      absl::Now() + BoundedArtifactSink::kDefaultDrainTimeout;
+  if (bounded_stream_ != nullptr) bounded_stream_->Stop(deadline);
+  if (bounded_sink_ != nullptr) bounded_sink_->Stop(deadline);
+  if (std::vector<std::string> drops = DescribeDroppedArtifacts();
+      drops != reported_drops) {
+    for (const std::string& description : drops)
+      std::cerr << description << std::endl;
+  }
 }
 
 }  // namespace ocpdiag::results::internal
@@ -7,62 +7,189 @@
 #ifndef OCPDIAG_LIB_RESULTS_INTERNAL_LOGGING_H_
 #define OCPDIAG_LIB_RESULTS_INTERNAL_LOGGING_H_
 
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <ostream>
+#include <string>
 #include <thread>  //
+#include <vector>
 
 #include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/artifact_sink.h"
+#include "ocpdiag/core/results/async_file_writer.h"
+#include "ocpdiag/core/results/bounded_artifact_sink.h"
+#include "ocpdiag/core/results/clock.h"
+#include "ocpdiag/core/results/crash_journal.h"
+#include "ocpdiag/core/results/flush_policy.h"
 #include "ocpdiag/core/results/int_incrementer.h"
+#include "ocpdiag/core/results/interned_records.h"
+#include "ocpdiag/core/results/interned_results.pb.h"
 #include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/results_dictionary.h"
+#include "ocpdiag/core/results/writer_metrics.h"
 #include "riegeli/base/object.h"
-#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/bytes/writer.h"
 #include "riegeli/records/record_writer.h"
 
 namespace ocpdiag::results::internal {
 
+struct ArtifactWriterOptions {
+  // Whether a thread makes the flushes that are due after some time, by
+  // interval or group commit; without it, every boundary flushes.
+  bool flush_each_minute = true;
+
+  // Artifacts are timestamped with this clock, which must outlive the writer
+  // and is read once per artifact; the process-wide realtime clock is used if
+  // it is null. Flush deadlines are kept by the wall clock, and the write
+  // metrics are timed by the monotonic clock.
+  Clock* clock = nullptr;
+
+  // Whether the identifiers that artifacts repeat are written once to the file
+  // and referenced by id, see ArtifactInterner; the file is then read with a
+  // ResultsFileReader.
+  bool intern_strings = false;
+
+  // Whether the artifacts not yet flushed to the file are also kept in a
+  // CrashJournal next to it, which is activated so that a crash leaves a
+  // terminal TestRunEnd artifact, and the file can be recovered with
+  // RecoverResults if the process dies.
+  bool crash_journal = false;
+
+  // When the outputs are flushed.
+  FlushPolicy flush_policy;
+
+  // Whether the file is written through an AsyncFileWriter, so that only
+  // flushes wait for the device.
+  bool async_file_io = false;
+
+  // If positive, the output stream and the sink are written through
+  // BoundedArtifactSinks with this budget, so that a stalled output never
+  // blocks the writer.
+  size_t output_budget_bytes = 0;
+
+  // If set, each record of the file is compressed on its own with this
+  // dictionary, instead of the file being compressed in chunks, and the
+  // dictionary is registered so that readers in this process find it; see
+  // ResultsDictionary.
+  std::shared_ptr<const ResultsDictionary> dictionary;
+};
+
 // Writes test output to file in a compressed binary format, an output stream in
-// JSONL format, or both.
+// JSONL format, or both. Alternatively, artifacts can be handed to an
+// ArtifactSink without being serialized. The output stream is flushed along
+// with the file rather than after every line.
 class ArtifactWriter {
  public:
+  using Options = ArtifactWriterOptions;
+
+  // Writes artifacts to the file at `output_filepath` if it is not empty, and
+  // to `output_stream` in JSONL format if it is not null.
   ArtifactWriter(absl::string_view output_filepath,
                  std::ostream* output_stream = nullptr,
-                 bool flush_each_minute = true);
+                 const Options& options = {});
+
+  // Writes artifacts to `sink` instead of a file, and to `output_stream` in
+  // JSONL format if it is not null. The sink is flushed by the flush policy
+  // like a file, and the options that only concern the file are ignored.
+  ArtifactWriter(std::shared_ptr<ArtifactSink> sink,
+                 std::ostream* output_stream = nullptr,
+                 const Options& options = {});
   ~ArtifactWriter();
 
-  // Flushes the file buffer, if any
+  // Flushes the file buffer, the output stream and the sink, if any
   void Flush() ABSL_LOCKS_EXCLUDED(mutex_);
 
-  // Write the artifact to the output file
+  // Flushes at a test step or measurement series boundary, or schedules the
+  // flush for later, as the flush policy says.
+  void FlushAtBoundary() ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Write the artifact to the output file. The rvalue overloads move the
+  // artifact into the written record instead of copying it, and the record of
+  // a step artifact is built on the artifact's arena, if any.
   void Write(const ocpdiag_results_v2_pb::TestRunArtifact& artifact);
+  void Write(ocpdiag_results_v2_pb::TestRunArtifact&& artifact);
   void Write(const ocpdiag_results_v2_pb::TestStepArtifact& artifact);
+  void Write(ocpdiag_results_v2_pb::TestStepArtifact&& artifact);
   void Write(const ocpdiag_results_v2_pb::SchemaVersion& artifact);
 
+  // Returns a snapshot of the writer's self-instrumentation: per-type artifact
+  // counts and sizes, serialization and write latencies, mutex wait times,
+  // flush durations, and the uncompressed and compressed output sizes.
+  ArtifactWriterMetrics GetMetrics() ABSL_LOCKS_EXCLUDED(mutex_);
+
+  // Returns the clock used to timestamp artifacts.
+  Clock& GetClock() { return clock_; }
+
+  // Describes the artifacts dropped so far by the outputs bounded by
+  // Options::output_budget_bytes, in a sentence for each output that dropped
+  // any. The writer is flushed and the bounded outputs drained when it is
+  // destroyed, and if they dropped more by then, the descriptions are printed
+  // to stderr.
+  std::vector<std::string> DescribeDroppedArtifacts()
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
  private:
-  void SetupRecordWriter();
+  void SetupRecordWriter(bool async_file_io);
+  void SetupBoundedOutputs(size_t output_budget_bytes);
   void SetupPeriodicFlush();
-  void FlushEveryMinute();
-  bool GetRunFlushRoutine();
+  void FlushWhenDue();
 
   void FlushLocked() ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   void Write(ocpdiag_results_v2_pb::OutputArtifact& artifact);
-  void WriteToFile(const ocpdiag_results_v2_pb::OutputArtifact& artifact)
-      ABSL_SHARED_LOCKS_REQUIRED(&mutex_);
-  void WriteToStream(const ocpdiag_results_v2_pb::OutputArtifact& artifact)
+  // Both return the number of bytes written and add the time spent
+  // serializing the artifact to `serialization_time`.
+  int64_t WriteToFile(ocpdiag_results_v2_pb::OutputArtifact& artifact,
+                      absl::Duration& serialization_time)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  bool WriteRecord(const std::string& record,
+                   const ocpdiag_results_v2_pb::OutputArtifact& artifact)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Appends the serialized artifact to the crash journal, if any.
+  void JournalRecord(absl::string_view record)
+      ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  int64_t WriteToStream(const ocpdiag_results_v2_pb::OutputArtifact& artifact,
+                        absl::Duration& serialization_time)
       ABSL_SHARED_LOCKS_REQUIRED(&mutex_);
 
   absl::Mutex mutex_;
   absl::string_view output_filepath_;
   std::ostream* output_stream_ ABSL_GUARDED_BY(mutex_);
   bool flush_each_minute_ = true;
-  riegeli::RecordWriter<riegeli::FdWriter<>> output_file_writer_
+  FlushScheduler flush_scheduler_ ABSL_GUARDED_BY(mutex_);
+  Clock& clock_;
+  std::unique_ptr<ArtifactInterner> interner_ ABSL_GUARDED_BY(mutex_);
+  InternedRecord interned_record_ ABSL_GUARDED_BY(mutex_);
+  InternedRecord dictionary_record_ ABSL_GUARDED_BY(mutex_);
+  std::unique_ptr<CrashJournal> journal_ ABSL_GUARDED_BY(mutex_);
+  std::unique_ptr<RecordCompressor> compressor_ ABSL_GUARDED_BY(mutex_);
+  std::string compressed_record_ ABSL_GUARDED_BY(mutex_);
+  std::shared_ptr<ArtifactSink> sink_;
+  // The bounded outputs, which replace the output stream and wrap the sink.
+  std::unique_ptr<BoundedArtifactSink> bounded_stream_;
+  BoundedArtifactSink* bounded_sink_ = nullptr;
+  // The descriptions last returned by DescribeDroppedArtifacts.
+  std::vector<std::string> reported_drops_ ABSL_GUARDED_BY(mutex_);
+  riegeli::RecordWriter<std::unique_ptr<riegeli::Writer>> output_file_writer_
       ABSL_GUARDED_BY(mutex_){riegeli::kClosed};
   bool stop_flush_routine_ ABSL_GUARDED_BY(mutex_) = false;
   std::thread flush_thread_;
   IntIncrementer sequence_number_;
+  WriterMetricsRecorder metrics_ ABSL_GUARDED_BY(mutex_);
 };
 
+// Serializes the artifact to `json` in the format written to the output
+// stream, without the trailing newline. The values of integer measurements
+// and series elements are printed with the exact digits of their integer
+// value, see IntegerValue.
+absl::Status ArtifactToJson(
+    const ocpdiag_results_v2_pb::OutputArtifact& artifact, std::string& json);
+
 }  // namespace ocpdiag::results::internal
 
 #endif  // OCPDIAG_LIB_RESULTS_INTERNAL_LOGGING_H_
@@ -7,19 +7,39 @@
 #include "ocpdiag/core/results/artifact_writer.h"
 
 #include <stdlib.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <cstdlib>
 #include <filesystem>  //
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
 #include <thread>      //
+#include <vector>
 
 #include "google/protobuf/struct.pb.h"
+#include "google/protobuf/util/json_util.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 #include "absl/cleanup/cleanup.h"
 #include "absl/log/check.h"
 #include "absl/status/status.h"
 #include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
 #include "absl/strings/string_view.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/artifact_sink.h"
+#include "ocpdiag/core/results/buffered_line_writer.h"
+#include "ocpdiag/core/results/clock.h"
+#include "ocpdiag/core/results/crash_journal.h"
 #include "ocpdiag/core/results/results.pb.h"
 #include "ocpdiag/core/testing/file_utils.h"
 #include "ocpdiag/core/testing/proto_matchers.h"
@@ -30,9 +50,11 @@
 namespace ocpdiag::results::internal {
 
 using ::ocpdiag::testing::EqualsProto;
+using ::ocpdiag::testing::IsOk;
 using ::ocpdiag::testing::IsOkAndHolds;
 using ::ocpdiag::testing::Partially;
 using ::testing::HasSubstr;
+using ::testing::Not;
 
 namespace {
 
@@ -62,6 +84,11 @@ TEST(ArtifactWriterDeathTest, NoFilepathOrOutputStreamCausesDeath) {
   EXPECT_DEATH(ArtifactWriter(""), "specify a valid filepath or output stream");
 }
 
+TEST(ArtifactWriterDeathTest, NullSinkCausesDeath) {
+  EXPECT_DEATH(ArtifactWriter(std::shared_ptr<ArtifactSink>()),
+               "specify a valid sink");
+}
+
 TEST(ArtifactWriterDeathTest, InvalidFilepathDeath) {
   EXPECT_DEATH(ArtifactWriter("invalid/\\//\\filepath"), "File writer error");
 }
@@ -155,6 +182,76 @@ TEST(ArtifactWriterTest, TestStepArtifactWritesSuccessfully) {
               )pb"))));
 }
 
+TEST(ArtifactWriterTest, ArtifactsAreWrittenToSink) {
+  auto sink = std::make_shared<InMemoryArtifactSink>();
+  std::stringstream json_stream;
+  {
+    ArtifactWriter writer(sink, &json_stream);
+    ocpdiag_results_v2_pb::SchemaVersion input_proto;
+    input_proto.set_major(2);
+    writer.Write(input_proto);
+    writer.Write(input_proto);
+  }
+
+  ASSERT_EQ(sink->size(), 2);
+  ocpdiag_results_v2_pb::OutputArtifact got;
+  ASSERT_TRUE(sink->Read(1, got));
+  EXPECT_THAT(got, Partially(EqualsProto(R"pb(
+                schema_version { major: 2 }
+                sequence_number: 1
+              )pb")));
+  EXPECT_THAT(json_stream.str(), HasSubstr("\"schemaVersion\""));
+}
+
+// Counts the flushes of the artifacts it keeps.
+class FlushCountingSink : public InMemoryArtifactSink {
+ public:
+  void Flush() override { flushes_++; }
+  int flushes() const { return flushes_; }
+
+ private:
+  std::atomic<int> flushes_ = 0;
+};
+
+TEST(ArtifactWriterTest, BoundedOutputsAreFlushedOnDestruction) {
+  auto sink = std::make_shared<FlushCountingSink>();
+  std::stringstream json_stream;
+  {
+    ArtifactWriter writer(sink, &json_stream,
+                          {.output_budget_bytes = 1 << 20});
+    writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  }
+  EXPECT_EQ(sink->size(), 1);
+  EXPECT_GE(sink->flushes(), 1);
+  EXPECT_THAT(json_stream.str(), HasSubstr("\"schemaVersion\""));
+}
+
+// Notifies when the stream is first flushed.
+class SyncNotifyingStreambuf : public std::stringbuf {
+ public:
+  absl::Notification& synced() { return synced_; }
+
+ protected:
+  int sync() override {
+    if (!synced_.HasBeenNotified()) synced_.Notify();
+    return 0;
+  }
+
+ private:
+  absl::Notification synced_;
+};
+
+TEST(ArtifactWriterTest, BoundedStreamIsFlushedByInterval) {
+  SyncNotifyingStreambuf buffer;
+  std::ostream stream(&buffer);
+  ArtifactWriter writer(
+      "", &stream,
+      {.flush_policy = {.interval = absl::Milliseconds(10)},
+       .output_budget_bytes = 1 << 20});
+  writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  EXPECT_TRUE(buffer.synced().WaitForNotificationWithTimeout(absl::Minutes(1)));
+}
+
 TEST(ArtifactWriterTest, SimultaneousWritesExecuteSuccessfully) {
   std::string tmp_filepath = GetTempFilepath();
   {
@@ -184,6 +281,360 @@ TEST(ArtifactWriterTest, SimultaneousWritesExecuteSuccessfully) {
   EXPECT_EQ(got_count, kWriterThreads * kArtifactsPerWriter);
 }
 
+TEST(ArtifactWriterTest, TimestampsAreTakenFromTheClock) {
+  FakeClock clock(absl::FromUnixNanos(1'500'000'000'123), absl::Seconds(1));
+  std::string tmp_filepath = GetTempFilepath();
+  {
+    ArtifactWriter writer(tmp_filepath, nullptr,
+                          {.flush_each_minute = false, .clock = &clock});
+    EXPECT_EQ(&writer.GetClock(), &clock);
+    // The clock is read once per artifact, so auto-advance spaces them out.
+    writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+    writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  }
+
+  riegeli::RecordReader<riegeli::FdReader<>> reader(
+      riegeli::FdReader<>{tmp_filepath});
+  absl::Cleanup closer = [&reader] { reader.Close(); };
+  ocpdiag_results_v2_pb::OutputArtifact got;
+  ASSERT_TRUE(reader.ReadRecord(got));
+  EXPECT_THAT(got.timestamp(), EqualsProto(R"pb(seconds: 1500 nanos: 123)pb"));
+  ASSERT_TRUE(reader.ReadRecord(got));
+  EXPECT_THAT(got.timestamp(), EqualsProto(R"pb(seconds: 1501 nanos: 123)pb"));
+}
+
+TEST(ArtifactWriterTest, MetricsCountArtifactsAndBytes) {
+  std::string tmp_filepath = GetTempFilepath();
+  std::stringstream json_stream;
+  ArtifactWriter writer(tmp_filepath, &json_stream);
+  ocpdiag_results_v2_pb::TestStepArtifact step_proto;
+  step_proto.mutable_log()->set_message("fake message");
+  writer.Write(step_proto);
+  writer.Write(step_proto);
+  writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  writer.Flush();
+
+  ArtifactWriterMetrics metrics = writer.GetMetrics();
+  ASSERT_EQ(metrics.artifacts.size(), 2);
+  const ArtifactTypeMetrics& logs = metrics.artifacts["testStepArtifact.log"];
+  EXPECT_EQ(logs.count, 2);
+  EXPECT_GT(logs.binary_bytes, 0);
+  EXPECT_GT(logs.json_bytes, logs.binary_bytes);
+  EXPECT_EQ(metrics.artifacts["schemaVersion"].count, 1);
+
+  // Each JSON line is the serialized artifact plus a newline.
+  int64_t json_bytes = 0;
+  for (const auto& [name, type_metrics] : metrics.artifacts)
+    json_bytes += type_metrics.json_bytes + type_metrics.count;
+  EXPECT_EQ(json_bytes, json_stream.str().size());
+
+  EXPECT_EQ(metrics.write_latency.count(), 3);
+  EXPECT_EQ(metrics.mutex_wait.count(), 3);
+  EXPECT_EQ(metrics.serialization_time.count(), 3);
+  EXPECT_EQ(metrics.flush_duration.count(), 1);
+  EXPECT_GT(metrics.uncompressed_bytes, 0);
+  EXPECT_GT(metrics.compressed_bytes, 0);
+}
+
+TEST(ArtifactWriterTest, FlushesByThePolicy) {
+  ArtifactWriter writer(
+      GetTempFilepath(), /*output_stream=*/nullptr,
+      {.flush_policy = {.max_unflushed_artifacts = 3,
+                        .group_commit_window = absl::Hours(1)}});
+  writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  writer.FlushAtBoundary();
+  EXPECT_EQ(writer.GetMetrics().flush_duration.count(), 1);
+
+  // The next boundaries are within the group commit window of the first.
+  writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  writer.FlushAtBoundary();
+  writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  writer.FlushAtBoundary();
+  EXPECT_EQ(writer.GetMetrics().flush_duration.count(), 1);
+
+  writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  EXPECT_EQ(writer.GetMetrics().flush_duration.count(), 2);
+}
+
+TEST(ArtifactWriterTest, SinkIsFlushedByThePolicy) {
+  auto sink = std::make_shared<FlushCountingSink>();
+  ArtifactWriter writer(
+      sink, /*output_stream=*/nullptr,
+      {.flush_policy = {.group_commit_window = absl::Hours(1)}});
+  writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  writer.FlushAtBoundary();
+  EXPECT_EQ(sink->flushes(), 1);
+
+  // The flush thread makes the flushes of the next boundaries, within the
+  // group commit window of the first.
+  for (int i = 0; i < 3; i++) {
+    writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+    writer.FlushAtBoundary();
+  }
+  EXPECT_EQ(sink->flushes(), 1);
+}
+
+TEST(ArtifactWriterTest, WriteMetricsAreNotTimedByTheClock) {
+  // A clock that never moves still leaves the metrics measured.
+  FakeClock clock;
+  ArtifactWriter writer(GetTempFilepath(), /*output_stream=*/nullptr,
+                        {.flush_each_minute = false, .clock = &clock});
+  for (int i = 0; i < 100; i++)
+    writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  EXPECT_GT(writer.GetMetrics().write_latency.max(), absl::ZeroDuration());
+  EXPECT_EQ(clock.Now(), absl::UnixEpoch());
+}
+
+TEST(ArtifactWriterTest, BoundariesFlushWithoutTheFlushThread) {
+  ArtifactWriter writer(
+      GetTempFilepath(), /*output_stream=*/nullptr,
+      {.flush_each_minute = false,
+       .flush_policy = {.group_commit_window = absl::Hours(1)}});
+  writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  writer.FlushAtBoundary();
+  writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  writer.FlushAtBoundary();
+  EXPECT_EQ(writer.GetMetrics().flush_duration.count(), 2);
+}
+
+TEST(ArtifactWriterTest, FileIsWrittenAsynchronously) {
+  std::string tmp_filepath = GetTempFilepath();
+  {
+    ArtifactWriter writer(
+        tmp_filepath, /*output_stream=*/nullptr,
+        {.flush_each_minute = false, .async_file_io = true});
+    for (int i = 0; i < 100; i++)
+      writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+    writer.Flush();
+    writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  }
+
+  riegeli::RecordReader<riegeli::FdReader<>> reader(
+      riegeli::FdReader<>{tmp_filepath});
+  absl::Cleanup closer = [&reader] { reader.Close(); };
+  ocpdiag_results_v2_pb::OutputArtifact got;
+  for (int i = 0; i < 101; i++) {
+    ASSERT_TRUE(reader.ReadRecord(got));
+    EXPECT_EQ(got.sequence_number(), i);
+  }
+  EXPECT_FALSE(reader.ReadRecord(got));
+}
+
+TEST(ArtifactWriterTest, StreamIsWrittenWhenFlushed) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  absl::Cleanup closer = [&fds] {
+    close(fds[0]);
+    close(fds[1]);
+  };
+  BufferedLineWriter buffer(fds[1]);
+  std::ostream stream(&buffer);
+  ArtifactWriter writer("", &stream);
+  for (int i = 0; i < 10; i++)
+    writer.Write(ocpdiag_results_v2_pb::SchemaVersion());
+  EXPECT_EQ(buffer.write_calls(), 0);
+
+  writer.Flush();
+  EXPECT_EQ(buffer.write_calls(), 1);
+  std::string lines(4096, '\0');
+  lines.resize(read(fds[0], lines.data(), lines.size()));
+  EXPECT_EQ(std::count(lines.begin(), lines.end(), '\n'), 10);
+}
+
+// Blocks every write until it is released, like a pipe that nobody reads.
+class StalledStreambuf : public std::streambuf {
+ public:
+  void Release() { released_.Notify(); }
+
+ protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override {
+    released_.WaitForNotification();
+    return n;
+  }
+  int overflow(int c) override {
+    released_.WaitForNotification();
+    return c;
+  }
+
+ private:
+  absl::Notification released_;
+};
+
+TEST(ArtifactWriterTest, StalledStreamDoesNotBlockTheFile) {
+  std::string tmp_filepath = GetTempFilepath();
+  StalledStreambuf buffer;
+  std::ostream stream(&buffer);
+  ArtifactWriter writer(
+      tmp_filepath, &stream,
+      {.flush_each_minute = false, .output_budget_bytes = 1024});
+  ocpdiag_results_v2_pb::TestStepArtifact step_proto;
+  step_proto.mutable_log()->set_severity(ocpdiag_results_v2_pb::Log::DEBUG);
+  step_proto.mutable_log()->set_message("debug");
+  for (int i = 0; i < 1000; i++) writer.Write(step_proto);
+  writer.Flush();
+
+  std::vector<std::string> dropped = writer.DescribeDroppedArtifacts();
+  ASSERT_EQ(dropped.size(), 1);
+  EXPECT_THAT(dropped[0], HasSubstr("The output stream fell behind"));
+  riegeli::RecordReader<riegeli::FdReader<>> reader(
+      riegeli::FdReader<>{tmp_filepath});
+  ocpdiag_results_v2_pb::OutputArtifact artifact;
+  int artifacts = 0;
+  while (reader.ReadRecord(artifact)) artifacts++;
+  EXPECT_EQ(artifacts, 1000);
+  buffer.Release();
+}
+
+TEST(ArtifactWriterTest, CrashJournalHoldsTheUnflushedArtifacts) {
+  std::string tmp_filepath = GetTempFilepath();
+  std::string journal_path =
+      absl::StrCat(tmp_filepath, CrashJournal::kFileSuffix);
+  {
+    ArtifactWriter writer(tmp_filepath, /*output_stream=*/nullptr,
+                          {.flush_each_minute = false,
+                           .intern_strings = true,
+                           .crash_journal = true});
+    ocpdiag_results_v2_pb::TestStepArtifact step_proto;
+    step_proto.mutable_log()->set_message("first");
+    writer.Write(step_proto);
+    writer.Flush();
+    step_proto.mutable_log()->set_message("second");
+    writer.Write(step_proto);
+
+    absl::StatusOr<CrashJournalContents> journal =
+        CrashJournal::Read(journal_path);
+    ASSERT_TRUE(journal.ok()) << journal.status();
+    ASSERT_EQ(journal->records.size(), 1);
+    ocpdiag_results_v2_pb::OutputArtifact artifact;
+    ASSERT_TRUE(artifact.ParseFromString(journal->records[0]));
+    EXPECT_THAT(artifact, Partially(EqualsProto(R"pb(
+                  test_step_artifact { log { message: "second" } }
+                  sequence_number: 1
+                )pb")));
+  }
+  EXPECT_FALSE(std::filesystem::exists(journal_path));
+}
+
+TEST(ArtifactToJsonTest, RawJsonIsSplicedIntoTheOutput) {
+  ocpdiag_results_v2_pb::OutputArtifact artifact;
+  ocpdiag_results_v2_pb::TestRunStart* start =
+      artifact.mutable_test_run_artifact()->mutable_test_run_start();
+  start->set_name("mlc");
+  start->set_parameters_raw_json("{\"mode\": \"fast\",\n \"id\": [1, 2]}");
+  start->mutable_dut_info()->set_metadata_raw_json(R"({"a":"b \"c\""})");
+  // A Struct that holds a key like that of a raw JSON field is not spliced.
+  google::protobuf::Value value;
+  value.set_string_value("{}");
+  (*start->mutable_metadata()->mutable_fields())["metadataRawJson"] = value;
+
+  std::string json;
+  ASSERT_THAT(ArtifactToJson(artifact, json), IsOk());
+  EXPECT_THAT(json,
+              HasSubstr(R"("parameters":{"mode": "fast",  "id": [1, 2]})"));
+  EXPECT_THAT(json, HasSubstr(R"("metadata":{"a":"b \"c\""})"));
+  EXPECT_THAT(json, HasSubstr(R"("metadata":{"metadataRawJson":"{}"})"));
+  EXPECT_THAT(json, Not(HasSubstr("parametersRawJson")));
+
+  // The output is JSON of the artifact with the raw JSON as Struct fields.
+  ocpdiag_results_v2_pb::OutputArtifact parsed;
+  ASSERT_TRUE(google::protobuf::util::JsonStringToMessage(json, &parsed).ok());
+  EXPECT_THAT(parsed, Partially(EqualsProto(R"pb(
+                test_run_artifact {
+                  test_run_start {
+                    name: "mlc"
+                    parameters {
+                      fields {
+                        key: "mode"
+                        value { string_value: "fast" }
+                      }
+                      fields {
+                        key: "id"
+                        value {
+                          list_value {
+                            values { number_value: 1 }
+                            values { number_value: 2 }
+                          }
+                        }
+                      }
+                    }
+                    dut_info {
+                      metadata {
+                        fields {
+                          key: "a"
+                          value { string_value: "b \"c\"" }
+                        }
+                      }
+                    }
+                  }
+                }
+              )pb")));
+}
+
+TEST(ArtifactToJsonTest, UnsetRawJsonFieldsAreNotPrinted) {
+  ocpdiag_results_v2_pb::OutputArtifact artifact;
+  artifact.mutable_test_step_artifact()->mutable_measurement()->set_name("m");
+  std::string json;
+  ASSERT_THAT(ArtifactToJson(artifact, json), IsOk());
+  EXPECT_THAT(json, Not(HasSubstr("RawJson")));
+}
+
+TEST(ArtifactToJsonTest, IntegerValuesArePrintedExactly) {
+  ocpdiag_results_v2_pb::OutputArtifact artifact;
+  ocpdiag_results_v2_pb::Measurement* measurement =
+      artifact.mutable_test_step_artifact()->mutable_measurement();
+  measurement->set_name("ecc-errors");
+  measurement->mutable_value()->set_number_value(3);
+  measurement->mutable_integer_value()->set_int64_value(3);
+  // A validator value and a metadata key of the same names are left alone.
+  ocpdiag_results_v2_pb::Validator* validator = measurement->add_validators();
+  validator->set_type(ocpdiag_results_v2_pb::Validator::LESS_THAN);
+  validator->mutable_value()->set_number_value(5);
+  (*measurement->mutable_metadata()->mutable_fields())["integerValue"]
+      .set_number_value(7);
+  std::string json;
+  ASSERT_THAT(ArtifactToJson(artifact, json), IsOk());
+  EXPECT_THAT(json, HasSubstr(R"("value":3)"));
+  EXPECT_THAT(json, HasSubstr(R"("value":5)"));
+  EXPECT_THAT(json, HasSubstr(R"("integerValue":7)"));
+  EXPECT_THAT(json, Not(HasSubstr("int64Value")));
+  // The artifact itself keeps the exact value.
+  EXPECT_EQ(measurement->integer_value().int64_value(), 3);
+}
+
+TEST(ArtifactWriterTest, IntegersBeyondDoublePrecisionAreWrittenExactly) {
+  std::stringstream json_stream;
+  {
+    ArtifactWriter writer("", &json_stream);
+    for (int64_t value : {int64_t{9007199254740993},
+                          std::numeric_limits<int64_t>::max()}) {
+      ocpdiag_results_v2_pb::TestStepArtifact artifact;
+      ocpdiag_results_v2_pb::Measurement* measurement =
+          artifact.mutable_measurement();
+      measurement->set_name("counter");
+      measurement->mutable_value()->set_number_value(value);
+      measurement->mutable_integer_value()->set_int64_value(value);
+      writer.Write(artifact);
+    }
+    ocpdiag_results_v2_pb::TestStepArtifact artifact;
+    ocpdiag_results_v2_pb::MeasurementSeriesElement* element =
+        artifact.mutable_measurement_series_element();
+    uint64_t value = std::numeric_limits<uint64_t>::max();
+    element->mutable_value()->set_number_value(value);
+    element->mutable_integer_value()->set_uint64_value(value);
+    writer.Write(artifact);
+  }
+  std::vector<std::string> lines = absl::StrSplit(
+      json_stream.str(), '\n', absl::SkipEmpty());
+  ASSERT_EQ(lines.size(), 3);
+  EXPECT_THAT(lines[0], HasSubstr(R"("value":9007199254740993})"));
+  EXPECT_THAT(lines[1], HasSubstr(R"("value":9223372036854775807})"));
+  EXPECT_THAT(lines[2], HasSubstr(R"("value":18446744073709551615})"));
+  for (const std::string& line : lines) {
+    EXPECT_THAT(line, Not(HasSubstr("e+")));
+    EXPECT_THAT(line, Not(HasSubstr("integerValue")));
+  }
+}
+
 }  // namespace
 
 }  // namespace ocpdiag::results::internal
@@ -0,0 +1,423 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/async_file_writer.h"
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/buffered_writer.h"
+
+namespace ocpdiag::results::internal {
+
+class AsyncFileWriter::Backend {
+ public:
+  // Tags the completion of a sync; writes are tagged with their buffer index.
+  static constexpr uint64_t kSyncTag = ~uint64_t{0};
+
+  struct Completion {
+    uint64_t tag;
+    int64_t result;  // Bytes written, or a negated errno
+  };
+
+  virtual ~Backend() = default;
+
+  // Writes `data`, which is in the buffer at `buffer_index`, at `offset`.
+  virtual void SubmitWrite(int buffer_index, absl::string_view data,
+                           int64_t offset) = 0;
+
+  // Syncs the file to the disk. Only called with no writes in flight.
+  virtual void SubmitSync() = 0;
+
+  // Waits for a write or sync to complete.
+  virtual Completion Reap() = 0;
+};
+
+namespace {
+
+using Completion = AsyncFileWriter::Backend::Completion;
+
+absl::Status ErrnoError(absl::string_view what, int error) {
+  return absl::InternalError(absl::StrCat(what, ": ", std::strerror(error)));
+}
+
+// Submits the writes to an io_uring, without liburing. The buffers are
+// registered with the ring, so that the kernel does not map them on every
+// write.
+class IoUringBackend : public AsyncFileWriter::Backend {
+ public:
+  // Returns null if io_uring is unavailable, e.g. on kernels before 5.1 or
+  // when it is disabled by seccomp.
+  static std::unique_ptr<IoUringBackend> Create(
+      int fd, const std::vector<iovec>& buffers) {
+    io_uring_params params = {};
+    // Room for a write from each buffer and a sync.
+    int ring_fd = syscall(__NR_io_uring_setup, buffers.size() + 1, &params);
+    if (ring_fd < 0) return nullptr;
+    auto backend = std::unique_ptr<IoUringBackend>(new IoUringBackend(fd));
+    backend->ring_fd_ = ring_fd;
+    if (!backend->MapRings(params) ||
+        syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS,
+                buffers.data(), buffers.size()) < 0) {
+      return nullptr;
+    }
+    return backend;
+  }
+
+  ~IoUringBackend() override {
+    if (sqes_ != nullptr) munmap(sqes_, sqes_size_);
+    if (cq_ring_ != nullptr && cq_ring_ != sq_ring_)
+      munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != nullptr) munmap(sq_ring_, sq_ring_size_);
+    if (ring_fd_ >= 0) close(ring_fd_);
+  }
+
+  void SubmitWrite(int buffer_index, absl::string_view data,
+                   int64_t offset) override {
+    io_uring_sqe& sqe = NextSqe();
+    sqe.opcode = IORING_OP_WRITE_FIXED;
+    sqe.fd = fd_;
+    sqe.addr = reinterpret_cast<uint64_t>(data.data());
+    sqe.len = data.size();
+    sqe.off = offset;
+    sqe.buf_index = buffer_index;
+    sqe.user_data = buffer_index;
+    Submit();
+  }
+
+  void SubmitSync() override {
+    io_uring_sqe& sqe = NextSqe();
+    sqe.opcode = IORING_OP_FSYNC;
+    sqe.flags = IOSQE_IO_DRAIN;
+    sqe.fd = fd_;
+    sqe.user_data = kSyncTag;
+    Submit();
+  }
+
+  Completion Reap() override {
+    while (true) {
+      unsigned head = *cq_head_;
+      if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+        const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+        Completion completion = {.tag = cqe.user_data, .result = cqe.res};
+        __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+        return completion;
+      }
+      syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS,
+              nullptr, 0);
+    }
+  }
+
+ private:
+  explicit IoUringBackend(int fd) : fd_(fd) {}
+
+  bool MapRings(const io_uring_params& params) {
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ =
+        params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = Map(sq_ring_size_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == nullptr) return false;
+    cq_ring_ = single_mmap ? sq_ring_ : Map(cq_ring_size_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == nullptr) return false;
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe*>(Map(sqes_size_, IORING_OFF_SQES));
+    if (sqes_ == nullptr) return false;
+
+    char* sq = static_cast<char*>(sq_ring_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* cq = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+  }
+
+  void* Map(size_t size, off_t offset) {
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd_, offset);
+    return address == MAP_FAILED ? nullptr : address;
+  }
+
+  io_uring_sqe& NextSqe() {
+    io_uring_sqe& sqe = sqes_[*sq_tail_ & *sq_mask_];
+    std::memset(&sqe, 0, sizeof(sqe));
+    return sqe;
+  }
+
+  void Submit() {
+    unsigned tail = *sq_tail_;
+    sq_array_[tail & *sq_mask_] = tail & *sq_mask_;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    while (syscall(__NR_io_uring_enter, ring_fd_, 1, 0, 0, nullptr, 0) < 0 &&
+           (errno == EINTR || errno == EAGAIN)) {
+    }
+  }
+
+  int fd_;
+  int ring_fd_ = -1;
+  void* sq_ring_ = nullptr;
+  void* cq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+};
+
+// Makes the writes with pwrite on a pool of threads.
+class ThreadPoolBackend : public AsyncFileWriter::Backend {
+ public:
+  ThreadPoolBackend(int fd, int num_threads) : fd_(fd) {
+    for (int i = 0; i < std::max(num_threads, 1); ++i)
+      threads_.emplace_back(&ThreadPoolBackend::Work, this);
+  }
+
+  ~ThreadPoolBackend() override {
+    {
+      absl::MutexLock lock(&mutex_);
+      stop_ = true;
+    }
+    for (std::thread& thread : threads_) thread.join();
+  }
+
+  void SubmitWrite(int buffer_index, absl::string_view data,
+                   int64_t offset) override {
+    absl::MutexLock lock(&mutex_);
+    jobs_.push_back({.tag = static_cast<uint64_t>(buffer_index),
+                     .data = data,
+                     .offset = offset});
+  }
+
+  void SubmitSync() override {
+    absl::MutexLock lock(&mutex_);
+    jobs_.push_back({.tag = kSyncTag});
+  }
+
+  Completion Reap() override {
+    absl::MutexLock lock(&mutex_);
+    mutex_.Await(absl::Condition(
+        +[](std::deque<Completion>* completions) {
+          return !completions->empty();
+        },
+        &completions_));
+    Completion completion = completions_.front();
+    completions_.pop_front();
+    return completion;
+  }
+
+ private:
+  struct Job {
+    uint64_t tag;
+    absl::string_view data;
+    int64_t offset = 0;
+  };
+
+  void Work() {
+    absl::MutexLock lock(&mutex_);
+    while (true) {
+      mutex_.Await(absl::Condition(this, &ThreadPoolBackend::HasWork));
+      if (stop_) return;
+      Job job = jobs_.front();
+      jobs_.pop_front();
+      mutex_.Unlock();
+      Completion completion = {.tag = job.tag, .result = Run(job)};
+      mutex_.Lock();
+      completions_.push_back(completion);
+    }
+  }
+
+  bool HasWork() const ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex_) {
+    return stop_ || !jobs_.empty();
+  }
+
+  int64_t Run(const Job& job) {
+    if (job.tag == kSyncTag) return fsync(fd_) == 0 ? 0 : -errno;
+    size_t written = 0;
+    while (written < job.data.size()) {
+      ssize_t result = pwrite(fd_, job.data.data() + written,
+                              job.data.size() - written, job.offset + written);
+      if (result < 0 && errno == EINTR) continue;
+      if (result < 0) return -errno;
+      written += result;
+    }
+    return written;
+  }
+
+  int fd_;
+  absl::Mutex mutex_;
+  std::deque<Job> jobs_ ABSL_GUARDED_BY(mutex_);
+  std::deque<Completion> completions_ ABSL_GUARDED_BY(mutex_);
+  bool stop_ ABSL_GUARDED_BY(mutex_) = false;
+  std::vector<std::thread> threads_;
+};
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<AsyncFileWriter>> AsyncFileWriter::Open(
+    absl::string_view path, const AsyncFileWriterOptions& options) {
+  int fd = open(std::string(path).c_str(),
+                O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd < 0) return ErrnoError(absl::StrCat("Cannot open ", path), errno);
+  return std::unique_ptr<AsyncFileWriter>(new AsyncFileWriter(fd, options));
+}
+
+AsyncFileWriter::AsyncFileWriter(int fd, const AsyncFileWriterOptions& options)
+    : fd_(fd),
+      buffer_size_(options.buffer_size),
+      buffers_(new char[options.buffer_size *
+                        std::max(options.num_buffers, 1)]),
+      slots_(std::max(options.num_buffers, 1)) {
+  if (options.use_io_uring) {
+    std::vector<iovec> buffers;
+    for (size_t i = 0; i < slots_.size(); ++i) {
+      buffers.push_back(
+          {.iov_base = &buffers_[i * buffer_size_], .iov_len = buffer_size_});
+    }
+    backend_ = IoUringBackend::Create(fd_, buffers);
+    uses_io_uring_ = backend_ != nullptr;
+  }
+  if (backend_ == nullptr)
+    backend_ = std::make_unique<ThreadPoolBackend>(fd_, options.num_threads);
+}
+
+AsyncFileWriter::~AsyncFileWriter() { Close().IgnoreError(); }
+
+absl::Status AsyncFileWriter::Write(absl::string_view data) {
+  while (!data.empty() && status_.ok()) {
+    size_t size = std::min(buffer_size_ - filled_, data.size());
+    std::memcpy(&buffers_[current_ * buffer_size_ + filled_], data.data(),
+                size);
+    filled_ += size;
+    data.remove_prefix(size);
+    if (filled_ == buffer_size_) SubmitCurrent();
+  }
+  return status_;
+}
+
+absl::Status AsyncFileWriter::Flush(bool sync) {
+  if (fd_ < 0) return status_;
+  SubmitCurrent();
+  while (in_flight_ > 0) ReapOne();
+  if (sync && status_.ok()) {
+    backend_->SubmitSync();
+    sync_in_flight_ = true;
+    while (sync_in_flight_) ReapOne();
+  }
+  return status_;
+}
+
+absl::Status AsyncFileWriter::Close() {
+  if (fd_ < 0) return status_;
+  Flush(/*sync=*/false).IgnoreError();
+  backend_ = nullptr;
+  if (close(fd_) != 0 && status_.ok()) status_ = ErrnoError("close", errno);
+  fd_ = -1;
+  return status_;
+}
+
+void AsyncFileWriter::SubmitCurrent() {
+  if (filled_ == 0) return;
+  Slot& slot = slots_[current_];
+  slot = {.offset = submitted_pos_, .size = filled_, .in_flight = true};
+  ++in_flight_;
+  backend_->SubmitWrite(
+      current_,
+      absl::string_view(&buffers_[current_ * buffer_size_], filled_),
+      slot.offset);
+  submitted_pos_ += filled_;
+  filled_ = 0;
+  current_ = (current_ + 1) % slots_.size();
+  while (slots_[current_].in_flight) ReapOne();
+}
+
+void AsyncFileWriter::ReapOne() {
+  Completion completion = backend_->Reap();
+  if (completion.tag == Backend::kSyncTag) {
+    sync_in_flight_ = false;
+    if (completion.result < 0 && status_.ok())
+      status_ = ErrnoError("fsync", -completion.result);
+    return;
+  }
+
+  Slot& slot = slots_[completion.tag];
+  const char* data = &buffers_[completion.tag * buffer_size_];
+  size_t written = std::max<int64_t>(completion.result, 0);
+  // Short writes are rare enough to be completed synchronously.
+  while (completion.result >= 0 && written < slot.size) {
+    ssize_t result = pwrite(fd_, data + written, slot.size - written,
+                            slot.offset + written);
+    if (result < 0 && errno == EINTR) continue;
+    completion.result = result < 0 ? -errno : result;
+    written += std::max<ssize_t>(result, 0);
+  }
+  if (completion.result < 0 && status_.ok())
+    status_ = ErrnoError("write", -completion.result);
+  slot.in_flight = false;
+  --in_flight_;
+}
+
+AsyncFdWriter::AsyncFdWriter(std::unique_ptr<AsyncFileWriter> file)
+    : file_(std::move(file)) {}
+
+void AsyncFdWriter::Done() {
+  BufferedWriter::Done();
+  if (absl::Status status = file_->Close(); !status.ok()) Fail(status);
+}
+
+bool AsyncFdWriter::WriteInternal(absl::string_view src) {
+  if (absl::Status status = file_->Write(src); !status.ok())
+    return Fail(status);
+  return true;
+}
+
+bool AsyncFdWriter::FlushImpl(riegeli::FlushType flush_type) {
+  if (!BufferedWriter::FlushImpl(flush_type)) return false;
+  if (flush_type == riegeli::FlushType::kFromObject) return true;
+  if (absl::Status status =
+          file_->Flush(flush_type == riegeli::FlushType::kFromMachine);
+      !status.ok()) {
+    return Fail(status);
+  }
+  return true;
+}
+
+}  // namespace ocpdiag::results::internal
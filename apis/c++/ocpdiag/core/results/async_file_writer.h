@@ -0,0 +1,110 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_ASYNC_FILE_WRITER_H_
+#define OCPDIAG_CORE_RESULTS_ASYNC_FILE_WRITER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/base/object.h"
+#include "riegeli/bytes/buffered_writer.h"
+
+namespace ocpdiag::results::internal {
+
+struct AsyncFileWriterOptions {
+  // Data is written from a ring of this many buffers of this size, so that
+  // this much can be in flight before a write waits for the device.
+  size_t buffer_size = 1 << 20;
+  int num_buffers = 4;
+
+  // Whether to submit the writes through io_uring, with the buffers
+  // registered with the ring. Otherwise, or if io_uring is unavailable, the
+  // writes are made with pwrite by a pool of `num_threads` threads.
+  bool use_io_uring = true;
+  int num_threads = 2;
+};
+
+// Appends to a file without waiting for the device, unless all the buffers
+// are in flight or the writer is flushed. This class is not thread-safe.
+class AsyncFileWriter {
+ public:
+  // The backend that the writes are submitted to.
+  class Backend;
+
+  // Creates or truncates the file at `path`.
+  static absl::StatusOr<std::unique_ptr<AsyncFileWriter>> Open(
+      absl::string_view path, const AsyncFileWriterOptions& options = {});
+  ~AsyncFileWriter();
+
+  // Copies `data` to the buffers, submitting those that are filled up.
+  absl::Status Write(absl::string_view data);
+
+  // Submits the buffered data, and waits until the file has all of it, and
+  // with `sync`, until it reached the disk.
+  absl::Status Flush(bool sync);
+
+  // Flushes the file without syncing it, and closes it.
+  absl::Status Close();
+
+  // Returns the size of the file once everything written is flushed.
+  int64_t pos() const { return submitted_pos_ + filled_; }
+
+  // Returns whether the writes are submitted through io_uring.
+  bool uses_io_uring() const { return uses_io_uring_; }
+
+ private:
+  struct Slot {
+    int64_t offset = 0;
+    size_t size = 0;
+    bool in_flight = false;
+  };
+
+  AsyncFileWriter(int fd, const AsyncFileWriterOptions& options);
+
+  // Submits the current buffer, if not empty, and waits for the next one.
+  void SubmitCurrent();
+  // Waits for one write or sync to complete.
+  void ReapOne();
+
+  int fd_;
+  const size_t buffer_size_;
+  std::unique_ptr<char[]> buffers_;
+  std::vector<Slot> slots_;
+  std::unique_ptr<Backend> backend_;
+  bool uses_io_uring_ = false;
+  int current_ = 0;
+  size_t filled_ = 0;
+  int64_t submitted_pos_ = 0;
+  int in_flight_ = 0;
+  bool sync_in_flight_ = false;
+  absl::Status status_;
+};
+
+// A riegeli writer to an AsyncFileWriter, e.g. for a riegeli::RecordWriter.
+// Flushing it from the process or the machine waits for the file as
+// AsyncFileWriter::Flush does; otherwise, writes do not wait for the device.
+class AsyncFdWriter : public riegeli::BufferedWriter {
+ public:
+  explicit AsyncFdWriter(std::unique_ptr<AsyncFileWriter> file);
+
+ protected:
+  void Done() override;
+  bool WriteInternal(absl::string_view src) override;
+  bool FlushImpl(riegeli::FlushType flush_type) override;
+
+ private:
+  std::unique_ptr<AsyncFileWriter> file_;
+};
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_ASYNC_FILE_WRITER_H_
@@ -0,0 +1,129 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/async_file_writer.h"
+
+#include <filesystem>  //
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "ocpdiag/core/testing/file_utils.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/writer.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+
+namespace ocpdiag::results::internal {
+
+using ::ocpdiag::testing::IsOk;
+using ::ocpdiag::testing::StatusIs;
+
+namespace {
+
+std::string GetTempFilepath() {
+  std::string filepath = testutils::MkTempFileOrDie("async_file_writer");
+  if (std::filesystem::exists(filepath))
+    CHECK(std::filesystem::remove(filepath)) << "Cannot remove temp file";
+  return filepath;
+}
+
+std::string ReadFile(const std::string& path) {
+  std::ifstream file(path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+// Tests both backends, where io_uring is available.
+class AsyncFileWriterTest : public ::testing::TestWithParam<bool> {
+ protected:
+  void SetUp() override {
+    if (GetParam() && !(*Open(GetTempFilepath()))->uses_io_uring())
+      GTEST_SKIP() << "io_uring is unavailable";
+  }
+
+  absl::StatusOr<std::unique_ptr<AsyncFileWriter>> Open(
+      const std::string& path, size_t buffer_size = 16) {
+    return AsyncFileWriter::Open(
+        path, {.buffer_size = buffer_size, .use_io_uring = GetParam()});
+  }
+};
+
+TEST_P(AsyncFileWriterTest, WritesAreInTheFileWhenFlushed) {
+  std::string path = GetTempFilepath();
+  absl::StatusOr<std::unique_ptr<AsyncFileWriter>> file = Open(path);
+  ASSERT_THAT(file.status(), IsOk());
+  std::string expected;
+  for (int i = 0; i < 100; i++) {
+    std::string data = absl::StrCat("write ", i, ";");
+    ASSERT_THAT((*file)->Write(data), IsOk());
+    expected += data;
+  }
+  EXPECT_EQ((*file)->pos(), expected.size());
+
+  ASSERT_THAT((*file)->Flush(/*sync=*/false), IsOk());
+  EXPECT_EQ(ReadFile(path), expected);
+  ASSERT_THAT((*file)->Write("last"), IsOk());
+  ASSERT_THAT((*file)->Flush(/*sync=*/true), IsOk());
+  EXPECT_EQ(ReadFile(path), expected + "last");
+}
+
+TEST_P(AsyncFileWriterTest, WritesLargerThanTheBuffersAreSplit) {
+  std::string path = GetTempFilepath();
+  std::string data(1000, 'x');
+  {
+    absl::StatusOr<std::unique_ptr<AsyncFileWriter>> file = Open(path);
+    ASSERT_THAT(file.status(), IsOk());
+    ASSERT_THAT((*file)->Write(data), IsOk());
+    ASSERT_THAT((*file)->Close(), IsOk());
+  }
+  EXPECT_EQ(ReadFile(path), data);
+}
+
+TEST_P(AsyncFileWriterTest, RecordsAreWrittenThroughRiegeli) {
+  std::string path = GetTempFilepath();
+  absl::StatusOr<std::unique_ptr<AsyncFileWriter>> file = Open(path, 4096);
+  ASSERT_THAT(file.status(), IsOk());
+  {
+    riegeli::RecordWriter<std::unique_ptr<riegeli::Writer>> writer(
+        std::make_unique<AsyncFdWriter>(*std::move(file)));
+    for (int i = 0; i < 1000; i++)
+      ASSERT_TRUE(writer.WriteRecord(absl::StrCat("record ", i)));
+    ASSERT_TRUE(writer.Close()) << writer.status();
+  }
+
+  riegeli::RecordReader<riegeli::FdReader<>> reader(riegeli::FdReader<>{path});
+  std::string record;
+  for (int i = 0; i < 1000; i++) {
+    ASSERT_TRUE(reader.ReadRecord(record));
+    EXPECT_EQ(record, absl::StrCat("record ", i));
+  }
+  EXPECT_FALSE(reader.ReadRecord(record));
+  EXPECT_TRUE(reader.Close()) << reader.status();
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, AsyncFileWriterTest, ::testing::Bool(),
+                         [](const ::testing::TestParamInfo<bool>& info) {
+                           return info.param ? "IoUring" : "ThreadPool";
+                         });
+
+TEST(AsyncFileWriterOpenTest, MissingDirectoryIsAnError) {
+  EXPECT_THAT(AsyncFileWriter::Open("/nonexistent/results").status(),
+              StatusIs(absl::StatusCode::kInternal));
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
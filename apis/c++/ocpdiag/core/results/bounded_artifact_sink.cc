@@ -0,0 +1,198 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/bounded_artifact_sink.h"
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+ArtifactPriority GetLogPriority(const ocpdiag_results_v2_pb::Log& log) {
+  switch (log.severity()) {
+    case ocpdiag_results_v2_pb::Log::ERROR:
+    case ocpdiag_results_v2_pb::Log::FATAL:
+      return ArtifactPriority::kHigh;
+    case ocpdiag_results_v2_pb::Log::WARNING:
+      return ArtifactPriority::kNormal;
+    default:
+      return ArtifactPriority::kLow;
+  }
+}
+
+}  // namespace
+
+ArtifactPriority GetArtifactPriority(
+    const ocpdiag_results_v2_pb::OutputArtifact& artifact) {
+  const ocpdiag_results_v2_pb::TestRunArtifact& run =
+      artifact.test_run_artifact();
+  const ocpdiag_results_v2_pb::TestStepArtifact& step =
+      artifact.test_step_artifact();
+  if (run.has_log()) return GetLogPriority(run.log());
+  if (step.has_log()) return GetLogPriority(step.log());
+  if (step.has_measurement_series_element()) return ArtifactPriority::kLow;
+  if (step.has_measurement() || step.has_measurement_series_start() ||
+      step.has_measurement_series_end() || step.has_file() ||
+      step.has_extension()) {
+    return ArtifactPriority::kNormal;
+  }
+  return ArtifactPriority::kHigh;
+}
+
+std::string DescribeDroppedArtifacts(absl::string_view output,
+                                     const DroppedArtifacts& dropped) {
+  return absl::StrCat(output, " fell behind, so ", dropped.total(),
+                      " of its artifacts (", dropped.bytes,
+                      " bytes) were dropped: ", dropped.low_priority,
+                      " of low priority, ", dropped.normal_priority,
+                      " of normal priority and ", dropped.high_priority,
+                      " of high priority.");
+}
+
+BoundedArtifactSink::BoundedArtifactSink(std::shared_ptr<ArtifactSink> sink,
+                                         size_t max_queued_bytes,
+                                         absl::Duration drain_timeout)
+    : max_queued_bytes_(max_queued_bytes),
+      drain_timeout_(drain_timeout),
+      state_(std::make_shared<State>()),
+      thread_(&BoundedArtifactSink::Drain, state_, std::move(sink)) {}
+
+BoundedArtifactSink::~BoundedArtifactSink() { Stop(); }
+
+void BoundedArtifactSink::Stop(absl::Time deadline) {
+  if (!thread_.joinable()) return;
+  bool finished;
+  {
+    absl::MutexLock lock(&state_->mutex);
+    state_->stopping = true;
+    state_->flush_requested = true;
+    State* state = state_.get();
+    auto done = [state]() {
+      state->mutex.AssertReaderHeld();
+      return state->finished;
+    };
+    finished =
+        state_->mutex.AwaitWithDeadline(absl::Condition(&done), deadline);
+    if (!finished) {
+      while (!state_->queue.empty())
+        state_->DropQueued(state_->queue.front().priority);
+    }
+  }
+  if (finished) {
+    thread_.join();
+  } else {
+    thread_.detach();
+  }
+}
+
+void BoundedArtifactSink::Write(
+    const ocpdiag_results_v2_pb::OutputArtifact& artifact) {
+  size_t bytes = artifact.ByteSizeLong();
+  ArtifactPriority priority = GetArtifactPriority(artifact);
+  absl::MutexLock lock(&state_->mutex);
+  if (state_->stopping) {
+    state_->CountDropped(priority, bytes);
+    return;
+  }
+  if (priority != ArtifactPriority::kHigh) {
+    while (state_->queued_bytes + bytes > max_queued_bytes_) {
+      int lowest = 0;
+      while (lowest < static_cast<int>(priority) &&
+             state_->queue_by_priority[lowest].empty()) {
+        lowest++;
+      }
+      if (lowest == static_cast<int>(priority)) {
+        state_->CountDropped(priority, bytes);
+        return;
+      }
+      state_->DropQueued(static_cast<ArtifactPriority>(lowest));
+    }
+  }
+  state_->queue.push_back(
+      {.artifact = artifact, .bytes = bytes, .priority = priority});
+  state_->queue_by_priority[static_cast<int>(priority)].push_back(
+      std::prev(state_->queue.end()));
+  state_->queued_bytes += bytes;
+}
+
+void BoundedArtifactSink::Flush() {
+  absl::MutexLock lock(&state_->mutex);
+  state_->flush_requested = true;
+}
+
+DroppedArtifacts BoundedArtifactSink::dropped() const {
+  absl::MutexLock lock(&state_->mutex);
+  return state_->dropped;
+}
+
+void BoundedArtifactSink::Drain(std::shared_ptr<State> state,
+                                std::shared_ptr<ArtifactSink> sink) {
+  absl::MutexLock lock(&state->mutex);
+  auto has_work = [&state]() {
+    state->mutex.AssertReaderHeld();
+    return !state->queue.empty() || state->flush_requested || state->stopping;
+  };
+  while (true) {
+    state->mutex.Await(absl::Condition(&has_work));
+    if (!state->queue.empty()) {
+      // Writes outside the lock, so that the writer never waits for the sink.
+      Entry entry = std::move(state->queue.front());
+      state->queue_by_priority[static_cast<int>(entry.priority)].pop_front();
+      state->queue.pop_front();
+      state->queued_bytes -= entry.bytes;
+      state->mutex.Unlock();
+      sink->Write(entry.artifact);
+      state->mutex.Lock();
+    } else if (state->flush_requested) {
+      state->flush_requested = false;
+      state->mutex.Unlock();
+      sink->Flush();
+      state->mutex.Lock();
+    } else {
+      state->finished = true;
+      return;
+    }
+  }
+}
+
+void BoundedArtifactSink::State::DropQueued(ArtifactPriority priority) {
+  std::deque<std::list<Entry>::iterator>& entries =
+      queue_by_priority[static_cast<int>(priority)];
+  CountDropped(priority, entries.front()->bytes);
+  queued_bytes -= entries.front()->bytes;
+  queue.erase(entries.front());
+  entries.pop_front();
+}
+
+void BoundedArtifactSink::State::CountDropped(ArtifactPriority priority,
+                                              size_t bytes) {
+  switch (priority) {
+    case ArtifactPriority::kLow:
+      dropped.low_priority++;
+      break;
+    case ArtifactPriority::kNormal:
+      dropped.normal_priority++;
+      break;
+    case ArtifactPriority::kHigh:
+      dropped.high_priority++;
+      break;
+  }
+  dropped.bytes += bytes;
+}
+
+}  // namespace ocpdiag::results::internal
@@ -0,0 +1,132 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_BOUNDED_ARTIFACT_SINK_H_
+#define OCPDIAG_CORE_RESULTS_BOUNDED_ARTIFACT_SINK_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/artifact_sink.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+// The order in which queued artifacts are dropped when an output falls
+// behind. Low priority artifacts are the debug and info logs and the
+// measurement series elements. High priority artifacts are the schema
+// version, the run and step boundaries, errors, diagnoses and logs of ERROR
+// severity or above. The rest are of normal priority.
+enum class ArtifactPriority { kLow = 0, kNormal = 1, kHigh = 2 };
+
+ArtifactPriority GetArtifactPriority(
+    const ocpdiag_results_v2_pb::OutputArtifact& artifact);
+
+// The artifacts dropped by a BoundedArtifactSink.
+struct DroppedArtifacts {
+  int64_t low_priority = 0;
+  int64_t normal_priority = 0;
+  int64_t high_priority = 0;
+  int64_t bytes = 0;
+
+  int64_t total() const {
+    return low_priority + normal_priority + high_priority;
+  }
+};
+
+// Describes the dropped artifacts of `output` in a sentence, for a log.
+std::string DescribeDroppedArtifacts(absl::string_view output,
+                                     const DroppedArtifacts& dropped);
+
+// Decouples a slow sink from the ArtifactWriter: artifacts are queued and
+// written to the sink by a thread of its own, so that a stalled sink, e.g. a
+// pipe to a log shipper, never blocks the writer or its other outputs. The
+// queue holds up to `max_queued_bytes` of serialized artifacts; past that, the
+// oldest queued artifact of the lowest priority below the new one's is
+// dropped to make room, or else the new one is. High priority artifacts are
+// queued regardless, since they are few and small, and are only dropped when
+// the sink is destroyed before they could be written.
+class BoundedArtifactSink : public ArtifactSink {
+ public:
+  static constexpr absl::Duration kDefaultDrainTimeout = absl::Seconds(10);
+
+  BoundedArtifactSink(std::shared_ptr<ArtifactSink> sink,
+                      size_t max_queued_bytes,
+                      absl::Duration drain_timeout = kDefaultDrainTimeout);
+
+  // Stops the sink, see Stop.
+  ~BoundedArtifactSink() override;
+
+  // Waits up to the drain timeout for the queued artifacts to be written and
+  // the sink to be flushed, and drops the rest. If the sink is still writing
+  // then, e.g. blocked on a full pipe, its thread is abandoned: it keeps the
+  // sink alive and exits once the write returns. Artifacts written after this
+  // are dropped.
+  void Stop() { Stop(absl::Now() + drain_timeout_); }
+
+  // Like Stop, but waits until `deadline` instead, so that several sinks can
+  // be stopped within the same drain timeout.
+  void Stop(absl::Time deadline);
+
+  void Write(const ocpdiag_results_v2_pb::OutputArtifact& artifact) override
+      ABSL_LOCKS_EXCLUDED(state_->mutex);
+
+  // Has the sink flushed once the queue is empty, without waiting for it.
+  void Flush() override ABSL_LOCKS_EXCLUDED(state_->mutex);
+
+  DroppedArtifacts dropped() const ABSL_LOCKS_EXCLUDED(state_->mutex);
+
+ private:
+  struct Entry {
+    ocpdiag_results_v2_pb::OutputArtifact artifact;
+    size_t bytes;
+    ArtifactPriority priority;
+  };
+
+  // The state shared with the thread writing to the sink, which outlives the
+  // BoundedArtifactSink when it is abandoned.
+  struct State {
+    // Drops the oldest queued entry of `priority`.
+    void DropQueued(ArtifactPriority priority)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex);
+    void CountDropped(ArtifactPriority priority, size_t bytes)
+        ABSL_EXCLUSIVE_LOCKS_REQUIRED(mutex);
+
+    absl::Mutex mutex;
+    // The queue in write order, and its entries of each priority in the same
+    // order, so that the oldest of a priority is dropped in constant time.
+    std::list<Entry> queue ABSL_GUARDED_BY(mutex);
+    std::array<std::deque<std::list<Entry>::iterator>, 3> queue_by_priority
+        ABSL_GUARDED_BY(mutex);
+    size_t queued_bytes ABSL_GUARDED_BY(mutex) = 0;
+    bool flush_requested ABSL_GUARDED_BY(mutex) = false;
+    bool stopping ABSL_GUARDED_BY(mutex) = false;
+    bool finished ABSL_GUARDED_BY(mutex) = false;
+    DroppedArtifacts dropped ABSL_GUARDED_BY(mutex);
+  };
+
+  static void Drain(std::shared_ptr<State> state,
+                    std::shared_ptr<ArtifactSink> sink);
+
+  const size_t max_queued_bytes_;
+  const absl::Duration drain_timeout_;
+  const std::shared_ptr<State> state_;
+  std::thread thread_;
+};
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_BOUNDED_ARTIFACT_SINK_H_
@@ -0,0 +1,186 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/bounded_artifact_sink.h"
+
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/synchronization/notification.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/artifact_sink.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+using ::ocpdiag_results_v2_pb::Log;
+using ::ocpdiag_results_v2_pb::OutputArtifact;
+using ::testing::ElementsAre;
+
+namespace {
+
+// Blocks every write until it is released, like a full pipe.
+class StalledSink : public ArtifactSink {
+ public:
+  void Write(const OutputArtifact& artifact) override {
+    if (!writing_.HasBeenNotified()) writing_.Notify();
+    released_.WaitForNotification();
+    absl::MutexLock lock(&mutex_);
+    sequence_numbers_.push_back(artifact.sequence_number());
+  }
+
+  void Flush() override {
+    absl::MutexLock lock(&mutex_);
+    flushed_ = true;
+  }
+
+  void AwaitWriting() { writing_.WaitForNotification(); }
+  void Release() { released_.Notify(); }
+
+  // Waits until `count` artifacts were written and the sink was flushed.
+  std::vector<int> AwaitFlushed(size_t count) {
+    absl::MutexLock lock(&mutex_);
+    auto flushed = [this, count]() {
+      mutex_.AssertReaderHeld();
+      return flushed_ && sequence_numbers_.size() >= count;
+    };
+    mutex_.Await(absl::Condition(&flushed));
+    return sequence_numbers_;
+  }
+
+ private:
+  absl::Notification writing_;
+  absl::Notification released_;
+  absl::Mutex mutex_;
+  std::vector<int> sequence_numbers_ ABSL_GUARDED_BY(mutex_);
+  bool flushed_ ABSL_GUARDED_BY(mutex_) = false;
+};
+
+OutputArtifact LogArtifact(int sequence_number, Log::Severity severity) {
+  OutputArtifact artifact;
+  artifact.set_sequence_number(sequence_number);
+  artifact.mutable_test_step_artifact()->mutable_log()->set_severity(severity);
+  artifact.mutable_test_step_artifact()->mutable_log()->set_message(
+      "0123456789");
+  return artifact;
+}
+
+TEST(BoundedArtifactSinkTest, LowerPrioritiesAreDroppedFirst) {
+  auto sink = std::make_shared<StalledSink>();
+  BoundedArtifactSink bounded(
+      sink, /*max_queued_bytes=*/4 * LogArtifact(1, Log::DEBUG).ByteSizeLong());
+
+  // The first artifact is taken by the stalled write, and four fill the queue.
+  bounded.Write(LogArtifact(0, Log::INFO));
+  sink->AwaitWriting();
+  for (int i = 1; i <= 5; i++) bounded.Write(LogArtifact(i, Log::DEBUG));
+  bounded.Write(LogArtifact(6, Log::WARNING));
+  bounded.Write(LogArtifact(7, Log::WARNING));
+  for (int i = 8; i <= 10; i++) bounded.Write(LogArtifact(i, Log::ERROR));
+  bounded.Write(LogArtifact(11, Log::DEBUG));
+
+  // The debug logs that did not fit were dropped, and so were the oldest
+  // ones to make room for the warnings. The errors were queued regardless.
+  DroppedArtifacts dropped = bounded.dropped();
+  EXPECT_EQ(dropped.low_priority, 4);
+  EXPECT_EQ(dropped.normal_priority, 0);
+  EXPECT_EQ(dropped.high_priority, 0);
+  sink->Release();
+  bounded.Flush();
+  EXPECT_THAT(sink->AwaitFlushed(/*count=*/8),
+              ElementsAre(0, 3, 4, 6, 7, 8, 9, 10));
+}
+
+TEST(BoundedArtifactSinkTest, EverythingIsWrittenWithinTheBudget) {
+  auto sink = std::make_shared<StalledSink>();
+  sink->Release();
+  {
+    BoundedArtifactSink bounded(sink, /*max_queued_bytes=*/1 << 20);
+    for (int i = 0; i < 100; i++) bounded.Write(LogArtifact(i, Log::DEBUG));
+    EXPECT_EQ(bounded.dropped().total(), 0);
+  }
+  std::vector<int> written = sink->AwaitFlushed(/*count=*/100);
+  ASSERT_EQ(written.size(), 100);
+  for (int i = 0; i < 100; i++) EXPECT_EQ(written[i], i);
+}
+
+TEST(BoundedArtifactSinkTest, StuckSinkIsAbandoned) {
+  auto sink = std::make_shared<StalledSink>();
+  auto bounded = std::make_unique<BoundedArtifactSink>(
+      sink, /*max_queued_bytes=*/1 << 20,
+      /*drain_timeout=*/absl::Milliseconds(10));
+  for (int i = 0; i < 3; i++) bounded->Write(LogArtifact(i, Log::INFO));
+  sink->AwaitWriting();
+
+  // The sink is still writing the first artifact, so the rest are dropped,
+  // and so are those written after the sink stopped.
+  bounded->Stop();
+  bounded->Write(LogArtifact(3, Log::ERROR));
+  DroppedArtifacts dropped = bounded->dropped();
+  EXPECT_EQ(dropped.low_priority, 2);
+  EXPECT_EQ(dropped.high_priority, 1);
+  bounded.reset();
+
+  // The abandoned thread finishes the write and exits.
+  sink->Release();
+  EXPECT_THAT(sink->AwaitFlushed(/*count=*/1), ElementsAre(0));
+}
+
+TEST(BoundedArtifactSinkTest, StuckSinksShareADeadline) {
+  auto sink = std::make_shared<StalledSink>();
+  auto other_sink = std::make_shared<StalledSink>();
+  BoundedArtifactSink bounded(sink, /*max_queued_bytes=*/1 << 20,
+                              /*drain_timeout=*/absl::Hours(1));
+  BoundedArtifactSink other(other_sink, /*max_queued_bytes=*/1 << 20,
+                            /*drain_timeout=*/absl::Hours(1));
+  bounded.Write(LogArtifact(0, Log::INFO));
+  other.Write(LogArtifact(0, Log::INFO));
+  sink->AwaitWriting();
+  other_sink->AwaitWriting();
+
+  // Neither waits for its own drain timeout.
+  absl::Time deadline = absl::Now() + absl::Milliseconds(10);
+  bounded.Stop(deadline);
+  other.Stop(deadline);
+  EXPECT_LT(absl::Now(), deadline + absl::Minutes(1));
+  sink->Release();
+  other_sink->Release();
+  EXPECT_THAT(sink->AwaitFlushed(/*count=*/1), ElementsAre(0));
+  EXPECT_THAT(other_sink->AwaitFlushed(/*count=*/1), ElementsAre(0));
+}
+
+TEST(BoundedArtifactSinkTest, ArtifactsHavePriorities) {
+  OutputArtifact artifact;
+  artifact.mutable_schema_version();
+  EXPECT_EQ(GetArtifactPriority(artifact), ArtifactPriority::kHigh);
+  artifact.mutable_test_run_artifact()->mutable_log()->set_severity(
+      Log::WARNING);
+  EXPECT_EQ(GetArtifactPriority(artifact), ArtifactPriority::kNormal);
+  artifact.mutable_test_step_artifact()->mutable_diagnosis();
+  EXPECT_EQ(GetArtifactPriority(artifact), ArtifactPriority::kHigh);
+  artifact.mutable_test_step_artifact()->mutable_measurement();
+  EXPECT_EQ(GetArtifactPriority(artifact), ArtifactPriority::kNormal);
+  artifact.mutable_test_step_artifact()->mutable_measurement_series_element();
+  EXPECT_EQ(GetArtifactPriority(artifact), ArtifactPriority::kLow);
+}
+
+TEST(BoundedArtifactSinkTest, DroppedArtifactsAreDescribed) {
+  EXPECT_EQ(DescribeDroppedArtifacts("The output stream",
+                                     {.low_priority = 3,
+                                      .normal_priority = 2,
+                                      .bytes = 100}),
+            "The output stream fell behind, so 5 of its artifacts (100 "
+            "bytes) were dropped: 3 of low priority, 2 of normal priority "
+            "and 0 of high priority.");
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
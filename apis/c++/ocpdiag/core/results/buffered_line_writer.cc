@@ -0,0 +1,131 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/buffered_line_writer.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <ios>
+#include <iostream>
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+// Returns whether `fd` can take more output without blocking.
+bool IsWritable(int fd) {
+  pollfd poll_fd = {.fd = fd, .events = POLLOUT};
+  return poll(&poll_fd, 1, /*timeout=*/0) == 1 &&
+         (poll_fd.revents & POLLOUT) != 0;
+}
+
+}  // namespace
+
+BufferedLineWriter::BufferedLineWriter(int fd,
+                                       const BufferedLineWriterOptions& options)
+    : fd_(fd), options_(options) {
+  buffer_.reserve(options_.buffer_size);
+}
+
+BufferedLineWriter::~BufferedLineWriter() {
+  if (!buffer_.empty()) WriteLines(buffer_, "", /*may_defer=*/false);
+}
+
+std::streamsize BufferedLineWriter::xsputn(const char* s, std::streamsize n) {
+  absl::string_view data(s, n);
+  size_t line_end = data.rfind('\n');
+  if (buffer_.size() + data.size() < options_.buffer_size ||
+      line_end == absl::string_view::npos) {
+    buffer_.append(s, n);
+    return n;
+  }
+  // The complete lines are written along with the buffer, without copying
+  // them into it first.
+  if (WriteLines(buffer_, data.substr(0, line_end + 1), /*may_defer=*/true)) {
+    buffer_.assign(s + line_end + 1, n - line_end - 1);
+  } else {
+    buffer_.append(s, n);
+  }
+  return n;
+}
+
+BufferedLineWriter::int_type BufferedLineWriter::overflow(int_type c) {
+  if (traits_type::eq_int_type(c, traits_type::eof()))
+    return traits_type::not_eof(c);
+  char ch = traits_type::to_char_type(c);
+  xsputn(&ch, 1);
+  return c;
+}
+
+int BufferedLineWriter::sync() {
+  size_t line_end = buffer_.rfind('\n');
+  if (line_end != std::string::npos &&
+      WriteLines(absl::string_view(buffer_).substr(0, line_end + 1), "",
+                 /*may_defer=*/true)) {
+    buffer_.erase(0, line_end + 1);
+  }
+  return failed_ ? -1 : 0;
+}
+
+bool BufferedLineWriter::WriteLines(absl::string_view first,
+                                    absl::string_view second, bool may_defer) {
+  if (may_defer && !options_.block_when_full && !IsWritable(fd_)) {
+    if (buffer_.size() + second.size() <= options_.max_buffered_bytes)
+      return false;
+    dropped_lines_ += std::count(first.begin(), first.end(), '\n') +
+                      std::count(second.begin(), second.end(), '\n');
+    return true;
+  }
+
+  iovec iov[2] = {
+      {.iov_base = const_cast<char*>(first.data()), .iov_len = first.size()},
+      {.iov_base = const_cast<char*>(second.data()), .iov_len = second.size()},
+  };
+  iovec* next = iov;
+  int count = 2;
+  while (count > 0) {
+    if (next->iov_len == 0) {
+      ++next;
+      --count;
+      continue;
+    }
+    ++write_calls_;
+    ssize_t written = writev(fd_, next, count);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        pollfd poll_fd = {.fd = fd_, .events = POLLOUT};
+        poll(&poll_fd, 1, /*timeout=*/-1);
+        continue;
+      }
+      if (!failed_) {
+        std::cerr << "Failed to write results to file descriptor " << fd_
+                  << ": " << std::strerror(errno) << std::endl;
+      }
+      failed_ = true;
+      return true;
+    }
+    for (; count > 0 && static_cast<size_t>(written) >= next->iov_len;
+         ++next, --count) {
+      written -= next->iov_len;
+    }
+    if (count > 0) {
+      next->iov_base = static_cast<char*>(next->iov_base) + written;
+      next->iov_len -= written;
+    }
+  }
+  return true;
+}
+
+}  // namespace ocpdiag::results::internal
@@ -0,0 +1,89 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_BUFFERED_LINE_WRITER_H_
+#define OCPDIAG_CORE_RESULTS_BUFFERED_LINE_WRITER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <ios>
+#include <ostream>
+#include <streambuf>
+#include <string>
+
+#include "absl/strings/string_view.h"
+
+namespace ocpdiag::results::internal {
+
+struct BufferedLineWriterOptions {
+  // Output is written once this many bytes are buffered.
+  size_t buffer_size = 64 << 10;
+
+  // Whether to wait for a full pipe or socket to take the output. Otherwise,
+  // the output is kept buffered until it can be written, and once more than
+  // `max_buffered_bytes` are buffered, the complete lines are dropped.
+  bool block_when_full = true;
+  size_t max_buffered_bytes = 1 << 20;
+};
+
+// A stream buffer that writes to a file descriptor in whole lines, such that a
+// line-oriented reader of a pipe never sees part of a line, and a syscall
+// writes as many lines as fit the buffer rather than one line. Flushing the
+// stream writes the complete lines buffered so far; the partial line, if any,
+// is written when it is completed or when the buffer is destroyed. Writes are
+// not interleaved with other output to the descriptor, such as std::cout's.
+// This class is not thread-safe.
+class BufferedLineWriter : public std::streambuf {
+ public:
+  // Does not take ownership of `fd`, which must outlive the buffer.
+  explicit BufferedLineWriter(int fd,
+                              const BufferedLineWriterOptions& options = {});
+  ~BufferedLineWriter() override;
+
+  // Returns the number of write syscalls made so far.
+  int64_t write_calls() const { return write_calls_; }
+
+  // Returns the number of lines dropped because the output was full.
+  int64_t dropped_lines() const { return dropped_lines_; }
+
+ protected:
+  std::streamsize xsputn(const char* s, std::streamsize n) override;
+  int_type overflow(int_type c) override;
+  int sync() override;
+
+ private:
+  // Writes `first` and `second`, which end with a complete line, in a single
+  // syscall if possible. Returns false if the output is full and they should
+  // be kept buffered instead, which is only the case with `may_defer` when
+  // not blocking. Once started, a write is always completed, so that no line
+  // is ever cut.
+  bool WriteLines(absl::string_view first, absl::string_view second,
+                  bool may_defer);
+
+  const int fd_;
+  const BufferedLineWriterOptions options_;
+  std::string buffer_;
+  bool failed_ = false;
+  int64_t write_calls_ = 0;
+  int64_t dropped_lines_ = 0;
+};
+
+// An output stream that writes through a BufferedLineWriter of its own.
+class BufferedLineStream : public std::ostream {
+ public:
+  explicit BufferedLineStream(int fd,
+                              const BufferedLineWriterOptions& options = {})
+      : std::ostream(&buffer_), buffer_(fd, options) {}
+
+  BufferedLineWriter& buffer() { return buffer_; }
+
+ private:
+  BufferedLineWriter buffer_;
+};
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_BUFFERED_LINE_WRITER_H_
@@ -0,0 +1,156 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/buffered_line_writer.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <ostream>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/log/check.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/strings/string_view.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+using ::testing::Each;
+using ::testing::EndsWith;
+using ::testing::Gt;
+using ::testing::IsEmpty;
+using ::testing::SizeIs;
+using ::testing::StartsWith;
+
+class BufferedLineWriterTest : public ::testing::Test {
+ protected:
+  BufferedLineWriterTest() { CHECK_EQ(pipe2(fds_, O_NONBLOCK), 0); }
+  ~BufferedLineWriterTest() override {
+    close(fds_[0]);
+    close(fds_[1]);
+  }
+
+  // Returns everything written to the pipe so far.
+  std::string ReadPipe() {
+    std::string data;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fds_[0], buffer, sizeof(buffer))) > 0)
+      data.append(buffer, n);
+    return data;
+  }
+
+  // Fills the pipe up, such that it cannot take another byte.
+  void FillPipe() {
+    std::string block(4096, 'x');
+    while (write(fds_[1], block.data(), block.size()) > 0) {
+    }
+    while (write(fds_[1], "x", 1) > 0) {
+    }
+  }
+
+  int write_fd() const { return fds_[1]; }
+
+ private:
+  int fds_[2];
+};
+
+TEST_F(BufferedLineWriterTest, LinesAreWrittenWhenTheBufferIsFull) {
+  BufferedLineWriter buffer(write_fd(), {.buffer_size = 100});
+  std::ostream stream(&buffer);
+  for (int i = 0; i < 10; i++) stream << "line " << i << '\n';
+  EXPECT_EQ(buffer.write_calls(), 0);
+
+  for (int i = 10; i < 20; i++) stream << "line " << i << '\n';
+  EXPECT_EQ(buffer.write_calls(), 1);
+  std::string written = ReadPipe();
+  EXPECT_THAT(written, StartsWith("line 0\n"));
+  EXPECT_THAT(written, EndsWith("\n"));
+}
+
+TEST_F(BufferedLineWriterTest, StreamWritesThroughItsOwnBuffer) {
+  {
+    BufferedLineStream stream(write_fd());
+    stream << "line 0\nline";
+    stream.flush();
+    EXPECT_EQ(stream.buffer().write_calls(), 1);
+    EXPECT_EQ(ReadPipe(), "line 0\n");
+    stream << " 1";
+  }
+  EXPECT_EQ(ReadPipe(), "line 1");
+}
+
+TEST_F(BufferedLineWriterTest, FlushWritesTheCompleteLines) {
+  BufferedLineWriter buffer(write_fd());
+  std::ostream stream(&buffer);
+  stream << "first\nsecond\nthi";
+  stream.flush();
+  EXPECT_EQ(ReadPipe(), "first\nsecond\n");
+
+  stream << "rd\n";
+  stream.flush();
+  EXPECT_EQ(ReadPipe(), "third\n");
+  EXPECT_EQ(buffer.write_calls(), 2);
+}
+
+TEST_F(BufferedLineWriterTest, LinesLongerThanTheBufferAreNotCut) {
+  std::string line(1000, 'a');
+  {
+    BufferedLineWriter buffer(write_fd(), {.buffer_size = 10});
+    std::ostream stream(&buffer);
+    stream << "short\n" << line << '\n' << "partial";
+    EXPECT_EQ(ReadPipe(), absl::StrCat("short\n", line, "\n"));
+  }
+  EXPECT_EQ(ReadPipe(), "partial");
+}
+
+TEST_F(BufferedLineWriterTest, FullOutputIsKeptBufferedWhenNotBlocking) {
+  FillPipe();
+  BufferedLineWriter buffer(write_fd(),
+                            {.buffer_size = 10, .block_when_full = false});
+  std::ostream stream(&buffer);
+  stream << "first line\n";
+  stream.flush();
+  EXPECT_EQ(buffer.dropped_lines(), 0);
+
+  std::string filler = ReadPipe();
+  EXPECT_THAT(filler, Each('x'));
+  stream << "second line\n";
+  stream.flush();
+  EXPECT_EQ(ReadPipe(), "first line\nsecond line\n");
+}
+
+TEST_F(BufferedLineWriterTest, FullOutputIsDroppedInWholeLines) {
+  FillPipe();
+  BufferedLineWriter buffer(write_fd(), {.buffer_size = 10,
+                                         .block_when_full = false,
+                                         .max_buffered_bytes = 20});
+  std::ostream stream(&buffer);
+  for (int i = 0; i < 10; i++) stream << "line " << i << '\n';
+  stream << "partial";
+  stream.flush();
+  EXPECT_THAT(buffer.dropped_lines(), Gt(0));
+
+  ReadPipe();
+  stream << " line\n";
+  stream.flush();
+  std::string written = ReadPipe();
+  ASSERT_THAT(written, EndsWith("partial line\n"));
+  for (absl::string_view line :
+       absl::StrSplit(written, '\n', absl::SkipEmpty())) {
+    EXPECT_THAT(line, SizeIs(Gt(5)));
+  }
+  EXPECT_THAT(ReadPipe(), IsEmpty());
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
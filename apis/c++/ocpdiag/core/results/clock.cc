@@ -0,0 +1,121 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/clock.h"
+
+#include <time.h>
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define OCPDIAG_HAS_TSC 1
+#endif
+
+#include "google/protobuf/timestamp.pb.h"
+#include "absl/log/check.h"
+#include "absl/log/log.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+absl::Time ReadClock(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return absl::TimeFromTimespec(ts);
+}
+
+uint64_t ReadTicks() {
+#ifdef OCPDIAG_HAS_TSC
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+}  // namespace
+
+absl::Time RealtimeClock::Now() { return ReadClock(CLOCK_REALTIME); }
+
+absl::Time CoarseRealtimeClock::Now() {
+  return ReadClock(CLOCK_REALTIME_COARSE);
+}
+
+TscClock::TscClock(absl::Duration calibration_period) {
+#ifdef OCPDIAG_HAS_TSC
+  absl::Time start_time = ReadClock(CLOCK_REALTIME);
+  uint64_t start_ticks = ReadTicks();
+  absl::SleepFor(calibration_period);
+  base_time_ = ReadClock(CLOCK_REALTIME);
+  base_ticks_ = ReadTicks();
+  ticks_per_ns_ = static_cast<double>(base_ticks_ - start_ticks) /
+                  absl::ToDoubleNanoseconds(base_time_ - start_time);
+  CHECK(ticks_per_ns_ > 0) << "Failed to calibrate the timestamp counter";
+#endif
+}
+
+absl::Time TscClock::Now() {
+#ifdef OCPDIAG_HAS_TSC
+  return base_time_ + absl::Nanoseconds(static_cast<int64_t>(
+                          (ReadTicks() - base_ticks_) / ticks_per_ns_));
+#else
+  return ReadClock(CLOCK_REALTIME);
+#endif
+}
+
+absl::Time FakeClock::Now() {
+  absl::MutexLock lock(&mutex_);
+  absl::Time now = now_;
+  now_ += auto_advance_;
+  return now;
+}
+
+void FakeClock::SetTime(absl::Time time) {
+  absl::MutexLock lock(&mutex_);
+  now_ = time;
+}
+
+void FakeClock::Advance(absl::Duration duration) {
+  absl::MutexLock lock(&mutex_);
+  now_ += duration;
+}
+
+Clock& GetClockByName(absl::string_view name) {
+  if (name == "realtime") {
+    static auto* clock = new RealtimeClock();
+    return *clock;
+  }
+  if (name == "coarse") {
+    static auto* clock = new CoarseRealtimeClock();
+    return *clock;
+  }
+  if (name == "tsc") {
+    static auto* clock = new TscClock();
+    return *clock;
+  }
+  LOG(FATAL) << "Unknown results clock \"" << name
+             << "\", must be one of \"realtime\", \"coarse\" or \"tsc\"";
+}
+
+namespace internal {
+
+google::protobuf::Timestamp TimeToTimestamp(absl::Time time) {
+  google::protobuf::Timestamp timestamp;
+  int64_t seconds = absl::ToUnixSeconds(time);
+  timestamp.set_seconds(seconds);
+  timestamp.set_nanos(
+      absl::ToInt64Nanoseconds(time - absl::FromUnixSeconds(seconds)));
+  return timestamp;
+}
+
+}  // namespace internal
+
+}  // namespace ocpdiag::results
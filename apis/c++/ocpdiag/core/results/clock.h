@@ -0,0 +1,98 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_CLOCK_H_
+#define OCPDIAG_CORE_RESULTS_CLOCK_H_
+
+#include <cstdint>
+#include <string>
+
+#include "google/protobuf/timestamp.pb.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::results {
+
+// Source of the timestamps attached to result artifacts. Implementations must
+// be thread-safe.
+class Clock {
+ public:
+  virtual ~Clock() = default;
+  virtual absl::Time Now() = 0;
+};
+
+// Reads CLOCK_REALTIME. This is the default clock.
+class RealtimeClock : public Clock {
+ public:
+  absl::Time Now() override;
+};
+
+// Reads CLOCK_REALTIME_COARSE, which is served from the vDSO without touching
+// the clocksource. It is several times cheaper than CLOCK_REALTIME but only
+// advances once per scheduler tick (typically 1-4 ms), so consecutive
+// artifacts often share a timestamp.
+class CoarseRealtimeClock : public Clock {
+ public:
+  absl::Time Now() override;
+};
+
+// Derives the time from the CPU timestamp counter, calibrated against
+// CLOCK_REALTIME when the clock is created. Reading the counter avoids the
+// clock_gettime call entirely, at the cost of drifting from the wall clock
+// over long runs and of requiring an invariant TSC. On architectures without
+// a TSC it behaves like RealtimeClock.
+class TscClock : public Clock {
+ public:
+  // Calibrates the counter frequency over `calibration_period`.
+  explicit TscClock(absl::Duration calibration_period = absl::Milliseconds(10));
+
+  absl::Time Now() override;
+
+  // Returns the measured number of counter ticks per nanosecond.
+  double ticks_per_ns() const { return ticks_per_ns_; }
+
+ private:
+  absl::Time base_time_;
+  uint64_t base_ticks_ = 0;
+  double ticks_per_ns_ = 0;
+};
+
+// Deterministic clock for tests and benchmarks. Time only moves when Advance()
+// or SetTime() is called, or by `auto_advance` after each call to Now(), which
+// keeps timestamps strictly increasing without depending on the wall clock.
+class FakeClock : public Clock {
+ public:
+  explicit FakeClock(absl::Time start = absl::UnixEpoch(),
+                     absl::Duration auto_advance = absl::ZeroDuration())
+      : now_(start), auto_advance_(auto_advance) {}
+
+  absl::Time Now() override ABSL_LOCKS_EXCLUDED(mutex_);
+  void SetTime(absl::Time time) ABSL_LOCKS_EXCLUDED(mutex_);
+  void Advance(absl::Duration duration) ABSL_LOCKS_EXCLUDED(mutex_);
+
+ private:
+  absl::Mutex mutex_;
+  absl::Time now_ ABSL_GUARDED_BY(mutex_);
+  const absl::Duration auto_advance_;
+};
+
+// Returns a process-wide clock by name: "realtime", "coarse" or "tsc". The
+// TSC clock is calibrated on first use. Dies on an unknown name.
+Clock& GetClockByName(absl::string_view name);
+
+namespace internal {
+
+// Converts an absl::Time to a protobuf Timestamp without going through a
+// timeval, which would drop sub-microsecond precision.
+google::protobuf::Timestamp TimeToTimestamp(absl::Time time);
+
+}  // namespace internal
+
+}  // namespace ocpdiag::results
+
+#endif  // OCPDIAG_CORE_RESULTS_CLOCK_H_
@@ -0,0 +1,89 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/clock.h"
+
+#include "google/protobuf/timestamp.pb.h"
+#include "gtest/gtest.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+// Real clocks are compared against absl::Now() with a generous tolerance, as
+// the coarse clock lags by up to a scheduler tick.
+constexpr absl::Duration kTolerance = absl::Milliseconds(100);
+
+void ExpectCloseToNow(Clock& clock) {
+  EXPECT_LT(absl::AbsDuration(clock.Now() - absl::Now()), kTolerance);
+}
+
+TEST(ClockTest, RealtimeClockTracksWallTime) {
+  RealtimeClock clock;
+  ExpectCloseToNow(clock);
+}
+
+TEST(ClockTest, CoarseRealtimeClockTracksWallTime) {
+  CoarseRealtimeClock clock;
+  ExpectCloseToNow(clock);
+}
+
+TEST(ClockTest, TscClockTracksWallTime) {
+  TscClock clock(absl::Milliseconds(5));
+  ExpectCloseToNow(clock);
+  absl::Time before = clock.Now();
+  absl::SleepFor(absl::Milliseconds(10));
+  EXPECT_GE(clock.Now() - before, absl::Milliseconds(9));
+}
+
+TEST(ClockTest, FakeClockOnlyMovesWhenAdvanced) {
+  FakeClock clock(absl::FromUnixSeconds(10));
+  EXPECT_EQ(clock.Now(), absl::FromUnixSeconds(10));
+  EXPECT_EQ(clock.Now(), absl::FromUnixSeconds(10));
+  clock.Advance(absl::Seconds(5));
+  EXPECT_EQ(clock.Now(), absl::FromUnixSeconds(15));
+  clock.SetTime(absl::FromUnixSeconds(3));
+  EXPECT_EQ(clock.Now(), absl::FromUnixSeconds(3));
+}
+
+TEST(ClockTest, FakeClockAutoAdvances) {
+  FakeClock clock(absl::UnixEpoch(), absl::Milliseconds(1));
+  EXPECT_EQ(clock.Now(), absl::UnixEpoch());
+  EXPECT_EQ(clock.Now(), absl::FromUnixMillis(1));
+  EXPECT_EQ(clock.Now(), absl::FromUnixMillis(2));
+}
+
+TEST(ClockTest, ClocksAreReturnedByName) {
+  EXPECT_NE(dynamic_cast<RealtimeClock*>(&GetClockByName("realtime")),
+            nullptr);
+  EXPECT_NE(dynamic_cast<CoarseRealtimeClock*>(&GetClockByName("coarse")),
+            nullptr);
+  EXPECT_EQ(&GetClockByName("coarse"), &GetClockByName("coarse"));
+}
+
+TEST(ClockDeathTest, UnknownClockNameCausesDeath) {
+  EXPECT_DEATH(GetClockByName("sundial"), "Unknown results clock");
+}
+
+TEST(TimeToTimestampTest, KeepsNanosecondPrecision) {
+  google::protobuf::Timestamp timestamp =
+      internal::TimeToTimestamp(absl::FromUnixNanos(12'000'000'345));
+  EXPECT_EQ(timestamp.seconds(), 12);
+  EXPECT_EQ(timestamp.nanos(), 345);
+}
+
+TEST(TimeToTimestampTest, NanosAreNonNegativeBeforeEpoch) {
+  google::protobuf::Timestamp timestamp =
+      internal::TimeToTimestamp(absl::FromUnixMillis(-1500));
+  EXPECT_EQ(timestamp.seconds(), -2);
+  EXPECT_EQ(timestamp.nanos(), 500'000'000);
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results
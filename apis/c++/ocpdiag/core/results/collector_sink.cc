@@ -0,0 +1,106 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/collector_sink.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+absl::StatusOr<int> ConnectToCollector(absl::string_view path, char kind) {
+  sockaddr_un address = {.sun_family = AF_UNIX};
+  if (path.size() >= sizeof(address.sun_path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Socket path is too long: ", path));
+  }
+  std::memcpy(address.sun_path, path.data(), path.size());
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    return absl::InternalError(
+        absl::StrCat("Cannot create a socket: ", std::strerror(errno)));
+  }
+  if (connect(fd, reinterpret_cast<const sockaddr*>(&address),
+              sizeof(address)) != 0 ||
+      send(fd, &kind, 1, MSG_NOSIGNAL) != 1) {
+    absl::Status status = absl::InternalError(absl::StrCat(
+        "Cannot connect to the results collector at ", path, ": ",
+        std::strerror(errno)));
+    close(fd);
+    return status;
+  }
+  return fd;
+}
+
+absl::StatusOr<std::unique_ptr<CollectorSink>> CollectorSink::Connect(
+    absl::string_view socket_path, size_t buffer_size) {
+  absl::StatusOr<int> fd =
+      ConnectToCollector(socket_path, kCollectorArtifactStream);
+  if (!fd.ok()) return fd.status();
+  return std::unique_ptr<CollectorSink>(new CollectorSink(*fd, buffer_size));
+}
+
+CollectorSink::CollectorSink(int fd, size_t buffer_size)
+    : fd_(fd), buffer_size_(buffer_size) {
+  buffer_.reserve(buffer_size);
+}
+
+CollectorSink::~CollectorSink() {
+  Flush();
+  if (fd_ >= 0) close(fd_);
+}
+
+void CollectorSink::Write(
+    const ocpdiag_results_v2_pb::OutputArtifact& artifact) {
+  size_t size = artifact.ByteSizeLong();
+  if (fd_ < 0 || size > kMaxCollectedArtifactSize) {
+    ++dropped_artifacts_;
+    return;
+  }
+  uint32_t size32 = size;
+  size_t offset = buffer_.size();
+  buffer_.resize(offset + sizeof(size32) + size);
+  std::memcpy(&buffer_[offset], &size32, sizeof(size32));
+  artifact.SerializeWithCachedSizesToArray(
+      reinterpret_cast<uint8_t*>(&buffer_[offset + sizeof(size32)]));
+  ++buffered_artifacts_;
+  if (buffer_.size() >= buffer_size_) Flush();
+}
+
+void CollectorSink::Flush() {
+  size_t sent = 0;
+  while (fd_ >= 0 && sent < buffer_.size()) {
+    ssize_t n = send(fd_, buffer_.data() + sent, buffer_.size() - sent,
+                     MSG_NOSIGNAL);
+    if (n > 0) {
+      sent += n;
+    } else if (errno != EINTR) {
+      std::cerr << "Lost the connection to the results collector: "
+                << std::strerror(errno) << std::endl;
+      close(fd_);
+      fd_ = -1;
+      dropped_artifacts_ += buffered_artifacts_;
+    }
+  }
+  buffer_.clear();
+  buffered_artifacts_ = 0;
+}
+
+}  // namespace ocpdiag::results::internal
@@ -0,0 +1,66 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_COLLECTOR_SINK_H_
+#define OCPDIAG_CORE_RESULTS_COLLECTOR_SINK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/artifact_sink.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+// A connection to the results collector starts with one of these bytes. An
+// artifact stream is followed by the artifacts, each serialized after its
+// 32-bit size in host byte order. A query is answered with the state of the
+// collector's runs, after which the collector closes the connection.
+inline constexpr char kCollectorArtifactStream = 'A';
+inline constexpr char kCollectorQuery = 'Q';
+
+// The largest artifact that the collector accepts.
+inline constexpr uint32_t kMaxCollectedArtifactSize = 64 << 20;
+
+// Connects to the UNIX socket at `path` and sends `kind`.
+absl::StatusOr<int> ConnectToCollector(absl::string_view path, char kind);
+
+// Streams the artifacts to a results collector over a UNIX socket. They are
+// sent once `buffer_size` bytes of them are buffered and whenever the
+// ArtifactWriter is flushed. Sends block while the collector falls behind.
+class CollectorSink : public ArtifactSink {
+ public:
+  static constexpr size_t kDefaultBufferSize = 64 << 10;
+
+  static absl::StatusOr<std::unique_ptr<CollectorSink>> Connect(
+      absl::string_view socket_path, size_t buffer_size = kDefaultBufferSize);
+  ~CollectorSink() override;
+
+  void Write(const ocpdiag_results_v2_pb::OutputArtifact& artifact) override;
+  void Flush() override;
+
+  // Returns the number of artifacts that could not be sent because the
+  // collector went away.
+  int64_t dropped_artifacts() const { return dropped_artifacts_; }
+
+ private:
+  CollectorSink(int fd, size_t buffer_size);
+
+  int fd_;
+  const size_t buffer_size_;
+  std::string buffer_;
+  int64_t buffered_artifacts_ = 0;
+  int64_t dropped_artifacts_ = 0;
+};
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_COLLECTOR_SINK_H_
@@ -0,0 +1,77 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/compiled_validators.h"
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "absl/hash/hash.h"
+#include "absl/log/check.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "ocpdiag/core/results/proto_converters.h"
+#include "ocpdiag/core/results/struct_validators.h"
+#include "ocpdiag/core/results/structs.h"
+#include "ocpdiag/core/results/variant.h"
+
+namespace ocpdiag::results {
+
+CompiledValidatorSet::CompiledValidatorSet(
+    const std::vector<Validator>& validators)
+    : validators_(validators) {
+  protos_.Reserve(validators.size());
+  for (const Validator& validator : validators) {
+    ValidateStructOrDie(validator);
+    // Checked regardless of --ocpdiag_struct_validation, as the type of the
+    // validators is needed to check the values.
+    CHECK(!validator.value.empty())
+        << "At least one value must be specified for validator: "
+        << (validator.name.empty() ? "Unnamed Validator" : validator.name);
+    VariantKind kind = KindOf(validator.value[0]);
+    if (!kind_.has_value()) kind_ = kind;
+    CHECK(*kind_ == kind)
+        << "All validators must be the same type: "
+        << (validator.name.empty() ? "Unnamed Validator" : validator.name);
+    *protos_.Add() = internal::StructToProto(validator);
+  }
+}
+
+void CompiledValidatorSet::CheckValueTypeOrDie(
+    const Variant& value, absl::string_view measurement_name) const {
+  CHECK(!kind_.has_value() || *kind_ == KindOf(value))
+      << "All validators and the value must be the same type for "
+         "measurement: "
+      << measurement_name;
+}
+
+namespace internal {
+
+size_t ValidatorCache::Hash::operator()(
+    const std::vector<Validator>& validators) const {
+  size_t hash = validators.size();
+  for (const Validator& validator : validators)
+    hash = absl::HashOf(hash, validator.type, validator.name, validator.value);
+  return hash;
+}
+
+std::shared_ptr<const CompiledValidatorSet> ValidatorCache::Compile(
+    const std::vector<Validator>& validators) {
+  {
+    absl::ReaderMutexLock lock(&mutex_);
+    auto it = cache_.find(validators);
+    if (it != cache_.end()) return it->second;
+  }
+  auto compiled = std::make_shared<const CompiledValidatorSet>(validators);
+  absl::MutexLock lock(&mutex_);
+  if (cache_.size() < kMaxEntries) cache_.try_emplace(validators, compiled);
+  return compiled;
+}
+
+}  // namespace internal
+
+}  // namespace ocpdiag::results
@@ -0,0 +1,82 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_COMPILED_VALIDATORS_H_
+#define OCPDIAG_CORE_RESULTS_COMPILED_VALIDATORS_H_
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "google/protobuf/repeated_ptr_field.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/structs.h"
+#include "ocpdiag/core/results/variant.h"
+
+namespace ocpdiag::results {
+
+// A list of validators that is validated and converted to its proto form once,
+// to be attached to any number of measurements. It is immutable and can be
+// shared between threads.
+class CompiledValidatorSet {
+ public:
+  explicit CompiledValidatorSet(const std::vector<Validator>& validators);
+
+  const std::vector<Validator>& validators() const { return validators_; }
+  // Checks that `value` has the kind of value of the validators, if any.
+  // Checks that `value` has the type of the validators, if any.
+  void CheckValueTypeOrDie(const Variant& value,
+                           absl::string_view measurement_name) const;
+
+  // Returns the proto form of the validators. This is intended for internal use
+  // only.
+  const google::protobuf::RepeatedPtrField<ocpdiag_results_v2_pb::Validator>&
+  protos() const {
+    return protos_;
+  }
+
+ private:
+  std::vector<Validator> validators_;
+  // The kind of value of the validators, if any.
+  std::optional<VariantKind> kind_;
+  google::protobuf::RepeatedPtrField<ocpdiag_results_v2_pb::Validator> protos_;
+};
+
+namespace internal {
+
+// Compiles the validators of measurements added by value, returning the same
+// CompiledValidatorSet for equal lists of validators so that they are only
+// validated and converted the first time. This class is thread-safe.
+class ValidatorCache {
+ public:
+  // Lists beyond this many distinct ones are compiled without being cached, so
+  // that measurements with ever-changing limits do not grow the cache.
+  static constexpr size_t kMaxEntries = 1024;
+
+  std::shared_ptr<const CompiledValidatorSet> Compile(
+      const std::vector<Validator>& validators);
+
+ private:
+  struct Hash {
+    size_t operator()(const std::vector<Validator>& validators) const;
+  };
+
+  absl::Mutex mutex_;
+  absl::flat_hash_map<std::vector<Validator>,
+                      std::shared_ptr<const CompiledValidatorSet>, Hash>
+      cache_ ABSL_GUARDED_BY(mutex_);
+};
+
+}  // namespace internal
+
+}  // namespace ocpdiag::results
+
+#endif  // OCPDIAG_CORE_RESULTS_COMPILED_VALIDATORS_H_
@@ -0,0 +1,119 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/compiled_validators.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/structs.h"
+#include "ocpdiag/core/testing/proto_matchers.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+using ::ocpdiag::testing::EqualsProto;
+
+std::vector<Validator> GetExampleValidators() {
+  return {{
+              .type = ValidatorType::kLessThanOrEqual,
+              .value = {11000.0},
+              .name = "80mm_fan_upper_limit",
+          },
+          {
+              .type = ValidatorType::kInSet,
+              .value = {8000.0, 9000.0},
+          }};
+}
+
+TEST(CompiledValidatorSetTest, ConvertsValidators) {
+  CompiledValidatorSet validators(GetExampleValidators());
+  EXPECT_EQ(validators.validators(), GetExampleValidators());
+  ASSERT_EQ(validators.protos().size(), 2);
+  EXPECT_THAT(validators.protos()[0], EqualsProto(R"pb(
+                name: "80mm_fan_upper_limit"
+                type: LESS_THAN_OR_EQUAL
+                value { number_value: 11000 }
+              )pb"));
+  EXPECT_THAT(validators.protos()[1], EqualsProto(R"pb(
+                type: IN_SET
+                value {
+                  list_value {
+                    values { number_value: 8000 }
+                    values { number_value: 9000 }
+                  }
+                }
+              )pb"));
+}
+
+TEST(CompiledValidatorSetTest, AcceptsValuesOfTheValidatorType) {
+  CompiledValidatorSet validators(GetExampleValidators());
+  validators.CheckValueTypeOrDie(1., "fan");
+  // Integers are numbers like the doubles of the validators.
+  validators.CheckValueTypeOrDie(int64_t{-1}, "fan");
+  validators.CheckValueTypeOrDie(uint64_t{1} << 63, "fan");
+  CompiledValidatorSet({}).CheckValueTypeOrDie("any", "fan");
+}
+
+TEST(CompiledValidatorSetTest, IntegerAndDoubleValidatorsMix) {
+  CompiledValidatorSet validators(
+      {{.type = ValidatorType::kLessThan, .value = {uint64_t{100}}},
+       {.type = ValidatorType::kGreaterThan, .value = {int64_t{-1}}},
+       {.type = ValidatorType::kNotEqual, .value = {0.5}}});
+  validators.CheckValueTypeOrDie(7., "fan");
+  validators.CheckValueTypeOrDie(7, "fan");
+}
+
+TEST(CompiledValidatorSetDeathTest, InvalidValidatorCausesDeath) {
+  EXPECT_DEATH(CompiledValidatorSet({{.type = ValidatorType::kEqual}}),
+               "At least one value");
+}
+
+TEST(CompiledValidatorSetDeathTest, MixedValidatorTypesCauseDeath) {
+  std::vector<Validator> validators = GetExampleValidators();
+  validators.push_back({.type = ValidatorType::kEqual, .value = {"x"}});
+  EXPECT_DEATH(CompiledValidatorSet{validators}, "must be the same type");
+}
+
+TEST(CompiledValidatorSetDeathTest, ValueOfTheWrongTypeCausesDeath) {
+  CompiledValidatorSet validators(GetExampleValidators());
+  EXPECT_DEATH(validators.CheckValueTypeOrDie(true, "fan"),
+               "must be the same type for measurement: fan");
+}
+
+TEST(ValidatorCacheTest, ReturnsTheSameSetForEqualValidators) {
+  internal::ValidatorCache cache;
+  std::shared_ptr<const CompiledValidatorSet> first =
+      cache.Compile(GetExampleValidators());
+  EXPECT_EQ(cache.Compile(GetExampleValidators()), first);
+
+  std::vector<Validator> other = GetExampleValidators();
+  other[0].value = {12000.0};
+  std::shared_ptr<const CompiledValidatorSet> second = cache.Compile(other);
+  EXPECT_NE(second, first);
+  EXPECT_EQ(second->validators(), other);
+}
+
+TEST(ValidatorCacheTest, CompilesWithoutCachingWhenFull) {
+  internal::ValidatorCache cache;
+  for (int i = 0; i < internal::ValidatorCache::kMaxEntries; ++i) {
+    cache.Compile({{.type = ValidatorType::kEqual, .value = {1. * i}}});
+  }
+  std::vector<Validator> validators = GetExampleValidators();
+  std::shared_ptr<const CompiledValidatorSet> compiled =
+      cache.Compile(validators);
+  EXPECT_EQ(compiled->validators(), validators);
+  EXPECT_NE(cache.Compile(validators), compiled);
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results
@@ -0,0 +1,235 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/crash_journal.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <string>
+
+#include "absl/base/call_once.h"
+#include "absl/cleanup/cleanup.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+// The journal file starts with this header, followed by a fixed size slot for
+// the terminal record and then by the records, each prefixed with its size.
+// The sizes are published after the bytes they cover are written, so that a
+// record cut short by the death of the process is not read back.
+struct CrashJournal::Header {
+  char magic[8];
+  uint64_t capacity;
+  std::atomic<uint64_t> size;
+  std::atomic<int64_t> termination_time_ns;
+  std::atomic<int32_t> signal;
+  std::atomic<uint32_t> terminal_size;
+};
+
+namespace {
+
+constexpr char kMagic[8] = {'O', 'C', 'P', 'J', 'R', 'N', 'L', '1'};
+constexpr size_t kTerminalSlotSize = 64;
+constexpr size_t kRecordSizeBytes = sizeof(uint32_t);
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                  std::atomic<int64_t>::is_always_lock_free &&
+                  std::atomic<int32_t>::is_always_lock_free &&
+                  std::atomic<uint32_t>::is_always_lock_free,
+              "Signal handlers and other processes need lock-free atomics");
+
+constexpr int kHandledSignals[] = {SIGSEGV, SIGBUS, SIGABRT, SIGTERM};
+
+std::atomic<CrashJournal*> active_journal{nullptr};
+struct sigaction previous_actions[std::size(kHandledSignals)];
+absl::once_flag install_handlers_once;
+
+void HandleSignal(int signal) {
+  CrashJournal* journal = active_journal.load(std::memory_order_acquire);
+  if (journal != nullptr) journal->WriteTerminalRecord(signal);
+  for (size_t i = 0; i < std::size(kHandledSignals); ++i) {
+    if (kHandledSignals[i] == signal)
+      sigaction(signal, &previous_actions[i], nullptr);
+  }
+  raise(signal);
+}
+
+void InstallHandlers() {
+  struct sigaction action = {};
+  action.sa_handler = HandleSignal;
+  sigemptyset(&action.sa_mask);
+  // Runs on the alternate signal stack, if any, to handle stack overflows.
+  action.sa_flags = SA_ONSTACK;
+  for (size_t i = 0; i < std::size(kHandledSignals); ++i) {
+    int signal = kHandledSignals[i];
+    CHECK(sigaction(signal, nullptr, &previous_actions[i]) == 0)
+        << "Cannot read the handler of signal " << signal;
+    // A SIGTERM that the process was started with ignored, e.g. by nohup, is
+    // left ignored rather than made to terminate the process.
+    if (signal == SIGTERM && !(previous_actions[i].sa_flags & SA_SIGINFO) &&
+        previous_actions[i].sa_handler == SIG_IGN) {
+      continue;
+    }
+    CHECK(sigaction(signal, &action, nullptr) == 0)
+        << "Cannot install the handler of signal " << signal;
+  }
+}
+
+}  // namespace
+
+CrashJournal::CrashJournal(absl::string_view path, size_t capacity)
+    : path_(path), capacity_(capacity) {
+  ocpdiag_results_v2_pb::OutputArtifact terminal;
+  ocpdiag_results_v2_pb::TestRunEnd* end =
+      terminal.mutable_test_run_artifact()->mutable_test_run_end();
+  end->set_status(ocpdiag_results_v2_pb::TestRunEnd::ERROR);
+  end->set_result(ocpdiag_results_v2_pb::TestRunEnd::NOT_APPLICABLE);
+  terminal.SerializeToString(&terminal_record_);
+  CHECK(terminal_record_.size() <= kTerminalSlotSize);
+  constexpr size_t kRecordsOffset = sizeof(Header) + kTerminalSlotSize;
+
+  int fd = open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  CHECK(fd >= 0) << "Cannot create crash journal " << path_ << ": "
+                 << std::strerror(errno);
+  mapping_size_ = kRecordsOffset + capacity_;
+  // Allocate the blocks of the file up front, so that writing to the mapping
+  // cannot fail for lack of space, unless the file system does not support it.
+  if (posix_fallocate(fd, 0, mapping_size_) != 0) {
+    CHECK(ftruncate(fd, mapping_size_) == 0)
+        << "Cannot size crash journal " << path_ << ": "
+        << std::strerror(errno);
+  }
+  void* mapping = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+  close(fd);
+  CHECK(mapping != MAP_FAILED) << "Cannot map crash journal " << path_ << ": "
+                               << std::strerror(errno);
+
+  char* base = static_cast<char*>(mapping);
+  header_ = new (base) Header();
+  std::memcpy(header_->magic, kMagic, sizeof(kMagic));
+  header_->capacity = capacity_;
+  terminal_slot_ = base + sizeof(Header);
+  records_ = base + kRecordsOffset;
+}
+
+CrashJournal::~CrashJournal() {
+  CrashJournal* self = this;
+  active_journal.compare_exchange_strong(self, nullptr);
+  munmap(header_, mapping_size_);
+  unlink(path_.c_str());
+}
+
+bool CrashJournal::Append(absl::string_view record) {
+  uint64_t size = header_->size.load(std::memory_order_relaxed);
+  if (kRecordSizeBytes + record.size() > capacity_ - size) return false;
+  uint32_t record_size = record.size();
+  std::memcpy(records_ + size, &record_size, kRecordSizeBytes);
+  std::memcpy(records_ + size + kRecordSizeBytes, record.data(), record.size());
+  header_->size.store(size + kRecordSizeBytes + record.size(),
+                      std::memory_order_release);
+  return true;
+}
+
+void CrashJournal::Reset() {
+  header_->size.store(0, std::memory_order_release);
+}
+
+void CrashJournal::Activate() {
+  absl::call_once(install_handlers_once, InstallHandlers);
+  active_journal.store(this, std::memory_order_release);
+}
+
+void CrashJournal::WriteTerminalRecord(int signal) {
+  int32_t no_signal = 0;
+  if (!header_->signal.compare_exchange_strong(no_signal, signal)) return;
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  header_->termination_time_ns.store(
+      int64_t{now.tv_sec} * 1'000'000'000 + now.tv_nsec,
+      std::memory_order_relaxed);
+  std::memcpy(terminal_slot_, terminal_record_.data(), terminal_record_.size());
+  header_->terminal_size.store(terminal_record_.size(),
+                               std::memory_order_release);
+}
+
+absl::StatusOr<CrashJournalContents> CrashJournal::Read(
+    absl::string_view path) {
+  constexpr size_t kRecordsOffset = sizeof(Header) + kTerminalSlotSize;
+  std::string path_string(path);
+  int fd = open(path_string.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return absl::NotFoundError(
+        absl::StrCat("Cannot open ", path, ": ", std::strerror(errno)));
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 ||
+      static_cast<size_t>(file_stat.st_size) < kRecordsOffset) {
+    close(fd);
+    return absl::DataLossError(absl::StrCat(path, " is not a crash journal"));
+  }
+  size_t file_size = file_stat.st_size;
+  void* mapping = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    return absl::UnavailableError(
+        absl::StrCat("Cannot map ", path, ": ", std::strerror(errno)));
+  }
+  absl::Cleanup unmap = [mapping, file_size] { munmap(mapping, file_size); };
+
+  const char* base = static_cast<const char*>(mapping);
+  const Header* header = reinterpret_cast<const Header*>(base);
+  uint64_t size = header->size.load(std::memory_order_acquire);
+  if (std::memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 ||
+      header->capacity > file_size - kRecordsOffset ||
+      size > header->capacity) {
+    return absl::DataLossError(absl::StrCat(path, " is not a crash journal"));
+  }
+
+  CrashJournalContents contents;
+  const char* records = base + kRecordsOffset;
+  for (uint64_t pos = 0; pos < size;) {
+    uint32_t record_size;
+    if (size - pos < kRecordSizeBytes) break;
+    std::memcpy(&record_size, records + pos, kRecordSizeBytes);
+    pos += kRecordSizeBytes;
+    if (size - pos < record_size) {
+      return absl::DataLossError(
+          absl::StrCat(path, " has a truncated record at offset ", pos));
+    }
+    contents.records.emplace_back(records + pos, record_size);
+    pos += record_size;
+  }
+
+  uint32_t terminal_size =
+      header->terminal_size.load(std::memory_order_acquire);
+  if (terminal_size > 0 && terminal_size <= kTerminalSlotSize) {
+    contents.terminal_record.emplace(base + sizeof(Header), terminal_size);
+    contents.signal = header->signal.load(std::memory_order_relaxed);
+    contents.termination_time = absl::FromUnixNanos(
+        header->termination_time_ns.load(std::memory_order_relaxed));
+  }
+  return contents;
+}
+
+}  // namespace ocpdiag::results::internal
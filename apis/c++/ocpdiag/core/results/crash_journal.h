@@ -0,0 +1,98 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_CRASH_JOURNAL_H_
+#define OCPDIAG_CORE_RESULTS_CRASH_JOURNAL_H_
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::results::internal {
+
+// The contents of a crash journal file, see CrashJournal::Read.
+struct CrashJournalContents {
+  // The serialized artifacts, in the order they were written.
+  std::vector<std::string> records;
+  // The serialized terminal TestRunEnd artifact, and the signal and time at
+  // which the process was terminated, if the process was terminated by one of
+  // the handled signals.
+  std::optional<std::string> terminal_record;
+  int signal = 0;
+  absl::Time termination_time = absl::InfinitePast();
+};
+
+// A file holding the serialized OutputArtifacts written to a binary results
+// file since it was last flushed. The file is mapped with MAP_SHARED, so its
+// contents outlive the process, even when it is killed with SIGKILL, and the
+// artifacts held back in the results file writer's buffers can be recovered
+// with RecoverResults.
+//
+// Once activated, the journal also receives a terminal TestRunEnd artifact with
+// the error status from the handlers of the signals that crash or terminate
+// the process. Except for those handlers, a journal must be accessed by one
+// thread at a time.
+class CrashJournal {
+ public:
+  // The journal of a results file is the results file path with this suffix.
+  static constexpr absl::string_view kFileSuffix = ".journal";
+  static constexpr size_t kDefaultCapacity = 16 << 20;
+
+  // Creates the journal file at `path`, replacing any existing one, with room
+  // for `capacity` bytes of records. Fails with a fatal CHECK error if the file
+  // cannot be created and mapped.
+  explicit CrashJournal(absl::string_view path,
+                        size_t capacity = kDefaultCapacity);
+  CrashJournal(const CrashJournal&) = delete;
+  CrashJournal& operator=(const CrashJournal&) = delete;
+  // Deactivates the journal and removes its file, as its records are expected
+  // to have been written to the results file by then.
+  ~CrashJournal();
+
+  // Appends a serialized artifact. Returns false, without appending it, if the
+  // journal is full, in which case the results file must be flushed and the
+  // journal reset.
+  bool Append(absl::string_view record);
+
+  // Discards the records, once they have been flushed to the results file.
+  void Reset();
+
+  // Makes this the journal written to by the handlers of SIGSEGV, SIGBUS,
+  // SIGABRT and SIGTERM, which are installed on first use. The handlers write
+  // the terminal record and then run the handlers installed before them, or
+  // the default action. SIGTERM is left alone if it is ignored by then.
+  void Activate();
+
+  // Writes the terminal TestRunEnd record once, noting the signal that
+  // terminated the process. This is async-signal-safe.
+  void WriteTerminalRecord(int signal);
+
+  // Reads the journal file at `path`, typically left behind by a process that
+  // died.
+  static absl::StatusOr<CrashJournalContents> Read(absl::string_view path);
+
+ private:
+  struct Header;
+
+  std::string path_;
+  size_t capacity_;
+  size_t mapping_size_ = 0;
+  Header* header_ = nullptr;
+  char* terminal_slot_ = nullptr;
+  char* records_ = nullptr;
+  // The serialized terminal artifact, prepared up front so that signal
+  // handlers only need to copy it.
+  std::string terminal_record_;
+};
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_CRASH_JOURNAL_H_
@@ -0,0 +1,146 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/crash_journal.h"
+
+#include <signal.h>
+
+#include <cstdlib>
+#include <filesystem>  //
+#include <fstream>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/testing/file_utils.h"
+#include "ocpdiag/core/testing/proto_matchers.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+
+namespace ocpdiag::results::internal {
+
+using ::ocpdiag::testing::EqualsProto;
+using ::ocpdiag::testing::StatusIs;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+namespace {
+
+std::string GetTempFilepath() {
+  std::string filepath = testutils::MkTempFileOrDie("crash_journal");
+  if (std::filesystem::exists(filepath))
+    CHECK(std::filesystem::remove(filepath)) << "Cannot remove temp file";
+  return filepath;
+}
+
+TEST(CrashJournalTest, RecordsAreReadBack) {
+  std::string path = GetTempFilepath();
+  CrashJournal journal(path);
+  ASSERT_TRUE(journal.Append("first"));
+  ASSERT_TRUE(journal.Append(""));
+  ASSERT_TRUE(journal.Append("third"));
+
+  absl::StatusOr<CrashJournalContents> contents = CrashJournal::Read(path);
+  ASSERT_TRUE(contents.ok()) << contents.status();
+  EXPECT_THAT(contents->records, ElementsAre("first", "", "third"));
+  EXPECT_FALSE(contents->terminal_record.has_value());
+}
+
+TEST(CrashJournalTest, FullJournalRejectsRecordsUntilReset) {
+  std::string path = GetTempFilepath();
+  CrashJournal journal(path, /*capacity=*/16);
+  ASSERT_TRUE(journal.Append("12345678"));
+  EXPECT_FALSE(journal.Append("12345678"));
+
+  journal.Reset();
+  EXPECT_THAT(CrashJournal::Read(path)->records, IsEmpty());
+  EXPECT_TRUE(journal.Append("12345678"));
+  EXPECT_THAT(CrashJournal::Read(path)->records, ElementsAre("12345678"));
+}
+
+TEST(CrashJournalTest, TerminalRecordIsWrittenOnce) {
+  std::string path = GetTempFilepath();
+  CrashJournal journal(path);
+  absl::Time start = absl::Now();
+  journal.WriteTerminalRecord(SIGTERM);
+  journal.WriteTerminalRecord(SIGSEGV);
+
+  absl::StatusOr<CrashJournalContents> contents = CrashJournal::Read(path);
+  ASSERT_TRUE(contents.ok()) << contents.status();
+  ASSERT_TRUE(contents->terminal_record.has_value());
+  ocpdiag_results_v2_pb::OutputArtifact terminal;
+  ASSERT_TRUE(terminal.ParseFromString(*contents->terminal_record));
+  EXPECT_THAT(terminal, EqualsProto(R"pb(
+                test_run_artifact {
+                  test_run_end { status: ERROR result: NOT_APPLICABLE }
+                }
+              )pb"));
+  EXPECT_EQ(contents->signal, SIGTERM);
+  EXPECT_GE(contents->termination_time, start - absl::Seconds(1));
+}
+
+TEST(CrashJournalTest, ActiveJournalIsWrittenOnTermination) {
+  std::string path = GetTempFilepath();
+  EXPECT_EXIT(
+      {
+        CrashJournal journal(path);
+        journal.Append("record");
+        journal.Activate();
+        raise(SIGTERM);
+      },
+      ::testing::KilledBySignal(SIGTERM), "");
+
+  absl::StatusOr<CrashJournalContents> contents = CrashJournal::Read(path);
+  ASSERT_TRUE(contents.ok()) << contents.status();
+  EXPECT_THAT(contents->records, ElementsAre("record"));
+  EXPECT_TRUE(contents->terminal_record.has_value());
+  EXPECT_EQ(contents->signal, SIGTERM);
+  std::filesystem::remove(path);
+}
+
+TEST(CrashJournalTest, IgnoredSigtermIsLeftIgnored) {
+  std::string path = GetTempFilepath();
+  EXPECT_EXIT(
+      {
+        signal(SIGTERM, SIG_IGN);
+        CrashJournal journal(path);
+        journal.Append("record");
+        journal.Activate();
+        raise(SIGTERM);
+        exit(0);
+      },
+      ::testing::ExitedWithCode(0), "");
+
+  absl::StatusOr<CrashJournalContents> contents = CrashJournal::Read(path);
+  ASSERT_TRUE(contents.ok()) << contents.status();
+  EXPECT_THAT(contents->records, ElementsAre("record"));
+  EXPECT_FALSE(contents->terminal_record.has_value());
+  std::filesystem::remove(path);
+}
+
+TEST(CrashJournalTest, FileIsRemovedWithTheJournal) {
+  std::string path = GetTempFilepath();
+  { CrashJournal journal(path); }
+  EXPECT_FALSE(std::filesystem::exists(path));
+  EXPECT_THAT(CrashJournal::Read(path).status(),
+              StatusIs(absl::StatusCode::kNotFound));
+}
+
+TEST(CrashJournalTest, OtherFilesAreNotJournals) {
+  std::string path = GetTempFilepath();
+  std::ofstream(path) << std::string(4096, 'x');
+  EXPECT_THAT(CrashJournal::Read(path).status(),
+              StatusIs(absl::StatusCode::kDataLoss));
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
@@ -0,0 +1,70 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/flush_policy.h"
+
+#include <algorithm>
+#include <cstdint>
+
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+using ::ocpdiag_results_v2_pb::Log;
+using ::ocpdiag_results_v2_pb::OutputArtifact;
+
+bool IsError(const OutputArtifact& artifact) {
+  const Log* log = nullptr;
+  if (artifact.has_test_run_artifact()) {
+    if (artifact.test_run_artifact().has_error()) return true;
+    if (artifact.test_run_artifact().has_log())
+      log = &artifact.test_run_artifact().log();
+  } else if (artifact.has_test_step_artifact()) {
+    if (artifact.test_step_artifact().has_error()) return true;
+    if (artifact.test_step_artifact().has_log())
+      log = &artifact.test_step_artifact().log();
+  }
+  // DEBUG sorts after FATAL, so the severities are compared one by one.
+  return log != nullptr &&
+         (log->severity() == Log::ERROR || log->severity() == Log::FATAL);
+}
+
+}  // namespace
+
+bool FlushScheduler::RecordArtifact(const OutputArtifact& artifact,
+                                    int64_t bytes, absl::Time now) {
+  if (unflushed_artifacts_ == 0) deadline_ = now + policy_.interval;
+  ++unflushed_artifacts_;
+  unflushed_bytes_ += bytes;
+  return (policy_.max_unflushed_artifacts > 0 &&
+          unflushed_artifacts_ >= policy_.max_unflushed_artifacts) ||
+         (policy_.max_unflushed_bytes > 0 &&
+          unflushed_bytes_ >= policy_.max_unflushed_bytes) ||
+         (policy_.flush_on_error && IsError(artifact));
+}
+
+bool FlushScheduler::RequestBoundaryFlush(absl::Time now) {
+  if (unflushed_artifacts_ == 0 ||
+      policy_.group_commit_window == absl::InfiniteDuration()) {
+    return false;
+  }
+  absl::Time window_end = last_flush_ + policy_.group_commit_window;
+  if (window_end <= now) return true;
+  deadline_ = std::min(deadline_, window_end);
+  return false;
+}
+
+void FlushScheduler::RecordFlush(absl::Time now) {
+  unflushed_bytes_ = 0;
+  unflushed_artifacts_ = 0;
+  deadline_ = absl::InfiniteFuture();
+  last_flush_ = now;
+}
+
+}  // namespace ocpdiag::results::internal
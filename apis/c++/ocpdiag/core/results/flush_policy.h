@@ -0,0 +1,80 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_FLUSH_POLICY_H_
+#define OCPDIAG_CORE_RESULTS_FLUSH_POLICY_H_
+
+#include <cstdint>
+
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+// When the ArtifactWriter flushes its outputs. Each flush ends a chunk of the
+// binary results file, so flushing less often makes for fewer, larger chunks
+// that compress better, at the cost of more artifacts being lost if the
+// process dies. The defaults flush within a minute of any artifact and at
+// every step and measurement series boundary, with an fsync.
+struct FlushPolicy {
+  // Flushes at most this long after an artifact is written.
+  absl::Duration interval = absl::Minutes(1);
+
+  // Flushes once this many bytes, as written to the file and the stream, or
+  // this many artifacts are unflushed, if positive.
+  int64_t max_unflushed_bytes = 0;
+  int64_t max_unflushed_artifacts = 0;
+
+  // Flushes right after Error artifacts, and logs of ERROR severity or above.
+  bool flush_on_error = false;
+
+  // Step and measurement series boundaries request a flush, which is delayed
+  // by up to this long so that the boundaries within the window share a
+  // single flush. Zero flushes at every boundary, and an infinite window
+  // leaves the boundaries to the other triggers.
+  absl::Duration group_commit_window = absl::ZeroDuration();
+
+  // Whether flushes wait for the file to reach the disk.
+  bool fsync = true;
+};
+
+// Decides when to flush by a FlushPolicy, given the artifacts written and
+// flushes made since the writer was created. This class is not thread-safe.
+class FlushScheduler {
+ public:
+  explicit FlushScheduler(const FlushPolicy& policy = {}) : policy_(policy) {}
+
+  const FlushPolicy& policy() const { return policy_; }
+
+  // Records an artifact of `bytes` written at `now`. Returns whether the
+  // outputs must be flushed right away.
+  bool RecordArtifact(const ocpdiag_results_v2_pb::OutputArtifact& artifact,
+                      int64_t bytes, absl::Time now);
+
+  // Records a request to flush at a step or measurement series boundary at
+  // `now`. Returns whether the outputs must be flushed right away, which is
+  // when the group commit window has passed since the last flush; otherwise
+  // the flush is due by deadline().
+  bool RequestBoundaryFlush(absl::Time now);
+
+  // Records a flush at `now` of every artifact written so far.
+  void RecordFlush(absl::Time now);
+
+  // Returns the time by which the unflushed artifacts must be flushed, or
+  // absl::InfiniteFuture() if there are none.
+  absl::Time deadline() const { return deadline_; }
+
+ private:
+  FlushPolicy policy_;
+  int64_t unflushed_bytes_ = 0;
+  int64_t unflushed_artifacts_ = 0;
+  absl::Time deadline_ = absl::InfiniteFuture();
+  absl::Time last_flush_ = absl::InfinitePast();
+};
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_FLUSH_POLICY_H_
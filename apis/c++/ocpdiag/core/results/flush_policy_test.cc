@@ -0,0 +1,98 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/flush_policy.h"
+
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+using ::ocpdiag_results_v2_pb::Log;
+using ::ocpdiag_results_v2_pb::OutputArtifact;
+
+const absl::Time kStart = absl::FromUnixSeconds(1000);
+
+OutputArtifact LogArtifact(Log::Severity severity) {
+  OutputArtifact artifact;
+  artifact.mutable_test_step_artifact()->mutable_log()->set_severity(severity);
+  return artifact;
+}
+
+TEST(FlushSchedulerTest, FlushIsDueAnIntervalAfterTheFirstUnflushedArtifact) {
+  FlushScheduler scheduler({.interval = absl::Seconds(10)});
+  EXPECT_EQ(scheduler.deadline(), absl::InfiniteFuture());
+
+  EXPECT_FALSE(scheduler.RecordArtifact(OutputArtifact(), 10, kStart));
+  EXPECT_FALSE(scheduler.RecordArtifact(OutputArtifact(), 10,
+                                        kStart + absl::Seconds(5)));
+  EXPECT_EQ(scheduler.deadline(), kStart + absl::Seconds(10));
+
+  scheduler.RecordFlush(kStart + absl::Seconds(6));
+  EXPECT_EQ(scheduler.deadline(), absl::InfiniteFuture());
+}
+
+TEST(FlushSchedulerTest, FlushesOnceTheLimitsAreReached) {
+  FlushScheduler scheduler(
+      {.max_unflushed_bytes = 100, .max_unflushed_artifacts = 3});
+  EXPECT_FALSE(scheduler.RecordArtifact(OutputArtifact(), 10, kStart));
+  EXPECT_FALSE(scheduler.RecordArtifact(OutputArtifact(), 10, kStart));
+  EXPECT_TRUE(scheduler.RecordArtifact(OutputArtifact(), 10, kStart));
+
+  scheduler.RecordFlush(kStart);
+  EXPECT_FALSE(scheduler.RecordArtifact(OutputArtifact(), 99, kStart));
+  EXPECT_TRUE(scheduler.RecordArtifact(OutputArtifact(), 1, kStart));
+}
+
+TEST(FlushSchedulerTest, FlushesAfterErrors) {
+  FlushScheduler scheduler({.flush_on_error = true});
+  EXPECT_FALSE(scheduler.RecordArtifact(LogArtifact(Log::DEBUG), 1, kStart));
+  EXPECT_FALSE(scheduler.RecordArtifact(LogArtifact(Log::WARNING), 1, kStart));
+  EXPECT_TRUE(scheduler.RecordArtifact(LogArtifact(Log::ERROR), 1, kStart));
+  EXPECT_TRUE(scheduler.RecordArtifact(LogArtifact(Log::FATAL), 1, kStart));
+
+  OutputArtifact error;
+  error.mutable_test_run_artifact()->mutable_error()->set_symptom("symptom");
+  EXPECT_TRUE(scheduler.RecordArtifact(error, 1, kStart));
+
+  FlushScheduler default_scheduler;
+  EXPECT_FALSE(default_scheduler.RecordArtifact(error, 1, kStart));
+}
+
+TEST(FlushSchedulerTest, BoundariesFlushByDefault) {
+  FlushScheduler scheduler;
+  EXPECT_FALSE(scheduler.RequestBoundaryFlush(kStart));
+  scheduler.RecordArtifact(OutputArtifact(), 1, kStart);
+  EXPECT_TRUE(scheduler.RequestBoundaryFlush(kStart));
+}
+
+TEST(FlushSchedulerTest, BoundariesWithinTheWindowShareAFlush) {
+  FlushScheduler scheduler({.group_commit_window = absl::Seconds(1)});
+  scheduler.RecordArtifact(OutputArtifact(), 1, kStart);
+  EXPECT_TRUE(scheduler.RequestBoundaryFlush(kStart));
+  scheduler.RecordFlush(kStart);
+
+  scheduler.RecordArtifact(OutputArtifact(), 1, kStart + absl::Milliseconds(1));
+  EXPECT_FALSE(scheduler.RequestBoundaryFlush(kStart + absl::Milliseconds(1)));
+  EXPECT_EQ(scheduler.deadline(), kStart + absl::Seconds(1));
+  EXPECT_FALSE(scheduler.RequestBoundaryFlush(kStart + absl::Milliseconds(2)));
+  EXPECT_TRUE(scheduler.RequestBoundaryFlush(kStart + absl::Seconds(1)));
+}
+
+TEST(FlushSchedulerTest, InfiniteWindowLeavesBoundariesToTheInterval) {
+  FlushScheduler scheduler({.interval = absl::Seconds(10),
+                            .group_commit_window = absl::InfiniteDuration()});
+  scheduler.RecordArtifact(OutputArtifact(), 1, kStart);
+  EXPECT_FALSE(scheduler.RequestBoundaryFlush(kStart));
+  EXPECT_EQ(scheduler.deadline(), kStart + absl::Seconds(10));
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
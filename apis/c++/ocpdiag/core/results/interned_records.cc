@@ -0,0 +1,254 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/interned_records.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/message_lite.h"
+#include "ocpdiag/core/results/interned_results.pb.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/results_dictionary.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/records_metadata.pb.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+using ::ocpdiag_results_v2_pb::Diagnosis;
+using ::ocpdiag_results_v2_pb::Measurement;
+using ::ocpdiag_results_v2_pb::OutputArtifact;
+using ::ocpdiag_results_v2_pb::Subcomponent;
+using ::ocpdiag_results_v2_pb::TestStepArtifact;
+
+// Calls `fn` with the message of the artifact that has interned fields, if
+// any, and returns its result.
+template <typename Fn>
+auto VisitInternedMessage(OutputArtifact& artifact, Fn fn) {
+  using Result = decltype(fn(std::declval<Measurement&>()));
+  if (!artifact.has_test_step_artifact()) return Result();
+  TestStepArtifact& step = *artifact.mutable_test_step_artifact();
+  switch (step.artifact_case()) {
+    case TestStepArtifact::kMeasurement:
+      return fn(*step.mutable_measurement());
+    case TestStepArtifact::kMeasurementSeriesStart:
+      return fn(*step.mutable_measurement_series_start());
+    case TestStepArtifact::kDiagnosis:
+      return fn(*step.mutable_diagnosis());
+    default:
+      return Result();
+  }
+}
+
+}  // namespace
+
+void ArtifactInterner::Intern(OutputArtifact& artifact,
+                              InternedArtifact& record,
+                              Dictionary& dictionary) {
+  record.mutable_artifact()->Swap(&artifact);
+  VisitInternedMessage(*record.mutable_artifact(), [&](auto& message) {
+    InternFields(message, record, dictionary);
+  });
+}
+
+template <typename T>
+void ArtifactInterner::InternFields(T& message, InternedArtifact& record,
+                                    Dictionary& dictionary) {
+  if constexpr (std::is_same_v<T, Diagnosis>) {
+    record.set_verdict_ref(
+        InternString(*message.mutable_verdict(), verdict_, dictionary));
+  } else {
+    record.set_name_ref(
+        InternString(*message.mutable_name(), name_, dictionary));
+    record.set_unit_ref(
+        InternString(*message.mutable_unit(), unit_, dictionary));
+  }
+  record.set_hardware_info_id_ref(InternString(
+      *message.mutable_hardware_info_id(), hardware_info_id_, dictionary));
+  if (!message.has_subcomponent()) return;
+  auto [it, inserted] = subcomponent_ids_.try_emplace(
+      message.subcomponent().SerializeAsString(),
+      subcomponent_ids_.size() + 1);
+  if (inserted) *dictionary.add_subcomponents() = message.subcomponent();
+  record.set_subcomponent_ref(it->second);
+  subcomponent_.reset(message.release_subcomponent());
+}
+
+uint32_t ArtifactInterner::InternString(std::string& value,
+                                        std::string& removed,
+                                        Dictionary& dictionary) {
+  if (value.empty()) return 0;
+  auto [it, inserted] =
+      string_ids_.try_emplace(value, string_ids_.size() + 1);
+  if (inserted) dictionary.add_strings(value);
+  removed.swap(value);
+  value.clear();
+  return it->second;
+}
+
+void ArtifactInterner::Restore(InternedArtifact& record,
+                               OutputArtifact& artifact) {
+  VisitInternedMessage(*record.mutable_artifact(), [&](auto& message) {
+    RestoreFields(record, message);
+  });
+  artifact.Swap(record.mutable_artifact());
+}
+
+template <typename T>
+void ArtifactInterner::RestoreFields(const InternedArtifact& record,
+                                     T& message) {
+  if constexpr (std::is_same_v<T, Diagnosis>) {
+    if (record.verdict_ref() != 0) message.mutable_verdict()->swap(verdict_);
+  } else {
+    if (record.name_ref() != 0) message.mutable_name()->swap(name_);
+    if (record.unit_ref() != 0) message.mutable_unit()->swap(unit_);
+  }
+  if (record.hardware_info_id_ref() != 0)
+    message.mutable_hardware_info_id()->swap(hardware_info_id_);
+  if (record.subcomponent_ref() != 0)
+    message.set_allocated_subcomponent(subcomponent_.release());
+}
+
+void ArtifactExpander::AddDictionary(const Dictionary& dictionary) {
+  strings_.insert(strings_.end(), dictionary.strings().begin(),
+                  dictionary.strings().end());
+  subcomponents_.insert(subcomponents_.end(),
+                        dictionary.subcomponents().begin(),
+                        dictionary.subcomponents().end());
+}
+
+absl::Status ArtifactExpander::Expand(InternedArtifact& record,
+                                      OutputArtifact& artifact) const {
+  artifact.Swap(record.mutable_artifact());
+  return VisitInternedMessage(artifact, [&](auto& message) {
+    return ExpandFields(record, message);
+  });
+}
+
+template <typename T>
+absl::Status ArtifactExpander::ExpandFields(const InternedArtifact& record,
+                                            T& message) const {
+  absl::Status status;
+  if constexpr (std::is_same_v<T, Diagnosis>) {
+    status.Update(
+        ExpandString(record.verdict_ref(), *message.mutable_verdict()));
+  } else {
+    status.Update(ExpandString(record.name_ref(), *message.mutable_name()));
+    status.Update(ExpandString(record.unit_ref(), *message.mutable_unit()));
+  }
+  status.Update(ExpandString(record.hardware_info_id_ref(),
+                             *message.mutable_hardware_info_id()));
+  if (uint32_t id = record.subcomponent_ref(); id != 0) {
+    if (id > subcomponents_.size()) {
+      status.Update(absl::DataLossError(
+          absl::StrCat("Undeclared subcomponent id ", id)));
+    } else {
+      *message.mutable_subcomponent() = subcomponents_[id - 1];
+    }
+  }
+  return status;
+}
+
+absl::Status ArtifactExpander::ExpandString(uint32_t id,
+                                            std::string& value) const {
+  if (id == 0) return absl::OkStatus();
+  if (id > strings_.size())
+    return absl::DataLossError(absl::StrCat("Undeclared string id ", id));
+  value = strings_[id - 1];
+  return absl::OkStatus();
+}
+
+ResultsFileReader::ResultsFileReader(absl::string_view file_path)
+    : reader_(riegeli::FdReader<>(file_path)) {
+  riegeli::RecordsMetadata metadata;
+  if (!reader_.ReadMetadata(metadata)) return;
+  interned_ = metadata.record_type_name() ==
+              InternedRecord::GetDescriptor()->full_name();
+  if (uint32_t id = GetResultsDictionaryId(metadata); id != 0) {
+    absl::StatusOr<std::shared_ptr<const ResultsDictionary>> dictionary =
+        FindResultsDictionary(id);
+    if (dictionary.ok()) {
+      decompressor_ =
+          std::make_unique<RecordDecompressor>(*std::move(dictionary));
+    } else {
+      status_ = dictionary.status();
+    }
+  }
+}
+
+bool ResultsFileReader::ReadRecord(google::protobuf::MessageLite& record) {
+  if (decompressor_ == nullptr) return reader_.ReadRecord(record);
+  if (!ReadRecord(record_)) return false;
+  if (!record.ParseFromString(record_)) {
+    status_ = absl::DataLossError(
+        absl::StrCat("Failed to parse a record as ", record.GetTypeName()));
+    return false;
+  }
+  return true;
+}
+
+bool ResultsFileReader::ReadRecord(std::string& record) {
+  if (decompressor_ == nullptr) return reader_.ReadRecord(record);
+  if (!reader_.ReadRecord(compressed_record_)) return false;
+  status_ = decompressor_->Decompress(compressed_record_, record);
+  return status_.ok();
+}
+
+bool ResultsFileReader::ReadArtifact(OutputArtifact& artifact) {
+  if (!status_.ok()) return false;
+  if (!interned_) return ReadRecord(artifact);
+  InternedRecord record;
+  while (ReadRecord(record)) {
+    if (record.has_dictionary()) {
+      expander_.AddDictionary(record.dictionary());
+      continue;
+    }
+    status_ = expander_.Expand(*record.mutable_artifact(), artifact);
+    return status_.ok();
+  }
+  return false;
+}
+
+bool ResultsFileReader::ReadSerializedArtifact(std::string& record) {
+  if (!status_.ok()) return false;
+  if (!interned_) return ReadRecord(record);
+  OutputArtifact artifact;
+  if (!ReadArtifact(artifact)) return false;
+  return artifact.SerializeToString(&record);
+}
+
+bool ResultsFileReader::Recover() {
+  return status_.ok() && reader_.Recover();
+}
+
+bool ResultsFileReader::Seek(riegeli::RecordPosition position) {
+  if (!status_.ok()) return false;
+  if (interned_) {
+    status_ = absl::FailedPreconditionError(
+        "Cannot seek in a results file written with interning");
+    return false;
+  }
+  return reader_.Seek(position);
+}
+
+absl::Status ResultsFileReader::status() const {
+  if (!status_.ok()) return status_;
+  return reader_.status();
+}
+
+bool ResultsFileReader::Close() { return reader_.Close() && status_.ok(); }
+
+}  // namespace ocpdiag::results::internal
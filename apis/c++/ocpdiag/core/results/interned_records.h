@@ -0,0 +1,135 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_INTERNED_RECORDS_H_
+#define OCPDIAG_CORE_RESULTS_INTERNED_RECORDS_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "google/protobuf/message_lite.h"
+#include "ocpdiag/core/results/interned_results.pb.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/results_dictionary.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/record_position.h"
+#include "riegeli/records/record_reader.h"
+
+namespace ocpdiag::results::internal {
+
+// Interns the identifiers that measurement, measurement series and diagnosis
+// artifacts repeat: names, units, hardware info ids, verdicts and
+// subcomponents. Each distinct value is declared once in a Dictionary record
+// and later artifacts refer to it by id. This class is not thread-safe.
+class ArtifactInterner {
+ public:
+  // Moves `artifact` into `record`, replacing its interned fields by the ids of
+  // their values. Values seen for the first time are added to `dictionary`,
+  // which must be written before the record if it is not empty. The artifact
+  // must be given back with Restore() before the next call.
+  void Intern(ocpdiag_results_v2_pb::OutputArtifact& artifact,
+              InternedArtifact& record, Dictionary& dictionary);
+
+  // Moves the artifact back out of `record`, with its interned fields.
+  void Restore(InternedArtifact& record,
+               ocpdiag_results_v2_pb::OutputArtifact& artifact);
+
+ private:
+  template <typename T>
+  void InternFields(T& message, InternedArtifact& record,
+                    Dictionary& dictionary);
+  template <typename T>
+  void RestoreFields(const InternedArtifact& record, T& message);
+  uint32_t InternString(std::string& value, std::string& removed,
+                        Dictionary& dictionary);
+
+  absl::flat_hash_map<std::string, uint32_t> string_ids_;
+  // Keyed by the serialized subcomponent.
+  absl::flat_hash_map<std::string, uint32_t> subcomponent_ids_;
+  // Values removed from the artifact being written, so that it can be
+  // restored without copies.
+  std::string name_;
+  std::string unit_;
+  std::string hardware_info_id_;
+  std::string verdict_;
+  std::unique_ptr<ocpdiag_results_v2_pb::Subcomponent> subcomponent_;
+};
+
+// Expands interned artifacts with the dictionaries that precede them.
+class ArtifactExpander {
+ public:
+  void AddDictionary(const Dictionary& dictionary);
+
+  // Moves the artifact out of `record` and fills in its interned fields. Fails
+  // if the record refers to values that have not been declared.
+  absl::Status Expand(InternedArtifact& record,
+                      ocpdiag_results_v2_pb::OutputArtifact& artifact) const;
+
+ private:
+  template <typename T>
+  absl::Status ExpandFields(const InternedArtifact& record, T& message) const;
+  absl::Status ExpandString(uint32_t id, std::string& value) const;
+
+  std::vector<std::string> strings_;
+  std::vector<ocpdiag_results_v2_pb::Subcomponent> subcomponents_;
+};
+
+// Reads the artifacts of a binary results file, which may have been written
+// with or without string interning, and with or without a ResultsDictionary.
+// The dictionary that the metadata names is found by FindResultsDictionary(),
+// and reading fails if it cannot be.
+class ResultsFileReader {
+ public:
+  explicit ResultsFileReader(absl::string_view file_path);
+
+  // Reads the next artifact. Returns false at the end of the file or on an
+  // error, which is then reported by status().
+  bool ReadArtifact(ocpdiag_results_v2_pb::OutputArtifact& artifact);
+
+  // Like ReadArtifact, but returns the serialized artifact. Records of files
+  // without interning are returned as is, without being parsed, once
+  // decompressed.
+  bool ReadSerializedArtifact(std::string& record);
+
+  // Skips the invalid region that made the last read fail, such as the
+  // unflushed end of a file whose writer died. Returns whether reading can
+  // continue.
+  bool Recover();
+
+  // The position of the next record, and seeking to one, so that a file that
+  // is still being written can be read incrementally by reopening it. Seeking
+  // would skip the dictionaries of an interned file, so it fails then.
+  riegeli::RecordPosition pos() const { return reader_.pos(); }
+  bool Seek(riegeli::RecordPosition position);
+
+  absl::Status status() const;
+  bool Close();
+
+  // Whether the file was written with string interning.
+  bool interned() const { return interned_; }
+
+ private:
+  // Read a record, decompressing it with the dictionary, if any.
+  bool ReadRecord(google::protobuf::MessageLite& record);
+  bool ReadRecord(std::string& record);
+
+  riegeli::RecordReader<riegeli::FdReader<>> reader_;
+  bool interned_ = false;
+  std::unique_ptr<RecordDecompressor> decompressor_;
+  std::string compressed_record_;
+  std::string record_;
+  ArtifactExpander expander_;
+  absl::Status status_;
+};
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_INTERNED_RECORDS_H_
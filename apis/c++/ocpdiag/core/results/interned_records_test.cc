@@ -0,0 +1,179 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/interned_records.h"
+
+#include <filesystem>  //
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/interned_results.pb.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/testing/file_utils.h"
+#include "ocpdiag/core/testing/parse_text_proto.h"
+#include "ocpdiag/core/testing/proto_matchers.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+#include "riegeli/records/record_position.h"
+
+namespace ocpdiag::results::internal {
+
+using ::ocpdiag::testing::EqualsProto;
+using ::ocpdiag::testing::IsOk;
+using ::ocpdiag::testing::ParseTextProtoOrDie;
+using ::ocpdiag::testing::StatusIs;
+using ::ocpdiag_results_v2_pb::OutputArtifact;
+using ::testing::ElementsAre;
+using ::testing::IsEmpty;
+
+namespace {
+
+OutputArtifact MakeMeasurement(double value) {
+  OutputArtifact artifact = ParseTextProtoOrDie(R"pb(
+    test_step_artifact {
+      test_step_id: "1"
+      measurement {
+        name: "fan-speed"
+        unit: "RPM"
+        hardware_info_id: "0"
+        subcomponent { name: "FAN1" location: "F0_1" version: "1" }
+      }
+    }
+  )pb");
+  artifact.mutable_test_step_artifact()
+      ->mutable_measurement()
+      ->mutable_value()
+      ->set_number_value(value);
+  return artifact;
+}
+
+TEST(ArtifactInternerTest, RepeatedValuesAreDeclaredOnce) {
+  ArtifactInterner interner;
+  ArtifactExpander expander;
+  for (double value : {1., 2.}) {
+    OutputArtifact artifact = MakeMeasurement(value);
+    InternedArtifact record;
+    Dictionary dictionary;
+    interner.Intern(artifact, record, dictionary);
+    if (value == 1) {
+      EXPECT_THAT(dictionary.strings(), ElementsAre("fan-speed", "RPM", "0"));
+      EXPECT_EQ(dictionary.subcomponents_size(), 1);
+    } else {
+      EXPECT_THAT(dictionary.strings(), IsEmpty());
+      EXPECT_EQ(dictionary.subcomponents_size(), 0);
+    }
+    EXPECT_EQ(record.name_ref(), 1);
+    EXPECT_EQ(record.subcomponent_ref(), 1);
+    const ocpdiag_results_v2_pb::Measurement& measurement =
+        record.artifact().test_step_artifact().measurement();
+    EXPECT_THAT(measurement.name(), IsEmpty());
+    EXPECT_FALSE(measurement.has_subcomponent());
+    EXPECT_EQ(measurement.value().number_value(), value);
+
+    // The interned record expands to the original artifact, which is also
+    // given back to the writer.
+    InternedArtifact copy = record;
+    interner.Restore(record, artifact);
+    EXPECT_THAT(artifact, EqualsProto(MakeMeasurement(value)));
+    expander.AddDictionary(dictionary);
+    OutputArtifact expanded;
+    ASSERT_THAT(expander.Expand(copy, expanded), IsOk());
+    EXPECT_THAT(expanded, EqualsProto(MakeMeasurement(value)));
+  }
+}
+
+TEST(ArtifactExpanderTest, UndeclaredIdIsAnError) {
+  ArtifactExpander expander;
+  InternedArtifact record = ParseTextProtoOrDie(R"pb(
+    artifact { test_step_artifact { diagnosis { type: PASS } } }
+    verdict_ref: 1
+  )pb");
+  OutputArtifact artifact;
+  EXPECT_THAT(expander.Expand(record, artifact),
+              StatusIs(absl::StatusCode::kDataLoss));
+}
+
+TEST(ResultsFileReaderTest, InternedFileIsSmallerAndReadsTheSame) {
+  std::vector<std::string> paths;
+  for (bool intern_strings : {false, true}) {
+    std::string path = testutils::MkTempFileOrDie("interned_records");
+    std::filesystem::remove(path);
+    ArtifactWriter writer(
+        path, /*output_stream=*/nullptr,
+        {.flush_each_minute = false, .intern_strings = intern_strings});
+    for (int i = 0; i < 100; i++)
+      writer.Write(MakeMeasurement(i).test_step_artifact());
+    paths.push_back(path);
+  }
+
+  ResultsFileReader plain(paths[0]);
+  ResultsFileReader interned(paths[1]);
+  EXPECT_FALSE(plain.interned());
+  EXPECT_TRUE(interned.interned());
+  OutputArtifact plain_artifact, interned_artifact;
+  int count = 0;
+  while (plain.ReadArtifact(plain_artifact)) {
+    ASSERT_TRUE(interned.ReadArtifact(interned_artifact));
+    plain_artifact.clear_timestamp();
+    interned_artifact.clear_timestamp();
+    EXPECT_THAT(interned_artifact, EqualsProto(plain_artifact));
+    count++;
+  }
+  EXPECT_EQ(count, 100);
+  EXPECT_FALSE(interned.ReadArtifact(interned_artifact));
+  EXPECT_THAT(interned.status(), IsOk());
+  EXPECT_LT(std::filesystem::file_size(paths[1]),
+            std::filesystem::file_size(paths[0]) * 3 / 4);
+}
+
+TEST(ResultsFileReaderTest, ReadingResumesAtAPosition) {
+  std::string path = testutils::MkTempFileOrDie("interned_records");
+  std::filesystem::remove(path);
+  ArtifactWriter writer(path, /*output_stream=*/nullptr,
+                        {.flush_each_minute = false});
+  writer.Write(MakeMeasurement(1).test_step_artifact());
+  writer.Flush();
+  riegeli::RecordPosition position;
+  {
+    ResultsFileReader reader(path);
+    OutputArtifact artifact;
+    ASSERT_TRUE(reader.ReadArtifact(artifact));
+    EXPECT_FALSE(reader.ReadArtifact(artifact));
+    position = reader.pos();
+  }
+
+  writer.Write(MakeMeasurement(2).test_step_artifact());
+  writer.Flush();
+  ResultsFileReader reader(path);
+  ASSERT_TRUE(reader.Seek(position));
+  OutputArtifact artifact;
+  ASSERT_TRUE(reader.ReadArtifact(artifact));
+  EXPECT_EQ(artifact.test_step_artifact().measurement().value().number_value(),
+            2);
+  EXPECT_FALSE(reader.ReadArtifact(artifact));
+  EXPECT_THAT(reader.status(), IsOk());
+}
+
+TEST(ResultsFileReaderTest, InternedFileCannotBeSeeked) {
+  std::string path = testutils::MkTempFileOrDie("interned_records");
+  std::filesystem::remove(path);
+  {
+    ArtifactWriter writer(
+        path, /*output_stream=*/nullptr,
+        {.flush_each_minute = false, .intern_strings = true});
+    writer.Write(MakeMeasurement(1).test_step_artifact());
+  }
+  ResultsFileReader reader(path);
+  EXPECT_FALSE(reader.Seek(riegeli::RecordPosition()));
+  EXPECT_THAT(reader.status(),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
@@ -0,0 +1,416 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/json_validator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/status/status.h"
+#include "absl/strings/charconv.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+constexpr uint64_t kOnes = 0x0101010101010101;
+constexpr uint64_t kHighBits = 0x8080808080808080;
+
+// Whether any byte of `word` is below `n`, which must be at most 128.
+constexpr uint64_t HasByteBelow(uint64_t word, uint8_t n) {
+  return (word - kOnes * n) & ~word & kHighBits;
+}
+
+// Whether any of the eight bytes of `word` ends a run of plain string
+// characters: a quote, a backslash, a control character or a non-ASCII byte.
+constexpr bool HasSpecialByte(uint64_t word) {
+  return (HasByteBelow(word ^ (kOnes * '"'), 1) |
+          HasByteBelow(word ^ (kOnes * '\\'), 1) | HasByteBelow(word, 0x20) |
+          (word & kHighBits)) != 0;
+}
+
+bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+int HexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Reads the four hex digits at `pos`, or returns -1.
+int32_t ReadHex4(absl::string_view json, size_t pos) {
+  if (pos + 4 > json.size()) return -1;
+  int32_t value = 0;
+  for (size_t i = pos; i < pos + 4; i++) {
+    int digit = HexDigit(json[i]);
+    if (digit < 0) return -1;
+    value = value << 4 | digit;
+  }
+  return value;
+}
+
+void AppendUtf8(uint32_t code_point, std::string& out) {
+  if (code_point < 0x80) {
+    out.push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    out.push_back(static_cast<char>(0xC0 | code_point >> 6));
+    out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else if (code_point < 0x10000) {
+    out.push_back(static_cast<char>(0xE0 | code_point >> 12));
+    out.push_back(static_cast<char>(0x80 | (code_point >> 6 & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else {
+    out.push_back(static_cast<char>(0xF0 | code_point >> 18));
+    out.push_back(static_cast<char>(0x80 | (code_point >> 12 & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (code_point >> 6 & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  }
+}
+
+class JsonValidator {
+ public:
+  explicit JsonValidator(absl::string_view json) : json_(json) {}
+
+  absl::Status Validate(bool object_only);
+
+ private:
+  enum class State { kValue, kKey, kAfterValue };
+
+  char Peek() const { return pos_ < json_.size() ? json_[pos_] : '\0'; }
+  void SkipWhitespace();
+  // Each reads the token at the current position and moves past it.
+  bool String();
+  // Adds the key that starts at `start` to the keys of the innermost object,
+  // unless it is already there.
+  bool UniqueKey(size_t start, int depth);
+  bool Number();
+  // Whether the number that starts at `start` and ends at the current position
+  // is in the range of a double. Those that underflow to zero are.
+  bool NumberInRange(size_t start) const;
+  bool Literal(absl::string_view literal);
+  bool Utf8Sequence();
+  absl::Status Error(absl::string_view expected) const;
+
+  const absl::string_view json_;
+  size_t pos_ = 0;
+  // The keys of each enclosing object, by depth, kept to be reused.
+  std::vector<absl::flat_hash_set<std::string>> keys_;
+  std::string key_;
+};
+
+absl::Status JsonValidator::Validate(bool object_only) {
+  // The containers that enclose the current position, by their opening
+  // character.
+  char open[kMaxJsonDepth];
+  int depth = 0;
+  SkipWhitespace();
+  if (object_only && Peek() != '{') return Error("an object");
+  State state = State::kValue;
+  while (true) {
+    SkipWhitespace();
+    switch (state) {
+      case State::kValue:
+        switch (Peek()) {
+          case '{':
+          case '[':
+            if (depth == kMaxJsonDepth) return Error("less nesting");
+            open[depth++] = json_[pos_++];
+            if (open[depth - 1] == '{') {
+              if (keys_.size() < static_cast<size_t>(depth))
+                keys_.resize(depth);
+              keys_[depth - 1].clear();
+            }
+            SkipWhitespace();
+            if (Peek() == (open[depth - 1] == '{' ? '}' : ']')) {
+              pos_++;
+              depth--;
+              state = State::kAfterValue;
+            } else {
+              state = open[depth - 1] == '{' ? State::kKey : State::kValue;
+            }
+            continue;
+          case '"':
+            if (!String()) return Error("a valid string");
+            break;
+          case 't':
+            if (!Literal("true")) return Error("true");
+            break;
+          case 'f':
+            if (!Literal("false")) return Error("false");
+            break;
+          case 'n':
+            if (!Literal("null")) return Error("null");
+            break;
+          default: {
+            size_t start = pos_;
+            if (!Number()) return Error("a value");
+            if (!NumberInRange(start)) {
+              pos_ = start;
+              return Error("a number in the range of a double");
+            }
+          }
+        }
+        state = State::kAfterValue;
+        break;
+      case State::kKey: {
+        size_t start = pos_;
+        if (Peek() != '"' || !String()) return Error("a key");
+        if (!UniqueKey(start, depth)) {
+          pos_ = start;
+          return Error("a key not already in the object");
+        }
+        SkipWhitespace();
+        if (Peek() != ':') return Error("':'");
+        pos_++;
+        state = State::kValue;
+        break;
+      }
+      case State::kAfterValue:
+        if (depth == 0) {
+          if (pos_ != json_.size()) return Error("the end of the input");
+          return absl::OkStatus();
+        }
+        if (Peek() == ',') {
+          pos_++;
+          state = open[depth - 1] == '{' ? State::kKey : State::kValue;
+        } else if (Peek() == (open[depth - 1] == '{' ? '}' : ']')) {
+          pos_++;
+          depth--;
+        } else {
+          return Error(open[depth - 1] == '{' ? "',' or '}'" : "',' or ']'");
+        }
+        break;
+    }
+  }
+}
+
+void JsonValidator::SkipWhitespace() {
+  while (pos_ < json_.size() && (json_[pos_] == ' ' || json_[pos_] == '\n' ||
+                                 json_[pos_] == '\r' || json_[pos_] == '\t')) {
+    pos_++;
+  }
+}
+
+bool JsonValidator::String() {
+  pos_++;
+  while (true) {
+    uint64_t word;
+    while (pos_ + sizeof(word) <= json_.size()) {
+      std::memcpy(&word, json_.data() + pos_, sizeof(word));
+      if (HasSpecialByte(word)) break;
+      pos_ += sizeof(word);
+    }
+    if (pos_ >= json_.size()) return false;
+    unsigned char c = json_[pos_];
+    if (c == '"') {
+      pos_++;
+      return true;
+    }
+    if (c == '\\') {
+      if (++pos_ >= json_.size()) return false;
+      switch (json_[pos_]) {
+        case '"':
+        case '\\':
+        case '/':
+        case 'b':
+        case 'f':
+        case 'n':
+        case 'r':
+        case 't':
+          pos_++;
+          break;
+        case 'u': {
+          int32_t code_point = ReadHex4(json_, pos_ + 1);
+          if (code_point < 0) return false;
+          pos_ += 5;
+          if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+            // A high surrogate must be followed by the low one of its pair.
+            int32_t low = json_.substr(pos_, 2) == "\\u"
+                              ? ReadHex4(json_, pos_ + 2)
+                              : -1;
+            if (low < 0xDC00 || low > 0xDFFF) return false;
+            pos_ += 6;
+          } else if (code_point >= 0xDC00 && code_point <= 0xDFFF) {
+            return false;
+          }
+          break;
+        }
+        default:
+          return false;
+      }
+    } else if (c < 0x20) {
+      return false;
+    } else if (c >= 0x80) {
+      if (!Utf8Sequence()) return false;
+    } else {
+      pos_++;
+    }
+  }
+}
+
+bool JsonValidator::UniqueKey(size_t start, int depth) {
+  // The key, without its quotes, is unescaped only if it has escapes.
+  absl::string_view key = json_.substr(start + 1, pos_ - start - 2);
+  if (key.find('\\') != absl::string_view::npos) {
+    key_.clear();
+    UnescapeJsonString(json_, start + 1, key_);
+    key = key_;
+  }
+  return keys_[depth - 1].emplace(key).second;
+}
+
+bool JsonValidator::Number() {
+  if (Peek() == '-') pos_++;
+  if (Peek() == '0') {
+    pos_++;
+  } else if (IsDigit(Peek())) {
+    while (IsDigit(Peek())) pos_++;
+  } else {
+    return false;
+  }
+  if (Peek() == '.') {
+    pos_++;
+    if (!IsDigit(Peek())) return false;
+    while (IsDigit(Peek())) pos_++;
+  }
+  if (Peek() == 'e' || Peek() == 'E') {
+    pos_++;
+    if (Peek() == '+' || Peek() == '-') pos_++;
+    if (!IsDigit(Peek())) return false;
+    while (IsDigit(Peek())) pos_++;
+  }
+  return true;
+}
+
+bool JsonValidator::NumberInRange(size_t start) const {
+  // A double holds any number of up to 308 digits without an exponent.
+  absl::string_view number = json_.substr(start, pos_ - start);
+  if (number.size() <= 308 && number.find_first_of("eE") == number.npos)
+    return true;
+  double value;
+  absl::from_chars_result result =
+      absl::from_chars(number.data(), number.data() + number.size(), value);
+  return result.ec != std::errc::result_out_of_range || value == 0;
+}
+
+bool JsonValidator::Literal(absl::string_view literal) {
+  if (json_.substr(pos_, literal.size()) != literal) return false;
+  pos_ += literal.size();
+  return true;
+}
+
+bool JsonValidator::Utf8Sequence() {
+  unsigned char c = json_[pos_];
+  size_t length;
+  uint32_t code_point;
+  if (c >= 0xC2 && c <= 0xDF) {
+    length = 2;
+    code_point = c & 0x1F;
+  } else if (c >= 0xE0 && c <= 0xEF) {
+    length = 3;
+    code_point = c & 0x0F;
+  } else if (c >= 0xF0 && c <= 0xF4) {
+    length = 4;
+    code_point = c & 0x07;
+  } else {
+    return false;
+  }
+  if (pos_ + length > json_.size()) return false;
+  for (size_t i = 1; i < length; i++) {
+    unsigned char continuation = json_[pos_ + i];
+    if ((continuation & 0xC0) != 0x80) return false;
+    code_point = code_point << 6 | (continuation & 0x3F);
+  }
+  // Rejects overlong encodings, surrogates and code points past U+10FFFF.
+  if (length == 3 &&
+      (code_point < 0x800 || (code_point >= 0xD800 && code_point <= 0xDFFF))) {
+    return false;
+  }
+  if (length == 4 && (code_point < 0x10000 || code_point > 0x10FFFF))
+    return false;
+  pos_ += length;
+  return true;
+}
+
+absl::Status JsonValidator::Error(absl::string_view expected) const {
+  return absl::InvalidArgumentError(
+      absl::StrCat("Invalid JSON at byte ", pos_, ": expected ", expected));
+}
+
+}  // namespace
+
+absl::Status ValidateJson(absl::string_view json) {
+  return JsonValidator(json).Validate(/*object_only=*/false);
+}
+
+absl::Status ValidateJsonObject(absl::string_view json) {
+  return JsonValidator(json).Validate(/*object_only=*/true);
+}
+
+size_t UnescapeJsonString(absl::string_view json, size_t pos,
+                          std::string& out) {
+  while (pos < json.size()) {
+    size_t end = json.find_first_of("\"\\", pos);
+    if (end == absl::string_view::npos) return std::string::npos;
+    out.append(json.data() + pos, end - pos);
+    pos = end + 1;
+    if (json[end] == '"') return pos;
+    if (pos >= json.size()) return std::string::npos;
+    char escaped = json[pos++];
+    switch (escaped) {
+      case '"':
+      case '\\':
+      case '/':
+        out.push_back(escaped);
+        break;
+      case 'b':
+        out.push_back('\b');
+        break;
+      case 'f':
+        out.push_back('\f');
+        break;
+      case 'n':
+        out.push_back('\n');
+        break;
+      case 'r':
+        out.push_back('\r');
+        break;
+      case 't':
+        out.push_back('\t');
+        break;
+      case 'u': {
+        int32_t code_point = ReadHex4(json, pos);
+        if (code_point < 0) return std::string::npos;
+        pos += 4;
+        if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+          // A high surrogate must be followed by the low one of its pair.
+          int32_t low = json.substr(pos, 2) == "\\u" ? ReadHex4(json, pos + 2)
+                                                      : -1;
+          if (low < 0xDC00 || low > 0xDFFF) return std::string::npos;
+          pos += 6;
+          code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+        } else if (code_point >= 0xDC00 && code_point <= 0xDFFF) {
+          return std::string::npos;
+        }
+        AppendUtf8(code_point, out);
+        break;
+      }
+      default:
+        return std::string::npos;
+    }
+  }
+  return std::string::npos;
+}
+
+}  // namespace ocpdiag::results::internal
@@ -0,0 +1,44 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_JSON_VALIDATOR_H_
+#define OCPDIAG_CORE_RESULTS_JSON_VALIDATOR_H_
+
+#include <cstddef>
+#include <string>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+
+namespace ocpdiag::results::internal {
+
+// Checks that `json` is a single JSON value, as RFC 8259 defines it, with
+// strings in valid UTF-8 and at most `kMaxJsonDepth` nested arrays and
+// objects. Like the protobuf JSON parser, it also rejects duplicate keys in an
+// object, numbers past the range of a double and unpaired surrogate escapes,
+// so that it accepts the JSON that parsing to a Struct would. It reads the
+// input once and builds nothing but the set of keys of each open object, so
+// that JSON which is only copied to the output is validated in a fraction of
+// the time a parse takes; the runs of plain characters in strings, which make
+// up most of the input, are skipped eight bytes at a time.
+absl::Status ValidateJson(absl::string_view json);
+
+// Like ValidateJson, but the value must also be an object, as it must be to
+// become a google.protobuf.Struct.
+absl::Status ValidateJsonObject(absl::string_view json);
+
+constexpr int kMaxJsonDepth = 100;
+
+// Appends the value of the JSON string that starts at `pos`, just after its
+// opening quote, to `out`, and returns the position after its closing quote.
+// Returns std::string::npos if the string is not terminated or has an invalid
+// escape sequence.
+size_t UnescapeJsonString(absl::string_view json, size_t pos,
+                          std::string& out);
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_JSON_VALIDATOR_H_
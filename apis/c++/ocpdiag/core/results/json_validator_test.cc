@@ -0,0 +1,126 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/json_validator.h"
+
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+
+namespace ocpdiag::results::internal {
+
+using ::ocpdiag::testing::IsOk;
+using ::ocpdiag::testing::StatusIs;
+using ::testing::Eq;
+using ::testing::HasSubstr;
+
+namespace {
+
+class ValidJsonTest : public ::testing::TestWithParam<absl::string_view> {};
+
+TEST_P(ValidJsonTest, IsAccepted) {
+  EXPECT_THAT(ValidateJson(GetParam()), IsOk());
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    JsonValidatorTest, ValidJsonTest,
+    ::testing::Values(
+        "{}", " [ ] ", "0", "-0.5e+10", "1E3", "true", "false", "null",
+        R"("")", R"({"a": [1, 2.5, "x", {"b": null}], "c": {}})",
+        // Long enough to be skipped a word at a time, with every escape.
+        R"("a run of plain characters \" \\ \/ \b \f \n \r \t \u00e9")",
+        // Two, three and four byte UTF-8, and a surrogate pair.
+        "\"\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 \\ud83d\\ude00\"",
+        "\n{\t\"a\"\r:\n1 }\n",
+        // Keys may repeat in other objects, and tiny numbers become zero.
+        R"([{"a": 1}, {"a": {"a": 2}}])", "1e-400"));
+
+class InvalidJsonTest : public ::testing::TestWithParam<absl::string_view> {};
+
+TEST_P(InvalidJsonTest, IsRejected) {
+  EXPECT_THAT(ValidateJson(GetParam()),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("Invalid JSON at byte")));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    JsonValidatorTest, InvalidJsonTest,
+    ::testing::Values(
+        "", "{", "}", "[1,]", "{,}", R"({"a" 1})", R"({"a":1,})", "{1:2}",
+        "[1] [2]", "01", "1.", "-", ".5", "1e", "+1", "tru", "nul", "True",
+        "NaN", R"("unterminated)", R"("bad \x escape")", R"("\u12G4")",
+        "\"raw\nnewline\"", "\"\xc0\xaf overlong\"", "\"\xed\xa0\x80\"",
+        "\"\xf4\x90\x80\x80 too large\"", "\"\x80 lone continuation\"",
+        "\"\xe2\x82 truncated\"", "{} trailing",
+        // Rejected by the protobuf JSON parser too.
+        R"({"a": 1, "b": {"a": 2}, "a": 3})", R"({"a": 1, "\u0061": 2})",
+        "1e400", "-1e400", R"("\ud800")",
+        R"("\ud800\u0041")", R"("\udc00")"));
+
+TEST(JsonValidatorTest, ErrorsGiveTheOffset) {
+  EXPECT_THAT(ValidateJson(R"({"a": [1, 2,]})"),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       Eq("Invalid JSON at byte 12: expected a value")));
+}
+
+TEST(JsonValidatorTest, RangeAndKeyErrorsGiveTheOffset) {
+  EXPECT_THAT(ValidateJson(R"({"a": 1e400})"),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       Eq("Invalid JSON at byte 6: expected a number in the "
+                          "range of a double")));
+  EXPECT_THAT(ValidateJson(R"({"a": 1, "a": 2})"),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       Eq("Invalid JSON at byte 9: expected a key not already "
+                          "in the object")));
+  EXPECT_THAT(ValidateJson(std::string(308, '9')), IsOk());
+  EXPECT_THAT(ValidateJson(std::string(309, '9')),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("expected a number in the range")));
+}
+
+TEST(JsonValidatorTest, ObjectsAreRequiredWhenAsked) {
+  EXPECT_THAT(ValidateJsonObject(R"({"a": 1})"), IsOk());
+  EXPECT_THAT(ValidateJsonObject(" {}"), IsOk());
+  EXPECT_THAT(ValidateJsonObject("[]"),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("expected an object")));
+}
+
+TEST(JsonValidatorTest, NestingIsLimited) {
+  std::string nested = absl::StrCat(std::string(kMaxJsonDepth, '['),
+                                    std::string(kMaxJsonDepth, ']'));
+  EXPECT_THAT(ValidateJson(nested), IsOk());
+  EXPECT_THAT(ValidateJson(absl::StrCat("[", nested, "]")),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr("expected less nesting")));
+}
+
+TEST(JsonValidatorTest, StringsAreUnescaped) {
+  absl::string_view json =
+      R"({"key": "a \"quoted\" \\ path\/ \n\t \u00e9 \ud83d\ude00", "next")";
+  std::string value;
+  size_t end = UnescapeJsonString(json, json.find(": \"") + 3, value);
+  EXPECT_EQ(value, "a \"quoted\" \\ path/ \n\t \xc3\xa9 \xf0\x9f\x98\x80");
+  EXPECT_EQ(json.substr(end), R"(, "next")");
+}
+
+TEST(JsonValidatorTest, InvalidStringsAreNotUnescaped) {
+  std::string value;
+  EXPECT_EQ(UnescapeJsonString(R"("unterminated)", 1, value),
+            std::string::npos);
+  EXPECT_EQ(UnescapeJsonString(R"("lone \udc00 surrogate")", 1, value),
+            std::string::npos);
+  EXPECT_EQ(UnescapeJsonString(R"("bad \q")", 1, value), std::string::npos);
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
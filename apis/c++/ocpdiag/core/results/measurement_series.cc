@@ -7,22 +7,23 @@
 #include "ocpdiag/core/results/measurement_series.h"
 
 #include <iostream>
+#include <utility>
 
 #include "google/protobuf/timestamp.pb.h"
 #include "absl/log/check.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/clock.h"
 #include "ocpdiag/core/results/proto_converters.h"
 #include "ocpdiag/core/results/results.pb.h"
 #include "ocpdiag/core/results/struct_validators.h"
 #include "ocpdiag/core/results/structs.h"
 #include "ocpdiag/core/results/test_step.h"
-#include "google/protobuf/util/time_util.h"
+#include "ocpdiag/core/results/variant.h"
 
 namespace ocpdiag::results {
 
-using google::protobuf::util::TimeUtil;
-
 MeasurementSeries::MeasurementSeries(const MeasurementSeriesStart& start,
                                      TestStep& test_step)
     : test_step_(test_step),
@@ -31,9 +32,9 @@ MeasurementSeries::MeasurementSeries(const MeasurementSeriesStart& start,
       << "MeasurementSeries can only be created with active TestSteps";
   ValidateStructOrDie(start);
   if (!start.validators.empty()) {
-    // Validation garuntees that all validators have the same type, so we can
-    // use the index of the first one
-    SetAndCheckSeriesType(start.validators[0].value[0].index());
+    // Validation garuntees that all validators have the same kind of value, so
+    // we can use the kind of the first one
+    SetAndCheckSeriesKind(KindOf(start.validators[0].value[0]));
   }
   EmitStart(start);
 }
@@ -44,20 +45,30 @@ void MeasurementSeries::EmitStart(const MeasurementSeriesStart& start) {
   proto.mutable_measurement_series_start()->set_measurement_series_id(
       series_id_);
   AssignStepIdAndEmitArtifact(proto);
-  GetArtifactWriter().Flush();
+  GetArtifactWriter().FlushAtBoundary();
 }
 
 void MeasurementSeries::AddElement(const MeasurementSeriesElement& element) {
-  google::protobuf::Timestamp now = TimeUtil::GetCurrentTime();
-  SetAndCheckSeriesType(element.value.index());
+  absl::Time now = test_step_.GetTestRun().GetClock().Now();
+  SetAndCheckSeriesKind(KindOf(element.value));
+  EmitElement(internal::StructToProto(element), now);
+}
 
-  ocpdiag_results_v2_pb::TestStepArtifact step_proto;
-  *step_proto.mutable_measurement_series_element() =
-      internal::StructToProto(element);
+void MeasurementSeries::AddElement(MeasurementSeriesElement&& element) {
+  absl::Time now = test_step_.GetTestRun().GetClock().Now();
+  SetAndCheckSeriesKind(KindOf(element.value));
+  EmitElement(internal::StructToProto(std::move(element)), now);
+}
 
+void MeasurementSeries::EmitElement(
+    ocpdiag_results_v2_pb::MeasurementSeriesElement element, absl::Time now) {
+  ocpdiag_results_v2_pb::TestStepArtifact step_proto;
   ocpdiag_results_v2_pb::MeasurementSeriesElement* element_proto =
       step_proto.mutable_measurement_series_element();
-  if (!element.timestamp.has_value()) *element_proto->mutable_timestamp() = now;
+  *element_proto = std::move(element);
+  // Elements without a timestamp are stamped with the time they were added.
+  if (!element_proto->has_timestamp())
+    *element_proto->mutable_timestamp() = internal::TimeToTimestamp(now);
   element_proto->set_index(element_count_.Next());
   element_proto->set_measurement_series_id(series_id_);
 
@@ -68,10 +79,10 @@ void MeasurementSeries::AddElement(const MeasurementSeriesElement& element) {
   AssignStepIdAndEmitArtifact(step_proto);
 }
 
-void MeasurementSeries::SetAndCheckSeriesType(int type_index) {
+void MeasurementSeries::SetAndCheckSeriesKind(VariantKind kind) {
   absl::MutexLock lock(&mutex_);
-  if (type_index_ == -1) type_index_ = type_index;
-  CHECK(type_index_ == type_index)
+  if (!kind_.has_value()) kind_ = kind;
+  CHECK(*kind_ == kind)
       << "All validators and elements in a measurement series "
          "must have the same type.";
 }
@@ -99,13 +110,13 @@ void MeasurementSeries::EmitEnd() {
   end_proto->set_measurement_series_id(series_id_);
   end_proto->set_total_count(element_count_.Next());
   AssignStepIdAndEmitArtifact(step_proto);
-  GetArtifactWriter().Flush();
+  GetArtifactWriter().FlushAtBoundary();
 }
 
 void MeasurementSeries::AssignStepIdAndEmitArtifact(
     ocpdiag_results_v2_pb::TestStepArtifact& artifact) {
-  artifact.set_test_step_id(series_id_);
-  GetArtifactWriter().Write(artifact);
+  artifact.set_test_step_id(test_step_.Id());
+  GetArtifactWriter().Write(std::move(artifact));
 }
 
 internal::ArtifactWriter& MeasurementSeries::GetArtifactWriter() {
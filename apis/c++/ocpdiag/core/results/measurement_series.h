@@ -7,15 +7,18 @@
 #ifndef OCPDIAG_CORE_RESULTS_OCP_MEASUREMENT_SERIES_H_
 #define OCPDIAG_CORE_RESULTS_OCP_MEASUREMENT_SERIES_H_
 
+#include <optional>
 #include <string>
 
 #include "absl/base/thread_annotations.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "ocpdiag/core/results/artifact_writer.h"
 #include "ocpdiag/core/results/int_incrementer.h"
 #include "ocpdiag/core/results/results.pb.h"
 #include "ocpdiag/core/results/structs.h"
 #include "ocpdiag/core/results/test_step.h"
+#include "ocpdiag/core/results/variant.h"
 
 namespace ocpdiag::results {
 
@@ -28,9 +31,11 @@ class MeasurementSeries {
 
   // Adds an element to the MeasurementSeries. Elements cannot be added once the
   // series or its assocated test step has been ended. All elements must be the
-  // same type as each other and the Validators included in
-  // MeasurementSeriesStart, if any.
+  // same kind of value as each other and the Validators included in
+  // MeasurementSeriesStart, if any. The rvalue overload moves a string value
+  // into the emitted artifact instead of copying it.
   void AddElement(const MeasurementSeriesElement& element);
+  void AddElement(MeasurementSeriesElement&& element);
 
   // Ends the series. Ending the series after the associated test step will
   // cause a failure.
@@ -45,7 +50,10 @@ class MeasurementSeries {
  private:
   void EmitStart(const MeasurementSeriesStart& start);
   void EmitEnd() ABSL_SHARED_LOCKS_REQUIRED(mutex_);
-  void SetAndCheckSeriesType(int type_index);
+  void SetAndCheckSeriesKind(VariantKind kind);
+  void EmitElement(ocpdiag_results_v2_pb::MeasurementSeriesElement element,
+                   absl::Time now);
+  // Moves the artifact to the artifact writer, leaving it empty.
   void AssignStepIdAndEmitArtifact(
       ocpdiag_results_v2_pb::TestStepArtifact& artifact);
   internal::ArtifactWriter& GetArtifactWriter();
@@ -56,7 +64,7 @@ class MeasurementSeries {
 
   mutable absl::Mutex mutex_;
   bool ended_ ABSL_GUARDED_BY(mutex_) = false;
-  int type_index_ ABSL_GUARDED_BY(mutex_) = -1;
+  std::optional<VariantKind> kind_ ABSL_GUARDED_BY(mutex_);
 };
 
 }  // namespace ocpdiag::results
@@ -6,11 +6,14 @@
 
 #include "ocpdiag/core/results/measurement_series.h"
 
+#include <cstdint>
 #include <string>
 #include <variant>
 
 #include "gtest/gtest.h"
 #include "absl/log/check.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/clock.h"
 #include "ocpdiag/core/results/dut_info.h"
 #include "ocpdiag/core/results/output_receiver.h"
 #include "ocpdiag/core/results/structs.h"
@@ -125,6 +128,19 @@ TEST_F(MeasurementSeriesTest, MeasurementSeriesElementIsEmittedProperly) {
   EXPECT_EQ(model.elements[0].measurement_series_id, "0");
 }
 
+TEST_F(MeasurementSeriesTest, IntegerAndDoubleElementsMix) {
+  series_.AddElement({.value = 1.5});
+  series_.AddElement({.value = int64_t{-2}});
+  series_.AddElement({.value = uint64_t{1} << 63});
+  run_.GetArtifactWriter().Flush();
+
+  MeasurementSeriesModel model = GetMeasurementSeriesModelIfValid(receiver_);
+  ASSERT_EQ(model.elements.size(), 3);
+  EXPECT_EQ(std::get<double>(model.elements[0].value), 1.5);
+  EXPECT_EQ(std::get<int64_t>(model.elements[1].value), -2);
+  EXPECT_EQ(std::get<uint64_t>(model.elements[2].value), uint64_t{1} << 63);
+}
+
 TEST_F(MeasurementSeriesTest, TimestampIsAssignedToElementWhenNoneIsProvided) {
   series_.AddElement({.value = 123.});
   run_.GetArtifactWriter().Flush();
@@ -134,6 +150,28 @@ TEST_F(MeasurementSeriesTest, TimestampIsAssignedToElementWhenNoneIsProvided) {
   EXPECT_NE(model.elements[0].timestamp.tv_sec, 0);
 }
 
+TEST(MeasurementSeriesClockTest, TimestampIsTakenFromTheRunClock) {
+  FakeClock clock(absl::FromUnixMicros(1'000'000'250));
+  OutputReceiver receiver;
+  {
+    TestRun run(
+        {
+            .name = "mlc_test",
+            .version = "1.0",
+            .command_line = "mlc/mlc --use_default_thresholds=true",
+        },
+        receiver.MakeArtifactWriter(&clock));
+    TestStep step = MakeTestStep(run);
+    MeasurementSeries series = MakeMeasurementSeries(step);
+    series.AddElement({.value = 123.});
+  }
+
+  MeasurementSeriesModel model = GetMeasurementSeriesModelIfValid(receiver);
+  ASSERT_EQ(model.elements.size(), 1);
+  EXPECT_EQ(model.elements[0].timestamp.tv_sec, 1000);
+  EXPECT_EQ(model.elements[0].timestamp.tv_usec, 250);
+}
+
 TEST_F(MeasurementSeriesTest, ElementIndexAndIncrementsProperly) {
   int element_count = 5;
   MeasurementSeriesElement element = {.value = 123.};
@@ -189,6 +227,33 @@ TEST_F(MeasurementSeriesTest, OnlyOneEndArtifactIsEmittedIfEndedIsCalledTwice) {
   EXPECT_EQ(artifact_count, 5);
 }
 
+TEST(MeasurementSeriesStepTest, SeriesArtifactsAreFiledUnderTheirStep) {
+  OutputReceiver receiver;
+  TestRun run = MakeTestRun(receiver);
+  StartTestRun(run);
+  TestStep first_step("first step", run);
+  TestStep second_step("second step", run);
+  MeasurementSeries first_series({.name = "first series"}, second_step);
+  MeasurementSeries second_series({.name = "second series"}, first_step);
+  first_series.AddElement({.value = 1.});
+  second_series.AddElement({.value = 2.});
+  first_series.End();
+  second_series.End();
+
+  OutputModel model = receiver.GetOutputModel();
+  ASSERT_EQ(model.test_steps.size(), 2);
+  ASSERT_EQ(model.test_steps[0].measurement_series.size(), 1);
+  ASSERT_EQ(model.test_steps[1].measurement_series.size(), 1);
+  MeasurementSeriesModel& first = model.test_steps[1].measurement_series[0];
+  MeasurementSeriesModel& second = model.test_steps[0].measurement_series[0];
+  EXPECT_EQ(first.start.name, "first series");
+  EXPECT_EQ(first.elements.size(), 1);
+  EXPECT_EQ(first.end.total_count, 1);
+  EXPECT_EQ(second.start.name, "second series");
+  EXPECT_EQ(second.elements.size(), 1);
+  EXPECT_EQ(second.end.total_count, 1);
+}
+
 }  // namespace
 
 }  // namespace ocpdiag::results
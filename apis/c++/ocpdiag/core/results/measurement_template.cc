@@ -0,0 +1,62 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/measurement_template.h"
+
+#include <memory>
+#include <utility>
+
+#include "absl/log/check.h"
+#include "ocpdiag/core/results/proto_converters.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/struct_validators.h"
+#include "ocpdiag/core/results/structs.h"
+#include "ocpdiag/core/results/variant.h"
+
+namespace ocpdiag::results {
+
+RegisteredSubcomponent::RegisteredSubcomponent(
+    const Subcomponent& subcomponent) {
+  ValidateStructOrDie(subcomponent);
+  data_ = std::make_shared<const Data>(Data{
+      .subcomponent = subcomponent,
+      .proto = internal::StructToProto(subcomponent),
+  });
+}
+
+MeasurementTemplate::MeasurementTemplate(const MeasurementInfo& info)
+    : validators_(info.validators) {
+  CHECK(!info.name.empty())
+      << "Must specify the name field of the measurement info struct";
+  proto_.set_name(info.name);
+  proto_.set_unit(info.unit);
+  if (info.hardware_info.has_value())
+    proto_.set_hardware_info_id(info.hardware_info->id());
+  if (info.subcomponent.has_value())
+    *proto_.mutable_subcomponent() = info.subcomponent->proto();
+  if (internal::KeepRawJsonOrDie(info.metadata_json)) {
+    proto_.set_metadata_raw_json(info.metadata_json);
+  } else {
+    *proto_.mutable_metadata() = internal::JsonToProtoOrDie(info.metadata_json);
+  }
+  *proto_.mutable_validators() = validators_.protos();
+}
+
+void MeasurementTemplate::ToProto(
+    const Variant& value, ocpdiag_results_v2_pb::Measurement& proto) const {
+  validators_.CheckValueTypeOrDie(value, proto_.name());
+  proto = proto_;
+  internal::SetValue(value, proto);
+}
+
+void MeasurementTemplate::ToProto(
+    Variant&& value, ocpdiag_results_v2_pb::Measurement& proto) const {
+  validators_.CheckValueTypeOrDie(value, proto_.name());
+  proto = proto_;
+  internal::SetValue(std::move(value), proto);
+}
+
+}  // namespace ocpdiag::results
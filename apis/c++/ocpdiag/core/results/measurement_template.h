@@ -0,0 +1,83 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_MEASUREMENT_TEMPLATE_H_
+#define OCPDIAG_CORE_RESULTS_MEASUREMENT_TEMPLATE_H_
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "ocpdiag/core/results/compiled_validators.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/structs.h"
+#include "ocpdiag/core/results/variant.h"
+
+namespace ocpdiag::results {
+
+// A subcomponent that is validated and converted to its proto form once, to be
+// shared by the measurements that refer to it. Copies are cheap and share the
+// same converted subcomponent.
+class RegisteredSubcomponent {
+ public:
+  explicit RegisteredSubcomponent(const Subcomponent& subcomponent);
+
+  const Subcomponent& subcomponent() const { return data_->subcomponent; }
+
+  // Returns the proto form of the subcomponent. This is intended for internal
+  // use only.
+  const ocpdiag_results_v2_pb::Subcomponent& proto() const {
+    return data_->proto;
+  }
+
+ private:
+  struct Data {
+    Subcomponent subcomponent;
+    ocpdiag_results_v2_pb::Subcomponent proto;
+  };
+  std::shared_ptr<const Data> data_;
+};
+
+// The fields of a Measurement that do not change between repeated
+// measurements of the same quantity.
+struct MeasurementInfo {
+  std::string name;  // Required
+  std::string unit;
+  std::optional<RegisteredHardwareInfo> hardware_info;
+  std::optional<RegisteredSubcomponent> subcomponent;
+  std::vector<Validator> validators;
+  std::string metadata_json;
+};
+
+// A measurement whose fixed fields are validated and converted to their proto
+// form once, typically once per test, so that repeated measurements only
+// supply their value, see TestStep::AddMeasurement. It is immutable and can be
+// shared between threads.
+class MeasurementTemplate {
+ public:
+  explicit MeasurementTemplate(const MeasurementInfo& info);
+
+  const std::string& name() const { return proto_.name(); }
+
+  // Builds the measurement with `value` in `proto`, which must have the type of
+  // the validators, if any. The measurement is built in place, typically in
+  // the artifact to be written and on its arena, so that the fixed fields are
+  // copied once. This is intended for internal use only.
+  void ToProto(const Variant& value,
+               ocpdiag_results_v2_pb::Measurement& proto) const;
+  void ToProto(Variant&& value,
+               ocpdiag_results_v2_pb::Measurement& proto) const;
+
+ private:
+  CompiledValidatorSet validators_;
+  // The measurement without its value.
+  ocpdiag_results_v2_pb::Measurement proto_;
+};
+
+}  // namespace ocpdiag::results
+
+#endif  // OCPDIAG_CORE_RESULTS_MEASUREMENT_TEMPLATE_H_
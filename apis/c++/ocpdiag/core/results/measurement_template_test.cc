@@ -0,0 +1,146 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/measurement_template.h"
+
+#include <cstdint>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "google/protobuf/arena.h"
+#include "ocpdiag/core/results/dut_info.h"
+#include "ocpdiag/core/results/proto_converters.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/structs.h"
+#include "ocpdiag/core/testing/proto_matchers.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+using ::ocpdiag::testing::EqualsProto;
+
+Subcomponent GetExampleSubcomponent() {
+  return {
+      .name = "FAN1",
+      .type = SubcomponentType::kConnector,
+      .location = "F0_1",
+      .version = "1",
+      .revision = "1",
+  };
+}
+
+std::vector<Validator> GetExampleValidators() {
+  return {{
+              .type = ValidatorType::kLessThanOrEqual,
+              .value = {11000.0},
+              .name = "80mm_fan_upper_limit",
+          },
+          {
+              .type = ValidatorType::kGreaterThanOrEqual,
+              .value = {8000.0},
+              .name = "80mm_fan_lower_limit",
+          }};
+}
+
+TEST(RegisteredSubcomponentTest, CopiesShareTheConvertedSubcomponent) {
+  RegisteredSubcomponent subcomponent(GetExampleSubcomponent());
+  RegisteredSubcomponent copy = subcomponent;
+  EXPECT_EQ(&copy.proto(), &subcomponent.proto());
+  EXPECT_EQ(copy.subcomponent(), GetExampleSubcomponent());
+  EXPECT_EQ(copy.proto().name(), "FAN1");
+}
+
+TEST(RegisteredSubcomponentDeathTest, InvalidSubcomponentCausesDeath) {
+  EXPECT_DEATH(RegisteredSubcomponent({.location = "F0_1"}),
+               "Must specify the name");
+}
+
+TEST(MeasurementTemplateTest, MatchesTheConvertedMeasurement) {
+  DutInfo dut_info("dut", "id");
+  RegisteredHardwareInfo hardware_info =
+      dut_info.AddHardwareInfo({.name = "hw_info"});
+  MeasurementTemplate measurement_template({
+      .name = "measured-fan-speed-100",
+      .unit = "RPM",
+      .hardware_info = hardware_info,
+      .subcomponent = RegisteredSubcomponent(GetExampleSubcomponent()),
+      .validators = GetExampleValidators(),
+      .metadata_json = R"json({"some": "JSON"})json",
+  });
+
+  for (double value : {9502.3, 10000.}) {
+    Measurement measurement = {
+        .name = "measured-fan-speed-100",
+        .unit = "RPM",
+        .hardware_info = hardware_info,
+        .subcomponent = GetExampleSubcomponent(),
+        .validators = GetExampleValidators(),
+        .value = value,
+        .metadata_json = R"json({"some": "JSON"})json",
+    };
+    ocpdiag_results_v2_pb::Measurement proto;
+    measurement_template.ToProto(value, proto);
+    EXPECT_THAT(proto, EqualsProto(internal::StructToProto(measurement)));
+  }
+}
+
+TEST(MeasurementTemplateTest, AcceptsAnyValueTypeWithoutValidators) {
+  MeasurementTemplate measurement_template({.name = "fan-state"});
+  ocpdiag_results_v2_pb::Measurement proto;
+  measurement_template.ToProto("spinning", proto);
+  EXPECT_EQ(proto.value().string_value(), "spinning");
+  measurement_template.ToProto(true, proto);
+  EXPECT_TRUE(proto.value().bool_value());
+}
+
+TEST(MeasurementTemplateTest, IntegersKeepTheirExactValue) {
+  MeasurementTemplate measurement_template(
+      {.name = "fan", .validators = GetExampleValidators()});
+  ocpdiag_results_v2_pb::Measurement proto;
+  int64_t value = (int64_t{1} << 53) + 1;
+  measurement_template.ToProto(value, proto);
+  EXPECT_EQ(proto.value().number_value(), static_cast<double>(value));
+  EXPECT_EQ(proto.integer_value().int64_value(), value);
+  measurement_template.ToProto(2., proto);
+  EXPECT_FALSE(proto.has_integer_value());
+}
+
+TEST(MeasurementTemplateTest, BuildsOnTheArenaOfTheProto) {
+  MeasurementTemplate measurement_template(
+      {.name = "fan", .validators = GetExampleValidators()});
+  google::protobuf::Arena arena;
+  auto* proto = google::protobuf::Arena::CreateMessage<
+      ocpdiag_results_v2_pb::Measurement>(&arena);
+  measurement_template.ToProto(9502.3, *proto);
+  EXPECT_EQ(proto->GetArena(), &arena);
+  EXPECT_EQ(proto->validators(0).GetArena(), &arena);
+  EXPECT_EQ(proto->value().number_value(), 9502.3);
+}
+
+TEST(MeasurementTemplateDeathTest, MissingNameCausesDeath) {
+  EXPECT_DEATH(MeasurementTemplate({.unit = "RPM"}), "Must specify the name");
+}
+
+TEST(MeasurementTemplateDeathTest, MixedValidatorTypesCauseDeath) {
+  std::vector<Validator> validators = GetExampleValidators();
+  validators.push_back({.type = ValidatorType::kEqual, .value = {"x"}});
+  EXPECT_DEATH(MeasurementTemplate({.name = "fan", .validators = validators}),
+               "must be the same type");
+}
+
+TEST(MeasurementTemplateDeathTest, ValueOfTheWrongTypeCausesDeath) {
+  MeasurementTemplate measurement_template(
+      {.name = "fan", .validators = GetExampleValidators()});
+  ocpdiag_results_v2_pb::Measurement proto;
+  EXPECT_DEATH(measurement_template.ToProto("fast", proto),
+               "must be the same type");
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results
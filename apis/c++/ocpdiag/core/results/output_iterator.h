@@ -7,34 +7,42 @@
 #ifndef OCPDIAG_CORE_RESULTS_OUTPUT_ITERATOR_H_
 #define OCPDIAG_CORE_RESULTS_OUTPUT_ITERATOR_H_
 
+#include <cstddef>
 #include <memory>
 #include <optional>
 #include <string>
 
 #include "absl/log/check.h"
+#include "ocpdiag/core/results/artifact_sink.h"
+#include "ocpdiag/core/results/interned_records.h"
 #include "ocpdiag/core/results/proto_converters.h"
 #include "ocpdiag/core/results/results.pb.h"
 #include "ocpdiag/core/results/structs.h"
-#include "riegeli/bytes/fd_reader.h"
-#include "riegeli/records/record_reader.h"
 
 namespace ocpdiag::results {
 
 // Satisfies the interface for range-based for loops in C++, to allow you to
 // iterate through OCPDiag test OutputArtifacts by pointing this class to the
-// recordio OCPDiag output. It crashes if errors are encountered, so this is not
-// suitable for production code. It is intended for unit tests only.
+// recordio OCPDiag output or to an in-memory sink. It crashes if errors are
+// encountered, so this is not suitable for production code. It is intended for
+// unit tests only.
 class OutputIterator {
  public:
   // Constructs a new iterator, pointing to the first OutputArtifact (if any).
   // If file_path is left unset, it will construct an invalid iterator.
   OutputIterator(std::optional<absl::string_view> file_path = std::nullopt) {
     if (!file_path.has_value()) return;
-    reader_ = std::make_unique<riegeli::RecordReader<riegeli::FdReader<>>>(
-        riegeli::FdReader{*file_path});
+    reader_ = std::make_unique<internal::ResultsFileReader>(*file_path);
     ++(*this);  // advance ourselves so we always start on the first item
   }
 
+  // Constructs a new iterator over the artifacts held by an in-memory sink,
+  // pointing to the first OutputArtifact (if any).
+  OutputIterator(std::shared_ptr<const internal::InMemoryArtifactSink> sink)
+      : sink_(std::move(sink)) {
+    ++(*this);
+  }
+
   // Dereferences the iterator.
   OutputArtifact &operator*() { return output_; }
   OutputArtifact *operator->() { return &output_; }
@@ -42,7 +50,15 @@ class OutputIterator {
   // Advances the iterator.
   OutputIterator &operator++() {
     ocpdiag_results_v2_pb::OutputArtifact output_proto;
-    if (!reader_->ReadRecord(output_proto)) {
+    if (sink_ != nullptr) {
+      if (!sink_->Read(next_index_++, output_proto)) {
+        sink_.reset();
+        return *this;
+      }
+      output_ = internal::ProtoToStruct(output_proto);
+      return *this;
+    }
+    if (!reader_->ReadArtifact(output_proto)) {
       CHECK_OK(reader_->status()) << "Failed while reading recordio";
       reader_.reset();
       return *this;
@@ -53,7 +69,7 @@ class OutputIterator {
 
   // The boolean operator can also be used to tell if the iterator still has
   // data left to consume.
-  operator bool() const { return reader_ != nullptr; }
+  operator bool() const { return reader_ != nullptr || sink_ != nullptr; }
 
   // We can only compare valid iterator vs. invalid, but we can't tell the
   // difference between two valid iterators.
@@ -62,7 +78,9 @@ class OutputIterator {
   }
 
  private:
-  std::unique_ptr<riegeli::RecordReader<riegeli::FdReader<>>> reader_;
+  std::unique_ptr<internal::ResultsFileReader> reader_;
+  std::shared_ptr<const internal::InMemoryArtifactSink> sink_;
+  size_t next_index_ = 0;
   OutputArtifact output_;
 };
 
@@ -80,13 +98,22 @@ class OutputContainer {
   // The container will read from the given file_path.
   OutputContainer(absl::string_view file_path) : file_path_(file_path) {}
 
+  // The container will read from the given in-memory sink.
+  OutputContainer(std::shared_ptr<const internal::InMemoryArtifactSink> sink)
+      : sink_(std::move(sink)) {}
+
+  // Returns the file path, which is empty for in-memory containers.
   absl::string_view file_path() const { return file_path_; }
 
-  const_iterator begin() const { return OutputIterator(file_path_); }
+  const_iterator begin() const {
+    if (sink_ != nullptr) return OutputIterator(sink_);
+    return OutputIterator(file_path_);
+  }
   const_iterator end() const { return OutputIterator(); }
 
  private:
   std::string file_path_;
+  std::shared_ptr<const internal::InMemoryArtifactSink> sink_;
 };
 
 }  // namespace ocpdiag::results
@@ -6,9 +6,12 @@
 
 #include "ocpdiag/core/results/output_iterator.h"
 
+#include <memory>
 #include <string>
+#include <variant>
 
 #include "gtest/gtest.h"
+#include "ocpdiag/core/results/artifact_sink.h"
 #include "ocpdiag/core/results/results.pb.h"
 #include "ocpdiag/core/testing/file_utils.h"
 #include "ocpdiag/core/testing/parse_text_proto.h"
@@ -66,6 +69,27 @@ TEST_F(OutputIteratorTest, ContainerWorksInRangeBasedForLoop) {
   EXPECT_EQ(cnt, num_protos_);
 }
 
+TEST(OutputIteratorInMemoryTest, ContainerIteratesOverSink) {
+  auto sink = std::make_shared<internal::InMemoryArtifactSink>();
+  OutputContainer container(sink);
+  EXPECT_EQ(container.file_path(), "");
+  EXPECT_FALSE(container.begin());
+
+  for (int i = 0; i < 3; i++) {
+    ocpdiag_results_v2_pb::OutputArtifact artifact;
+    artifact.mutable_schema_version()->set_major(i);
+    sink->Write(artifact);
+  }
+
+  int cnt = 0;
+  for (const OutputArtifact& artifact : container) {
+    auto* schema_version = std::get_if<SchemaVersionOutput>(&artifact.artifact);
+    ASSERT_NE(schema_version, nullptr);
+    EXPECT_EQ(schema_version->major, cnt++);
+  }
+  EXPECT_EQ(cnt, 3);
+}
+
 TEST(OutputIteratorDeathTest, BadFilepathCausesDeath) {
   EXPECT_DEATH(OutputIterator(""), "");
   EXPECT_DEATH(OutputIterator("path-doesnt-exist"), "");
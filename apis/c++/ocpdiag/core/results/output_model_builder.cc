@@ -0,0 +1,297 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/output_model_builder.h"
+
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "absl/log/log.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/structs.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+// Ids up to this value are interned through a vector.
+constexpr int kMaxDenseId = 1 << 20;
+
+// Returns the value of an id written as a canonical decimal integer below
+// kMaxDenseId, or -1 for any other id.
+int ParseDenseId(absl::string_view id) {
+  if (id.empty() || id.size() > 7 || (id.size() > 1 && id[0] == '0'))
+    return -1;
+  int value = 0;
+  for (char c : id) {
+    if (c < '0' || c > '9') return -1;
+    value = value * 10 + (c - '0');
+  }
+  return value < kMaxDenseId ? value : -1;
+}
+
+}  // namespace
+
+int OutputModelBuilder::IdInterner::Find(absl::string_view id) const {
+  if (int dense_id = ParseDenseId(id); dense_id >= 0)
+    return dense_id < static_cast<int>(dense_.size()) ? dense_[dense_id] : -1;
+  auto it = sparse_.find(id);
+  return it == sparse_.end() ? -1 : it->second;
+}
+
+int OutputModelBuilder::IdInterner::Intern(absl::string_view id) {
+  int* value;
+  if (int dense_id = ParseDenseId(id); dense_id >= 0) {
+    if (dense_id >= static_cast<int>(dense_.size()))
+      dense_.resize(dense_id + 1, -1);
+    value = &dense_[dense_id];
+  } else {
+    value = &sparse_.try_emplace(id, -1).first->second;
+  }
+  if (*value == -1) *value = size_++;
+  return *value;
+}
+
+void OutputModelBuilder::Add(const OutputArtifact& artifact) {
+  artifact_count_++;
+  if (auto* test_run = std::get_if<TestRunArtifact>(&artifact.artifact);
+      test_run != nullptr) {
+    AddTestRunArtifact(*test_run);
+  } else if (auto* test_step =
+                 std::get_if<TestStepArtifact>(&artifact.artifact);
+             test_step != nullptr) {
+    AddTestStepArtifact(*test_step);
+  } else if (auto* schema_version =
+                 std::get_if<SchemaVersionOutput>(&artifact.artifact);
+             schema_version != nullptr) {
+    model_.schema_version = *schema_version;
+  } else {
+    LOG(FATAL) << "Tried to parse an invalid output artifact.";
+  }
+}
+
+void OutputModelBuilder::Reset() { *this = OutputModelBuilder(); }
+
+void OutputModelBuilder::AddTestRunArtifact(const TestRunArtifact& artifact) {
+  if (auto* test_run_start =
+          std::get_if<TestRunStartOutput>(&artifact.artifact);
+      test_run_start != nullptr) {
+    model_.test_run.start = *test_run_start;
+  } else if (auto* test_run_end =
+                 std::get_if<TestRunEndOutput>(&artifact.artifact);
+             test_run_end != nullptr) {
+    model_.test_run.end = *test_run_end;
+  } else if (auto* log = std::get_if<LogOutput>(&artifact.artifact);
+             log != nullptr) {
+    model_.test_run.pre_start_logs.push_back(*log);
+  } else if (auto* error = std::get_if<ErrorOutput>(&artifact.artifact);
+             error != nullptr) {
+    model_.test_run.pre_start_errors.push_back(*error);
+  } else {
+    LOG(FATAL) << "Tried to parse an invalid test run artifact.";
+  }
+}
+
+void OutputModelBuilder::AddTestStepArtifact(const TestStepArtifact& artifact) {
+  int idx = GetTestStepIdx(artifact.test_step_id);
+  TestStepModel& step = model_.test_steps[idx];
+  if (auto* test_step_start =
+          std::get_if<TestStepStartOutput>(&artifact.artifact);
+      test_step_start != nullptr) {
+    step.start = *test_step_start;
+  } else if (auto* test_step_end =
+                 std::get_if<TestStepEndOutput>(&artifact.artifact);
+             test_step_end != nullptr) {
+    step.end = *test_step_end;
+  } else if (auto* log = std::get_if<LogOutput>(&artifact.artifact);
+             log != nullptr) {
+    step.logs.push_back(*log);
+  } else if (auto* error = std::get_if<ErrorOutput>(&artifact.artifact);
+             error != nullptr) {
+    step.errors.push_back(*error);
+  } else if (auto* file = std::get_if<FileOutput>(&artifact.artifact);
+             file != nullptr) {
+    step.files.push_back(*file);
+  } else if (auto* extension = std::get_if<ExtensionOutput>(&artifact.artifact);
+             extension != nullptr) {
+    step.extensions.push_back(*extension);
+  } else if (auto* measurement_series_start =
+                 std::get_if<MeasurementSeriesStartOutput>(&artifact.artifact);
+             measurement_series_start != nullptr) {
+    ItemRef ref = GetMeasurementSeries(
+        measurement_series_start->measurement_series_id, idx);
+    SeriesAt(ref).start = *measurement_series_start;
+    if (!measurement_series_start->hardware_info_id.empty()) {
+      series_by_hardware_info_id_[measurement_series_start->hardware_info_id]
+          .push_back(ref);
+    }
+  } else if (auto* measurement_series_element =
+                 std::get_if<MeasurementSeriesElementOutput>(
+                     &artifact.artifact);
+             measurement_series_element != nullptr) {
+    SeriesAt(GetMeasurementSeries(
+                 measurement_series_element->measurement_series_id, idx))
+        .elements.push_back(*measurement_series_element);
+  } else if (auto* measurement_series_end =
+                 std::get_if<MeasurementSeriesEndOutput>(&artifact.artifact);
+             measurement_series_end != nullptr) {
+    SeriesAt(GetMeasurementSeries(measurement_series_end->measurement_series_id,
+                                  idx))
+        .end = *measurement_series_end;
+  } else if (auto* measurement =
+                 std::get_if<MeasurementOutput>(&artifact.artifact);
+             measurement != nullptr) {
+    ItemRef ref = {idx, static_cast<int>(step.measurements.size())};
+    step.measurements.push_back(*measurement);
+    measurements_by_name_[measurement->name].push_back(ref);
+  } else if (auto* diagnosis = std::get_if<DiagnosisOutput>(&artifact.artifact);
+             diagnosis != nullptr) {
+    ItemRef ref = {idx, static_cast<int>(step.diagnoses.size())};
+    step.diagnoses.push_back(*diagnosis);
+    diagnoses_by_verdict_[diagnosis->verdict].push_back(ref);
+    diagnoses_by_type_[diagnosis->type].push_back(ref);
+    if (!diagnosis->hardware_info_id.empty())
+      diagnoses_by_hardware_info_id_[diagnosis->hardware_info_id].push_back(
+          ref);
+  } else {
+    LOG(FATAL) << "Tried to parse an invalid test step artifact.";
+  }
+}
+
+int OutputModelBuilder::GetTestStepIdx(const std::string& test_step_id) {
+  int idx = step_ids_.Intern(test_step_id);
+  if (idx == static_cast<int>(model_.test_steps.size()))
+    model_.test_steps.push_back(TestStepModel({.test_step_id = test_step_id}));
+  return idx;
+}
+
+// Series are filed under the step of their artifacts, by a (step, series)
+// index of interned ids.
+OutputModelBuilder::ItemRef OutputModelBuilder::GetMeasurementSeries(
+    const std::string& measurement_series_id, int step_idx) {
+  int series = series_ids_.Intern(measurement_series_id);
+  auto [it, inserted] = step_series_.try_emplace({step_idx, series}, 0);
+  if (inserted) {
+    std::vector<MeasurementSeriesModel>& step_series =
+        model_.test_steps[step_idx].measurement_series;
+    it->second = static_cast<int>(step_series.size());
+    step_series.push_back(MeasurementSeriesModel());
+    if (series == static_cast<int>(series_refs_.size()))
+      series_refs_.push_back({step_idx, it->second});
+  }
+  return {step_idx, it->second};
+}
+
+const TestStepModel* OutputModelBuilder::FindTestStep(
+    absl::string_view test_step_id) const {
+  int idx = step_ids_.Find(test_step_id);
+  if (idx == -1) return nullptr;
+  return &model_.test_steps[idx];
+}
+
+const MeasurementSeriesModel* OutputModelBuilder::FindMeasurementSeries(
+    absl::string_view measurement_series_id) const {
+  int series = series_ids_.Find(measurement_series_id);
+  if (series == -1) return nullptr;
+  const ItemRef& ref = series_refs_[series];
+  return &model_.test_steps[ref.step_idx].measurement_series[ref.item_idx];
+}
+
+const MeasurementSeriesModel* OutputModelBuilder::FindMeasurementSeries(
+    absl::string_view test_step_id,
+    absl::string_view measurement_series_id) const {
+  int step_idx = step_ids_.Find(test_step_id);
+  int series = series_ids_.Find(measurement_series_id);
+  if (step_idx == -1 || series == -1) return nullptr;
+  auto it = step_series_.find({step_idx, series});
+  if (it == step_series_.end()) return nullptr;
+  return &model_.test_steps[step_idx].measurement_series[it->second];
+}
+
+std::vector<const MeasurementSeriesModel*>
+OutputModelBuilder::FindMeasurementSeriesByHardwareInfoId(
+    absl::string_view hardware_info_id) const {
+  std::vector<const MeasurementSeriesModel*> series;
+  auto it = series_by_hardware_info_id_.find(hardware_info_id);
+  if (it == series_by_hardware_info_id_.end()) return series;
+  for (const ItemRef& ref : it->second) {
+    series.push_back(
+        &model_.test_steps[ref.step_idx].measurement_series[ref.item_idx]);
+  }
+  return series;
+}
+
+std::vector<const MeasurementOutput*>
+OutputModelBuilder::FindMeasurementsByName(absl::string_view name) const {
+  auto it = measurements_by_name_.find(name);
+  if (it == measurements_by_name_.end()) return {};
+  return GetMeasurements(it->second);
+}
+
+std::vector<const DiagnosisOutput*>
+OutputModelBuilder::FindDiagnosesByVerdict(absl::string_view verdict) const {
+  auto it = diagnoses_by_verdict_.find(verdict);
+  if (it == diagnoses_by_verdict_.end()) return {};
+  return GetDiagnoses(it->second);
+}
+
+std::vector<const DiagnosisOutput*> OutputModelBuilder::FindDiagnosesByType(
+    DiagnosisType type) const {
+  auto it = diagnoses_by_type_.find(type);
+  if (it == diagnoses_by_type_.end()) return {};
+  return GetDiagnoses(it->second);
+}
+
+std::vector<const DiagnosisOutput*>
+OutputModelBuilder::FindDiagnosesByHardwareInfoId(
+    absl::string_view hardware_info_id) const {
+  auto it = diagnoses_by_hardware_info_id_.find(hardware_info_id);
+  if (it == diagnoses_by_hardware_info_id_.end()) return {};
+  return GetDiagnoses(it->second);
+}
+
+std::vector<const TestStepModel*>
+OutputModelBuilder::FindTestStepsWithDiagnosis(
+    DiagnosisType type, absl::string_view hardware_info_id) const {
+  std::vector<const TestStepModel*> steps;
+  auto it = diagnoses_by_hardware_info_id_.find(hardware_info_id);
+  if (it == diagnoses_by_hardware_info_id_.end()) return steps;
+  absl::flat_hash_set<int> seen_steps;
+  for (const ItemRef& ref : it->second) {
+    const TestStepModel& step = model_.test_steps[ref.step_idx];
+    if (step.diagnoses[ref.item_idx].type == type &&
+        seen_steps.insert(ref.step_idx).second) {
+      steps.push_back(&step);
+    }
+  }
+  return steps;
+}
+
+std::vector<const MeasurementOutput*> OutputModelBuilder::GetMeasurements(
+    const std::vector<ItemRef>& refs) const {
+  std::vector<const MeasurementOutput*> measurements;
+  measurements.reserve(refs.size());
+  for (const ItemRef& ref : refs) {
+    measurements.push_back(
+        &model_.test_steps[ref.step_idx].measurements[ref.item_idx]);
+  }
+  return measurements;
+}
+
+std::vector<const DiagnosisOutput*> OutputModelBuilder::GetDiagnoses(
+    const std::vector<ItemRef>& refs) const {
+  std::vector<const DiagnosisOutput*> diagnoses;
+  diagnoses.reserve(refs.size());
+  for (const ItemRef& ref : refs) {
+    diagnoses.push_back(
+        &model_.test_steps[ref.step_idx].diagnoses[ref.item_idx]);
+  }
+  return diagnoses;
+}
+
+}  // namespace ocpdiag::results
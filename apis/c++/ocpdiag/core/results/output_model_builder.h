@@ -0,0 +1,132 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_OUTPUT_MODEL_BUILDER_H_
+#define OCPDIAG_CORE_RESULTS_OUTPUT_MODEL_BUILDER_H_
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/structs.h"
+
+namespace ocpdiag::results {
+
+// Builds an OutputModel one artifact at a time, as the artifacts are produced,
+// and maintains secondary indexes so that common queries over large runs don't
+// need to scan every test step.
+//
+// Pointers returned by the lookup functions point into the model and are only
+// valid until the next call to Add() or Reset(). This class is not thread-safe.
+class OutputModelBuilder {
+ public:
+  // Adds the artifact to the model and updates the indexes.
+  void Add(const OutputArtifact& artifact);
+
+  // Clears the model and all indexes.
+  void Reset();
+
+  const OutputModel& model() const { return model_; }
+
+  // Returns the number of artifacts added since construction or the last
+  // Reset().
+  size_t artifact_count() const { return artifact_count_; }
+
+  // Returns the test step with the given id, or null if there is none.
+  const TestStepModel* FindTestStep(absl::string_view test_step_id) const;
+
+  // Returns the measurement series with the given id, or null if there is none.
+  // If steps reuse the id, this is the series of the first one.
+  const MeasurementSeriesModel* FindMeasurementSeries(
+      absl::string_view measurement_series_id) const;
+  // Returns the measurement series with the given id within the given test
+  // step, or null if there is none.
+  const MeasurementSeriesModel* FindMeasurementSeries(
+      absl::string_view test_step_id,
+      absl::string_view measurement_series_id) const;
+
+  // The following return matching items in the order they were added. Hardware
+  // info ids are the ids registered in the DutInfo.
+  std::vector<const MeasurementSeriesModel*>
+  FindMeasurementSeriesByHardwareInfoId(
+      absl::string_view hardware_info_id) const;
+  std::vector<const MeasurementOutput*> FindMeasurementsByName(
+      absl::string_view name) const;
+  std::vector<const DiagnosisOutput*> FindDiagnosesByVerdict(
+      absl::string_view verdict) const;
+  std::vector<const DiagnosisOutput*> FindDiagnosesByType(
+      DiagnosisType type) const;
+  std::vector<const DiagnosisOutput*> FindDiagnosesByHardwareInfoId(
+      absl::string_view hardware_info_id) const;
+
+  // Returns the test steps with at least one diagnosis of the given type for
+  // the given hardware info, e.g. the steps that failed for one DIMM.
+  std::vector<const TestStepModel*> FindTestStepsWithDiagnosis(
+      DiagnosisType type, absl::string_view hardware_info_id) const;
+
+ private:
+  // Location of an item within one of the vectors of a TestStepModel.
+  struct ItemRef {
+    int step_idx;
+    int item_idx;
+  };
+  using RefIndex = absl::flat_hash_map<std::string, std::vector<ItemRef>>;
+
+  // Interns artifact ids to dense integers, in the order they are first seen.
+  // The ids assigned by TestRun are small decimal integers, which are mapped
+  // through a vector without hashing the string. Any other ids fall back to a
+  // hash map.
+  class IdInterner {
+   public:
+    // Returns the interned value of the id, or -1 if it was never interned.
+    int Find(absl::string_view id) const;
+
+    // Returns the interned value of the id, interning it if needed.
+    int Intern(absl::string_view id);
+
+   private:
+    std::vector<int> dense_;
+    absl::flat_hash_map<std::string, int> sparse_;
+    int size_ = 0;
+  };
+
+  void AddTestRunArtifact(const TestRunArtifact& artifact);
+  void AddTestStepArtifact(const TestStepArtifact& artifact);
+  int GetTestStepIdx(const std::string& test_step_id);
+  ItemRef GetMeasurementSeries(const std::string& measurement_series_id,
+                               int step_idx);
+  MeasurementSeriesModel& SeriesAt(const ItemRef& ref) {
+    return model_.test_steps[ref.step_idx].measurement_series[ref.item_idx];
+  }
+
+  std::vector<const MeasurementOutput*> GetMeasurements(
+      const std::vector<ItemRef>& refs) const;
+  std::vector<const DiagnosisOutput*> GetDiagnoses(
+      const std::vector<ItemRef>& refs) const;
+
+  OutputModel model_;
+  size_t artifact_count_ = 0;
+  // Step ids are interned to their index in the model.
+  IdInterner step_ids_;
+  // Series are found by their step and interned series id, so that steps may
+  // reuse series ids, and each element is filed without hashing a string.
+  IdInterner series_ids_;
+  absl::flat_hash_map<std::pair<int, int>, int> step_series_;
+  // The first series of each interned series id, for run-wide lookups.
+  std::vector<ItemRef> series_refs_;
+  RefIndex series_by_hardware_info_id_;
+  RefIndex measurements_by_name_;
+  RefIndex diagnoses_by_verdict_;
+  absl::flat_hash_map<DiagnosisType, std::vector<ItemRef>> diagnoses_by_type_;
+  RefIndex diagnoses_by_hardware_info_id_;
+};
+
+}  // namespace ocpdiag::results
+
+#endif  // OCPDIAG_CORE_RESULTS_OUTPUT_MODEL_BUILDER_H_
@@ -0,0 +1,205 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/output_model_builder.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "ocpdiag/core/results/structs.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+OutputArtifact MakeStepArtifact(const std::string& test_step_id,
+                                TestStepVariant artifact) {
+  return OutputArtifact({.artifact = TestStepArtifact({
+                             .artifact = std::move(artifact),
+                             .test_step_id = test_step_id,
+                         })});
+}
+
+OutputArtifact MakeDiagnosis(const std::string& test_step_id,
+                             const std::string& verdict, DiagnosisType type,
+                             const std::string& hardware_info_id) {
+  DiagnosisOutput diagnosis = {
+      .verdict = verdict,
+      .type = type,
+      .hardware_info_id = hardware_info_id,
+  };
+  return MakeStepArtifact(test_step_id, std::move(diagnosis));
+}
+
+OutputArtifact MakeMeasurement(const std::string& test_step_id,
+                               const std::string& name) {
+  return MakeStepArtifact(test_step_id,
+                          MeasurementOutput({.name = name, .value = 1.}));
+}
+
+TEST(OutputModelBuilderTest, ModelIsBuiltIncrementally) {
+  OutputModelBuilder builder;
+  builder.Add(OutputArtifact(
+      {.artifact = SchemaVersionOutput({.major = 2, .minor = 0})}));
+  EXPECT_EQ(builder.model().schema_version.major, 2);
+  EXPECT_TRUE(builder.model().test_steps.empty());
+
+  builder.Add(MakeStepArtifact("0", TestStepStartOutput({.name = "step"})));
+  builder.Add(MakeMeasurement("0", "temp"));
+  ASSERT_EQ(builder.model().test_steps.size(), 1);
+  EXPECT_EQ(builder.model().test_steps[0].start.name, "step");
+  EXPECT_EQ(builder.model().test_steps[0].measurements.size(), 1);
+  EXPECT_EQ(builder.artifact_count(), 3);
+
+  builder.Reset();
+  EXPECT_EQ(builder.artifact_count(), 0);
+  EXPECT_TRUE(builder.model().test_steps.empty());
+  EXPECT_EQ(builder.FindTestStep("0"), nullptr);
+}
+
+TEST(OutputModelBuilderTest, MeasurementsAreIndexedByName) {
+  OutputModelBuilder builder;
+  builder.Add(MakeMeasurement("0", "temp"));
+  builder.Add(MakeMeasurement("0", "fan"));
+  builder.Add(MakeMeasurement("1", "temp"));
+
+  std::vector<const MeasurementOutput*> temps =
+      builder.FindMeasurementsByName("temp");
+  ASSERT_EQ(temps.size(), 2);
+  EXPECT_EQ(temps[0], &builder.model().test_steps[0].measurements[0]);
+  EXPECT_EQ(temps[1], &builder.model().test_steps[1].measurements[0]);
+  EXPECT_TRUE(builder.FindMeasurementsByName("voltage").empty());
+}
+
+TEST(OutputModelBuilderTest, DiagnosesAreIndexed) {
+  OutputModelBuilder builder;
+  builder.Add(MakeDiagnosis("0", "good", DiagnosisType::kPass, "dimm_a1"));
+  builder.Add(MakeDiagnosis("1", "bad", DiagnosisType::kFail, "dimm_a1"));
+  builder.Add(MakeDiagnosis("1", "bad", DiagnosisType::kFail, "dimm_a1"));
+  builder.Add(MakeDiagnosis("2", "bad", DiagnosisType::kFail, "dimm_b1"));
+
+  EXPECT_EQ(builder.FindDiagnosesByVerdict("bad").size(), 3);
+  EXPECT_EQ(builder.FindDiagnosesByType(DiagnosisType::kPass).size(), 1);
+  EXPECT_TRUE(builder.FindDiagnosesByType(DiagnosisType::kUnknown).empty());
+  EXPECT_EQ(builder.FindDiagnosesByHardwareInfoId("dimm_a1").size(), 3);
+
+  std::vector<const TestStepModel*> failed_steps =
+      builder.FindTestStepsWithDiagnosis(DiagnosisType::kFail, "dimm_a1");
+  ASSERT_EQ(failed_steps.size(), 1);
+  EXPECT_EQ(failed_steps[0]->test_step_id, "1");
+  EXPECT_EQ(failed_steps[0], builder.FindTestStep("1"));
+}
+
+TEST(OutputModelBuilderTest, MeasurementSeriesAreIndexed) {
+  OutputModelBuilder builder;
+  builder.Add(MakeStepArtifact("0", MeasurementSeriesStartOutput({
+                                        .measurement_series_id = "0",
+                                        .name = "temp",
+                                        .hardware_info_id = "cpu0",
+                                    })));
+  builder.Add(MakeStepArtifact("0", MeasurementSeriesElementOutput({
+                                        .index = 0,
+                                        .measurement_series_id = "0",
+                                        .value = 1.,
+                                    })));
+  builder.Add(MakeStepArtifact("0", MeasurementSeriesEndOutput({
+                                        .measurement_series_id = "0",
+                                        .total_count = 1,
+                                    })));
+
+  const MeasurementSeriesModel* series = builder.FindMeasurementSeries("0");
+  ASSERT_NE(series, nullptr);
+  EXPECT_EQ(series->start.name, "temp");
+  EXPECT_EQ(series->elements.size(), 1);
+  EXPECT_EQ(series->end.total_count, 1);
+  std::vector<const MeasurementSeriesModel*> by_hardware =
+      builder.FindMeasurementSeriesByHardwareInfoId("cpu0");
+  ASSERT_EQ(by_hardware.size(), 1);
+  EXPECT_EQ(by_hardware[0], series);
+  EXPECT_EQ(builder.FindMeasurementSeries("1"), nullptr);
+}
+
+TEST(OutputModelBuilderTest, SeriesStayWithTheirStepAcrossSteps) {
+  OutputModelBuilder builder;
+  for (const std::string step_id : {"0", "1", "2"}) {
+    builder.Add(MakeStepArtifact(
+        step_id, TestStepStartOutput({.name = "step " + step_id})));
+  }
+  // Series ids are unique to the run, so interleave series of different steps
+  // and mix in ids that aren't assigned by TestRun.
+  const std::vector<std::pair<std::string, std::string>> series = {
+      {"2", "0"}, {"1", "1"}, {"2", "custom"}, {"0", "007"}, {"1", "7"}};
+  for (const auto& [step_id, series_id] : series) {
+    builder.Add(MakeStepArtifact(step_id, MeasurementSeriesStartOutput({
+                                              .measurement_series_id =
+                                                  series_id,
+                                          })));
+  }
+  for (const auto& [step_id, series_id] : series) {
+    builder.Add(MakeStepArtifact(step_id, MeasurementSeriesElementOutput({
+                                              .measurement_series_id =
+                                                  series_id,
+                                              .value = 1.,
+                                          })));
+  }
+
+  const OutputModel& model = builder.model();
+  ASSERT_EQ(model.test_steps.size(), 3);
+  EXPECT_EQ(model.test_steps[0].measurement_series.size(), 1);
+  EXPECT_EQ(model.test_steps[1].measurement_series.size(), 2);
+  EXPECT_EQ(model.test_steps[2].measurement_series.size(), 2);
+  for (const auto& [step_id, series_id] : series) {
+    const MeasurementSeriesModel* found =
+        builder.FindMeasurementSeries(series_id);
+    ASSERT_NE(found, nullptr);
+    EXPECT_EQ(found->start.measurement_series_id, series_id);
+    ASSERT_EQ(found->elements.size(), 1);
+    EXPECT_EQ(found->elements[0].measurement_series_id, series_id);
+
+    const TestStepModel* step = builder.FindTestStep(step_id);
+    ASSERT_NE(step, nullptr);
+    const MeasurementSeriesModel* step_series = step->measurement_series.data();
+    EXPECT_GE(found, step_series);
+    EXPECT_LT(found, step_series + step->measurement_series.size());
+  }
+  EXPECT_EQ(builder.FindMeasurementSeries("3"), nullptr);
+  EXPECT_EQ(builder.FindMeasurementSeries("07"), nullptr);
+}
+
+TEST(OutputModelBuilderTest, StepsMayReuseSeriesIds) {
+  OutputModelBuilder builder;
+  for (const std::string step_id : {"0", "1"}) {
+    builder.Add(MakeStepArtifact(step_id, MeasurementSeriesStartOutput({
+                                              .measurement_series_id = "0",
+                                              .name = "temp " + step_id,
+                                          })));
+  }
+  for (const std::string step_id : {"1", "0", "1"}) {
+    builder.Add(MakeStepArtifact(step_id, MeasurementSeriesElementOutput({
+                                              .measurement_series_id = "0",
+                                              .value = 1.,
+                                          })));
+  }
+
+  const MeasurementSeriesModel* first = builder.FindMeasurementSeries("0", "0");
+  const MeasurementSeriesModel* second =
+      builder.FindMeasurementSeries("1", "0");
+  ASSERT_NE(first, nullptr);
+  ASSERT_NE(second, nullptr);
+  EXPECT_EQ(first->start.name, "temp 0");
+  EXPECT_EQ(first->elements.size(), 1);
+  EXPECT_EQ(second->start.name, "temp 1");
+  EXPECT_EQ(second->elements.size(), 2);
+  EXPECT_EQ(builder.FindMeasurementSeries("0"), first);
+  EXPECT_EQ(builder.FindMeasurementSeries("2", "0"), nullptr);
+  EXPECT_EQ(builder.FindMeasurementSeries("0", "1"), nullptr);
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results
@@ -8,14 +8,15 @@
 #define OCPDIAG_CORE_RESULTS_OUTPUT_RECEIVER_H_
 
 #include <memory>
-#include <optional>
-#include <string>
 
-#include "absl/container/flat_hash_map.h"
+#include "ocpdiag/core/results/artifact_sink.h"
 #include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/clock.h"
 #include "ocpdiag/core/results/output_iterator.h"
+#include "ocpdiag/core/results/output_model_builder.h"
 #include "ocpdiag/core/results/results.pb.h"
 #include "ocpdiag/core/results/structs.h"
+#include "riegeli/records/record_position.h"
 
 namespace ocpdiag::results {
 
@@ -24,51 +25,60 @@ namespace ocpdiag::results {
 // in two ways. Either you can use the structured OutputModel, or iterate over
 // the class itself to get one OutputArtifact at a time.
 //
+// By default the artifacts are kept in memory, which avoids the temp file and
+// the serialization round trip. The file backend writes and reads back the
+// same compressed record file that tests produce in production.
+//
 // This class is not thread-safe and not meant for production code. It is
 // intended to be used for unit testing.
 class OutputReceiver {
  public:
-  OutputReceiver();
+  enum class Backend {
+    kInMemory,
+    kFile,
+  };
+
+  explicit OutputReceiver(Backend backend = Backend::kInMemory);
 
   // Creates an artifact writer that will write to this receiver instance. This
   // should only be called once per OutputReceiver instance. Note that this
   // artifact writer will be set to not spin up additional threads (for periodic
-  // file flushing) as this can disrupt unit tests.
-  std::unique_ptr<internal::ArtifactWriter> MakeArtifactWriter();
+  // file flushing) as this can disrupt unit tests. Artifacts are timestamped
+  // with `clock` if given, e.g. a FakeClock for reproducible output.
+  std::unique_ptr<internal::ArtifactWriter> MakeArtifactWriter(
+      Clock* clock = nullptr);
 
   // Returns an iterable container of the raw output artifacts. It can be
   // iterated over as many times as you like. This should not be called until
   // an artifact writer has been created.
   const OutputContainer& GetOutputContainer() const;
 
-  // Returns all the output artifacts in a structured data model. The
-  // results are cached after the first call, so you should only call this after
-  // the test has run to completion.
+  // Returns all the output artifacts in a structured data model. Artifacts
+  // written since the previous call are added to the model incrementally, so
+  // this can be called at any point while the test is running.
   //
   // This will store all of the output in memory at once. If that is a
   // problem, consider iterating over this class which holds only one output
   // artifact in memory at a time.
-  const OutputModel& GetOutputModel();
+  const OutputModel& GetOutputModel() { return GetModelBuilder().model(); }
 
-  //
-  // Unsets the currently stored model (if any) so that it will be rebuilt when
+  // Returns the builder behind GetOutputModel(), brought up to date with the
+  // written artifacts, for indexed lookups into the model.
+  const OutputModelBuilder& GetModelBuilder();
+
+  // Discards the stored model so that it will be rebuilt from scratch when
   // next accessed.
-  void ResetModel() { model_.reset(); }
+  void ResetModel() {
+    builder_.Reset();
+    file_position_ = riegeli::RecordPosition();
+  }
 
  private:
-  void BuildModel();
-  void HandleOutputArtifact(const OutputArtifact& artifact);
-  void HandleTestRunArtifact(const TestRunArtifact& artifact);
-  void HandleTestStepArtifact(const TestStepArtifact& artifact);
-  int GetTestStepIdx(const std::string& test_step_id);
-  void HandleMeasurementSeriesModel(const MeasurementSeriesModel& model);
-  int GetMeasurementSeriesIdx(const std::string& measurement_series_id,
-                              int step_idx);
-
+  std::shared_ptr<internal::InMemoryArtifactSink> sink_;
   OutputContainer container_;
-  std::optional<OutputModel> model_;
-  absl::flat_hash_map<std::string, int> test_step_id_to_idx_;
-  absl::flat_hash_map<std::string, int> measurement_series_id_to_idx_;
+  OutputModelBuilder builder_;
+  // The position in the file of the first artifact not yet in the model.
+  riegeli::RecordPosition file_position_;
   bool writer_created_ = false;
 };
 
@@ -43,7 +43,7 @@ TEST(OutputReceiverDeathTest,
                "Attempted to access receiver contents");
 }
 
-TEST(OutputReceiverTest, RebuildingModelAddsWrittenArtifacts) {
+TEST(OutputReceiverTest, ModelPicksUpWrittenArtifacts) {
   OutputReceiver receiver;
   ocpdiag_results_v2_pb::SchemaVersion artifact = GetExampleSchemaVersion();
   SchemaVersionOutput schema_version = ProtoToStruct(artifact);
@@ -53,13 +53,33 @@ TEST(OutputReceiverTest, RebuildingModelAddsWrittenArtifacts) {
   EXPECT_NE(receiver.GetOutputModel().schema_version, schema_version);
   writer->Write(artifact);
   writer->Flush();
-  EXPECT_NE(receiver.GetOutputModel().schema_version, schema_version);
-  receiver.ResetModel();
   EXPECT_EQ(receiver.GetOutputModel().schema_version, schema_version);
 }
 
-TEST(OutputReceiverTest, OutputContainerIteratesProperly) {
-  OutputReceiver receiver;
+TEST(OutputReceiverTest, ResetModelRebuildsFromAllArtifacts) {
+  OutputReceiver receiver(OutputReceiver::Backend::kFile);
+  std::unique_ptr<internal::ArtifactWriter> writer =
+      receiver.MakeArtifactWriter();
+  ocpdiag_results_v2_pb::TestStepArtifact artifact = ParseTextProtoOrDie(
+      R"pb(test_step_id: "1"
+           diagnosis { verdict: "bad" type: FAIL hardware_info_id: "0" })pb");
+  writer->Write(artifact);
+  writer->Flush();
+  ASSERT_EQ(receiver.GetOutputModel().test_steps.size(), 1);
+
+  writer->Write(artifact);
+  writer->Flush();
+  EXPECT_EQ(receiver.GetOutputModel().test_steps[0].diagnoses.size(), 2);
+  receiver.ResetModel();
+  EXPECT_EQ(receiver.GetModelBuilder().FindDiagnosesByVerdict("bad").size(),
+            2);
+}
+
+class OutputReceiverBackendTest
+    : public ::testing::TestWithParam<OutputReceiver::Backend> {};
+
+TEST_P(OutputReceiverBackendTest, OutputContainerIteratesProperly) {
+  OutputReceiver receiver(GetParam());
   ocpdiag_results_v2_pb::SchemaVersion first_artifact =
       GetExampleSchemaVersion();
   ocpdiag_results_v2_pb::TestRunArtifact second_artifact = ParseTextProtoOrDie(
@@ -88,6 +108,10 @@ TEST(OutputReceiverTest, OutputContainerIteratesProperly) {
   EXPECT_EQ(*test_run_end, ProtoToStruct(second_artifact.test_run_end()));
 }
 
+INSTANTIATE_TEST_SUITE_P(Backends, OutputReceiverBackendTest,
+                         ::testing::Values(OutputReceiver::Backend::kInMemory,
+                                           OutputReceiver::Backend::kFile));
+
 TEST(OutputReceiverTest, SchemaVersionAppearsInModel) {
   OutputReceiver receiver;
   std::unique_ptr<internal::ArtifactWriter> writer =
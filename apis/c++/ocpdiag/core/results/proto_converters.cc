@@ -6,21 +6,80 @@
 
 #include "ocpdiag/core/results/proto_converters.h"
 
+#include <string>
+#include <utility>
+
 #include "google/protobuf/struct.pb.h"
 #include "google/protobuf/util/json_util.h"
 #include "google/protobuf/util/time_util.h"
+#include "absl/flags/flag.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "ocpdiag/core/compat/status_converters.h"
 #include "ocpdiag/core/results/dut_info.h"
+#include "ocpdiag/core/results/json_validator.h"
 #include "ocpdiag/core/results/results.pb.h"
 #include "ocpdiag/core/results/structs.h"
 #include "ocpdiag/core/results/variant.h"
 
+ABSL_FLAG(bool, ocpdiag_results_raw_json, false,
+          "Validates the metadata, parameters and extension JSON that tests "
+          "pass without parsing it, and copies it verbatim into the JSON "
+          "results. The binary results keep it in the *_raw_json fields "
+          "instead of the google.protobuf.Struct ones, which only readers "
+          "that convert artifacts with ProtoToStruct see.");
+
 namespace ocpdiag::results::internal {
 
-//
+bool KeepRawJsonOrDie(absl::string_view json) {
+  if (json.empty() || !absl::GetFlag(FLAGS_ocpdiag_results_raw_json))
+    return false;
+  absl::Status status = ValidateJsonObject(json);
+  CHECK_OK(status) << "Must pass a valid JSON string to results objects: "
+                   << status.ToString();
+  return true;
+}
+
+namespace {
+
+// Returns the JSON of the Struct fields of an artifact, which is their raw
+// JSON when they were kept as such.
+template <typename Proto>
+std::string MetadataJson(const Proto& proto) {
+  if (proto.has_metadata_raw_json()) return proto.metadata_raw_json();
+  return ProtoToJsonOrDie(proto.metadata());
+}
+
+std::string ParametersJson(
+    const ocpdiag_results_v2_pb::TestRunStart& test_run_start) {
+  if (test_run_start.has_parameters_raw_json())
+    return test_run_start.parameters_raw_json();
+  return ProtoToJsonOrDie(test_run_start.parameters());
+}
+
+std::string ContentJson(const ocpdiag_results_v2_pb::Extension& extension) {
+  if (extension.has_content_raw_json()) return extension.content_raw_json();
+  return ProtoToJsonOrDie(extension.content());
+}
+
+// Sets the value of a measurement or series element, and its exact value if
+// it is an integer.
+template <typename V, typename Proto>
+void SetValueOf(V&& value, Proto& proto) {
+  if (const int64_t* i = std::get_if<int64_t>(&value); i != nullptr) {
+    proto.mutable_integer_value()->set_int64_value(*i);
+  } else if (const uint64_t* u = std::get_if<uint64_t>(&value); u != nullptr) {
+    proto.mutable_integer_value()->set_uint64_value(*u);
+  } else {
+    proto.clear_integer_value();
+  }
+  *proto.mutable_value() = VariantToProto(std::forward<V>(value));
+}
+
+}  // namespace
+
 google::protobuf::Value VariantToProto(const Variant& value) {
   google::protobuf::Value proto;
   if (auto* str_val = std::get_if<std::string>(&value); str_val != nullptr) {
@@ -30,12 +89,41 @@ google::protobuf::Value VariantToProto(const Variant& value) {
   } else if (auto* double_val = std::get_if<double>(&value);
              double_val != nullptr) {
     proto.set_number_value(*double_val);
+  } else if (IsNumeric(value)) {
+    proto.set_number_value(NumericAsDouble(value));
   } else {
     LOG(FATAL) << "Tried to convert an invalid value.";
   }
   return proto;
 }
 
+google::protobuf::Value VariantToProto(Variant&& value) {
+  if (auto* str_val = std::get_if<std::string>(&value); str_val != nullptr) {
+    google::protobuf::Value proto;
+    proto.set_string_value(std::move(*str_val));
+    return proto;
+  }
+  return VariantToProto(value);
+}
+
+void SetValue(const Variant& value, ocpdiag_results_v2_pb::Measurement& proto) {
+  SetValueOf(value, proto);
+}
+
+void SetValue(Variant&& value, ocpdiag_results_v2_pb::Measurement& proto) {
+  SetValueOf(std::move(value), proto);
+}
+
+void SetValue(const Variant& value,
+              ocpdiag_results_v2_pb::MeasurementSeriesElement& proto) {
+  SetValueOf(value, proto);
+}
+
+void SetValue(Variant&& value,
+              ocpdiag_results_v2_pb::MeasurementSeriesElement& proto) {
+  SetValueOf(std::move(value), proto);
+}
+
 ocpdiag_results_v2_pb::Validator StructToProto(const Validator& validator) {
   ocpdiag_results_v2_pb::Validator proto;
   proto.set_name(validator.name);
@@ -111,37 +199,100 @@ ocpdiag_results_v2_pb::MeasurementSeriesStart StructToProto(
         StructToProto(*measurement_series_start.subcomponent);
   for (const Validator& v : measurement_series_start.validators)
     *proto.add_validators() = StructToProto(v);
-  *proto.mutable_metadata() =
-      JsonToProtoOrDie(measurement_series_start.metadata_json);
+  if (KeepRawJsonOrDie(measurement_series_start.metadata_json)) {
+    proto.set_metadata_raw_json(measurement_series_start.metadata_json);
+  } else {
+    *proto.mutable_metadata() =
+        JsonToProtoOrDie(measurement_series_start.metadata_json);
+  }
   return proto;
 }
 
-ocpdiag_results_v2_pb::MeasurementSeriesElement StructToProto(
+namespace {
+
+// Converts all the fields of the element except for its value.
+ocpdiag_results_v2_pb::MeasurementSeriesElement ElementToProtoWithoutValue(
     const MeasurementSeriesElement& measurement_series_element) {
   ocpdiag_results_v2_pb::MeasurementSeriesElement proto;
-  *proto.mutable_value() = VariantToProto(measurement_series_element.value);
   if (measurement_series_element.timestamp.has_value()) {
     *proto.mutable_timestamp() = google::protobuf::util::TimeUtil::TimevalToTimestamp(
         *measurement_series_element.timestamp);
   }
-  *proto.mutable_metadata() =
-      JsonToProtoOrDie(measurement_series_element.metadata_json);
+  if (KeepRawJsonOrDie(measurement_series_element.metadata_json)) {
+    proto.set_metadata_raw_json(measurement_series_element.metadata_json);
+  } else {
+    *proto.mutable_metadata() =
+        JsonToProtoOrDie(measurement_series_element.metadata_json);
+  }
   return proto;
 }
 
-ocpdiag_results_v2_pb::Measurement StructToProto(
+// Converts all the fields of the measurement except for its value and
+// validators.
+ocpdiag_results_v2_pb::Measurement MeasurementToProtoWithoutValueAndValidators(
     const Measurement& measurement) {
   ocpdiag_results_v2_pb::Measurement proto;
-  *proto.mutable_value() = VariantToProto(measurement.value);
   proto.set_name(measurement.name);
   proto.set_unit(measurement.unit);
   if (measurement.hardware_info.has_value())
     proto.set_hardware_info_id(measurement.hardware_info->id());
   if (measurement.subcomponent.has_value())
     *proto.mutable_subcomponent() = StructToProto(*measurement.subcomponent);
+  if (KeepRawJsonOrDie(measurement.metadata_json)) {
+    proto.set_metadata_raw_json(measurement.metadata_json);
+  } else {
+    *proto.mutable_metadata() = JsonToProtoOrDie(measurement.metadata_json);
+  }
+  return proto;
+}
+
+}  // namespace
+
+ocpdiag_results_v2_pb::MeasurementSeriesElement StructToProto(
+    const MeasurementSeriesElement& measurement_series_element) {
+  ocpdiag_results_v2_pb::MeasurementSeriesElement proto =
+      ElementToProtoWithoutValue(measurement_series_element);
+  SetValue(measurement_series_element.value, proto);
+  return proto;
+}
+
+ocpdiag_results_v2_pb::MeasurementSeriesElement StructToProto(
+    MeasurementSeriesElement&& measurement_series_element) {
+  ocpdiag_results_v2_pb::MeasurementSeriesElement proto =
+      ElementToProtoWithoutValue(measurement_series_element);
+  SetValue(std::move(measurement_series_element.value), proto);
+  return proto;
+}
+
+ocpdiag_results_v2_pb::Measurement StructToProto(
+    const Measurement& measurement) {
+  ocpdiag_results_v2_pb::Measurement proto =
+      MeasurementToProtoWithoutValueAndValidators(measurement);
+  SetValue(measurement.value, proto);
   for (const Validator& v : measurement.validators)
     *proto.add_validators() = StructToProto(v);
-  *proto.mutable_metadata() = JsonToProtoOrDie(measurement.metadata_json);
+  return proto;
+}
+
+ocpdiag_results_v2_pb::Measurement StructToProto(
+    const Measurement& measurement,
+    const google::protobuf::RepeatedPtrField<ocpdiag_results_v2_pb::Validator>&
+        validators) {
+  ocpdiag_results_v2_pb::Measurement proto =
+      MeasurementToProtoWithoutValueAndValidators(measurement);
+  SetValue(measurement.value, proto);
+  *proto.mutable_validators() = validators;
+  return proto;
+}
+
+ocpdiag_results_v2_pb::Measurement StructToProto(
+    Measurement&& measurement,
+    const google::protobuf::RepeatedPtrField<ocpdiag_results_v2_pb::Validator>&
+        validators) {
+  ocpdiag_results_v2_pb::Measurement proto =
+      MeasurementToProtoWithoutValueAndValidators(measurement);
+  SetValue(std::move(measurement.value), proto);
+  *proto.mutable_validators() = validators;
   return proto;
 }
 
@@ -182,9 +333,17 @@ ocpdiag_results_v2_pb::TestRunStart StructToProto(
   proto.set_name(test_run_start.name);
   proto.set_version(test_run_start.version);
   proto.set_command_line(test_run_start.command_line);
-  *proto.mutable_parameters() =
-      JsonToProtoOrDie(test_run_start.parameters_json);
-  *proto.mutable_metadata() = JsonToProtoOrDie(test_run_start.metadata_json);
+  if (KeepRawJsonOrDie(test_run_start.parameters_json)) {
+    proto.set_parameters_raw_json(test_run_start.parameters_json);
+  } else {
+    *proto.mutable_parameters() =
+        JsonToProtoOrDie(test_run_start.parameters_json);
+  }
+  if (KeepRawJsonOrDie(test_run_start.metadata_json)) {
+    proto.set_metadata_raw_json(test_run_start.metadata_json);
+  } else {
+    *proto.mutable_metadata() = JsonToProtoOrDie(test_run_start.metadata_json);
+  }
   return proto;
 }
 
@@ -198,7 +357,11 @@ ocpdiag_results_v2_pb::Log StructToProto(const Log& log) {
 ocpdiag_results_v2_pb::Extension StructToProto(const Extension& extension) {
   ocpdiag_results_v2_pb::Extension proto;
   proto.set_name(extension.name);
-  *proto.mutable_content() = JsonToProtoOrDie(extension.content_json);
+  if (KeepRawJsonOrDie(extension.content_json)) {
+    proto.set_content_raw_json(extension.content_json);
+  } else {
+    *proto.mutable_content() = JsonToProtoOrDie(extension.content_json);
+  }
   return proto;
 }
 
@@ -216,7 +379,11 @@ ocpdiag_results_v2_pb::DutInfo DutInfoToProto(const DutInfo& dut_info) {
   ocpdiag_results_v2_pb::DutInfo proto;
   proto.set_dut_info_id(dut_info.id());
   proto.set_name(dut_info.name());
-  *proto.mutable_metadata() = JsonToProtoOrDie(dut_info.GetMetadataJson());
+  if (std::string json = dut_info.GetMetadataJson(); KeepRawJsonOrDie(json)) {
+    proto.set_metadata_raw_json(std::move(json));
+  } else {
+    *proto.mutable_metadata() = JsonToProtoOrDie(json);
+  }
   for (const PlatformInfo& platform_info : dut_info.GetPlatformInfos())
     *proto.add_platform_infos() = StructToProto(platform_info);
   for (const HardwareInfo& hardware_info : dut_info.GetHardwareInfos())
@@ -237,6 +404,24 @@ Variant ProtoToVariant(google::protobuf::Value value) {
   LOG(FATAL) << "Tried to convert an invalid value protobuf to a Variant.";
 }
 
+namespace {
+
+// Returns the value of a measurement or series element, which is exact for
+// integers.
+template <typename Proto>
+Variant ValueOf(const Proto& proto) {
+  switch (proto.integer_value().value_case()) {
+    case ocpdiag_results_v2_pb::IntegerValue::kInt64Value:
+      return proto.integer_value().int64_value();
+    case ocpdiag_results_v2_pb::IntegerValue::kUint64Value:
+      return proto.integer_value().uint64_value();
+    default:
+      return ProtoToVariant(proto.value());
+  }
+}
+
+}  // namespace
+
 SchemaVersionOutput ProtoToStruct(
     const ocpdiag_results_v2_pb::SchemaVersion& schema_version) {
   return {.major = schema_version.major(), .minor = schema_version.minor()};
@@ -294,7 +479,7 @@ DutInfoOutput ProtoToStruct(const ocpdiag_results_v2_pb::DutInfo& dut_info) {
   return {
       .dut_info_id = dut_info.dut_info_id(),
       .name = dut_info.name(),
-      .metadata_json = ProtoToJsonOrDie(dut_info.metadata()),
+      .metadata_json = MetadataJson(dut_info),
       .platform_infos = platform_infos,
       .hardware_infos = hardware_infos,
       .software_infos = software_infos,
@@ -307,9 +492,9 @@ TestRunStartOutput ProtoToStruct(
       .name = test_run_start.name(),
       .version = test_run_start.version(),
       .command_line = test_run_start.command_line(),
-      .parameters_json = ProtoToJsonOrDie(test_run_start.parameters()),
+      .parameters_json = ParametersJson(test_run_start),
       .dut_info = ProtoToStruct(test_run_start.dut_info()),
-      .metadata_json = ProtoToJsonOrDie(test_run_start.metadata()),
+      .metadata_json = MetadataJson(test_run_start),
   };
 }
 
@@ -387,8 +572,8 @@ MeasurementOutput ProtoToStruct(
       .hardware_info_id = measurement.hardware_info_id(),
       .subcomponent = subcomponent,
       .validators = validators,
-      .value = ProtoToVariant(measurement.value()),
-      .metadata_json = ProtoToJsonOrDie(measurement.metadata()),
+      .value = ValueOf(measurement),
+      .metadata_json = MetadataJson(measurement),
   };
 }
 
@@ -409,7 +594,7 @@ MeasurementSeriesStartOutput ProtoToStruct(
       .hardware_info_id = measurement_series_start.hardware_info_id(),
       .subcomponent = subcomponent,
       .validators = validators,
-      .metadata_json = ProtoToJsonOrDie(measurement_series_start.metadata()),
+      .metadata_json = MetadataJson(measurement_series_start),
   };
 }
 
@@ -418,10 +603,10 @@ MeasurementSeriesElementOutput ProtoToStruct(
   return {
       .index = element.index(),
       .measurement_series_id = element.measurement_series_id(),
-      .value = ProtoToVariant(element.value()),
+      .value = ValueOf(element),
       .timestamp =
           google::protobuf::util::TimeUtil::TimestampToTimeval(element.timestamp()),
-      .metadata_json = ProtoToJsonOrDie(element.metadata()),
+      .metadata_json = MetadataJson(element),
   };
 }
 
@@ -461,7 +646,7 @@ ExtensionOutput ProtoToStruct(
     const ocpdiag_results_v2_pb::Extension& extension) {
   return {
       .name = extension.name(),
-      .content_json = ProtoToJsonOrDie(extension.content()),
+      .content_json = ContentJson(extension),
   };
 }
 
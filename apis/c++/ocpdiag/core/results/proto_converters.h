@@ -7,20 +7,57 @@
 #ifndef OCPDIAG_CORE_RESULTS_OCP_PROTO_CONVERTERS_H_
 #define OCPDIAG_CORE_RESULTS_OCP_PROTO_CONVERTERS_H_
 
+#include <string>
+
 #include "google/protobuf/struct.pb.h"
+#include "absl/flags/declare.h"
 #include "absl/strings/string_view.h"
 #include "ocpdiag/core/results/dut_info.h"
 #include "ocpdiag/core/results/results.pb.h"
 #include "ocpdiag/core/results/structs.h"
+#include "ocpdiag/core/results/variant.h"
+
+ABSL_DECLARE_FLAG(bool, ocpdiag_results_raw_json);
 
 namespace ocpdiag::results::internal {
 
+// Converts a variant value to its corresponding protobuf. Integers become
+// numbers, which are exact up to 2^53 in magnitude.
+google::protobuf::Value VariantToProto(const Variant& value);
+// Like the above, but moves a string value instead of copying it.
+google::protobuf::Value VariantToProto(Variant&& value);
+
+// Sets the value of a measurement or series element. Integers are also kept
+// exactly in its integer_value field, which ProtoToStruct reads them from. The
+// rvalue overloads move a string value instead of copying it.
+void SetValue(const Variant& value, ocpdiag_results_v2_pb::Measurement& proto);
+void SetValue(Variant&& value, ocpdiag_results_v2_pb::Measurement& proto);
+void SetValue(const Variant& value,
+              ocpdiag_results_v2_pb::MeasurementSeriesElement& proto);
+void SetValue(Variant&& value,
+              ocpdiag_results_v2_pb::MeasurementSeriesElement& proto);
+
 // Converts the OCP data struct to its corresponding protobuf
+ocpdiag_results_v2_pb::Validator StructToProto(const Validator& validator);
+ocpdiag_results_v2_pb::Subcomponent StructToProto(
+    const Subcomponent& subcomponent);
 ocpdiag_results_v2_pb::MeasurementSeriesStart StructToProto(
     const MeasurementSeriesStart& measurement_series_start);
 ocpdiag_results_v2_pb::MeasurementSeriesElement StructToProto(
     const MeasurementSeriesElement& measurement_series_element);
+ocpdiag_results_v2_pb::MeasurementSeriesElement StructToProto(
+    MeasurementSeriesElement&& measurement_series_element);
 ocpdiag_results_v2_pb::Measurement StructToProto(const Measurement& measurement);
+// Like the above, but attaches the given converted validators instead of
+// converting those of the measurement.
+ocpdiag_results_v2_pb::Measurement StructToProto(
+    const Measurement& measurement,
+    const google::protobuf::RepeatedPtrField<ocpdiag_results_v2_pb::Validator>&
+        validators);
+ocpdiag_results_v2_pb::Measurement StructToProto(
+    Measurement&& measurement,
+    const google::protobuf::RepeatedPtrField<ocpdiag_results_v2_pb::Validator>&
+        validators);
 ocpdiag_results_v2_pb::Diagnosis StructToProto(const Diagnosis& diagnosis);
 ocpdiag_results_v2_pb::Error StructToProto(const Error& error);
 ocpdiag_results_v2_pb::File StructToProto(const File& file);
@@ -33,6 +70,12 @@ ocpdiag_results_v2_pb::Extension StructToProto(const Extension& extension);
 // CHECK error
 google::protobuf::Struct JsonToProtoOrDie(absl::string_view json);
 
+// Returns whether `json` is to be kept in a *_raw_json field, as the
+// --ocpdiag_results_raw_json flag asks, rather than parsed with
+// JsonToProtoOrDie, after checking that it is a valid JSON object or throwing
+// a fatal CHECK error. Empty JSON is always parsed, into an empty Struct.
+bool KeepRawJsonOrDie(absl::string_view json);
+
 // Convert the DutInfo class into its corresponding protobuf
 ocpdiag_results_v2_pb::DutInfo DutInfoToProto(const DutInfo& dut_info);
 
@@ -6,10 +6,17 @@
 
 #include "ocpdiag/core/results/proto_converters.h"
 
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "google/protobuf/util/json_util.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/reflection.h"
 #include "absl/strings/string_view.h"
 #include "ocpdiag/core/results/dut_info.h"
 #include "ocpdiag/core/results/results.pb.h"
@@ -109,6 +116,22 @@ TEST(StructToProtoTest, MeasurementSeriesElementStructConvertsSuccessfully) {
               )pb"));
 }
 
+TEST(StructToProtoTest, MovedStringValueIsNotCopied) {
+  MeasurementSeriesElement element = {.value = std::string(64, 'x')};
+  const char* data = std::get<std::string>(element.value).data();
+  ocpdiag_results_v2_pb::MeasurementSeriesElement proto =
+      StructToProto(std::move(element));
+  EXPECT_EQ(proto.value().string_value(), std::string(64, 'x'));
+  EXPECT_EQ(proto.value().string_value().data(), data);
+
+  Measurement measurement = {.name = "link-state", .value = "up"};
+  EXPECT_THAT(StructToProto(std::move(measurement), {}), EqualsProto(R"pb(
+                name: "link-state"
+                value { string_value: "up" }
+                metadata {}
+              )pb"));
+}
+
 TEST(StructToProtoTest, MeasurementStructConvertsSuccessfully) {
   Measurement measurement = {
       .name = "measured-fan-speed-100",
@@ -200,6 +223,71 @@ TEST(StructToProtoTest, BoolValidatorConvertsSuccessfully) {
               )pb"));
 }
 
+TEST(StructToProtoTest, IntegerValuesAreNumbers) {
+  EXPECT_EQ(VariantToProto(int64_t{-42}).number_value(), -42);
+  EXPECT_EQ(VariantToProto(uint64_t{999999999999999}).number_value(),
+            999999999999999);
+  // Beyond 2^53, the number is the nearest double.
+  EXPECT_EQ(VariantToProto((int64_t{1} << 53) + 1).number_value(),
+            static_cast<double>(int64_t{1} << 53));
+  EXPECT_EQ(VariantToProto(std::numeric_limits<uint64_t>::max()).number_value(),
+            18446744073709551616.);
+}
+
+TEST(StructToProtoTest, IntegerValuesPrintAsJsonIntegers) {
+  for (const auto& [value, want_json] :
+       std::vector<std::pair<Variant, std::string>>{
+           {int64_t{123456789012345}, "123456789012345"},
+           {int64_t{-7}, "-7"},
+           {uint64_t{0}, "0"},
+       }) {
+    std::string json;
+    ASSERT_TRUE(google::protobuf::util::MessageToJsonString(
+                    VariantToProto(value), &json)
+                    .ok());
+    EXPECT_EQ(json, want_json);
+  }
+}
+
+TEST(StructToProtoTest, IntegerMeasurementsKeepTheirExactValue) {
+  ocpdiag_results_v2_pb::Measurement proto =
+      StructToProto(Measurement({.name = "ecc-errors", .value = -3}));
+  EXPECT_EQ(proto.value().number_value(), -3);
+  EXPECT_EQ(proto.integer_value().int64_value(), -3);
+  proto = StructToProto(Measurement({.name = "ecc-errors", .value = 3.}));
+  EXPECT_FALSE(proto.has_integer_value());
+  ocpdiag_results_v2_pb::MeasurementSeriesElement element =
+      StructToProto(MeasurementSeriesElement({.value = uint64_t{3}}));
+  EXPECT_EQ(element.value().number_value(), 3);
+  EXPECT_EQ(element.integer_value().uint64_value(), 3);
+}
+
+TEST(ProtoToStructTest, IntegerValuesRoundTripExactly) {
+  for (const Variant& value : std::vector<Variant>{
+           int64_t{-42},
+           std::numeric_limits<int64_t>::min(),
+           std::numeric_limits<int64_t>::max(),
+           uint64_t{7},
+           std::numeric_limits<uint64_t>::max(),
+           (uint64_t{1} << 53) + 1,
+       }) {
+    Measurement measurement = {
+        .name = "ecc-errors",
+        .validators = {{.type = ValidatorType::kLessThan, .value = {value}}},
+        .value = value,
+    };
+    ocpdiag_results_v2_pb::Measurement proto = StructToProto(measurement);
+    // The exact value survives serialization, as in the binary results file.
+    ASSERT_TRUE(proto.ParseFromString(proto.SerializeAsString()));
+    MeasurementOutput output = ProtoToStruct(proto);
+    EXPECT_EQ(output.value, value);
+    // Validator values are only kept as numbers.
+    ASSERT_EQ(output.validators.size(), 1);
+    EXPECT_EQ(output.validators[0].value,
+              std::vector<Variant>{NumericAsDouble(value)});
+  }
+}
+
 TEST(StructToProtoTest, DiagnosisStructConvertsSuccessfully) {
   RegisteredHardwareInfo hw_info = GetRegisteredHardwareInfo();
   Diagnosis diagnosis = {
@@ -384,6 +472,61 @@ TEST(JsonToProtoDeathTest, InvalidJsonCausesError) {
   EXPECT_DEATH(JsonToProtoOrDie(invalid_json), "");
 }
 
+TEST(RawJsonTest, JsonIsKeptRawWithTheFlag) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_results_raw_json, true);
+  TestRunStart test_run_start = {
+      .name = "mlc",
+      .parameters_json = R"json({"max_bandwidth": 7200.0})json",
+  };
+  ocpdiag_results_v2_pb::TestRunStart proto = StructToProto(test_run_start);
+  EXPECT_EQ(proto.parameters_raw_json(), test_run_start.parameters_json);
+  EXPECT_FALSE(proto.has_parameters());
+  // Empty JSON is converted as without the flag.
+  EXPECT_FALSE(proto.has_metadata_raw_json());
+  EXPECT_THAT(proto.metadata(), EqualsProto(""));
+
+  TestRunStartOutput output = ProtoToStruct(proto);
+  EXPECT_EQ(output.parameters_json, test_run_start.parameters_json);
+  EXPECT_EQ(output.metadata_json, "{}");
+}
+
+TEST(RawJsonTest, AllJsonFieldsCanBeKeptRaw) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_results_raw_json, true);
+  const std::string json = R"json({"a": [1, {"b": null}]})json";
+  EXPECT_EQ(StructToProto(Measurement{.name = "m",
+                                      .value = 1.0,
+                                      .metadata_json = json})
+                .metadata_raw_json(),
+            json);
+  EXPECT_EQ(StructToProto(MeasurementSeriesStart{.name = "s",
+                                                 .metadata_json = json})
+                .metadata_raw_json(),
+            json);
+  EXPECT_EQ(StructToProto(MeasurementSeriesElement{.value = 1.0,
+                                                   .metadata_json = json})
+                .metadata_raw_json(),
+            json);
+  EXPECT_EQ(
+      StructToProto(Extension{.name = "e", .content_json = json})
+          .content_raw_json(),
+      json);
+  DutInfo dut_info("dut", "id");
+  dut_info.SetMetadataJson(json);
+  EXPECT_EQ(DutInfoToProto(dut_info).metadata_raw_json(), json);
+}
+
+TEST(RawJsonDeathTest, InvalidRawJsonCausesError) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_results_raw_json, true);
+  EXPECT_DEATH(StructToProto(Extension{.name = "e", .content_json = "[1, 2]"}),
+               "Must pass a valid JSON string");
+  EXPECT_DEATH(
+      StructToProto(Extension{.name = "e", .content_json = R"({"a": 1,})"}),
+      "Must pass a valid JSON string");
+}
+
 TEST(DutInfoToProtoTest, DutInfoConvertsSuccessfully) {
   DutInfo dut_info("dut", "id");
   RegisteredHardwareInfo hw_info1 = dut_info.AddHardwareInfo({
@@ -0,0 +1,433 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_aggregator.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "google/protobuf/timestamp.pb.h"
+#include "absl/functional/function_ref.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/types/span.h"
+#include "ocpdiag/core/results/interned_records.h"
+#include "ocpdiag/core/results/proto_converters.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/structs.h"
+#include "ocpdiag/core/results/variant.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/record_reader.h"
+#include "riegeli/records/record_writer.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+absl::Status FileError(absl::string_view path, const absl::Status& status) {
+  return absl::Status(status.code(),
+                      absl::StrCat(path, ": ", status.message()));
+}
+
+// Artifacts in timestamp order, each with the index of the results file it
+// comes from.
+class MergeInput {
+ public:
+  virtual ~MergeInput() = default;
+
+  // Reads the next artifact. Returns false at the end of the input or on an
+  // error, which is then returned by Close().
+  virtual bool Read(int& file_index,
+                    ocpdiag_results_v2_pb::OutputArtifact& artifact) = 0;
+  virtual absl::Status Close() = 0;
+};
+
+class ResultsFileInput : public MergeInput {
+ public:
+  ResultsFileInput(absl::string_view path, int file_index)
+      : path_(path), file_index_(file_index), reader_(path) {}
+
+  bool Read(int& file_index,
+            ocpdiag_results_v2_pb::OutputArtifact& artifact) override {
+    file_index = file_index_;
+    return reader_.ReadArtifact(artifact);
+  }
+
+  absl::Status Close() override {
+    if (!reader_.Close()) return FileError(path_, reader_.status());
+    return absl::OkStatus();
+  }
+
+ private:
+  std::string path_;
+  int file_index_;
+  internal::ResultsFileReader reader_;
+};
+
+// An intermediate file of a merge in batches. Each record holds the file
+// index, in the byte order of the host, followed by the serialized artifact.
+class IntermediateFileInput : public MergeInput {
+ public:
+  explicit IntermediateFileInput(absl::string_view path)
+      : path_(path), reader_(riegeli::FdReader<>(path)) {}
+
+  bool Read(int& file_index,
+            ocpdiag_results_v2_pb::OutputArtifact& artifact) override {
+    if (!reader_.ReadRecord(record_)) return false;
+    if (record_.size() < sizeof(file_index) ||
+        !artifact.ParseFromArray(record_.data() + sizeof(file_index),
+                                 record_.size() - sizeof(file_index))) {
+      status_ = absl::DataLossError("Invalid intermediate record");
+      return false;
+    }
+    std::memcpy(&file_index, record_.data(), sizeof(file_index));
+    return true;
+  }
+
+  absl::Status Close() override {
+    if (!reader_.Close()) return FileError(path_, reader_.status());
+    if (!status_.ok()) return FileError(path_, status_);
+    return absl::OkStatus();
+  }
+
+ private:
+  std::string path_;
+  riegeli::RecordReader<riegeli::FdReader<>> reader_;
+  std::string record_;
+  absl::Status status_;
+};
+
+// Writes the artifact to an intermediate file, for an IntermediateFileInput
+// to read.
+absl::Status WriteIntermediateRecord(
+    absl::string_view path, int file_index,
+    const ocpdiag_results_v2_pb::OutputArtifact& artifact,
+    riegeli::RecordWriter<riegeli::FdWriter<>>& writer, std::string& record) {
+  record.assign(reinterpret_cast<const char*>(&file_index),
+                sizeof(file_index));
+  artifact.AppendToString(&record);
+  if (!writer.WriteRecord(record)) return FileError(path, writer.status());
+  return absl::OkStatus();
+}
+
+// The intermediate files of one level of a merge in batches, which are
+// removed along with this.
+class IntermediateFiles {
+ public:
+  explicit IntermediateFiles(absl::string_view dir) : dir_(dir) {}
+  IntermediateFiles(const IntermediateFiles&) = delete;
+  IntermediateFiles& operator=(const IntermediateFiles&) = delete;
+  ~IntermediateFiles() {
+    for (const std::string& path : paths_) std::remove(path.c_str());
+  }
+
+  // Creates a new empty file and returns its path.
+  absl::StatusOr<std::string> Create() {
+    std::string path = absl::StrCat(dir_, "/ocpdiag_merge_XXXXXX");
+    int fd = mkstemp(path.data());
+    if (fd < 0) {
+      return absl::InternalError(
+          absl::StrCat("Cannot create an intermediate file in ", dir_, ": ",
+                       std::strerror(errno)));
+    }
+    close(fd);
+    paths_.push_back(path);
+    return path;
+  }
+
+ private:
+  std::string dir_;
+  std::vector<std::string> paths_;
+};
+
+using MergeInputFactory = std::function<std::unique_ptr<MergeInput>()>;
+
+// Merges the inputs, all of which are open at the same time.
+absl::Status MergeInputs(
+    absl::Span<const MergeInputFactory> factories,
+    absl::FunctionRef<absl::Status(
+        int file_index, const ocpdiag_results_v2_pb::OutputArtifact&)>
+        callback) {
+  struct Input {
+    std::unique_ptr<MergeInput> input;
+    int file_index = 0;
+    ocpdiag_results_v2_pb::OutputArtifact next;
+  };
+  std::vector<Input> inputs(factories.size());
+
+  // Holds the indexes of the inputs with a pending artifact, earliest first.
+  auto key = [&inputs](int index) {
+    const Input& input = inputs[index];
+    const google::protobuf::Timestamp& timestamp = input.next.timestamp();
+    return std::make_tuple(timestamp.seconds(), timestamp.nanos(),
+                           input.file_index, index);
+  };
+  auto later = [&key](int lhs, int rhs) { return key(lhs) > key(rhs); };
+  std::priority_queue<int, std::vector<int>, decltype(later)> pending(later);
+
+  // Reads the next artifact of the input, releasing the input once all of its
+  // artifacts have been read.
+  auto read_next = [&inputs](int index) -> absl::Status {
+    Input& input = inputs[index];
+    if (input.input->Read(input.file_index, input.next))
+      return absl::OkStatus();
+    absl::Status status = input.input->Close();
+    input.input.reset();
+    return status;
+  };
+
+  for (int i = 0; i < static_cast<int>(factories.size()); i++) {
+    inputs[i].input = factories[i]();
+    if (absl::Status status = read_next(i); !status.ok()) return status;
+    if (inputs[i].input != nullptr) pending.push(i);
+  }
+  while (!pending.empty()) {
+    int index = pending.top();
+    pending.pop();
+    if (absl::Status status =
+            callback(inputs[index].file_index, inputs[index].next);
+        !status.ok()) {
+      return status;
+    }
+    if (absl::Status status = read_next(index); !status.ok()) return status;
+    if (inputs[index].input != nullptr) pending.push(index);
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+void MeasurementStats::Add(const Variant& value) {
+  count_++;
+  double number;
+  if (IsNumeric(value)) {
+    number = NumericAsDouble(value);
+  } else if (const bool* b = std::get_if<bool>(&value); b != nullptr) {
+    number = *b ? 1 : 0;
+  } else {
+    return;
+  }
+  numeric_count_++;
+  min_ = std::min(min_, number);
+  max_ = std::max(max_, number);
+  double delta = number - mean_;
+  mean_ += delta / numeric_count_;
+  squared_deviations_ += delta * (number - mean_);
+}
+
+void MeasurementStats::Merge(const MeasurementStats& other) {
+  count_ += other.count_;
+  if (other.numeric_count_ == 0) return;
+  int64_t numeric_count = numeric_count_ + other.numeric_count_;
+  double delta = other.mean_ - mean_;
+  // Chan et al.'s formula for combining the deviations of two samples.
+  squared_deviations_ += other.squared_deviations_ +
+                         delta * delta * numeric_count_ *
+                             other.numeric_count_ / numeric_count;
+  mean_ += delta * other.numeric_count_ / numeric_count;
+  numeric_count_ = numeric_count;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+}
+
+double MeasurementStats::Variance() const {
+  if (numeric_count_ == 0) return 0;
+  return squared_deviations_ / numeric_count_;
+}
+
+void FleetAggregates::Merge(const FleetAggregates& other) {
+  files += other.files;
+  artifacts += other.artifacts;
+  for (const auto& [result, count] : other.test_run_results)
+    test_run_results[result] += count;
+  for (const auto& [verdict, counts] : other.diagnoses_by_verdict) {
+    DiagnosisCounts& merged = diagnoses_by_verdict[verdict];
+    merged.pass += counts.pass;
+    merged.fail += counts.fail;
+    merged.unknown += counts.unknown;
+  }
+  for (const auto& [key, stats] : other.measurements)
+    measurements[key].Merge(stats);
+  for (const auto& [symptom, count] : other.errors_by_symptom)
+    errors_by_symptom[symptom] += count;
+}
+
+absl::Status ResultsAggregator::AddFile(absl::string_view file_path) {
+  series_keys_.clear();
+  aggregates_.files++;
+  internal::ResultsFileReader reader(file_path);
+  ocpdiag_results_v2_pb::OutputArtifact artifact;
+  while (reader.ReadArtifact(artifact))
+    AddArtifact(internal::ProtoToStruct(artifact));
+  if (!reader.Close()) return FileError(file_path, reader.status());
+  return absl::OkStatus();
+}
+
+void ResultsAggregator::AddArtifact(const OutputArtifact& artifact) {
+  aggregates_.artifacts++;
+  if (auto* test_step = std::get_if<TestStepArtifact>(&artifact.artifact);
+      test_step != nullptr) {
+    AddTestStepArtifact(*test_step);
+  } else if (auto* test_run =
+                 std::get_if<TestRunArtifact>(&artifact.artifact);
+             test_run != nullptr) {
+    if (auto* end = std::get_if<TestRunEndOutput>(&test_run->artifact);
+        end != nullptr) {
+      aggregates_.test_run_results[end->result]++;
+    } else if (auto* error = std::get_if<ErrorOutput>(&test_run->artifact);
+               error != nullptr) {
+      aggregates_.errors_by_symptom[error->symptom]++;
+    }
+  }
+}
+
+void ResultsAggregator::AddTestStepArtifact(const TestStepArtifact& artifact) {
+  if (auto* measurement = std::get_if<MeasurementOutput>(&artifact.artifact);
+      measurement != nullptr) {
+    aggregates_.measurements[{measurement->name, measurement->unit}].Add(
+        measurement->value);
+  } else if (auto* element = std::get_if<MeasurementSeriesElementOutput>(
+                 &artifact.artifact);
+             element != nullptr) {
+    auto it = series_keys_.find(element->measurement_series_id);
+    if (it != series_keys_.end())
+      aggregates_.measurements[it->second].Add(element->value);
+  } else if (auto* series_start = std::get_if<MeasurementSeriesStartOutput>(
+                 &artifact.artifact);
+             series_start != nullptr) {
+    series_keys_[series_start->measurement_series_id] = {series_start->name,
+                                                         series_start->unit};
+  } else if (auto* diagnosis = std::get_if<DiagnosisOutput>(&artifact.artifact);
+             diagnosis != nullptr) {
+    DiagnosisCounts& counts =
+        aggregates_.diagnoses_by_verdict[diagnosis->verdict];
+    switch (diagnosis->type) {
+      case DiagnosisType::kPass:
+        counts.pass++;
+        break;
+      case DiagnosisType::kFail:
+        counts.fail++;
+        break;
+      default:
+        counts.unknown++;
+        break;
+    }
+  } else if (auto* error = std::get_if<ErrorOutput>(&artifact.artifact);
+             error != nullptr) {
+    aggregates_.errors_by_symptom[error->symptom]++;
+  }
+}
+
+absl::StatusOr<FleetAggregates> AggregateResultsFiles(
+    const std::vector<std::string>& paths, int num_threads) {
+  num_threads = std::clamp(num_threads, 1,
+                           std::max(static_cast<int>(paths.size()), 1));
+  std::vector<ResultsAggregator> aggregators(num_threads);
+  std::vector<absl::Status> statuses(num_threads);
+  std::atomic<size_t> next_path = 0;
+  std::atomic<bool> failed = false;
+  auto aggregate_files = [&](int thread) {
+    for (size_t i = next_path++; i < paths.size() && !failed;
+         i = next_path++) {
+      statuses[thread] = aggregators[thread].AddFile(paths[i]);
+      if (!statuses[thread].ok()) {
+        failed = true;
+        return;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (int i = 1; i < num_threads; i++)
+    threads.emplace_back(aggregate_files, i);
+  aggregate_files(0);
+  for (std::thread& thread : threads) thread.join();
+
+  FleetAggregates aggregates;
+  for (int i = 0; i < num_threads; i++) {
+    if (!statuses[i].ok()) return statuses[i];
+    aggregates.Merge(aggregators[i].aggregates());
+  }
+  return aggregates;
+}
+
+absl::Status MergeResultsFiles(
+    const std::vector<std::string>& paths,
+    absl::FunctionRef<absl::Status(
+        int file_index, const ocpdiag_results_v2_pb::OutputArtifact&)>
+        callback,
+    const MergeOptions& options) {
+  CHECK_GE(options.max_open_files, 2) << "Must merge at least two files";
+  size_t batch_size = options.max_open_files;
+  std::vector<MergeInputFactory> factories;
+  factories.reserve(paths.size());
+  for (int i = 0; i < static_cast<int>(paths.size()); i++) {
+    factories.push_back([&path = paths[i], i] {
+      return std::make_unique<ResultsFileInput>(path, i);
+    });
+  }
+
+  // Merges each batch into an intermediate file until the files of a level
+  // can be merged at once. The files of a level are removed once the next
+  // level is written.
+  std::string temp_dir = options.temp_dir.empty()
+                             ? std::filesystem::temp_directory_path().string()
+                             : options.temp_dir;
+  std::unique_ptr<IntermediateFiles> level_files;
+  while (factories.size() > batch_size) {
+    auto next_level_files = std::make_unique<IntermediateFiles>(temp_dir);
+    std::vector<MergeInputFactory> next_level;
+    for (size_t begin = 0; begin < factories.size(); begin += batch_size) {
+      absl::StatusOr<std::string> path = next_level_files->Create();
+      if (!path.ok()) return path.status();
+      riegeli::RecordWriter<riegeli::FdWriter<>> writer{
+          riegeli::FdWriter<>(*path)};
+      if (!writer.ok()) return FileError(*path, writer.status());
+      std::string record;
+      if (absl::Status status = MergeInputs(
+              absl::MakeConstSpan(factories).subspan(begin, batch_size),
+              [&](int file_index, const auto& artifact) {
+                return WriteIntermediateRecord(*path, file_index, artifact,
+                                               writer, record);
+              });
+          !status.ok()) {
+        return status;
+      }
+      if (!writer.Close()) return FileError(*path, writer.status());
+      next_level.push_back([path = *path] {
+        return std::make_unique<IntermediateFileInput>(path);
+      });
+    }
+    factories = std::move(next_level);
+    level_files = std::move(next_level_files);
+  }
+  return MergeInputs(factories, callback);
+}
+
+}  // namespace ocpdiag::results
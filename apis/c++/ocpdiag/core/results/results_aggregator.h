@@ -0,0 +1,132 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_RESULTS_AGGREGATOR_H_
+#define OCPDIAG_CORE_RESULTS_RESULTS_AGGREGATOR_H_
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/container/flat_hash_map.h"
+#include "absl/functional/function_ref.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/structs.h"
+
+namespace ocpdiag::results {
+
+// Running statistics of the values recorded for one measurement. Numeric and
+// boolean values contribute to the mean and spread, strings are only counted.
+// Two instances can be merged without revisiting the values.
+class MeasurementStats {
+ public:
+  void Add(const Variant& value);
+  void Merge(const MeasurementStats& other);
+
+  // Number of values of any type.
+  int64_t count() const { return count_; }
+  // Number of numeric and boolean values.
+  int64_t numeric_count() const { return numeric_count_; }
+  double min() const { return min_; }
+  double max() const { return max_; }
+  double mean() const { return mean_; }
+  // Population variance of the numeric values.
+  double Variance() const;
+
+ private:
+  int64_t count_ = 0;
+  int64_t numeric_count_ = 0;
+  double min_ = std::numeric_limits<double>::infinity();
+  double max_ = -std::numeric_limits<double>::infinity();
+  double mean_ = 0;
+  // Sum of squared differences from the mean, see Welford's algorithm.
+  double squared_deviations_ = 0;
+};
+
+// Counts of the diagnoses that share a verdict.
+struct DiagnosisCounts {
+  int64_t pass = 0;
+  int64_t fail = 0;
+  int64_t unknown = 0;
+};
+
+// Aggregates over the results of many test runs, e.g. one per DUT.
+struct FleetAggregates {
+  int64_t files = 0;
+  int64_t artifacts = 0;
+  // Keyed by the result in each test run's end artifact.
+  std::map<TestResult, int64_t> test_run_results;
+  std::map<std::string, DiagnosisCounts> diagnoses_by_verdict;
+  // Keyed by measurement name and unit. Measurement series elements are
+  // counted under the name and unit of their series.
+  std::map<std::pair<std::string, std::string>, MeasurementStats> measurements;
+  std::map<std::string, int64_t> errors_by_symptom;
+
+  void Merge(const FleetAggregates& other);
+};
+
+// Aggregates the artifacts of results files one at a time, without keeping
+// the artifacts in memory. This class is not thread-safe.
+class ResultsAggregator {
+ public:
+  // Aggregates every artifact of the results file. Returns an error if the
+  // file cannot be read, in which case the artifacts read before the error
+  // stay aggregated.
+  absl::Status AddFile(absl::string_view file_path);
+
+  // Aggregates a single artifact of the current file.
+  void AddArtifact(const OutputArtifact& artifact);
+
+  const FleetAggregates& aggregates() const { return aggregates_; }
+
+ private:
+  void AddTestStepArtifact(const TestStepArtifact& artifact);
+
+  FleetAggregates aggregates_;
+  // Measurement keys of the current file's series, which are only unique
+  // within the file.
+  absl::flat_hash_map<std::string, std::pair<std::string, std::string>>
+      series_keys_;
+};
+
+// Aggregates the results files using up to `num_threads` threads, each of
+// which aggregates whole files and holds one artifact at a time. Returns the
+// error of the first file that cannot be read, after which no more files are
+// started.
+absl::StatusOr<FleetAggregates> AggregateResultsFiles(
+    const std::vector<std::string>& paths, int num_threads);
+
+struct MergeOptions {
+  // The most files read at the same time. Beyond it, the files are merged in
+  // batches of this many into intermediate files, which are merged in turn.
+  int max_open_files = 256;
+  // Where the intermediate files are written, the system's temporary
+  // directory if empty. They are removed once merged.
+  std::string temp_dir;
+};
+
+// Reads the results files side by side, calling `callback` with each artifact
+// and the index of its file in timestamp order. Artifacts with the same
+// timestamp are ordered by file. Only one artifact per open file is held in
+// memory, so each file must already be in timestamp order, as written by a
+// TestRun. The merge stops at the first error, of a file or of `callback`,
+// and returns it.
+absl::Status MergeResultsFiles(
+    const std::vector<std::string>& paths,
+    absl::FunctionRef<absl::Status(
+        int file_index, const ocpdiag_results_v2_pb::OutputArtifact&)>
+        callback,
+    const MergeOptions& options = {});
+
+}  // namespace ocpdiag::results
+
+#endif  // OCPDIAG_CORE_RESULTS_RESULTS_AGGREGATOR_H_
@@ -0,0 +1,149 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+// Aggregates OCPDiag results files across test runs, e.g. one file per DUT,
+// and prints a fleet report:
+//   aggregate_results --threads=16 results/*.riegeli
+// With --merged_output, the files are also merged into a single results file
+// in timestamp order.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>  //
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_format.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/results_aggregator.h"
+#include "ocpdiag/core/results/structs.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/record_writer.h"
+#include "riegeli/records/records_metadata.pb.h"
+
+ABSL_FLAG(int, threads, std::thread::hardware_concurrency(),
+          "Number of files aggregated at the same time.");
+ABSL_FLAG(std::string, merged_output, "",
+          "If set, the input files are merged into a single results file at "
+          "this path, in timestamp order.");
+ABSL_FLAG(int, max_open_files, 256,
+          "Most input files read at the same time by --merged_output. More "
+          "files are merged in batches through temporary files.");
+
+namespace {
+
+using ::ocpdiag::results::FleetAggregates;
+using ::ocpdiag::results::TestResult;
+
+absl::Status WriteMergedResults(const std::vector<std::string>& paths,
+                                const std::string& output_path) {
+  riegeli::RecordsMetadata metadata;
+  riegeli::SetRecordType(
+      *ocpdiag_results_v2_pb::OutputArtifact::GetDescriptor(), metadata);
+  riegeli::RecordWriter<riegeli::FdWriter<>> writer(
+      riegeli::FdWriter<>(output_path),
+      riegeli::RecordWriterBase::Options().set_metadata(std::move(metadata)));
+  if (!writer.ok()) return writer.status();
+  if (absl::Status status = ocpdiag::results::MergeResultsFiles(
+          paths,
+          [&writer](int /*file_index*/, const auto& artifact) -> absl::Status {
+            if (!writer.WriteRecord(artifact)) return writer.status();
+            return absl::OkStatus();
+          },
+          {.max_open_files = absl::GetFlag(FLAGS_max_open_files)});
+      !status.ok()) {
+    return status;
+  }
+  if (!writer.Close()) return writer.status();
+  return absl::OkStatus();
+}
+
+const char* TestResultName(TestResult result) {
+  switch (result) {
+    case TestResult::kPass:
+      return "PASS";
+    case TestResult::kFail:
+      return "FAIL";
+    default:
+      return "NOT_APPLICABLE";
+  }
+}
+
+void PrintReport(const FleetAggregates& aggregates) {
+  absl::PrintF("Files: %d\nArtifacts: %d\n", aggregates.files,
+               aggregates.artifacts);
+
+  absl::PrintF("\nTest run results:\n");
+  for (const auto& [result, count] : aggregates.test_run_results)
+    absl::PrintF("  %-16s %d\n", TestResultName(result), count);
+
+  absl::PrintF("\nDiagnoses:\n  %-32s %10s %10s %10s\n", "verdict", "pass",
+               "fail", "unknown");
+  for (const auto& [verdict, counts] : aggregates.diagnoses_by_verdict) {
+    absl::PrintF("  %-32s %10d %10d %10d\n", verdict, counts.pass, counts.fail,
+                 counts.unknown);
+  }
+
+  absl::PrintF("\nMeasurements:\n  %-32s %-10s %10s %12s %12s %12s %12s\n",
+               "name", "unit", "count", "min", "max", "mean", "stddev");
+  for (const auto& [key, stats] : aggregates.measurements) {
+    const auto& [name, unit] = key;
+    if (stats.numeric_count() == 0) {
+      absl::PrintF("  %-32s %-10s %10d\n", name, unit, stats.count());
+      continue;
+    }
+    absl::PrintF("  %-32s %-10s %10d %12g %12g %12g %12g\n", name, unit,
+                 stats.count(), stats.min(), stats.max(), stats.mean(),
+                 std::sqrt(stats.Variance()));
+  }
+
+  absl::PrintF("\nErrors:\n");
+  for (const auto& [symptom, count] : aggregates.errors_by_symptom)
+    absl::PrintF("  %-32s %10d\n", symptom, count);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Aggregates OCPDiag results files across test runs.\n"
+      "Usage: aggregate_results [flags] FILE...");
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  std::vector<std::string> paths(args.begin() + 1, args.end());
+  if (paths.empty()) {
+    std::cerr << "No input files given" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (std::string merged_output = absl::GetFlag(FLAGS_merged_output);
+      !merged_output.empty()) {
+    if (absl::Status status = WriteMergedResults(paths, merged_output);
+        !status.ok()) {
+      std::cerr << "Failed to merge results: " << status.ToString()
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  absl::StatusOr<FleetAggregates> aggregates =
+      ocpdiag::results::AggregateResultsFiles(paths,
+                                              absl::GetFlag(FLAGS_threads));
+  if (!aggregates.ok()) {
+    std::cerr << "Failed to aggregate results: "
+              << aggregates.status().ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
+  PrintReport(*aggregates);
+  return EXIT_SUCCESS;
+}
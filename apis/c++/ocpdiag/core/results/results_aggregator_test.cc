@@ -0,0 +1,248 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_aggregator.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>  //
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/clock.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/structs.h"
+#include "ocpdiag/core/testing/file_utils.h"
+#include "ocpdiag/core/testing/parse_text_proto.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+
+namespace ocpdiag::results {
+
+using ::ocpdiag::testing::IsOk;
+using ::ocpdiag::testing::ParseTextProtoOrDie;
+using ::ocpdiag::testing::StatusIs;
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+using ::testing::Pair;
+
+namespace {
+
+std::string GetTempFilepath() {
+  std::string filepath = testutils::MkTempFileOrDie("results_aggregator");
+  if (std::filesystem::exists(filepath))
+    CHECK(std::filesystem::remove(filepath)) << "Cannot remove temp file";
+  return filepath;
+}
+
+// Writes the artifacts and a test run end to a new results file, timestamped
+// `interval_seconds` apart from `start_seconds`, and returns its path.
+std::string WriteResultsFile(
+    const std::vector<ocpdiag_results_v2_pb::TestStepArtifact>& artifacts,
+    int start_seconds = 0, int interval_seconds = 1) {
+  std::string path = GetTempFilepath();
+  FakeClock clock(absl::FromUnixSeconds(start_seconds),
+                  absl::Seconds(interval_seconds));
+  internal::ArtifactWriter writer(
+      path, /*output_stream=*/nullptr,
+      {.flush_each_minute = false, .clock = &clock});
+  for (const auto& artifact : artifacts) writer.Write(artifact);
+  ocpdiag_results_v2_pb::TestRunArtifact end = ParseTextProtoOrDie(
+      R"pb(test_run_end { status: COMPLETE result: PASS })pb");
+  writer.Write(end);
+  return path;
+}
+
+std::vector<ocpdiag_results_v2_pb::TestStepArtifact> MakeDutArtifacts() {
+  return {
+      ParseTextProtoOrDie(R"pb(
+        test_step_id: "0"
+        measurement {
+          name: "temperature"
+          unit: "C"
+          value { number_value: 40 }
+        }
+      )pb"),
+      ParseTextProtoOrDie(R"pb(
+        test_step_id: "0"
+        measurement_series_start {
+          measurement_series_id: "0"
+          name: "temperature"
+          unit: "C"
+        }
+      )pb"),
+      ParseTextProtoOrDie(R"pb(
+        test_step_id: "0"
+        measurement_series_element {
+          measurement_series_id: "0"
+          value { number_value: 50 }
+        }
+      )pb"),
+      ParseTextProtoOrDie(R"pb(
+        test_step_id: "0"
+        diagnosis { verdict: "dimm-good" type: PASS }
+      )pb"),
+      ParseTextProtoOrDie(R"pb(
+        test_step_id: "0"
+        diagnosis { verdict: "dimm-bad" type: FAIL }
+      )pb"),
+      ParseTextProtoOrDie(R"pb(
+        test_step_id: "0"
+        error { symptom: "timeout" }
+      )pb"),
+  };
+}
+
+TEST(MeasurementStatsTest, MergedStatsMatchSequentialStats) {
+  MeasurementStats all, first, second;
+  for (double value : {1., 2., 3.}) {
+    all.Add(value);
+    first.Add(value);
+  }
+  for (Variant value : {Variant(10.), Variant(true), Variant("text")}) {
+    all.Add(value);
+    second.Add(value);
+  }
+  first.Merge(second);
+
+  EXPECT_EQ(first.count(), 6);
+  EXPECT_EQ(first.numeric_count(), 5);
+  EXPECT_EQ(first.min(), 1);
+  EXPECT_EQ(first.max(), 10);
+  EXPECT_DOUBLE_EQ(first.mean(), 17. / 5);
+  EXPECT_DOUBLE_EQ(first.mean(), all.mean());
+  EXPECT_DOUBLE_EQ(first.Variance(), all.Variance());
+}
+
+TEST(ResultsAggregatorTest, FileIsAggregated) {
+  ResultsAggregator aggregator;
+  ASSERT_THAT(aggregator.AddFile(WriteResultsFile(MakeDutArtifacts())),
+              IsOk());
+  const FleetAggregates& aggregates = aggregator.aggregates();
+
+  EXPECT_EQ(aggregates.files, 1);
+  EXPECT_EQ(aggregates.artifacts, 7);
+  EXPECT_THAT(aggregates.test_run_results,
+              ElementsAre(Pair(TestResult::kPass, 1)));
+  ASSERT_EQ(aggregates.diagnoses_by_verdict.size(), 2);
+  EXPECT_EQ(aggregates.diagnoses_by_verdict.at("dimm-bad").fail, 1);
+  EXPECT_EQ(aggregates.diagnoses_by_verdict.at("dimm-good").pass, 1);
+  ASSERT_EQ(aggregates.measurements.size(), 1);
+  const MeasurementStats& temperature =
+      aggregates.measurements.at({"temperature", "C"});
+  EXPECT_EQ(temperature.count(), 2);
+  EXPECT_EQ(temperature.mean(), 45);
+  EXPECT_THAT(aggregates.errors_by_symptom, ElementsAre(Pair("timeout", 1)));
+}
+
+TEST(ResultsAggregatorTest, FilesAreAggregatedInParallel) {
+  std::vector<std::string> paths;
+  for (int i = 0; i < 10; i++)
+    paths.push_back(WriteResultsFile(MakeDutArtifacts()));
+
+  absl::StatusOr<FleetAggregates> result =
+      AggregateResultsFiles(paths, /*num_threads=*/4);
+  ASSERT_THAT(result.status(), IsOk());
+  const FleetAggregates& aggregates = *result;
+  EXPECT_EQ(aggregates.files, 10);
+  EXPECT_EQ(aggregates.artifacts, 70);
+  EXPECT_THAT(aggregates.test_run_results,
+              ElementsAre(Pair(TestResult::kPass, 10)));
+  EXPECT_EQ(aggregates.diagnoses_by_verdict.at("dimm-bad").fail, 10);
+  EXPECT_EQ(aggregates.measurements.at({"temperature", "C"}).count(), 20);
+  EXPECT_THAT(aggregates.errors_by_symptom, ElementsAre(Pair("timeout", 10)));
+}
+
+TEST(ResultsAggregatorTest, CorruptFileIsAnError) {
+  std::string path = GetTempFilepath();
+  std::ofstream(path) << "not a results file";
+  ResultsAggregator aggregator;
+  EXPECT_THAT(aggregator.AddFile(path),
+              StatusIs(absl::StatusCode::kDataLoss, HasSubstr(path)));
+
+  std::vector<std::string> paths = {WriteResultsFile(MakeDutArtifacts()),
+                                    path};
+  EXPECT_FALSE(AggregateResultsFiles(paths, /*num_threads=*/2).ok());
+}
+
+TEST(MergeResultsFilesTest, ArtifactsAreMergedByTimestamp) {
+  // Each file holds a log and the test run end, two seconds apart. The first
+  // and last files have the same timestamps.
+  std::vector<ocpdiag_results_v2_pb::TestStepArtifact> artifacts = {
+      ParseTextProtoOrDie(R"pb(log { message: "log" })pb")};
+  std::vector<std::string> paths = {WriteResultsFile(artifacts, 0, 2),
+                                    WriteResultsFile(artifacts, 1, 2),
+                                    WriteResultsFile(artifacts, 0, 2)};
+
+  std::vector<std::pair<int, int64_t>> merged;
+  auto callback = [&merged](int file_index, const auto& artifact) {
+    merged.push_back({file_index, artifact.timestamp().seconds()});
+    return absl::OkStatus();
+  };
+  ASSERT_THAT(MergeResultsFiles(paths, callback), IsOk());
+  EXPECT_THAT(merged, ElementsAre(Pair(0, 0), Pair(2, 0), Pair(1, 1),
+                                  Pair(0, 2), Pair(2, 2), Pair(1, 3)));
+}
+
+TEST(MergeResultsFilesTest, ManyFilesAreMergedInBatches) {
+  std::vector<ocpdiag_results_v2_pb::TestStepArtifact> artifacts = {
+      ParseTextProtoOrDie(R"pb(log { message: "log" })pb")};
+  std::vector<std::string> paths;
+  for (int i = 0; i < 10; i++)
+    paths.push_back(WriteResultsFile(artifacts, /*start_seconds=*/i % 3));
+  std::string temp_dir = testutils::MkTempFileOrDie("merge_dir");
+  CHECK(std::filesystem::remove(temp_dir));
+  CHECK(std::filesystem::create_directory(temp_dir));
+
+  std::vector<std::pair<int64_t, int>> merged;
+  auto callback = [&merged](int file_index, const auto& artifact) {
+    merged.push_back({artifact.timestamp().seconds(), file_index});
+    return absl::OkStatus();
+  };
+  // Three files at a time need two levels of intermediate files.
+  ASSERT_THAT(MergeResultsFiles(paths, callback,
+                                {.max_open_files = 3, .temp_dir = temp_dir}),
+              IsOk());
+  ASSERT_EQ(merged.size(), 20);
+  EXPECT_TRUE(std::is_sorted(merged.begin(), merged.end()));
+  EXPECT_EQ(merged.front(), std::make_pair(int64_t{0}, 0));
+  EXPECT_EQ(merged.back(), std::make_pair(int64_t{3}, 8));
+  EXPECT_TRUE(std::filesystem::is_empty(temp_dir));
+}
+
+TEST(MergeResultsFilesTest, MissingFileIsAnError) {
+  EXPECT_FALSE(MergeResultsFiles({"/nonexistent/results"},
+                                 [](int /*file_index*/, const auto&) {
+                                   return absl::OkStatus();
+                                 })
+                   .ok());
+}
+
+TEST(MergeResultsFilesTest, CallbackErrorStopsTheMerge) {
+  std::vector<std::string> paths = {WriteResultsFile(MakeDutArtifacts()),
+                                    WriteResultsFile(MakeDutArtifacts())};
+  int calls = 0;
+  EXPECT_THAT(MergeResultsFiles(paths,
+                                [&calls](int /*file_index*/, const auto&) {
+                                  calls++;
+                                  return absl::DataLossError("disk full");
+                                }),
+              StatusIs(absl::StatusCode::kDataLoss));
+  EXPECT_EQ(calls, 1);
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results
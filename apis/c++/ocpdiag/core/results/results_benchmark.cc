@@ -0,0 +1,705 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+// Benchmarks for the hot paths of the results library: artifact emission,
+// struct to proto conversion, measurement series elements and reading results
+// back. Run with:
+//   bazel run -c opt //ocpdiag/core/results:results_benchmark
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>  //
+#include <memory>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "google/protobuf/arena.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/reflection.h"
+#include "absl/log/check.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/artifact_sink.h"
+#include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/clock.h"
+#include "ocpdiag/core/results/compiled_validators.h"
+#include "ocpdiag/core/results/dut_info.h"
+#include "ocpdiag/core/results/measurement_series.h"
+#include "ocpdiag/core/results/measurement_template.h"
+#include "ocpdiag/core/results/output_iterator.h"
+#include "ocpdiag/core/results/output_model_builder.h"
+#include "ocpdiag/core/results/proto_converters.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/struct_validators.h"
+#include "ocpdiag/core/results/structs.h"
+#include "ocpdiag/core/results/test_run.h"
+#include "ocpdiag/core/results/test_step.h"
+
+namespace ocpdiag::results {
+namespace {
+
+using ::ocpdiag::results::internal::ArtifactWriter;
+using ::ocpdiag::results::internal::InMemoryArtifactSink;
+
+// Output modes for the ArtifactWriter benchmarks.
+enum OutputMode { kFileOnly = 0, kStreamOnly = 1, kFileAndStream = 2 };
+
+// A stream buffer that discards everything, so stream benchmarks measure JSON
+// serialization rather than terminal throughput.
+class NullBuffer : public std::streambuf {
+ protected:
+  int overflow(int c) override { return c; }
+  std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+std::string MakeTempFilepath(absl::string_view modifier) {
+  std::string path =
+      absl::StrCat(std::filesystem::temp_directory_path().string(),
+                   "/ocpdiag_", modifier, "_bench_XXXXXX");
+  int fd = mkstemp(path.data());
+  CHECK_NE(fd, -1) << "Cannot make temp file path";
+  close(fd);
+  return path;
+}
+
+Subcomponent MakeSubcomponent() {
+  return {
+      .name = "FAN1",
+      .type = SubcomponentType::kUnspecified,
+      .location = "F0_1",
+      .version = "1",
+      .revision = "1",
+  };
+}
+
+std::vector<Validator> MakeValidators() {
+  return {{
+              .type = ValidatorType::kLessThanOrEqual,
+              .value = {23850.0},
+              .name = "40mm_fan_upper_limit",
+          },
+          {
+              .type = ValidatorType::kGreaterThanOrEqual,
+              .value = {18550.0},
+              .name = "40mm_fan_lower_limit",
+          }};
+}
+
+// Builds one of each step artifact type, modelled on the content of the
+// validators/spec_validator/samples (fanspeed, mlc, memtester and pcie).
+ocpdiag_results_v2_pb::TestStepArtifact MakeStepStart() {
+  ocpdiag_results_v2_pb::TestStepArtifact proto;
+  proto.mutable_test_step_start()->set_name("Measure Internode Bandwidth");
+  return proto;
+}
+
+ocpdiag_results_v2_pb::TestStepArtifact MakeStepEnd() {
+  ocpdiag_results_v2_pb::TestStepArtifact proto;
+  proto.mutable_test_step_end()->set_status(
+      ocpdiag_results_v2_pb::TestRunEnd::COMPLETE);
+  return proto;
+}
+
+ocpdiag_results_v2_pb::TestStepArtifact MakeMeasurement() {
+  ocpdiag_results_v2_pb::TestStepArtifact proto;
+  *proto.mutable_measurement() = internal::StructToProto(Measurement{
+      .name = "inter_node_bandwidth_min",
+      .unit = "MB/sec",
+      .validators = {{
+          .type = ValidatorType::kGreaterThanOrEqual,
+          .value = {49500.0},
+          .name = "min_bandwidth",
+      }},
+      .value = 46757.6,
+  });
+  return proto;
+}
+
+ocpdiag_results_v2_pb::TestStepArtifact MakeSeriesStart() {
+  ocpdiag_results_v2_pb::TestStepArtifact proto;
+  *proto.mutable_measurement_series_start() =
+      internal::StructToProto(MeasurementSeriesStart{
+          .name = "measured-fan-speed-100",
+          .unit = "RPM",
+          .subcomponent = MakeSubcomponent(),
+          .validators = MakeValidators(),
+      });
+  proto.mutable_measurement_series_start()->set_measurement_series_id("0");
+  return proto;
+}
+
+ocpdiag_results_v2_pb::TestStepArtifact MakeSeriesElement() {
+  ocpdiag_results_v2_pb::TestStepArtifact proto;
+  *proto.mutable_measurement_series_element() =
+      internal::StructToProto(MeasurementSeriesElement{.value = 23364.0});
+  proto.mutable_measurement_series_element()->set_measurement_series_id("0");
+  return proto;
+}
+
+ocpdiag_results_v2_pb::TestStepArtifact MakeSeriesEnd() {
+  ocpdiag_results_v2_pb::TestStepArtifact proto;
+  proto.mutable_measurement_series_end()->set_measurement_series_id("0");
+  proto.mutable_measurement_series_end()->set_total_count(5);
+  return proto;
+}
+
+ocpdiag_results_v2_pb::TestStepArtifact MakeDiagnosis() {
+  ocpdiag_results_v2_pb::TestStepArtifact proto;
+  *proto.mutable_diagnosis() = internal::StructToProto(Diagnosis{
+      .verdict = "fan_speed-pass",
+      .type = DiagnosisType::kPass,
+      .message = "computer-model_40MM fan /phys/BIGGULP:device:fan0 reported 1 "
+                 "measurements at 100% duty cycle: actual violations: 0 <= "
+                 "maximum violations: 0",
+      .subcomponent = MakeSubcomponent(),
+  });
+  return proto;
+}
+
+ocpdiag_results_v2_pb::TestStepArtifact MakeLog() {
+  ocpdiag_results_v2_pb::TestStepArtifact proto;
+  *proto.mutable_log() = internal::StructToProto(Log{
+      .severity = LogSeverity::kInfo,
+      .message = "Measuring Memory Bandwidths between nodes within system",
+  });
+  return proto;
+}
+
+// Returns a mix of step artifacts whose proportions match the step artifacts
+// found across validators/spec_validator/samples: series elements dominate,
+// followed by logs, series start/end pairs, step start/end pairs, diagnoses
+// and single measurements.
+std::vector<ocpdiag_results_v2_pb::TestStepArtifact> MakeArtifactMix() {
+  struct Weighted {
+    ocpdiag_results_v2_pb::TestStepArtifact artifact;
+    int count;
+  };
+  const std::vector<Weighted> weights = {
+      {MakeStepStart(), 9}, {MakeSeriesStart(), 9}, {MakeSeriesElement(), 43},
+      {MakeSeriesEnd(), 9}, {MakeMeasurement(), 3}, {MakeDiagnosis(), 8},
+      {MakeLog(), 10},      {MakeStepEnd(), 9},
+  };
+  std::vector<ocpdiag_results_v2_pb::TestStepArtifact> mix;
+  for (const Weighted& weighted : weights) {
+    for (int i = 0; i < weighted.count; i++) {
+      mix.push_back(weighted.artifact);
+      mix.back().set_test_step_id("1");
+    }
+  }
+  return mix;
+}
+
+void BM_ArtifactWriterWrite(benchmark::State& state) {
+  const auto mode = static_cast<OutputMode>(state.range(0));
+  const std::vector<ocpdiag_results_v2_pb::TestStepArtifact> mix =
+      MakeArtifactMix();
+  std::string filepath;
+  if (mode != kStreamOnly) filepath = MakeTempFilepath("artifact_writer");
+  NullBuffer null_buffer;
+  std::ostream null_stream(&null_buffer);
+
+  {
+    ArtifactWriter writer(filepath, mode != kFileOnly ? &null_stream : nullptr,
+                          {.flush_each_minute = false});
+    size_t idx = 0;
+    for (auto _ : state) {
+      writer.Write(mix[idx]);
+      if (++idx == mix.size()) idx = 0;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (!filepath.empty()) {
+    state.counters["file_bytes_per_artifact"] = benchmark::Counter(
+        std::filesystem::file_size(filepath),
+        benchmark::Counter::kAvgIterations);
+    std::filesystem::remove(filepath);
+  }
+}
+BENCHMARK(BM_ArtifactWriterWrite)
+    ->ArgName("mode")
+    ->Arg(kFileOnly)
+    ->Arg(kStreamOnly)
+    ->Arg(kFileAndStream);
+
+void BM_ArtifactWriterInternStrings(benchmark::State& state) {
+  const bool intern_strings = state.range(0) != 0;
+  const std::vector<ocpdiag_results_v2_pb::TestStepArtifact> mix =
+      MakeArtifactMix();
+  std::string filepath = MakeTempFilepath("artifact_writer_intern");
+  {
+    ArtifactWriter writer(
+        filepath, /*output_stream=*/nullptr,
+        {.flush_each_minute = false, .intern_strings = intern_strings});
+    size_t idx = 0;
+    for (auto _ : state) {
+      writer.Write(mix[idx]);
+      if (++idx == mix.size()) idx = 0;
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.counters["file_bytes_per_artifact"] =
+      benchmark::Counter(std::filesystem::file_size(filepath),
+                         benchmark::Counter::kAvgIterations);
+  std::filesystem::remove(filepath);
+}
+BENCHMARK(BM_ArtifactWriterInternStrings)->ArgName("intern")->Arg(0)->Arg(1);
+
+template <typename ClockT>
+void BM_ClockNow(benchmark::State& state) {
+  ClockT clock;
+  for (auto _ : state) benchmark::DoNotOptimize(clock.Now());
+}
+BENCHMARK_TEMPLATE(BM_ClockNow, RealtimeClock);
+BENCHMARK_TEMPLATE(BM_ClockNow, CoarseRealtimeClock);
+BENCHMARK_TEMPLATE(BM_ClockNow, TscClock);
+BENCHMARK_TEMPLATE(BM_ClockNow, FakeClock);
+
+// Returns a fully populated example of each input struct.
+template <typename T>
+T MakeExampleStruct();
+
+template <>
+MeasurementSeriesStart MakeExampleStruct() {
+  return {
+      .name = "measured-fan-speed-100",
+      .unit = "RPM",
+      .subcomponent = MakeSubcomponent(),
+      .validators = MakeValidators(),
+      .metadata_json = R"json({"extra-key": 5})json",
+  };
+}
+
+template <>
+MeasurementSeriesElement MakeExampleStruct() {
+  return {.value = 23364.0};
+}
+
+template <>
+Measurement MakeExampleStruct() {
+  return {
+      .name = "measured-fan-speed-100",
+      .unit = "RPM",
+      .subcomponent = MakeSubcomponent(),
+      .validators = MakeValidators(),
+      .value = 9502.3,
+      .metadata_json = R"json({"measurement-type": "FAN"})json",
+  };
+}
+
+template <>
+Diagnosis MakeExampleStruct() {
+  return {
+      .verdict = "mlc-intranode-bandwidth-pass",
+      .type = DiagnosisType::kPass,
+      .message = "intranode bandwidth within threshold.",
+      .subcomponent = MakeSubcomponent(),
+  };
+}
+
+template <>
+Error MakeExampleStruct() {
+  return {
+      .symptom = "bad-return-code",
+      .message = "software exited abnormally.",
+  };
+}
+
+template <>
+File MakeExampleStruct() {
+  return {
+      .display_name = "mem_cfg_log",
+      .uri = "file:///root/mem_cfg_log",
+      .is_snapshot = false,
+      .description = "DIMM configuration settings.",
+      .content_type = "text/plain",
+  };
+}
+
+template <>
+TestRunStart MakeExampleStruct() {
+  return {
+      .name = "mlc_test",
+      .version = "1.0",
+      .command_line = "mlc/mlc --use_default_thresholds=true",
+      .parameters_json = R"json({"max_bandwidth": 7200.0, "mode": "fast_mode"})json",
+      .metadata_json = R"json({"some": "JSON"})json",
+  };
+}
+
+template <>
+Log MakeExampleStruct() {
+  return {
+      .severity = LogSeverity::kInfo,
+      .message = "Using default thresholds...",
+  };
+}
+
+template <>
+Extension MakeExampleStruct() {
+  return {
+      .name = "Extension",
+      .content_json = R"json({"extra-identifier": 17})json",
+  };
+}
+
+template <typename T>
+void BM_StructToProto(benchmark::State& state) {
+  const T input = MakeExampleStruct<T>();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(internal::StructToProto(input));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_TEMPLATE(BM_StructToProto, MeasurementSeriesStart);
+BENCHMARK_TEMPLATE(BM_StructToProto, MeasurementSeriesElement);
+BENCHMARK_TEMPLATE(BM_StructToProto, Measurement);
+BENCHMARK_TEMPLATE(BM_StructToProto, Diagnosis);
+BENCHMARK_TEMPLATE(BM_StructToProto, Error);
+BENCHMARK_TEMPLATE(BM_StructToProto, File);
+BENCHMARK_TEMPLATE(BM_StructToProto, TestRunStart);
+BENCHMARK_TEMPLATE(BM_StructToProto, Log);
+BENCHMARK_TEMPLATE(BM_StructToProto, Extension);
+
+template <typename T>
+void BM_ValidateStructOrDie(benchmark::State& state) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_struct_validation,
+                static_cast<StructValidation>(state.range(0)));
+  const T input = MakeExampleStruct<T>();
+  for (auto _ : state) ValidateStructOrDie(input);
+  state.SetItemsProcessed(state.iterations());
+}
+// The arguments are the values of StructValidation: full, first use and none.
+BENCHMARK_TEMPLATE(BM_ValidateStructOrDie, MeasurementSeriesStart)
+    ->ArgName("mode")
+    ->DenseRange(0, 2);
+BENCHMARK_TEMPLATE(BM_ValidateStructOrDie, Measurement)
+    ->ArgName("mode")
+    ->DenseRange(0, 2);
+BENCHMARK_TEMPLATE(BM_ValidateStructOrDie, Diagnosis)
+    ->ArgName("mode")
+    ->DenseRange(0, 2);
+
+// Converts a measurement series element holding a counter to JSON, as a
+// double and as an integer.
+void BM_CounterElementToJson(benchmark::State& state) {
+  const bool integral = state.range(0) != 0;
+  ocpdiag_results_v2_pb::OutputArtifact artifact;
+  *artifact.mutable_test_step_artifact()->mutable_measurement_series_element() =
+      internal::StructToProto(MeasurementSeriesElement{
+          .value = integral ? Variant(uint64_t{123456789012})
+                            : Variant(123456789012.)});
+  std::string json;
+  for (auto _ : state) {
+    CHECK_OK(internal::ArtifactToJson(artifact, json));
+    benchmark::DoNotOptimize(json);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CounterElementToJson)->ArgName("integral")->Arg(0)->Arg(1);
+
+// Compares validating and converting the example validators on every call
+// with looking them up in a ValidatorCache.
+void BM_CompileValidators(benchmark::State& state) {
+  const bool cached = state.range(0) != 0;
+  const std::vector<Validator> validators = MakeValidators();
+  internal::ValidatorCache cache;
+  for (auto _ : state) {
+    if (cached) {
+      benchmark::DoNotOptimize(cache.Compile(validators));
+    } else {
+      benchmark::DoNotOptimize(CompiledValidatorSet(validators));
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CompileValidators)->ArgName("cached")->Arg(0)->Arg(1);
+
+void BM_JsonToProtoOrDie(benchmark::State& state) {
+  const std::string json =
+      state.range(0) == 0
+          ? ""
+          : R"json({"measurement-type": "FAN", "slot": 3, "nested": {"a": [1, 2, 3], "ok": true}})json";
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(internal::JsonToProtoOrDie(json));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_JsonToProtoOrDie)->ArgName("non_empty")->Arg(0)->Arg(1);
+
+// Converts a measurement with metadata and prints it as JSON, with the
+// metadata parsed into a Struct and kept as raw JSON.
+void BM_MeasurementWithMetadataToJson(benchmark::State& state) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_results_raw_json, state.range(0) != 0);
+  const Measurement measurement = {
+      .name = "fan-speed",
+      .unit = "RPM",
+      .value = 1000.0,
+      .metadata_json =
+          R"json({"measurement-type": "FAN", "slot": 3, "nested": {"a": [1, 2, 3], "ok": true}})json",
+  };
+  ocpdiag_results_v2_pb::OutputArtifact artifact;
+  std::string json;
+  for (auto _ : state) {
+    *artifact.mutable_test_step_artifact()->mutable_measurement() =
+        internal::StructToProto(measurement);
+    CHECK_OK(internal::ArtifactToJson(artifact, json));
+    benchmark::DoNotOptimize(json);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MeasurementWithMetadataToJson)->ArgName("raw")->Arg(0)->Arg(1);
+
+// Shared state for the MeasurementSeries benchmark. Thread 0 sets it up before
+// the timed loop and tears it down afterwards; the benchmark library
+// synchronizes all threads at the start and end of the loop.
+struct SeriesFixture {
+  std::string filepath;
+  std::unique_ptr<TestRun> run;
+  std::unique_ptr<TestStep> step;
+  std::unique_ptr<MeasurementSeries> series;
+};
+SeriesFixture* series_fixture = nullptr;
+
+void BM_MeasurementSeriesAddElement(benchmark::State& state) {
+  if (state.thread_index() == 0) {
+    series_fixture = new SeriesFixture;
+    series_fixture->filepath = MakeTempFilepath("measurement_series");
+    series_fixture->run = std::make_unique<TestRun>(
+        MakeExampleStruct<TestRunStart>(),
+        std::make_unique<ArtifactWriter>(
+            series_fixture->filepath, /*output_stream=*/nullptr,
+            ArtifactWriter::Options{.flush_each_minute = false}));
+    series_fixture->run->StartAndRegisterDutInfo(
+        std::make_unique<DutInfo>("dut", "id"));
+    series_fixture->step =
+        std::make_unique<TestStep>("fan-speed", *series_fixture->run);
+    series_fixture->series = std::make_unique<MeasurementSeries>(
+        MakeExampleStruct<MeasurementSeriesStart>(), *series_fixture->step);
+  }
+
+  const MeasurementSeriesElement element =
+      MakeExampleStruct<MeasurementSeriesElement>();
+  for (auto _ : state) {
+    series_fixture->series->AddElement(element);
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  if (state.thread_index() == 0) {
+    series_fixture->series.reset();
+    series_fixture->step.reset();
+    series_fixture->run.reset();
+    std::filesystem::remove(series_fixture->filepath);
+    delete series_fixture;
+    series_fixture = nullptr;
+  }
+}
+BENCHMARK(BM_MeasurementSeriesAddElement)->ThreadRange(1, 64)->UseRealTime();
+
+// Compares adding a full Measurement struct with adding the value of a
+// MeasurementTemplate built once from the same fields.
+void BM_TestStepAddMeasurement(benchmark::State& state) {
+  const bool use_template = state.range(0) != 0;
+  std::string filepath = MakeTempFilepath("test_step_measurement");
+  {
+    TestRun run(MakeExampleStruct<TestRunStart>(),
+                std::make_unique<ArtifactWriter>(
+                    filepath, /*output_stream=*/nullptr,
+                    ArtifactWriter::Options{.flush_each_minute = false}));
+    run.StartAndRegisterDutInfo(std::make_unique<DutInfo>("dut", "id"));
+    TestStep step("fan-speed", run);
+    const Measurement measurement = MakeExampleStruct<Measurement>();
+    const MeasurementTemplate measurement_template({
+        .name = measurement.name,
+        .unit = measurement.unit,
+        .subcomponent = RegisteredSubcomponent(*measurement.subcomponent),
+        .validators = measurement.validators,
+        .metadata_json = measurement.metadata_json,
+    });
+    for (auto _ : state) {
+      if (use_template) {
+        step.AddMeasurement(measurement_template, measurement.value);
+      } else {
+        step.AddMeasurement(measurement);
+      }
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  std::filesystem::remove(filepath);
+}
+BENCHMARK(BM_TestStepAddMeasurement)->ArgName("template")->Arg(0)->Arg(1);
+
+// Builds the artifact of a MeasurementTemplate on the heap or on an arena whose
+// first block is on the stack, as TestStep::AddMeasurement does.
+void BM_MeasurementTemplateToProto(benchmark::State& state) {
+  const bool use_arena = state.range(0) != 0;
+  const Measurement measurement = MakeExampleStruct<Measurement>();
+  const MeasurementTemplate measurement_template({
+      .name = measurement.name,
+      .unit = measurement.unit,
+      .subcomponent = RegisteredSubcomponent(*measurement.subcomponent),
+      .validators = measurement.validators,
+      .metadata_json = measurement.metadata_json,
+  });
+  for (auto _ : state) {
+    alignas(std::max_align_t) char initial_block[4096];
+    google::protobuf::ArenaOptions options;
+    options.initial_block = initial_block;
+    options.initial_block_size = sizeof(initial_block);
+    google::protobuf::Arena arena(options);
+    auto* proto = google::protobuf::Arena::CreateMessage<
+        ocpdiag_results_v2_pb::OutputArtifact>(use_arena ? &arena : nullptr);
+    measurement_template.ToProto(
+        measurement.value,
+        *proto->mutable_test_step_artifact()->mutable_measurement());
+    benchmark::DoNotOptimize(proto);
+    if (!use_arena) delete proto;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_MeasurementTemplateToProto)->ArgName("arena")->Arg(0)->Arg(1);
+
+// Adds string measurements, such as link states, of the given length with a
+// MeasurementTemplate.
+void BM_TestStepAddStringMeasurement(benchmark::State& state) {
+  const std::string link_state(state.range(0), 'x');
+  std::string filepath = MakeTempFilepath("test_step_string_measurement");
+  {
+    TestRun run(MakeExampleStruct<TestRunStart>(),
+                std::make_unique<ArtifactWriter>(
+                    filepath, /*output_stream=*/nullptr,
+                    ArtifactWriter::Options{.flush_each_minute = false}));
+    run.StartAndRegisterDutInfo(std::make_unique<DutInfo>("dut", "id"));
+    TestStep step("link-state", run);
+    const MeasurementTemplate measurement_template({.name = "link-state"});
+    for (auto _ : state) {
+      step.AddMeasurement(measurement_template, absl::string_view(link_state));
+    }
+  }
+  state.SetItemsProcessed(state.iterations());
+  std::filesystem::remove(filepath);
+}
+BENCHMARK(BM_TestStepAddStringMeasurement)->ArgName("length")->Arg(6)->Arg(64);
+
+void BM_OutputIteratorRead(benchmark::State& state) {
+  const int num_artifacts = state.range(0);
+  const std::string filepath = MakeTempFilepath("output_iterator");
+  {
+    const std::vector<ocpdiag_results_v2_pb::TestStepArtifact> mix =
+        MakeArtifactMix();
+    ArtifactWriter writer(filepath, /*output_stream=*/nullptr,
+                          {.flush_each_minute = false});
+    for (int i = 0; i < num_artifacts; i++) writer.Write(mix[i % mix.size()]);
+  }
+
+  for (auto _ : state) {
+    int count = 0;
+    for (const OutputArtifact& artifact : OutputContainer(filepath)) {
+      benchmark::DoNotOptimize(artifact);
+      count++;
+    }
+    CHECK_EQ(count, num_artifacts);
+  }
+  state.SetItemsProcessed(state.iterations() * num_artifacts);
+  state.SetBytesProcessed(state.iterations() *
+                          std::filesystem::file_size(filepath));
+  std::filesystem::remove(filepath);
+}
+BENCHMARK(BM_OutputIteratorRead)->Arg(1000)->Arg(100000);
+
+// Measures what a unit test pays to write artifacts and read them back, either
+// through a temp file or through an in-memory sink.
+void BM_WriteAndReadBack(benchmark::State& state) {
+  const bool in_memory = state.range(0);
+  const int num_artifacts = state.range(1);
+  const std::vector<ocpdiag_results_v2_pb::TestStepArtifact> mix =
+      MakeArtifactMix();
+  for (auto _ : state) {
+    std::string filepath;
+    std::shared_ptr<InMemoryArtifactSink> sink;
+    std::unique_ptr<ArtifactWriter> writer;
+    if (in_memory) {
+      sink = std::make_shared<InMemoryArtifactSink>();
+      writer = std::make_unique<ArtifactWriter>(sink);
+    } else {
+      filepath = MakeTempFilepath("write_and_read_back");
+      writer = std::make_unique<ArtifactWriter>(
+          filepath, /*output_stream=*/nullptr,
+          ArtifactWriter::Options{.flush_each_minute = false});
+    }
+    for (int i = 0; i < num_artifacts; i++) writer->Write(mix[i % mix.size()]);
+    writer->Flush();
+
+    int count = 0;
+    OutputContainer container =
+        in_memory ? OutputContainer(sink) : OutputContainer(filepath);
+    for (const OutputArtifact& artifact : container) {
+      benchmark::DoNotOptimize(artifact);
+      count++;
+    }
+    CHECK_EQ(count, num_artifacts);
+    writer.reset();
+    if (!in_memory) std::filesystem::remove(filepath);
+  }
+  state.SetItemsProcessed(state.iterations() * num_artifacts);
+}
+BENCHMARK(BM_WriteAndReadBack)
+    ->ArgNames({"in_memory", "artifacts"})
+    ->ArgsProduct({{0, 1}, {10, 1000}});
+
+// Builds the model of a run with `steps` test steps, each with `series` series
+// of ten elements.
+void BM_BuildOutputModel(benchmark::State& state) {
+  const int num_steps = state.range(0);
+  const int series_per_step = state.range(1);
+  constexpr int kElementsPerSeries = 10;
+  std::vector<OutputArtifact> artifacts;
+  for (int step = 0; step < num_steps; step++) {
+    for (int series = 0; series < series_per_step; series++) {
+      std::string series_id = absl::StrCat(step * series_per_step + series);
+      auto add = [&](TestStepVariant artifact) {
+        artifacts.push_back(OutputArtifact({
+            .artifact = TestStepArtifact({
+                .artifact = std::move(artifact),
+                .test_step_id = absl::StrCat(step),
+            }),
+        }));
+      };
+      add(MeasurementSeriesStartOutput({.measurement_series_id = series_id}));
+      for (int i = 0; i < kElementsPerSeries; i++) {
+        add(MeasurementSeriesElementOutput({
+            .index = i,
+            .measurement_series_id = series_id,
+            .value = 1.,
+        }));
+      }
+      add(MeasurementSeriesEndOutput({
+          .measurement_series_id = series_id,
+          .total_count = kElementsPerSeries,
+      }));
+    }
+  }
+  for (auto _ : state) {
+    OutputModelBuilder builder;
+    for (const OutputArtifact& artifact : artifacts) builder.Add(artifact);
+    benchmark::DoNotOptimize(builder.model());
+  }
+  state.SetItemsProcessed(state.iterations() * artifacts.size());
+}
+BENCHMARK(BM_BuildOutputModel)
+    ->ArgNames({"steps", "series"})
+    ->ArgsProduct({{1, 100}, {10, 50}});
+
+}  // namespace
+}  // namespace ocpdiag::results
@@ -0,0 +1,343 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_collector.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_format.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "ocpdiag/core/results/collected_results.pb.h"
+#include "ocpdiag/core/results/collector_sink.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/record_writer.h"
+#include "riegeli/records/records_metadata.pb.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+using ::ocpdiag_results_v2_pb::OutputArtifact;
+using ::ocpdiag_results_v2_pb::TestRunEnd;
+
+// How much is read from a connection at a time, before the others are read.
+constexpr size_t kReadSize = 256 << 10;
+
+absl::Status ErrnoError(absl::string_view what) {
+  return absl::InternalError(absl::StrCat(what, ": ", std::strerror(errno)));
+}
+
+riegeli::RecordWriterBase::Options RecordWriterOptions() {
+  riegeli::RecordsMetadata metadata;
+  riegeli::SetRecordType(*CollectedArtifact::GetDescriptor(), metadata);
+  return riegeli::RecordWriterBase::Options().set_metadata(std::move(metadata));
+}
+
+}  // namespace
+
+struct ResultsCollector::Connection {
+  int fd;
+  uint64_t source_id;
+  int pid;
+  // The first byte received, once it is.
+  char kind = 0;
+  std::string buffer;
+};
+
+std::string CollectedSegmentPath(absl::string_view output_dir, int index) {
+  return absl::StrFormat("%s/collected-%05d.riegeli", output_dir, index);
+}
+
+std::string FormatRunState(const CollectedRunState& state) {
+  return absl::StrCat(
+      "source ", state.source_id, " pid ", state.pid, " \"", state.name,
+      "\": ", state.artifacts, " artifacts, ", state.missing_artifacts,
+      " missing, ", state.out_of_order_artifacts, " out of order, ",
+      state.open_steps, " open steps, ", state.errors, " errors, ",
+      state.ended ? absl::StrCat(TestRunEnd::TestStatus_Name(state.status),
+                                 " ",
+                                 TestRunEnd::TestResult_Name(state.result))
+                  : "running",
+      state.connected ? "" : " (disconnected)");
+}
+
+absl::StatusOr<std::unique_ptr<ResultsCollector>> ResultsCollector::Create(
+    const ResultsCollectorOptions& options) {
+  sockaddr_un address = {.sun_family = AF_UNIX};
+  if (options.socket_path.size() >= sizeof(address.sun_path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Socket path is too long: ", options.socket_path));
+  }
+  std::memcpy(address.sun_path, options.socket_path.data(),
+              options.socket_path.size());
+  unlink(options.socket_path.c_str());
+
+  int listen_fd =
+      socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd < 0) return ErrnoError("Cannot create a socket");
+  if (bind(listen_fd, reinterpret_cast<const sockaddr*>(&address),
+           sizeof(address)) != 0 ||
+      listen(listen_fd, SOMAXCONN) != 0) {
+    absl::Status status =
+        ErrnoError(absl::StrCat("Cannot listen on ", options.socket_path));
+    close(listen_fd);
+    return status;
+  }
+  int wake_fds[2];
+  if (pipe2(wake_fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+    absl::Status status = ErrnoError("Cannot create a pipe");
+    close(listen_fd);
+    return status;
+  }
+  auto collector = std::unique_ptr<ResultsCollector>(
+      new ResultsCollector(options, listen_fd, wake_fds[0], wake_fds[1]));
+  if (absl::Status status = collector->StartSegment(); !status.ok())
+    return status;
+  return collector;
+}
+
+ResultsCollector::ResultsCollector(const ResultsCollectorOptions& options,
+                                   int listen_fd, int wake_read_fd,
+                                   int wake_write_fd)
+    : options_(options),
+      listen_fd_(listen_fd),
+      wake_read_fd_(wake_read_fd),
+      wake_write_fd_(wake_write_fd) {}
+
+ResultsCollector::~ResultsCollector() {
+  for (const std::unique_ptr<Connection>& connection : connections_)
+    close(connection->fd);
+  close(listen_fd_);
+  unlink(options_.socket_path.c_str());
+  close(wake_read_fd_);
+  close(wake_write_fd_);
+}
+
+absl::Status ResultsCollector::StartSegment() {
+  if (writer_ != nullptr && !writer_->Close()) return writer_->status();
+  std::string path =
+      CollectedSegmentPath(options_.output_dir, ++segment_index_);
+  writer_ = std::make_unique<riegeli::RecordWriter<riegeli::FdWriter<>>>(
+      riegeli::FdWriter<>(path), RecordWriterOptions());
+  segment_bytes_ = 0;
+  if (!writer_->ok()) {
+    return absl::Status(writer_->status().code(),
+                        absl::StrCat(path, ": ", writer_->status().message()));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ResultsCollector::Serve() {
+  std::vector<pollfd> fds;
+  while (status_.ok()) {
+    fds.assign({{.fd = wake_read_fd_, .events = POLLIN},
+                {.fd = listen_fd_, .events = POLLIN}});
+    for (const std::unique_ptr<Connection>& connection : connections_)
+      fds.push_back({.fd = connection->fd, .events = POLLIN});
+    if (poll(fds.data(), fds.size(), /*timeout=*/-1) < 0) {
+      if (errno == EINTR) continue;
+      status_ = ErrnoError("Cannot poll the connections");
+      break;
+    }
+    if (fds[0].revents != 0) break;
+
+    // Connections are read in reverse so that those closed can be erased.
+    for (size_t i = connections_.size(); i-- > 0;) {
+      if (fds[i + 2].revents == 0 || ReadFrom(*connections_[i])) continue;
+      Disconnect(*connections_[i]);
+      connections_.erase(connections_.begin() + i);
+    }
+    if (fds[1].revents != 0) Accept();
+    if (wrote_ && status_.ok() && !writer_->Flush())
+      status_ = writer_->status();
+    wrote_ = false;
+  }
+
+  char drained[64];
+  while (read(wake_read_fd_, drained, sizeof(drained)) > 0) {
+  }
+  for (const std::unique_ptr<Connection>& connection : connections_)
+    Disconnect(*connection);
+  connections_.clear();
+  if (!writer_->Close() && status_.ok()) status_ = writer_->status();
+  return status_;
+}
+
+void ResultsCollector::Shutdown() {
+  char wake = 0;
+  // This only fails if the pipe is already full of wakeups.
+  [[maybe_unused]] ssize_t written = write(wake_write_fd_, &wake, 1);
+}
+
+std::vector<CollectedRunState> ResultsCollector::GetRunStates() const {
+  absl::MutexLock lock(&mutex_);
+  std::vector<CollectedRunState> states;
+  states.reserve(runs_.size());
+  for (const auto& [source_id, state] : runs_) states.push_back(state);
+  return states;
+}
+
+void ResultsCollector::Accept() {
+  int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0) return;
+  ucred credentials = {};
+  socklen_t length = sizeof(credentials);
+  getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length);
+  connections_.push_back(std::make_unique<Connection>(Connection{
+      .fd = fd, .source_id = next_source_id_++, .pid = credentials.pid}));
+}
+
+bool ResultsCollector::ReadFrom(Connection& connection) {
+  size_t size = connection.buffer.size();
+  connection.buffer.resize(size + kReadSize);
+  ssize_t n = read(connection.fd, &connection.buffer[size], kReadSize);
+  bool open = n > 0 || (n < 0 && (errno == EAGAIN || errno == EINTR));
+  connection.buffer.resize(size + std::max<ssize_t>(n, 0));
+
+  absl::string_view unread = connection.buffer;
+  if (connection.kind == 0 && !unread.empty()) {
+    connection.kind = unread[0];
+    unread.remove_prefix(1);
+    if (connection.kind == internal::kCollectorQuery) {
+      Answer(connection);
+      return false;
+    } else if (connection.kind != internal::kCollectorArtifactStream) {
+      return false;
+    }
+    absl::MutexLock lock(&mutex_);
+    runs_[connection.source_id] = {.source_id = connection.source_id,
+                                   .pid = connection.pid};
+  }
+
+  OutputArtifact artifact;
+  uint32_t artifact_size;
+  while (unread.size() >= sizeof(artifact_size)) {
+    std::memcpy(&artifact_size, unread.data(), sizeof(artifact_size));
+    if (artifact_size > internal::kMaxCollectedArtifactSize ||
+        (unread.size() >= sizeof(artifact_size) + artifact_size &&
+         !artifact.ParseFromArray(unread.data() + sizeof(artifact_size),
+                                  artifact_size))) {
+      std::cerr << "Closing source " << connection.source_id
+                << ", which sent an invalid artifact" << std::endl;
+      return false;
+    }
+    if (unread.size() < sizeof(artifact_size) + artifact_size) break;
+    unread.remove_prefix(sizeof(artifact_size) + artifact_size);
+    Collect(connection, artifact);
+  }
+  connection.buffer.erase(0, connection.buffer.size() - unread.size());
+  return open;
+}
+
+void ResultsCollector::Collect(const Connection& connection,
+                               OutputArtifact& artifact) {
+  {
+    absl::MutexLock lock(&mutex_);
+    CollectedRunState& run = runs_[connection.source_id];
+    ++run.artifacts;
+    if (artifact.sequence_number() > run.last_sequence_number) {
+      run.missing_artifacts +=
+          artifact.sequence_number() - run.last_sequence_number - 1;
+      run.last_sequence_number = artifact.sequence_number();
+    } else {
+      ++run.out_of_order_artifacts;
+    }
+    const ocpdiag_results_v2_pb::TestRunArtifact& run_artifact =
+        artifact.test_run_artifact();
+    const ocpdiag_results_v2_pb::TestStepArtifact& step_artifact =
+        artifact.test_step_artifact();
+    if (run_artifact.has_test_run_start()) {
+      run.name = run_artifact.test_run_start().name();
+    } else if (run_artifact.has_test_run_end()) {
+      run.ended = true;
+      run.status = run_artifact.test_run_end().status();
+      run.result = run_artifact.test_run_end().result();
+    } else if (run_artifact.has_error() || step_artifact.has_error()) {
+      ++run.errors;
+    } else if (step_artifact.has_test_step_start()) {
+      ++run.open_steps;
+    } else if (step_artifact.has_test_step_end()) {
+      --run.open_steps;
+    }
+  }
+
+  if (!status_.ok()) return;
+  CollectedArtifact record;
+  record.set_source_id(connection.source_id);
+  record.set_pid(connection.pid);
+  *record.mutable_artifact() = std::move(artifact);
+  if (!writer_->WriteRecord(record)) {
+    status_ = writer_->status();
+    return;
+  }
+  wrote_ = true;
+  segment_bytes_ += record.ByteSizeLong();
+  if (segment_bytes_ >= options_.max_segment_bytes) status_ = StartSegment();
+}
+
+void ResultsCollector::Answer(const Connection& connection) {
+  std::string answer;
+  for (const CollectedRunState& state : GetRunStates())
+    absl::StrAppend(&answer, FormatRunState(state), "\n");
+  fcntl(connection.fd, F_SETFL, 0);
+  absl::string_view unsent = answer;
+  while (!unsent.empty()) {
+    ssize_t n = send(connection.fd, unsent.data(), unsent.size(), MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) break;
+    unsent.remove_prefix(n);
+  }
+}
+
+void ResultsCollector::Disconnect(const Connection& connection) {
+  close(connection.fd);
+  absl::MutexLock lock(&mutex_);
+  auto run = runs_.find(connection.source_id);
+  if (run != runs_.end()) run->second.connected = false;
+}
+
+absl::StatusOr<std::string> QueryResultsCollector(
+    absl::string_view socket_path) {
+  absl::StatusOr<int> fd =
+      internal::ConnectToCollector(socket_path, internal::kCollectorQuery);
+  if (!fd.ok()) return fd.status();
+  std::string answer;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(*fd, buffer, sizeof(buffer))) != 0) {
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) {
+      absl::Status status = ErrnoError("Cannot read the answer");
+      close(*fd);
+      return status;
+    }
+    answer.append(buffer, n);
+  }
+  close(*fd);
+  return answer;
+}
+
+}  // namespace ocpdiag::results
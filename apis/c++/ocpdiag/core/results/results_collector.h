@@ -0,0 +1,132 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_RESULTS_COLLECTOR_H_
+#define OCPDIAG_CORE_RESULTS_RESULTS_COLLECTOR_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "ocpdiag/core/results/collected_results.pb.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/record_writer.h"
+
+namespace ocpdiag::results {
+
+struct ResultsCollectorOptions {
+  // The UNIX socket that tests connect to, e.g. with
+  // --ocpdiag_results_collector_socket. An existing socket is replaced.
+  std::string socket_path;
+
+  // The directory that the CollectedArtifact records are written to, in
+  // files named by CollectedSegmentPath. A new file is started once this many
+  // bytes of artifacts were written to the current one.
+  std::string output_dir;
+  int64_t max_segment_bytes = 256 << 20;
+};
+
+// Returns the path of the file numbered `index` in `output_dir`.
+std::string CollectedSegmentPath(absl::string_view output_dir, int index);
+
+// The state of a test run, as of the last artifact collected from it.
+struct CollectedRunState {
+  uint64_t source_id = 0;
+  int pid = 0;
+  // The name in the TestRunStart artifact.
+  std::string name;
+  bool connected = true;
+  int64_t artifacts = 0;
+  int32_t last_sequence_number = -1;
+  // Artifacts skipped by the sequence numbers, and artifacts whose sequence
+  // number is not above the last one.
+  int64_t missing_artifacts = 0;
+  int64_t out_of_order_artifacts = 0;
+  int open_steps = 0;
+  int64_t errors = 0;
+  bool ended = false;
+  ocpdiag_results_v2_pb::TestRunEnd::TestStatus status =
+      ocpdiag_results_v2_pb::TestRunEnd::UNKNOWN;
+  ocpdiag_results_v2_pb::TestRunEnd::TestResult result =
+      ocpdiag_results_v2_pb::TestRunEnd::NOT_APPLICABLE;
+};
+
+// Formats the state on a single line, as in the answer to a query.
+std::string FormatRunState(const CollectedRunState& state);
+
+// Collects the artifacts that many concurrent tests stream over a UNIX socket
+// with a CollectorSink, into a single series of riegeli files, and keeps the
+// state of each test run in memory. The state can be queried with
+// GetRunStates, or from other processes with QueryResultsCollector.
+class ResultsCollector {
+ public:
+  static absl::StatusOr<std::unique_ptr<ResultsCollector>> Create(
+      const ResultsCollectorOptions& options);
+  ~ResultsCollector();
+
+  // Collects artifacts on the calling thread until Shutdown is called or the
+  // output cannot be written. The output is flushed as artifacts arrive, and
+  // closed when this returns.
+  absl::Status Serve();
+
+  // Makes Serve return. This can be called from any thread, and from signal
+  // handlers.
+  void Shutdown();
+
+  // Returns the state of every run collected so far, by source id.
+  std::vector<CollectedRunState> GetRunStates() const
+      ABSL_LOCKS_EXCLUDED(mutex_);
+
+ private:
+  struct Connection;
+
+  ResultsCollector(const ResultsCollectorOptions& options, int listen_fd,
+                   int wake_read_fd, int wake_write_fd);
+
+  absl::Status StartSegment();
+  void Accept();
+  // Returns false once the connection is to be closed.
+  bool ReadFrom(Connection& connection);
+  void Collect(const Connection& connection,
+               ocpdiag_results_v2_pb::OutputArtifact& artifact)
+      ABSL_LOCKS_EXCLUDED(mutex_);
+  void Answer(const Connection& connection) ABSL_LOCKS_EXCLUDED(mutex_);
+  void Disconnect(const Connection& connection) ABSL_LOCKS_EXCLUDED(mutex_);
+
+  const ResultsCollectorOptions options_;
+  const int listen_fd_;
+  const int wake_read_fd_;
+  const int wake_write_fd_;
+
+  // Only used by the serving thread.
+  std::vector<std::unique_ptr<Connection>> connections_;
+  uint64_t next_source_id_ = 1;
+  std::unique_ptr<riegeli::RecordWriter<riegeli::FdWriter<>>> writer_;
+  int segment_index_ = -1;
+  int64_t segment_bytes_ = 0;
+  bool wrote_ = false;
+  absl::Status status_;
+
+  mutable absl::Mutex mutex_;
+  std::map<uint64_t, CollectedRunState> runs_ ABSL_GUARDED_BY(mutex_);
+};
+
+// Returns the answer of the collector listening on `socket_path` to a query:
+// a line formatted by FormatRunState for each run.
+absl::StatusOr<std::string> QueryResultsCollector(
+    absl::string_view socket_path);
+
+}  // namespace ocpdiag::results
+
+#endif  // OCPDIAG_CORE_RESULTS_RESULTS_COLLECTOR_H_
@@ -0,0 +1,95 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+// Collects the results of the tests running on a host into a single series of
+// riegeli files, until it is interrupted:
+//   collect_results --socket=/run/ocpdiag.sock --output_dir=/var/ocpdiag
+// Tests send their results to it with
+// --ocpdiag_results_collector_socket=/run/ocpdiag.sock, and the state of
+// their runs is printed with
+//   collect_results --socket=/run/ocpdiag.sock --query
+
+#include <signal.h>
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "ocpdiag/core/results/results_collector.h"
+
+ABSL_FLAG(std::string, socket, "", "Path of the collector's UNIX socket.");
+ABSL_FLAG(std::string, output_dir, ".",
+          "Directory that the collected results are written to.");
+ABSL_FLAG(int64_t, max_segment_bytes, 256 << 20,
+          "Size of the artifacts after which a new results file is started.");
+ABSL_FLAG(bool, query, false,
+          "If set, prints the state of the runs of the collector listening on "
+          "--socket instead of starting one.");
+
+namespace {
+
+ocpdiag::results::ResultsCollector* collector = nullptr;
+
+void HandleSignal(int) { collector->Shutdown(); }
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Collects the results of many concurrent tests.\n"
+      "Usage: collect_results --socket=PATH [--output_dir=DIR | --query]");
+  absl::ParseCommandLine(argc, argv);
+  std::string socket = absl::GetFlag(FLAGS_socket);
+  if (socket.empty()) {
+    std::cerr << "--socket is required" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  if (absl::GetFlag(FLAGS_query)) {
+    absl::StatusOr<std::string> answer =
+        ocpdiag::results::QueryResultsCollector(socket);
+    if (!answer.ok()) {
+      std::cerr << answer.status().ToString() << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::cout << *answer;
+    return EXIT_SUCCESS;
+  }
+
+  absl::StatusOr<std::unique_ptr<ocpdiag::results::ResultsCollector>> created =
+      ocpdiag::results::ResultsCollector::Create({
+          .socket_path = socket,
+          .output_dir = absl::GetFlag(FLAGS_output_dir),
+          .max_segment_bytes = absl::GetFlag(FLAGS_max_segment_bytes),
+      });
+  if (!created.ok()) {
+    std::cerr << created.status().ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
+  collector = created->get();
+  signal(SIGINT, HandleSignal);
+  signal(SIGTERM, HandleSignal);
+  absl::Status status = collector->Serve();
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+
+  for (const ocpdiag::results::CollectedRunState& state :
+       collector->GetRunStates()) {
+    std::cout << FormatRunState(state) << std::endl;
+  }
+  if (!status.ok()) {
+    std::cerr << status.ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
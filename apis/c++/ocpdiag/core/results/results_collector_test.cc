@@ -0,0 +1,264 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_collector.h"
+
+#include <unistd.h>
+
+#include <filesystem>  //
+#include <memory>
+#include <string>
+#include <thread>  //
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/functional/function_ref.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/collected_results.pb.h"
+#include "ocpdiag/core/results/collector_sink.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/testing/file_utils.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/record_reader.h"
+
+namespace ocpdiag::results {
+
+using ::ocpdiag::results::internal::ArtifactWriter;
+using ::ocpdiag::results::internal::CollectorSink;
+using ::ocpdiag::testing::IsOk;
+using ::ocpdiag_results_v2_pb::OutputArtifact;
+using ::ocpdiag_results_v2_pb::TestRunArtifact;
+using ::ocpdiag_results_v2_pb::TestRunEnd;
+using ::ocpdiag_results_v2_pb::TestStepArtifact;
+using ::testing::AllOf;
+using ::testing::ElementsAre;
+using ::testing::Field;
+using ::testing::HasSubstr;
+
+namespace {
+
+// Serves a collector writing to a new directory on another thread.
+class ResultsCollectorTest : public ::testing::Test {
+ protected:
+  void StartCollector(int64_t max_segment_bytes = 256 << 20) {
+    output_dir_ = testutils::MkTempFileOrDie("results_collector");
+    CHECK(std::filesystem::remove(output_dir_));
+    CHECK(std::filesystem::create_directory(output_dir_));
+    socket_path_ = output_dir_ + "/collector.sock";
+    absl::StatusOr<std::unique_ptr<ResultsCollector>> collector =
+        ResultsCollector::Create({.socket_path = socket_path_,
+                                  .output_dir = output_dir_,
+                                  .max_segment_bytes = max_segment_bytes});
+    ASSERT_THAT(collector.status(), IsOk());
+    collector_ = *std::move(collector);
+    server_ = std::thread([this] { EXPECT_THAT(collector_->Serve(), IsOk()); });
+  }
+
+  void TearDown() override {
+    if (collector_ == nullptr) return;
+    collector_->Shutdown();
+    server_.join();
+  }
+
+  std::unique_ptr<CollectorSink> Connect() {
+    absl::StatusOr<std::unique_ptr<CollectorSink>> sink =
+        CollectorSink::Connect(socket_path_);
+    CHECK(sink.ok()) << sink.status();
+    return *std::move(sink);
+  }
+
+  // Waits until the collector saw `runs` runs disconnect.
+  std::vector<CollectedRunState> AwaitDisconnected(size_t runs) {
+    absl::Time deadline = absl::Now() + absl::Seconds(30);
+    std::vector<CollectedRunState> states;
+    while (absl::Now() < deadline) {
+      states = collector_->GetRunStates();
+      size_t disconnected = 0;
+      for (const CollectedRunState& state : states)
+        disconnected += !state.connected;
+      if (disconnected >= runs) break;
+      absl::SleepFor(absl::Milliseconds(1));
+    }
+    return states;
+  }
+
+  // Calls `callback` with every record written by the collector, once it is
+  // shut down.
+  void ReadRecords(absl::FunctionRef<void(const CollectedArtifact&)> callback) {
+    collector_->Shutdown();
+    server_.join();
+    collector_ = nullptr;
+    for (int i = 0;; i++) {
+      std::string path = CollectedSegmentPath(output_dir_, i);
+      if (!std::filesystem::exists(path)) break;
+      riegeli::RecordReader<riegeli::FdReader<>> reader(
+          riegeli::FdReader<>{path});
+      CollectedArtifact record;
+      while (reader.ReadRecord(record)) callback(record);
+      EXPECT_TRUE(reader.Close()) << reader.status();
+    }
+  }
+
+  std::string output_dir_;
+  std::string socket_path_;
+  std::unique_ptr<ResultsCollector> collector_;
+  std::thread server_;
+};
+
+TestRunArtifact RunStart(absl::string_view name) {
+  TestRunArtifact artifact;
+  artifact.mutable_test_run_start()->set_name(std::string(name));
+  return artifact;
+}
+
+TestRunArtifact RunEnd(TestRunEnd::TestResult result) {
+  TestRunArtifact artifact;
+  artifact.mutable_test_run_end()->set_status(TestRunEnd::COMPLETE);
+  artifact.mutable_test_run_end()->set_result(result);
+  return artifact;
+}
+
+TestStepArtifact StepArtifact(int step) {
+  TestStepArtifact artifact;
+  artifact.set_test_step_id(absl::StrCat(step));
+  return artifact;
+}
+
+TEST_F(ResultsCollectorTest, ConcurrentRunsAreCollected) {
+  StartCollector();
+  constexpr int kRuns = 8;
+  constexpr int kSteps = 50;
+  std::vector<std::thread> runs;
+  for (int run = 0; run < kRuns; run++) {
+    runs.emplace_back([this, run] {
+      ArtifactWriter writer(Connect());
+      writer.Write(RunStart(absl::StrCat("run ", run)));
+      for (int step = 0; step < kSteps; step++) {
+        TestStepArtifact start = StepArtifact(step);
+        start.mutable_test_step_start()->set_name("step");
+        writer.Write(start);
+        if (run % 2 == 1) {
+          TestStepArtifact error = StepArtifact(step);
+          error.mutable_error()->set_symptom("symptom");
+          writer.Write(error);
+        }
+        TestStepArtifact end = StepArtifact(step);
+        end.mutable_test_step_end();
+        writer.Write(end);
+        writer.Flush();
+      }
+      // The last run never ends, as if it crashed.
+      if (run != kRuns - 1) writer.Write(RunEnd(TestRunEnd::PASS));
+    });
+  }
+  for (std::thread& run : runs) run.join();
+
+  std::vector<CollectedRunState> states = AwaitDisconnected(kRuns);
+  ASSERT_EQ(states.size(), kRuns);
+  for (const CollectedRunState& state : states) {
+    EXPECT_FALSE(state.connected);
+    EXPECT_EQ(state.pid, getpid());
+    EXPECT_THAT(state.name, HasSubstr("run "));
+    EXPECT_EQ(state.missing_artifacts, 0);
+    EXPECT_EQ(state.out_of_order_artifacts, 0);
+    EXPECT_EQ(state.open_steps, 0);
+    EXPECT_EQ(state.last_sequence_number, state.artifacts - 1);
+    if (state.name == absl::StrCat("run ", kRuns - 1)) {
+      EXPECT_FALSE(state.ended);
+    } else {
+      EXPECT_TRUE(state.ended);
+      EXPECT_EQ(state.result, TestRunEnd::PASS);
+    }
+  }
+
+  // Each source's artifacts are written in the order they were sent.
+  std::vector<int> next_sequence_number(kRuns + 1);
+  int records = 0;
+  ReadRecords([&](const CollectedArtifact& record) {
+    ASSERT_GE(record.source_id(), 1);
+    ASSERT_LE(record.source_id(), kRuns);
+    EXPECT_EQ(record.artifact().sequence_number(),
+              next_sequence_number[record.source_id()]++);
+    records++;
+  });
+  int64_t artifacts = 0;
+  for (const CollectedRunState& state : states) artifacts += state.artifacts;
+  EXPECT_EQ(records, artifacts);
+}
+
+TEST_F(ResultsCollectorTest, SequenceNumbersAreTracked) {
+  StartCollector();
+  {
+    std::unique_ptr<CollectorSink> sink = Connect();
+    for (int sequence_number : {0, 1, 3, 2, 6}) {
+      OutputArtifact artifact;
+      artifact.set_sequence_number(sequence_number);
+      sink->Write(artifact);
+    }
+  }
+  EXPECT_THAT(AwaitDisconnected(1),
+              ElementsAre(AllOf(
+                  Field(&CollectedRunState::artifacts, 5),
+                  Field(&CollectedRunState::last_sequence_number, 6),
+                  Field(&CollectedRunState::missing_artifacts, 3),
+                  Field(&CollectedRunState::out_of_order_artifacts, 1))));
+}
+
+TEST_F(ResultsCollectorTest, OutputIsSplitIntoSegments) {
+  StartCollector(/*max_segment_bytes=*/1000);
+  {
+    ArtifactWriter writer(Connect());
+    for (int i = 0; i < 1000; i++) writer.Write(RunStart("segmented"));
+  }
+  AwaitDisconnected(1);
+
+  int records = 0;
+  ReadRecords([&](const CollectedArtifact& record) {
+    EXPECT_EQ(record.artifact().sequence_number(), records++);
+  });
+  EXPECT_EQ(records, 1000);
+  EXPECT_TRUE(std::filesystem::exists(CollectedSegmentPath(output_dir_, 10)));
+}
+
+TEST_F(ResultsCollectorTest, RunStatesCanBeQueried) {
+  StartCollector();
+  std::unique_ptr<CollectorSink> sink = Connect();
+  OutputArtifact artifact;
+  *artifact.mutable_test_run_artifact() = RunStart("queried");
+  sink->Write(artifact);
+  sink->Flush();
+
+  // The artifact may not be collected yet when the query is answered.
+  absl::StatusOr<std::string> answer;
+  absl::Time deadline = absl::Now() + absl::Seconds(30);
+  do {
+    answer = QueryResultsCollector(socket_path_);
+    ASSERT_THAT(answer.status(), IsOk());
+  } while (!absl::StrContains(*answer, "queried") && absl::Now() < deadline);
+  EXPECT_EQ(*answer,
+            absl::StrCat("source 1 pid ", getpid(),
+                         " \"queried\": 1 artifacts, 0 missing, 0 out of "
+                         "order, 0 open steps, 0 errors, running\n"));
+}
+
+TEST(ResultsCollectorCreateTest, SocketPathMustFit) {
+  EXPECT_THAT(
+      ResultsCollector::Create({.socket_path = std::string(200, 'x')}).status(),
+      ::ocpdiag::testing::StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results
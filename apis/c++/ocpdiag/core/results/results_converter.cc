@@ -0,0 +1,285 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_converter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/util/json_util.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/status/status.h"
+#include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "ocpdiag/core/compat/status_converters.h"
+#include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/interned_records.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/results_dictionary.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/record_writer.h"
+#include "riegeli/records/records_metadata.pb.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+// Replaces every item of a chunk with the result of `convert`, splitting the
+// items evenly across the calling thread and a fixed pool of workers, which
+// are started once and reused for every chunk.
+class ChunkConverter {
+ public:
+  ChunkConverter(int num_threads,
+                 std::function<absl::Status(std::string&)> convert)
+      : num_threads_(std::max(num_threads, 1)),
+        convert_(std::move(convert)),
+        statuses_(num_threads_) {
+    threads_.reserve(num_threads_ - 1);
+    for (int slice = 1; slice < num_threads_; slice++)
+      threads_.emplace_back(&ChunkConverter::Work, this, slice);
+  }
+
+  ~ChunkConverter() {
+    {
+      absl::MutexLock lock(&mutex_);
+      stop_ = true;
+    }
+    for (std::thread& thread : threads_) thread.join();
+  }
+
+  // Returns the error of the first item that failed to convert, if any.
+  absl::Status Convert(std::vector<std::string>& items) {
+    {
+      absl::MutexLock lock(&mutex_);
+      items_ = &items;
+      generation_++;
+      pending_ = num_threads_ - 1;
+    }
+    statuses_[0] = ConvertSlice(items, 0);
+    {
+      absl::MutexLock lock(&mutex_);
+      auto done = [this]() {
+        mutex_.AssertReaderHeld();
+        return pending_ == 0;
+      };
+      mutex_.Await(absl::Condition(&done));
+      items_ = nullptr;
+    }
+    for (absl::Status& status : statuses_) {
+      if (!status.ok()) return status;
+    }
+    return absl::OkStatus();
+  }
+
+ private:
+  void Work(int slice) {
+    int64_t done_generation = 0;
+    absl::MutexLock lock(&mutex_);
+    auto has_work = [this, &done_generation]() {
+      mutex_.AssertReaderHeld();
+      return stop_ || generation_ != done_generation;
+    };
+    while (true) {
+      mutex_.Await(absl::Condition(&has_work));
+      if (stop_) return;
+      done_generation = generation_;
+      std::vector<std::string>& items = *items_;
+      mutex_.Unlock();
+      statuses_[slice] = ConvertSlice(items, slice);
+      mutex_.Lock();
+      pending_--;
+    }
+  }
+
+  absl::Status ConvertSlice(std::vector<std::string>& items, int slice) {
+    size_t begin = items.size() * slice / num_threads_;
+    size_t end = items.size() * (slice + 1) / num_threads_;
+    for (size_t i = begin; i < end; i++) {
+      if (absl::Status status = convert_(items[i]); !status.ok())
+        return status;
+    }
+    return absl::OkStatus();
+  }
+
+  const int num_threads_;
+  const std::function<absl::Status(std::string&)> convert_;
+  absl::Mutex mutex_;
+  std::vector<std::string>* items_ ABSL_GUARDED_BY(mutex_) = nullptr;
+  int64_t generation_ ABSL_GUARDED_BY(mutex_) = 0;
+  int pending_ ABSL_GUARDED_BY(mutex_) = 0;
+  bool stop_ ABSL_GUARDED_BY(mutex_) = false;
+  // The status of each slice of the chunk, set by the thread converting it.
+  std::vector<absl::Status> statuses_;
+  std::vector<std::thread> threads_;
+};
+
+absl::Status FileError(absl::string_view path, const absl::Status& status) {
+  return absl::Status(status.code(),
+                      absl::StrCat(path, ": ", status.message()));
+}
+
+}  // namespace
+
+absl::Status ConvertRecordsToJsonl(absl::string_view input_path,
+                                   absl::string_view output_path,
+                                   const ConverterOptions& options) {
+  internal::ResultsFileReader reader(input_path);
+  std::ofstream output{std::string(output_path), std::ios::trunc};
+  if (!output) {
+    return absl::UnavailableError(
+        absl::StrCat("Cannot open ", output_path, " for writing"));
+  }
+
+  ChunkConverter converter(options.num_threads, [](std::string& item) {
+    ocpdiag_results_v2_pb::OutputArtifact artifact;
+    if (!artifact.ParseFromString(item))
+      return absl::DataLossError("Cannot parse output artifact");
+    return internal::ArtifactToJson(artifact, item);
+  });
+  const size_t chunk_size = std::max(options.chunk_size, 1);
+  std::vector<std::string> chunk;
+  std::string record;
+  std::string lines;
+  while (true) {
+    chunk.clear();
+    while (chunk.size() < chunk_size && reader.ReadSerializedArtifact(record))
+      chunk.push_back(std::move(record));
+    if (chunk.empty()) break;
+
+    if (absl::Status status = converter.Convert(chunk); !status.ok())
+      return FileError(input_path, status);
+
+    // Write the whole chunk at once rather than line by line.
+    lines.clear();
+    for (const std::string& json : chunk) absl::StrAppend(&lines, json, "\n");
+    output << lines;
+  }
+  if (!reader.Close()) return FileError(input_path, reader.status());
+  output.close();
+  if (!output) {
+    return absl::DataLossError(absl::StrCat("Failed to write ", output_path));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ConvertJsonlToRecords(absl::string_view input_path,
+                                   absl::string_view output_path,
+                                   const ConverterOptions& options) {
+  std::ifstream input{std::string(input_path)};
+  if (!input) {
+    return absl::NotFoundError(
+        absl::StrCat("Cannot open ", input_path, " for reading"));
+  }
+  riegeli::RecordsMetadata metadata;
+  riegeli::SetRecordType(
+      *ocpdiag_results_v2_pb::OutputArtifact::GetDescriptor(), metadata);
+  riegeli::RecordWriterBase::Options writer_options;
+  std::unique_ptr<internal::RecordCompressor> compressor;
+  if (options.dictionary != nullptr) {
+    internal::SetResultsDictionary(*options.dictionary, metadata);
+    writer_options.set_uncompressed();
+    compressor =
+        std::make_unique<internal::RecordCompressor>(options.dictionary);
+  }
+  riegeli::RecordWriter<riegeli::FdWriter<>> writer(
+      riegeli::FdWriter<>(output_path),
+      std::move(writer_options.set_metadata(std::move(metadata))
+                    .set_parallelism(std::max(options.num_threads - 1, 0))));
+  if (!writer.ok()) return FileError(output_path, writer.status());
+
+  // The line number of each item of the chunk, for errors.
+  std::vector<size_t> line_numbers;
+  std::vector<std::string> chunk;
+  ChunkConverter converter(options.num_threads, [&](std::string& item) {
+    ocpdiag_results_v2_pb::OutputArtifact artifact;
+    if (absl::Status status = AsAbslStatus(
+            google::protobuf::util::JsonStringToMessage(item, &artifact));
+        !status.ok()) {
+      size_t line = line_numbers[&item - chunk.data()];
+      return absl::Status(status.code(),
+                          absl::StrCat("line ", line, ": ", status.message()));
+    }
+    item.clear();
+    artifact.SerializeToString(&item);
+    return absl::OkStatus();
+  });
+  const size_t chunk_size = std::max(options.chunk_size, 1);
+  std::string line;
+  size_t line_number = 0;
+  while (true) {
+    chunk.clear();
+    line_numbers.clear();
+    while (chunk.size() < chunk_size && std::getline(input, line)) {
+      line_number++;
+      // Blank lines, such as a trailing one, hold no artifact.
+      if (absl::StripAsciiWhitespace(line).empty()) continue;
+      chunk.push_back(std::move(line));
+      line_numbers.push_back(line_number);
+    }
+    if (chunk.empty()) break;
+
+    if (absl::Status status = converter.Convert(chunk); !status.ok())
+      return FileError(input_path, status);
+
+    std::string compressed;
+    for (const std::string& record : chunk) {
+      if (compressor != nullptr) {
+        if (absl::Status status = compressor->Compress(record, compressed);
+            !status.ok()) {
+          return FileError(output_path, status);
+        }
+      }
+      if (!writer.WriteRecord(compressor != nullptr ? compressed : record))
+        return FileError(output_path, writer.status());
+    }
+  }
+  if (input.bad()) {
+    return absl::DataLossError(absl::StrCat("Failed to read ", input_path));
+  }
+  if (!writer.Close()) return FileError(output_path, writer.status());
+  return absl::OkStatus();
+}
+
+std::vector<absl::Status> RunConversions(
+    ConversionDirection direction, const std::vector<Conversion>& conversions,
+    const ConverterOptions& options) {
+  std::vector<absl::Status> statuses(conversions.size());
+  if (conversions.empty()) return statuses;
+  std::atomic<size_t> next_conversion = 0;
+  auto run_conversions = [&] {
+    for (size_t i = next_conversion++; i < conversions.size();
+         i = next_conversion++) {
+      const Conversion& conversion = conversions[i];
+      auto convert = direction == ConversionDirection::kRecordsToJsonl
+                         ? ConvertRecordsToJsonl
+                         : ConvertJsonlToRecords;
+      statuses[i] =
+          convert(conversion.input_path, conversion.output_path, options);
+    }
+  };
+
+  int num_threads = std::clamp(options.parallel_files, 1,
+                               static_cast<int>(conversions.size()));
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads - 1);
+  for (int i = 1; i < num_threads; i++) threads.emplace_back(run_conversions);
+  run_conversions();
+  for (std::thread& thread : threads) thread.join();
+  return statuses;
+}
+
+}  // namespace ocpdiag::results
@@ -0,0 +1,64 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_RESULTS_CONVERTER_H_
+#define OCPDIAG_CORE_RESULTS_RESULTS_CONVERTER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/results_dictionary.h"
+
+namespace ocpdiag::results {
+
+struct ConverterOptions {
+  // Number of threads converting the artifacts of a single file.
+  int num_threads = 1;
+  // Number of artifacts read before they are converted in parallel. Larger
+  // chunks amortize the cost of handing them to the threads over more
+  // artifacts.
+  int chunk_size = 4096;
+  // Number of files converted at the same time by RunConversions().
+  int parallel_files = 1;
+  // If set, each record of the binary results files written is compressed
+  // with this dictionary, as by the ArtifactWriter.
+  std::shared_ptr<const internal::ResultsDictionary> dictionary;
+};
+
+// Converts a binary results file, as written by the ArtifactWriter, to JSONL in
+// the same format that the writer copies to its output stream.
+absl::Status ConvertRecordsToJsonl(absl::string_view input_path,
+                                   absl::string_view output_path,
+                                   const ConverterOptions& options = {});
+
+// Converts a JSONL results file with one OutputArtifact per line to the binary
+// results format. Blank lines are skipped.
+absl::Status ConvertJsonlToRecords(absl::string_view input_path,
+                                   absl::string_view output_path,
+                                   const ConverterOptions& options = {});
+
+enum class ConversionDirection {
+  kRecordsToJsonl,
+  kJsonlToRecords,
+};
+
+struct Conversion {
+  std::string input_path;
+  std::string output_path;
+};
+
+// Runs the conversions, up to `options.parallel_files` at a time. Returns the
+// status of each conversion, in the same order.
+std::vector<absl::Status> RunConversions(
+    ConversionDirection direction, const std::vector<Conversion>& conversions,
+    const ConverterOptions& options = {});
+
+}  // namespace ocpdiag::results
+
+#endif  // OCPDIAG_CORE_RESULTS_RESULTS_CONVERTER_H_
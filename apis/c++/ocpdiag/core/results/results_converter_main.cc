@@ -0,0 +1,136 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+// Converts OCPDiag results files between the binary format and JSONL. Each
+// input file is written to the output directory with the extension of the
+// target format, e.g.
+//   convert_results --to=jsonl --output_dir=/tmp/jsonl results/*.riegeli
+
+#include <cstdlib>
+#include <filesystem>  //
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>  //
+#include <utility>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "ocpdiag/core/results/results_converter.h"
+#include "ocpdiag/core/results/results_dictionary.h"
+
+ABSL_FLAG(std::string, to, "jsonl",
+          "Format to convert the input files to, either \"jsonl\" or "
+          "\"binary\".");
+ABSL_FLAG(std::string, output_dir, "",
+          "Directory where converted files are written. Defaults to the "
+          "directory of each input file.");
+ABSL_FLAG(int, threads_per_file, 1,
+          "Number of threads converting the artifacts of each file.");
+ABSL_FLAG(int, parallel_files, std::thread::hardware_concurrency(),
+          "Number of files converted at the same time.");
+ABSL_FLAG(int, chunk_size, 4096,
+          "Number of artifacts read from a file before they are converted in "
+          "parallel.");
+ABSL_FLAG(std::string, dictionary, "",
+          "Path of a zstd dictionary trained by train_results_dictionary to "
+          "compress the records of the binary files written with. Binary "
+          "files read are decompressed with the dictionary named by their "
+          "metadata, found in --ocpdiag_results_dictionary_dir.");
+
+namespace {
+
+using ::ocpdiag::results::Conversion;
+using ::ocpdiag::results::ConversionDirection;
+
+constexpr char kJsonlExtension[] = ".jsonl";
+constexpr char kBinaryExtension[] = ".riegeli";
+
+std::string OutputPath(const std::filesystem::path& input,
+                       ConversionDirection direction) {
+  std::filesystem::path output = input.parent_path();
+  if (std::string output_dir = absl::GetFlag(FLAGS_output_dir);
+      !output_dir.empty()) {
+    output = output_dir;
+  }
+  output /= input.filename();
+  output.replace_extension(direction == ConversionDirection::kRecordsToJsonl
+                               ? kJsonlExtension
+                               : kBinaryExtension);
+  return output;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Converts OCPDiag results files between the binary format and JSONL.\n"
+      "Usage: convert_results --to=jsonl|binary [flags] FILE...");
+  std::vector<char*> inputs = absl::ParseCommandLine(argc, argv);
+  inputs.erase(inputs.begin());
+  if (inputs.empty()) {
+    std::cerr << "No input files given" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  ConversionDirection direction;
+  if (absl::GetFlag(FLAGS_to) == "jsonl") {
+    direction = ConversionDirection::kRecordsToJsonl;
+  } else if (absl::GetFlag(FLAGS_to) == "binary") {
+    direction = ConversionDirection::kJsonlToRecords;
+  } else {
+    std::cerr << "--to must be either \"jsonl\" or \"binary\"" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::shared_ptr<const ocpdiag::results::internal::ResultsDictionary>
+      dictionary;
+  if (std::string path = absl::GetFlag(FLAGS_dictionary); !path.empty()) {
+    absl::StatusOr<
+        std::shared_ptr<const ocpdiag::results::internal::ResultsDictionary>>
+        loaded = ocpdiag::results::internal::ResultsDictionary::Load(path);
+    if (!loaded.ok()) {
+      std::cerr << loaded.status().ToString() << std::endl;
+      return EXIT_FAILURE;
+    }
+    dictionary = *std::move(loaded);
+  }
+
+  std::vector<Conversion> conversions;
+  for (const char* input : inputs) {
+    std::string output = OutputPath(input, direction);
+    if (output == input) {
+      std::cerr << input << " is already in the target format" << std::endl;
+      return EXIT_FAILURE;
+    }
+    conversions.push_back({.input_path = input, .output_path = output});
+  }
+
+  std::vector<absl::Status> statuses = ocpdiag::results::RunConversions(
+      direction, conversions,
+      {
+          .num_threads = absl::GetFlag(FLAGS_threads_per_file),
+          .chunk_size = absl::GetFlag(FLAGS_chunk_size),
+          .parallel_files = absl::GetFlag(FLAGS_parallel_files),
+          .dictionary = std::move(dictionary),
+      });
+  int failures = 0;
+  for (const absl::Status& status : statuses) {
+    if (status.ok()) continue;
+    std::cerr << status.ToString() << std::endl;
+    failures++;
+  }
+  if (failures > 0) {
+    std::cerr << "Failed to convert " << failures << " of "
+              << conversions.size() << " files" << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_converter.h"
+
+#include <filesystem>  //
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/testing/file_utils.h"
+#include "ocpdiag/core/testing/proto_matchers.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/record_reader.h"
+
+namespace ocpdiag::results {
+
+using ::ocpdiag::testing::EqualsProto;
+using ::ocpdiag::testing::IsOk;
+using ::ocpdiag::testing::StatusIs;
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+
+namespace {
+
+constexpr int kArtifacts = 25;
+
+std::string GetTempFilepath(absl::string_view name) {
+  std::string filepath = testutils::MkTempFileOrDie(name);
+  if (std::filesystem::exists(filepath))
+    CHECK(std::filesystem::remove(filepath)) << "Cannot remove temp file";
+  return filepath;
+}
+
+std::string ReadFile(absl::string_view path) {
+  std::ifstream file{std::string(path)};
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+std::vector<ocpdiag_results_v2_pb::OutputArtifact> ReadRecords(
+    absl::string_view path) {
+  riegeli::RecordReader<riegeli::FdReader<>> reader(riegeli::FdReader<>{path});
+  std::vector<ocpdiag_results_v2_pb::OutputArtifact> artifacts;
+  ocpdiag_results_v2_pb::OutputArtifact artifact;
+  while (reader.ReadRecord(artifact)) artifacts.push_back(artifact);
+  CHECK(reader.Close()) << reader.status();
+  return artifacts;
+}
+
+// Writes a results file and returns the JSONL the writer copied to its output
+// stream.
+std::string WriteResults(absl::string_view path) {
+  std::stringstream jsonl;
+  internal::ArtifactWriter writer(path, &jsonl, {.flush_each_minute = false});
+  for (int i = 0; i < kArtifacts; i++) {
+    ocpdiag_results_v2_pb::TestStepArtifact artifact;
+    artifact.set_test_step_id(absl::StrCat(i % 3));
+    artifact.mutable_log()->set_message(absl::StrCat("log ", i));
+    writer.Write(artifact);
+  }
+  writer.Flush();
+  return jsonl.str();
+}
+
+class ResultsConverterTest
+    : public ::testing::TestWithParam<ConverterOptions> {};
+
+TEST_P(ResultsConverterTest, RecordsToJsonlMatchesTheWriterOutput) {
+  std::string records_path = GetTempFilepath("converter_records");
+  std::string jsonl_path = GetTempFilepath("converter_jsonl");
+  std::string expected_jsonl = WriteResults(records_path);
+
+  ASSERT_THAT(ConvertRecordsToJsonl(records_path, jsonl_path, GetParam()),
+              IsOk());
+  EXPECT_EQ(ReadFile(jsonl_path), expected_jsonl);
+}
+
+TEST_P(ResultsConverterTest, JsonlToRecordsRoundTrips) {
+  std::string records_path = GetTempFilepath("converter_records");
+  std::string jsonl_path = GetTempFilepath("converter_jsonl");
+  std::string round_trip_path = GetTempFilepath("converter_round_trip");
+  WriteResults(records_path);
+
+  ASSERT_THAT(ConvertRecordsToJsonl(records_path, jsonl_path, GetParam()),
+              IsOk());
+  ASSERT_THAT(ConvertJsonlToRecords(jsonl_path, round_trip_path, GetParam()),
+              IsOk());
+  std::vector<ocpdiag_results_v2_pb::OutputArtifact> expected =
+      ReadRecords(records_path);
+  std::vector<ocpdiag_results_v2_pb::OutputArtifact> got =
+      ReadRecords(round_trip_path);
+  ASSERT_EQ(got.size(), kArtifacts);
+  for (int i = 0; i < kArtifacts; i++)
+    EXPECT_THAT(got[i], EqualsProto(expected[i]));
+}
+
+INSTANTIATE_TEST_SUITE_P(
+    Options, ResultsConverterTest,
+    ::testing::Values(ConverterOptions(),
+                      ConverterOptions({.num_threads = 4, .chunk_size = 7})));
+
+TEST(ResultsConverterErrorTest, InvalidJsonReportsTheLine) {
+  std::string jsonl_path = GetTempFilepath("converter_jsonl");
+  std::ofstream(jsonl_path) << R"json({"sequenceNumber": 1})json" << "\n"
+                            << "not json\n";
+
+  EXPECT_THAT(ConvertJsonlToRecords(jsonl_path,
+                                    GetTempFilepath("converter_records"),
+                                    {.num_threads = 2, .chunk_size = 1}),
+              StatusIs(::testing::_, HasSubstr("line 2")));
+}
+
+TEST(ResultsConverterTest, BlankLinesAreSkipped) {
+  std::string jsonl_path = GetTempFilepath("converter_jsonl");
+  std::string records_path = GetTempFilepath("converter_records");
+  std::ofstream(jsonl_path) << "\n"
+                            << R"json({"sequenceNumber": 1})json" << "\n"
+                            << " \t\n"
+                            << R"json({"sequenceNumber": 2})json" << "\n\n";
+
+  ASSERT_THAT(ConvertJsonlToRecords(jsonl_path, records_path,
+                                    {.num_threads = 3, .chunk_size = 1}),
+              IsOk());
+  std::vector<ocpdiag_results_v2_pb::OutputArtifact> got =
+      ReadRecords(records_path);
+  ASSERT_EQ(got.size(), 2);
+  EXPECT_EQ(got[0].sequence_number(), 1);
+  EXPECT_EQ(got[1].sequence_number(), 2);
+}
+
+TEST(ResultsConverterErrorTest, InvalidJsonAfterBlankLinesReportsTheLine) {
+  std::string jsonl_path = GetTempFilepath("converter_jsonl");
+  std::ofstream(jsonl_path) << "\n\n" << R"json({"sequenceNumber": 1})json"
+                            << "\n"
+                            << "not json\n";
+
+  EXPECT_THAT(ConvertJsonlToRecords(jsonl_path,
+                                    GetTempFilepath("converter_records"),
+                                    {.num_threads = 2, .chunk_size = 4}),
+              StatusIs(::testing::_, HasSubstr("line 4")));
+}
+
+TEST(ResultsConverterErrorTest, MissingInputIsAnError) {
+  EXPECT_FALSE(ConvertRecordsToJsonl("/nonexistent/results",
+                                     GetTempFilepath("converter_jsonl"))
+                   .ok());
+  EXPECT_FALSE(ConvertJsonlToRecords("/nonexistent/results.jsonl",
+                                     GetTempFilepath("converter_records"))
+                   .ok());
+}
+
+TEST(RunConversionsTest, EachFileIsConverted) {
+  std::vector<Conversion> conversions;
+  std::vector<std::string> expected_jsonl;
+  for (int i = 0; i < 3; i++) {
+    std::string records_path = GetTempFilepath("converter_records");
+    expected_jsonl.push_back(WriteResults(records_path));
+    conversions.push_back({
+        .input_path = records_path,
+        .output_path = GetTempFilepath("converter_jsonl"),
+    });
+  }
+  conversions.push_back({
+      .input_path = "/nonexistent/results",
+      .output_path = GetTempFilepath("converter_jsonl"),
+  });
+
+  std::vector<absl::Status> statuses =
+      RunConversions(ConversionDirection::kRecordsToJsonl, conversions,
+                     {.parallel_files = 2});
+  EXPECT_THAT(statuses, ElementsAre(IsOk(), IsOk(), IsOk(),
+                                    StatusIs(::testing::Ne(
+                                        absl::StatusCode::kOk))));
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(ReadFile(conversions[i].output_path), expected_jsonl[i]);
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results
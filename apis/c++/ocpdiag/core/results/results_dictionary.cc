@@ -0,0 +1,232 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_dictionary.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/base/const_init.h"
+#include "absl/base/thread_annotations.h"
+#include "absl/container/flat_hash_map.h"
+#include "absl/flags/flag.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/synchronization/mutex.h"
+#include "ocpdiag/core/results/results_dictionary.pb.h"
+#include "riegeli/records/records_metadata.pb.h"
+#include "zdict.h"
+#include "zstd.h"
+
+ABSL_FLAG(std::string, ocpdiag_results_dictionary_dir, "",
+          "Directory of the zstd dictionaries that binary results files may "
+          "be compressed with, as written by train_results_dictionary. The "
+          "dictionary of a file is found by the id in its metadata.");
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+// Records are small, so this bounds what a corrupt frame header can make the
+// decompressor allocate rather than limiting valid records.
+constexpr unsigned long long kMaxRecordSize = 1 << 30;
+
+ABSL_CONST_INIT absl::Mutex registry_mutex(absl::kConstInit);
+
+absl::flat_hash_map<uint32_t, std::shared_ptr<const ResultsDictionary>>&
+Registry() ABSL_EXCLUSIVE_LOCKS_REQUIRED(registry_mutex) {
+  static auto* const registry =
+      new absl::flat_hash_map<uint32_t,
+                              std::shared_ptr<const ResultsDictionary>>();
+  return *registry;
+}
+
+}  // namespace
+
+ResultsDictionary::ResultsDictionary(std::string content, uint32_t id)
+    : content_(std::move(content)), id_(id) {}
+
+ResultsDictionary::~ResultsDictionary() {
+  ZSTD_freeCDict(compression_dictionary_);
+  ZSTD_freeDDict(decompression_dictionary_);
+}
+
+absl::StatusOr<std::shared_ptr<const ResultsDictionary>>
+ResultsDictionary::Create(std::string content, int compression_level) {
+  uint32_t id = ZSTD_getDictID_fromDict(content.data(), content.size());
+  if (id == 0) {
+    return absl::InvalidArgumentError(
+        "Not a zstd dictionary, or one without an id");
+  }
+  std::shared_ptr<ResultsDictionary> dictionary(
+      new ResultsDictionary(std::move(content), id));
+  dictionary->compression_dictionary_ =
+      ZSTD_createCDict(dictionary->content_.data(),
+                       dictionary->content_.size(), compression_level);
+  dictionary->decompression_dictionary_ = ZSTD_createDDict(
+      dictionary->content_.data(), dictionary->content_.size());
+  if (dictionary->compression_dictionary_ == nullptr ||
+      dictionary->decompression_dictionary_ == nullptr) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Invalid zstd dictionary ", id));
+  }
+  return dictionary;
+}
+
+absl::StatusOr<std::shared_ptr<const ResultsDictionary>>
+ResultsDictionary::Load(absl::string_view path, int compression_level) {
+  std::ifstream input{std::string(path), std::ios::binary};
+  if (!input) {
+    return absl::NotFoundError(
+        absl::StrCat("Cannot open ", path, " for reading"));
+  }
+  std::ostringstream content;
+  content << input.rdbuf();
+  if (input.bad()) {
+    return absl::DataLossError(absl::StrCat("Failed to read ", path));
+  }
+  absl::StatusOr<std::shared_ptr<const ResultsDictionary>> dictionary =
+      Create(std::move(content).str(), compression_level);
+  if (!dictionary.ok()) {
+    const absl::Status& status = dictionary.status();
+    return absl::Status(status.code(),
+                        absl::StrCat(path, ": ", status.message()));
+  }
+  return dictionary;
+}
+
+absl::StatusOr<std::string> TrainResultsDictionary(
+    const std::vector<std::string>& samples, size_t max_size) {
+  std::string concatenated;
+  std::vector<size_t> sizes;
+  sizes.reserve(samples.size());
+  for (const std::string& sample : samples) {
+    concatenated.append(sample);
+    sizes.push_back(sample.size());
+  }
+  std::string content(max_size, '\0');
+  size_t size =
+      ZDICT_trainFromBuffer(content.data(), content.size(),
+                            concatenated.data(), sizes.data(), sizes.size());
+  if (ZDICT_isError(size)) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("Cannot train a dictionary on ", samples.size(),
+                     " samples of ", concatenated.size(),
+                     " bytes: ", ZDICT_getErrorName(size)));
+  }
+  content.resize(size);
+  return content;
+}
+
+RecordCompressor::RecordCompressor(
+    std::shared_ptr<const ResultsDictionary> dictionary)
+    : dictionary_(std::move(dictionary)), context_(ZSTD_createCCtx()) {
+  CHECK(context_ != nullptr) << "Cannot create a zstd compression context";
+  // The level is the one the dictionary was prepared with.
+  ZSTD_CCtx_refCDict(context_, dictionary_->compression_dictionary_);
+  ZSTD_CCtx_setParameter(context_, ZSTD_c_dictIDFlag, 0);
+  ZSTD_CCtx_setParameter(context_, ZSTD_c_checksumFlag, 0);
+}
+
+RecordCompressor::~RecordCompressor() { ZSTD_freeCCtx(context_); }
+
+absl::Status RecordCompressor::Compress(absl::string_view record,
+                                        std::string& compressed) {
+  compressed.resize(ZSTD_compressBound(record.size()));
+  size_t size = ZSTD_compress2(context_, compressed.data(), compressed.size(),
+                               record.data(), record.size());
+  if (ZSTD_isError(size)) {
+    compressed.clear();
+    return absl::InternalError(
+        absl::StrCat("Cannot compress record: ", ZSTD_getErrorName(size)));
+  }
+  compressed.resize(size);
+  return absl::OkStatus();
+}
+
+RecordDecompressor::RecordDecompressor(
+    std::shared_ptr<const ResultsDictionary> dictionary)
+    : dictionary_(std::move(dictionary)), context_(ZSTD_createDCtx()) {
+  CHECK(context_ != nullptr) << "Cannot create a zstd decompression context";
+}
+
+RecordDecompressor::~RecordDecompressor() { ZSTD_freeDCtx(context_); }
+
+absl::Status RecordDecompressor::Decompress(absl::string_view compressed,
+                                            std::string& record) {
+  unsigned long long record_size =
+      ZSTD_getFrameContentSize(compressed.data(), compressed.size());
+  if (record_size == ZSTD_CONTENTSIZE_ERROR ||
+      record_size == ZSTD_CONTENTSIZE_UNKNOWN || record_size > kMaxRecordSize) {
+    return absl::DataLossError("Invalid compressed record");
+  }
+  record.resize(record_size);
+  size_t size = ZSTD_decompress_usingDDict(
+      context_, record.data(), record.size(), compressed.data(),
+      compressed.size(), dictionary_->decompression_dictionary_);
+  if (ZSTD_isError(size) || size != record_size) {
+    record.clear();
+    return absl::DataLossError(absl::StrCat(
+        "Cannot decompress record with dictionary ", dictionary_->id(), ": ",
+        ZSTD_isError(size) ? ZSTD_getErrorName(size) : "truncated frame"));
+  }
+  return absl::OkStatus();
+}
+
+void RegisterResultsDictionary(
+    std::shared_ptr<const ResultsDictionary> dictionary) {
+  absl::MutexLock lock(&registry_mutex);
+  uint32_t id = dictionary->id();
+  Registry()[id] = std::move(dictionary);
+}
+
+absl::StatusOr<std::shared_ptr<const ResultsDictionary>> FindResultsDictionary(
+    uint32_t id) {
+  // Held while loading, so that concurrent readers load each dictionary once.
+  absl::MutexLock lock(&registry_mutex);
+  if (auto it = Registry().find(id); it != Registry().end()) return it->second;
+  std::string dir = absl::GetFlag(FLAGS_ocpdiag_results_dictionary_dir);
+  if (dir.empty()) {
+    return absl::NotFoundError(absl::StrCat(
+        "Zstd dictionary ", id,
+        " is not registered, and --ocpdiag_results_dictionary_dir is not set"));
+  }
+  absl::StatusOr<std::shared_ptr<const ResultsDictionary>> dictionary =
+      ResultsDictionary::Load(
+          absl::StrCat(dir, "/", ResultsDictionaryFileName(id)));
+  if (!dictionary.ok()) return dictionary.status();
+  if ((*dictionary)->id() != id) {
+    return absl::DataLossError(absl::StrCat(
+        "The file of zstd dictionary ", id, " holds dictionary ",
+        (*dictionary)->id()));
+  }
+  Registry()[id] = *dictionary;
+  return dictionary;
+}
+
+std::string ResultsDictionaryFileName(uint32_t id) {
+  return absl::StrCat(id, ".zdict");
+}
+
+void SetResultsDictionary(const ResultsDictionary& dictionary,
+                          riegeli::RecordsMetadata& metadata) {
+  metadata.SetExtension(results_dictionary_id, dictionary.id());
+}
+
+uint32_t GetResultsDictionaryId(const riegeli::RecordsMetadata& metadata) {
+  return metadata.GetExtension(results_dictionary_id);
+}
+
+}  // namespace ocpdiag::results::internal
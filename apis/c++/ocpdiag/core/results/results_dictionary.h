@@ -0,0 +1,136 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_RESULTS_DICTIONARY_H_
+#define OCPDIAG_CORE_RESULTS_RESULTS_DICTIONARY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "absl/flags/declare.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "riegeli/records/records_metadata.pb.h"
+#include "zstd.h"
+
+ABSL_DECLARE_FLAG(std::string, ocpdiag_results_dictionary_dir);
+
+namespace ocpdiag::results::internal {
+
+// A zstd dictionary trained on results artifacts. Artifacts are small records
+// that repeat field names, enums, names and units, which compression of the
+// records alone leaves in place; with a dictionary, each record compresses to
+// the little that sets it apart, at a lower level than chunk compression
+// needs for the same ratio. The dictionary is immutable and can be shared by
+// any number of compressors and decompressors.
+class ResultsDictionary {
+ public:
+  static constexpr int kDefaultCompressionLevel = 3;
+
+  // Prepares `content`, as trained by TrainResultsDictionary(), to compress
+  // at `compression_level`. Fails if it is not a zstd dictionary with an id.
+  static absl::StatusOr<std::shared_ptr<const ResultsDictionary>> Create(
+      std::string content, int compression_level = kDefaultCompressionLevel);
+
+  // Loads the dictionary in the file at `path`.
+  static absl::StatusOr<std::shared_ptr<const ResultsDictionary>> Load(
+      absl::string_view path, int compression_level = kDefaultCompressionLevel);
+
+  ResultsDictionary(const ResultsDictionary&) = delete;
+  ResultsDictionary& operator=(const ResultsDictionary&) = delete;
+  ~ResultsDictionary();
+
+  // The id that zstd assigned to the dictionary when it was trained, which
+  // identifies it in the metadata of the files it compressed.
+  uint32_t id() const { return id_; }
+  const std::string& content() const { return content_; }
+
+ private:
+  friend class RecordCompressor;
+  friend class RecordDecompressor;
+
+  ResultsDictionary(std::string content, uint32_t id);
+
+  const std::string content_;
+  const uint32_t id_;
+  ZSTD_CDict* compression_dictionary_ = nullptr;
+  ZSTD_DDict* decompression_dictionary_ = nullptr;
+};
+
+// Trains a dictionary of up to `max_size` bytes on `samples`, the serialized
+// records it is meant to compress. Fails if there are too few samples to
+// learn from; zstd needs around a hundred times the dictionary size.
+absl::StatusOr<std::string> TrainResultsDictionary(
+    const std::vector<std::string>& samples, size_t max_size);
+
+// Compresses records one at a time with a dictionary, each to a zstd frame of
+// its own. The frames leave out the dictionary id, which is recorded once in
+// the file metadata. This class is not thread-safe.
+class RecordCompressor {
+ public:
+  explicit RecordCompressor(
+      std::shared_ptr<const ResultsDictionary> dictionary);
+  RecordCompressor(const RecordCompressor&) = delete;
+  RecordCompressor& operator=(const RecordCompressor&) = delete;
+  ~RecordCompressor();
+
+  absl::Status Compress(absl::string_view record, std::string& compressed);
+
+  const std::shared_ptr<const ResultsDictionary>& dictionary() const {
+    return dictionary_;
+  }
+
+ private:
+  const std::shared_ptr<const ResultsDictionary> dictionary_;
+  ZSTD_CCtx* context_;
+};
+
+// Decompresses the records of a RecordCompressor with the same dictionary.
+// This class is not thread-safe.
+class RecordDecompressor {
+ public:
+  explicit RecordDecompressor(
+      std::shared_ptr<const ResultsDictionary> dictionary);
+  RecordDecompressor(const RecordDecompressor&) = delete;
+  RecordDecompressor& operator=(const RecordDecompressor&) = delete;
+  ~RecordDecompressor();
+
+  absl::Status Decompress(absl::string_view compressed, std::string& record);
+
+ private:
+  const std::shared_ptr<const ResultsDictionary> dictionary_;
+  ZSTD_DCtx* context_;
+};
+
+// Makes the dictionary available to FindResultsDictionary() in this process,
+// as the ArtifactWriter does with the dictionary it compresses with.
+void RegisterResultsDictionary(
+    std::shared_ptr<const ResultsDictionary> dictionary);
+
+// Returns the dictionary with `id`: one registered in this process, or else
+// the one in the directory given by --ocpdiag_results_dictionary_dir, where
+// it is named by ResultsDictionaryFileName(). Loaded dictionaries are
+// registered, so that each is only loaded once.
+absl::StatusOr<std::shared_ptr<const ResultsDictionary>> FindResultsDictionary(
+    uint32_t id);
+
+// The name of the file that train_results_dictionary writes the dictionary
+// with `id` to, and that FindResultsDictionary() looks for.
+std::string ResultsDictionaryFileName(uint32_t id);
+
+// Records in `metadata` that the records of a file are compressed with
+// `dictionary`, or returns the id recorded there, or 0 if there is none.
+void SetResultsDictionary(const ResultsDictionary& dictionary,
+                          riegeli::RecordsMetadata& metadata);
+uint32_t GetResultsDictionaryId(const riegeli::RecordsMetadata& metadata);
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_RESULTS_DICTIONARY_H_
@@ -0,0 +1,59 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+// Trains a zstd dictionary on a corpus of results files, for tests to
+// compress their binary results files with through
+// --ocpdiag_results_dictionary, and for readers to find through
+// --ocpdiag_results_dictionary_dir, e.g.
+//   train_results_dictionary --output_dir=/usr/share/ocpdiag/dictionaries \
+//       validators/spec_validator/samples/*.jsonl
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/statusor.h"
+#include "ocpdiag/core/results/results_dictionary_trainer.h"
+
+ABSL_FLAG(std::string, output_dir, ".",
+          "Directory where the dictionary is written, named by its id.");
+ABSL_FLAG(int64_t, max_size, 32 << 10,
+          "Maximum size of the dictionary in bytes.");
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Trains a zstd dictionary on the artifacts of OCPDiag results files.\n"
+      "Usage: train_results_dictionary [--output_dir=DIR] FILE...");
+  std::vector<char*> args = absl::ParseCommandLine(argc, argv);
+  std::vector<std::string> inputs(args.begin() + 1, args.end());
+  if (inputs.empty()) {
+    std::cerr << "No input files given" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  absl::StatusOr<std::string> dictionary =
+      ocpdiag::results::TrainDictionaryOnResults(
+          inputs,
+          {.max_dictionary_size =
+               static_cast<size_t>(absl::GetFlag(FLAGS_max_size))});
+  if (!dictionary.ok()) {
+    std::cerr << dictionary.status().ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
+  absl::StatusOr<std::string> path = ocpdiag::results::WriteResultsDictionary(
+      *dictionary, absl::GetFlag(FLAGS_output_dir));
+  if (!path.ok()) {
+    std::cerr << path.status().ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "Dictionary written to " << *path << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,217 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_dictionary.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/reflection.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/interned_records.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/results_dictionary.pb.h"
+#include "ocpdiag/core/testing/file_utils.h"
+#include "ocpdiag/core/testing/proto_matchers.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/record_writer.h"
+#include "riegeli/records/records_metadata.pb.h"
+#include "zstd.h"
+
+namespace ocpdiag::results::internal {
+
+using ::ocpdiag::testing::EqualsProto;
+using ::ocpdiag::testing::IsOk;
+using ::ocpdiag::testing::StatusIs;
+using ::ocpdiag_results_v2_pb::OutputArtifact;
+using ::testing::HasSubstr;
+using ::testing::Lt;
+
+namespace {
+
+std::string GetTempFilepath(absl::string_view name) {
+  std::string filepath = testutils::MkTempFileOrDie(name);
+  if (std::filesystem::exists(filepath))
+    CHECK(std::filesystem::remove(filepath)) << "Cannot remove temp file";
+  return filepath;
+}
+
+OutputArtifact MeasurementArtifact(int i, absl::string_view name_prefix) {
+  OutputArtifact artifact;
+  artifact.set_sequence_number(i);
+  artifact.mutable_timestamp()->set_seconds(1670000000 + i);
+  ocpdiag_results_v2_pb::TestStepArtifact& step =
+      *artifact.mutable_test_step_artifact();
+  step.set_test_step_id(absl::StrCat(i % 4));
+  ocpdiag_results_v2_pb::Measurement& measurement =
+      *step.mutable_measurement();
+  measurement.set_name(absl::StrCat(name_prefix, "-", i % 40));
+  measurement.set_unit(i % 2 == 0 ? "degrees Celsius" : "RPM");
+  measurement.set_hardware_info_id(absl::StrCat(i % 8));
+  measurement.mutable_value()->set_number_value(i * 1.5);
+  return artifact;
+}
+
+// Trains a dictionary whose id depends on `name_prefix`, so that each test
+// has one that no other test registered.
+std::shared_ptr<const ResultsDictionary> TrainDictionary(
+    absl::string_view name_prefix) {
+  std::vector<std::string> samples;
+  for (int i = 0; i < 2000; i++) {
+    samples.push_back(MeasurementArtifact(i, name_prefix).SerializeAsString());
+  }
+  absl::StatusOr<std::string> content =
+      TrainResultsDictionary(samples, /*max_size=*/4 << 10);
+  CHECK(content.ok()) << content.status();
+  absl::StatusOr<std::shared_ptr<const ResultsDictionary>> dictionary =
+      ResultsDictionary::Create(*std::move(content));
+  CHECK(dictionary.ok()) << dictionary.status();
+  return *std::move(dictionary);
+}
+
+TEST(ResultsDictionaryTest, RecordsAreCompressedWithTheDictionary) {
+  std::shared_ptr<const ResultsDictionary> dictionary =
+      TrainDictionary("fan-speed");
+  RecordCompressor compressor(dictionary);
+  RecordDecompressor decompressor(dictionary);
+
+  std::string record =
+      MeasurementArtifact(12345, "fan-speed").SerializeAsString();
+  std::string compressed;
+  ASSERT_THAT(compressor.Compress(record, compressed), IsOk());
+  // Without the dictionary, the frame would be larger than the record.
+  std::string plain(ZSTD_compressBound(record.size()), '\0');
+  plain.resize(ZSTD_compress(plain.data(), plain.size(), record.data(),
+                             record.size(),
+                             ResultsDictionary::kDefaultCompressionLevel));
+  EXPECT_THAT(compressed.size(), Lt(record.size()));
+  EXPECT_THAT(compressed.size(), Lt(plain.size() - 20));
+  std::string decompressed;
+  ASSERT_THAT(decompressor.Decompress(compressed, decompressed), IsOk());
+  EXPECT_EQ(decompressed, record);
+
+  EXPECT_THAT(decompressor.Decompress("not a frame", decompressed),
+              StatusIs(absl::StatusCode::kDataLoss));
+}
+
+TEST(ResultsDictionaryTest, OnlyZstdDictionariesAreAccepted) {
+  EXPECT_THAT(ResultsDictionary::Create("not a dictionary").status(),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+  EXPECT_THAT(TrainResultsDictionary({"too", "few"}, 4 << 10).status(),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+}
+
+TEST(ResultsDictionaryTest, WriterCompressesWithTheDictionary) {
+  std::string path = GetTempFilepath("dictionary");
+  std::shared_ptr<const ResultsDictionary> dictionary =
+      TrainDictionary("cpu-temperature");
+  std::vector<OutputArtifact> written;
+  {
+    ArtifactWriter writer(
+        path, nullptr,
+        {.flush_each_minute = false, .dictionary = std::move(dictionary)});
+    for (int i = 0; i < 100; i++) {
+      OutputArtifact artifact = MeasurementArtifact(i, "cpu-temperature");
+      writer.Write(artifact.test_step_artifact());
+      written.push_back(artifact);
+    }
+  }
+
+  // The writer registered the dictionary, so the reader finds it.
+  ResultsFileReader reader(path);
+  OutputArtifact artifact;
+  for (const OutputArtifact& expected : written) {
+    ASSERT_TRUE(reader.ReadArtifact(artifact)) << reader.status();
+    EXPECT_THAT(artifact.test_step_artifact(),
+                EqualsProto(expected.test_step_artifact()));
+  }
+  EXPECT_FALSE(reader.ReadArtifact(artifact));
+  EXPECT_TRUE(reader.Close()) << reader.status();
+}
+
+TEST(ResultsDictionaryTest, InternedRecordsAreCompressed) {
+  std::string path = GetTempFilepath("interned");
+  std::shared_ptr<const ResultsDictionary> dictionary =
+      TrainDictionary("voltage");
+  {
+    ArtifactWriter writer(path, nullptr,
+                          {.flush_each_minute = false,
+                           .intern_strings = true,
+                           .dictionary = std::move(dictionary)});
+    for (int i = 0; i < 10; i++) {
+      writer.Write(MeasurementArtifact(i, "voltage").test_step_artifact());
+    }
+  }
+
+  ResultsFileReader reader(path);
+  OutputArtifact artifact;
+  for (int i = 0; i < 10; i++) {
+    ASSERT_TRUE(reader.ReadArtifact(artifact)) << reader.status();
+    EXPECT_EQ(artifact.test_step_artifact().measurement().name(),
+              absl::StrCat("voltage-", i));
+  }
+  EXPECT_TRUE(reader.interned());
+  EXPECT_TRUE(reader.Close()) << reader.status();
+}
+
+TEST(ResultsDictionaryTest, DictionariesAreFoundInTheDictionaryDir) {
+  absl::FlagSaver flag_saver;
+  std::shared_ptr<const ResultsDictionary> dictionary =
+      TrainDictionary("power-draw");
+  std::string dir = GetTempFilepath("dictionaries");
+  ASSERT_TRUE(std::filesystem::create_directory(dir));
+  {
+    std::ofstream file(
+        absl::StrCat(dir, "/", ResultsDictionaryFileName(dictionary->id())),
+        std::ios::binary);
+    file << dictionary->content();
+  }
+
+  EXPECT_THAT(FindResultsDictionary(dictionary->id()).status(),
+              StatusIs(absl::StatusCode::kNotFound));
+  absl::SetFlag(&FLAGS_ocpdiag_results_dictionary_dir, dir);
+  absl::StatusOr<std::shared_ptr<const ResultsDictionary>> found =
+      FindResultsDictionary(dictionary->id());
+  ASSERT_THAT(found, IsOk());
+  EXPECT_EQ((*found)->content(), dictionary->content());
+}
+
+TEST(ResultsDictionaryTest, ReadingFailsWithoutTheDictionary) {
+  std::string path = GetTempFilepath("missing");
+  {
+    riegeli::RecordsMetadata metadata;
+    riegeli::SetRecordType(*OutputArtifact::GetDescriptor(), metadata);
+    metadata.SetExtension(results_dictionary_id, 12345);
+    riegeli::RecordWriter<riegeli::FdWriter<>> writer(
+        riegeli::FdWriter<>(path),
+        riegeli::RecordWriterBase::Options().set_metadata(metadata));
+    ASSERT_TRUE(writer.WriteRecord("compressed"));
+    ASSERT_TRUE(writer.Close());
+  }
+
+  ResultsFileReader reader(path);
+  OutputArtifact artifact;
+  EXPECT_FALSE(reader.ReadArtifact(artifact));
+  EXPECT_THAT(reader.status(), StatusIs(absl::StatusCode::kNotFound,
+                                        HasSubstr("dictionary 12345")));
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
@@ -0,0 +1,115 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_dictionary_trainer.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/struct.pb.h"
+#include "google/protobuf/util/json_util.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/compat/status_converters.h"
+#include "ocpdiag/core/results/interned_records.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/results_dictionary.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+absl::Status FileError(absl::string_view path, const absl::Status& status) {
+  return absl::Status(status.code(),
+                      absl::StrCat(path, ": ", status.message()));
+}
+
+absl::Status ReadJsonlSamples(absl::string_view path,
+                              std::vector<std::string>& samples) {
+  std::ifstream input{std::string(path)};
+  if (!input) {
+    return absl::NotFoundError(
+        absl::StrCat("Cannot open ", path, " for reading"));
+  }
+  google::protobuf::util::JsonParseOptions options;
+  options.ignore_unknown_fields = true;
+  std::string line;
+  for (int line_number = 1; std::getline(input, line); line_number++) {
+    if (line.empty()) continue;
+    ocpdiag_results_v2_pb::OutputArtifact artifact;
+    if (google::protobuf::util::JsonStringToMessage(line, &artifact, options)
+            .ok()) {
+      samples.push_back(artifact.SerializeAsString());
+      continue;
+    }
+    // Artifacts of older versions of the specification, as in the samples of
+    // the spec validator, may not fit the current schema. Their names and
+    // units are still worth training on, so only lines that are not JSON at
+    // all are errors.
+    google::protobuf::Value value;
+    if (absl::Status status = AsAbslStatus(
+            google::protobuf::util::JsonStringToMessage(line, &value));
+        !status.ok()) {
+      return FileError(
+          path, absl::Status(status.code(), absl::StrCat("line ", line_number,
+                                                         ": ",
+                                                         status.message())));
+    }
+    samples.push_back(value.SerializeAsString());
+  }
+  if (input.bad()) {
+    return absl::DataLossError(absl::StrCat("Failed to read ", path));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ReadRecordSamples(absl::string_view path,
+                               std::vector<std::string>& samples) {
+  internal::ResultsFileReader reader(path);
+  std::string record;
+  while (reader.ReadSerializedArtifact(record)) samples.push_back(record);
+  if (!reader.Close()) return FileError(path, reader.status());
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<std::string> TrainDictionaryOnResults(
+    const std::vector<std::string>& input_paths,
+    const DictionaryTrainingOptions& options) {
+  std::vector<std::string> samples;
+  for (const std::string& path : input_paths) {
+    absl::Status status = absl::EndsWith(path, ".jsonl")
+                              ? ReadJsonlSamples(path, samples)
+                              : ReadRecordSamples(path, samples);
+    if (!status.ok()) return status;
+  }
+  return internal::TrainResultsDictionary(samples,
+                                          options.max_dictionary_size);
+}
+
+absl::StatusOr<std::string> WriteResultsDictionary(
+    absl::string_view content, absl::string_view output_dir) {
+  absl::StatusOr<std::shared_ptr<const internal::ResultsDictionary>>
+      dictionary = internal::ResultsDictionary::Create(std::string(content));
+  if (!dictionary.ok()) return dictionary.status();
+  std::string path =
+      absl::StrCat(output_dir, "/",
+                   internal::ResultsDictionaryFileName((*dictionary)->id()));
+  std::ofstream output{path, std::ios::binary | std::ios::trunc};
+  output.write(content.data(), content.size());
+  output.close();
+  if (!output) {
+    return absl::DataLossError(absl::StrCat("Failed to write ", path));
+  }
+  return path;
+}
+
+}  // namespace ocpdiag::results
@@ -0,0 +1,43 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_RESULTS_DICTIONARY_TRAINER_H_
+#define OCPDIAG_CORE_RESULTS_RESULTS_DICTIONARY_TRAINER_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+
+namespace ocpdiag::results {
+
+struct DictionaryTrainingOptions {
+  // Larger dictionaries hold more of what the artifacts repeat, but need more
+  // samples to train, and more memory to compress and decompress with.
+  size_t max_dictionary_size = 32 << 10;
+};
+
+// Trains a zstd dictionary for the ArtifactWriter to compress binary results
+// files with, see internal::ResultsDictionary. It learns from the artifacts
+// of `input_paths`: JSONL files with one OutputArtifact per line, told apart
+// by their .jsonl extension, or else binary results files. The JSON fields
+// that OutputArtifact does not have are ignored, so that samples of other
+// versions of the output specification can be used. Returns the content of
+// the dictionary.
+absl::StatusOr<std::string> TrainDictionaryOnResults(
+    const std::vector<std::string>& input_paths,
+    const DictionaryTrainingOptions& options = {});
+
+// Writes the dictionary to `output_dir`, under the name that readers look
+// for, and returns its path.
+absl::StatusOr<std::string> WriteResultsDictionary(
+    absl::string_view content, absl::string_view output_dir);
+
+}  // namespace ocpdiag::results
+
+#endif  // OCPDIAG_CORE_RESULTS_RESULTS_DICTIONARY_TRAINER_H_
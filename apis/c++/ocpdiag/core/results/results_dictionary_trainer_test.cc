@@ -0,0 +1,93 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_dictionary_trainer.h"
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/results_dictionary.h"
+#include "ocpdiag/core/testing/file_utils.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+
+namespace ocpdiag::results {
+
+using ::ocpdiag::testing::IsOk;
+using ::ocpdiag::testing::StatusIs;
+using ::testing::EndsWith;
+using ::testing::HasSubstr;
+
+namespace {
+
+std::string GetTempFilepath(absl::string_view name) {
+  std::string filepath = testutils::MkTempFileOrDie(name);
+  if (std::filesystem::exists(filepath))
+    CHECK(std::filesystem::remove(filepath)) << "Cannot remove temp file";
+  return filepath;
+}
+
+ocpdiag_results_v2_pb::TestStepArtifact LogArtifact(int i) {
+  ocpdiag_results_v2_pb::TestStepArtifact artifact;
+  artifact.set_test_step_id(absl::StrCat(i % 5));
+  artifact.mutable_log()->set_severity(ocpdiag_results_v2_pb::Log::INFO);
+  artifact.mutable_log()->set_message(
+      absl::StrCat("Checked memory region ", i % 64, " of DIMM", i % 8));
+  return artifact;
+}
+
+TEST(ResultsDictionaryTrainerTest, TrainsOnJsonlAndBinaryResults) {
+  std::string jsonl_path = absl::StrCat(GetTempFilepath("samples"), ".jsonl");
+  std::string binary_path = GetTempFilepath("samples");
+  {
+    std::ofstream jsonl(jsonl_path);
+    internal::ArtifactWriter writer(binary_path, &jsonl,
+                                    {.flush_each_minute = false});
+    for (int i = 0; i < 1000; i++) writer.Write(LogArtifact(i));
+    // Artifacts of other versions of the specification are still samples.
+    jsonl << R"({"testRunArtifact":{"testRunStart":{"name":"mlc",)"
+          << R"("dutInfo":[{"hostname":"dut"}]}},"sequenceNumber":1000})"
+          << std::endl;
+  }
+
+  absl::StatusOr<std::string> dictionary = TrainDictionaryOnResults(
+      {jsonl_path, binary_path}, {.max_dictionary_size = 4 << 10});
+  ASSERT_THAT(dictionary, IsOk());
+  EXPECT_LE(dictionary->size(), 4 << 10);
+
+  std::string dir = GetTempFilepath("dictionaries");
+  ASSERT_TRUE(std::filesystem::create_directory(dir));
+  absl::StatusOr<std::string> path = WriteResultsDictionary(*dictionary, dir);
+  ASSERT_THAT(path, IsOk());
+  absl::StatusOr<std::shared_ptr<const internal::ResultsDictionary>> loaded =
+      internal::ResultsDictionary::Load(*path);
+  ASSERT_THAT(loaded, IsOk());
+  EXPECT_EQ((*loaded)->content(), *dictionary);
+  EXPECT_THAT(*path, EndsWith(internal::ResultsDictionaryFileName(
+                         (*loaded)->id())));
+}
+
+TEST(ResultsDictionaryTrainerTest, InvalidJsonIsReported) {
+  std::string path = absl::StrCat(GetTempFilepath("invalid"), ".jsonl");
+  std::ofstream(path) << "{}\nnot json\n";
+  EXPECT_THAT(TrainDictionaryOnResults({path}).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument,
+                       HasSubstr(absl::StrCat(path, ": line 2"))));
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results
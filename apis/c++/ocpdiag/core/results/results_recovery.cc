@@ -0,0 +1,179 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_recovery.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "google/protobuf/timestamp.pb.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/clock.h"
+#include "ocpdiag/core/results/crash_journal.h"
+#include "ocpdiag/core/results/interned_records.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "riegeli/bytes/fd_writer.h"
+#include "riegeli/records/record_writer.h"
+#include "riegeli/records/records_metadata.pb.h"
+
+namespace ocpdiag::results {
+
+namespace {
+
+using ::ocpdiag_results_v2_pb::OutputArtifact;
+
+absl::Status FileError(absl::string_view path, const absl::Status& status) {
+  return absl::Status(status.code(),
+                      absl::StrCat(path, ": ", status.message()));
+}
+
+riegeli::RecordWriterBase::Options RecordWriterOptions() {
+  riegeli::RecordsMetadata metadata;
+  riegeli::SetRecordType(*OutputArtifact::GetDescriptor(), metadata);
+  return riegeli::RecordWriterBase::Options().set_metadata(std::move(metadata));
+}
+
+// Writes the recovered artifacts, keeping track of what is needed to complete
+// the test run.
+class RecoveredResultsWriter {
+ public:
+  explicit RecoveredResultsWriter(absl::string_view path)
+      : writer_(riegeli::FdWriter<>(path), RecordWriterOptions()) {}
+
+  bool Write(const OutputArtifact& artifact) {
+    last_sequence_number_ = artifact.sequence_number();
+    last_timestamp_ = artifact.timestamp();
+    const ocpdiag_results_v2_pb::TestStepArtifact& step =
+        artifact.test_step_artifact();
+    if (step.has_test_step_start()) {
+      open_steps_.push_back(step.test_step_id());
+    } else if (step.has_test_step_end()) {
+      open_steps_.erase(std::remove(open_steps_.begin(), open_steps_.end(),
+                                    step.test_step_id()),
+                        open_steps_.end());
+    }
+    run_ended_ |= artifact.test_run_artifact().has_test_run_end();
+    return writer_.WriteRecord(artifact);
+  }
+
+  // Writes `artifact` after the last one written, at `time` if it is known.
+  bool WriteNext(OutputArtifact& artifact, absl::Time time) {
+    artifact.set_sequence_number(last_sequence_number_ + 1);
+    *artifact.mutable_timestamp() = time == absl::InfinitePast()
+                                        ? last_timestamp_
+                                        : internal::TimeToTimestamp(time);
+    return Write(artifact);
+  }
+
+  int64_t last_sequence_number() const { return last_sequence_number_; }
+  const std::vector<std::string>& open_steps() const { return open_steps_; }
+  bool run_ended() const { return run_ended_; }
+
+  bool Close() { return writer_.Close(); }
+  absl::Status status() const { return writer_.status(); }
+
+ private:
+  riegeli::RecordWriter<riegeli::FdWriter<>> writer_;
+  int64_t last_sequence_number_ = -1;
+  google::protobuf::Timestamp last_timestamp_;
+  std::vector<std::string> open_steps_;
+  bool run_ended_ = false;
+};
+
+}  // namespace
+
+absl::Status RecoverResults(absl::string_view results_path,
+                            absl::string_view output_path) {
+  RecoveredResultsWriter writer(output_path);
+  if (!writer.status().ok()) return FileError(output_path, writer.status());
+
+  // The end of the file may not have been flushed, and is skipped.
+  internal::ResultsFileReader reader(results_path);
+  OutputArtifact artifact;
+  while (true) {
+    if (reader.ReadArtifact(artifact)) {
+      if (!writer.Write(artifact))
+        return FileError(output_path, writer.status());
+    } else if (!reader.Recover()) {
+      break;
+    }
+  }
+  if (!reader.Close()) return FileError(results_path, reader.status());
+
+  // The journal holds the artifacts written since the file was last flushed,
+  // some of which may have reached the file nonetheless.
+  std::string journal_path =
+      absl::StrCat(results_path, internal::CrashJournal::kFileSuffix);
+  absl::StatusOr<internal::CrashJournalContents> journal =
+      internal::CrashJournal::Read(journal_path);
+  if (!journal.ok() && !absl::IsNotFound(journal.status()))
+    return journal.status();
+  if (journal.ok()) {
+    for (const std::string& record : journal->records) {
+      if (!artifact.ParseFromString(record)) {
+        return absl::DataLossError(
+            absl::StrCat(journal_path, ": Cannot parse output artifact"));
+      }
+      if (artifact.sequence_number() <= writer.last_sequence_number()) continue;
+      if (!writer.Write(artifact))
+        return FileError(output_path, writer.status());
+    }
+  }
+  if (writer.run_ended()) {
+    if (!writer.Close()) return FileError(output_path, writer.status());
+    return absl::OkStatus();
+  }
+
+  absl::Time termination_time = absl::InfinitePast();
+  std::string message = "The test process died without ending the test run";
+  OutputArtifact run_end;
+  if (journal.ok() && journal->terminal_record.has_value()) {
+    termination_time = journal->termination_time;
+    message = absl::StrCat("The test process was terminated by signal ",
+                           journal->signal, " (", strsignal(journal->signal),
+                           ")");
+    if (!run_end.ParseFromString(*journal->terminal_record)) {
+      return absl::DataLossError(
+          absl::StrCat(journal_path, ": Cannot parse the terminal artifact"));
+    }
+  } else {
+    ocpdiag_results_v2_pb::TestRunEnd* end =
+        run_end.mutable_test_run_artifact()->mutable_test_run_end();
+    end->set_status(ocpdiag_results_v2_pb::TestRunEnd::ERROR);
+    end->set_result(ocpdiag_results_v2_pb::TestRunEnd::NOT_APPLICABLE);
+  }
+
+  // Copied, as writing the step ends updates the open steps.
+  std::vector<std::string> open_steps = writer.open_steps();
+  for (const std::string& step_id : open_steps) {
+    OutputArtifact step_end;
+    step_end.mutable_test_step_artifact()->set_test_step_id(step_id);
+    step_end.mutable_test_step_artifact()->mutable_test_step_end()->set_status(
+        ocpdiag_results_v2_pb::TestRunEnd::ERROR);
+    if (!writer.WriteNext(step_end, termination_time))
+      return FileError(output_path, writer.status());
+  }
+  OutputArtifact error;
+  error.mutable_test_run_artifact()->mutable_error()->set_symptom(
+      std::string(kProcessTerminatedSymptom));
+  error.mutable_test_run_artifact()->mutable_error()->set_message(message);
+  if (!writer.WriteNext(error, termination_time) ||
+      !writer.WriteNext(run_end, termination_time) || !writer.Close()) {
+    return FileError(output_path, writer.status());
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace ocpdiag::results
@@ -0,0 +1,33 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_RESULTS_RECOVERY_H_
+#define OCPDIAG_CORE_RESULTS_RESULTS_RECOVERY_H_
+
+#include "absl/status/status.h"
+#include "absl/strings/string_view.h"
+
+namespace ocpdiag::results {
+
+// The symptom of the error added to the results of a test whose process died.
+inline constexpr absl::string_view kProcessTerminatedSymptom =
+    "ocpdiag-process-terminated";
+
+// Recovers the binary results file of a test whose process died before closing
+// it, from the artifacts that can still be read from the file and from the
+// crash journal kept next to it with --ocpdiag_crash_safe_results, if any.
+//
+// Writes to `output_path` the artifacts of the file, followed by those of the
+// journal that are missing from it. Unless the test run had ended, they are
+// followed by a TestStepEnd artifact for each step left open, an Error
+// artifact saying how the process died, and a TestRunEnd artifact with the
+// error status. The output is written without string interning.
+absl::Status RecoverResults(absl::string_view results_path,
+                            absl::string_view output_path);
+
+}  // namespace ocpdiag::results
+
+#endif  // OCPDIAG_CORE_RESULTS_RESULTS_RECOVERY_H_
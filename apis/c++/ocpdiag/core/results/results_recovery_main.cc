@@ -0,0 +1,46 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+// Recovers the binary results file of a test whose process died, using the
+// crash journal that --ocpdiag_crash_safe_results keeps next to it, e.g.
+//   recover_results --output=/tmp/recovered.riegeli results.riegeli
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/flags/usage.h"
+#include "absl/status/status.h"
+#include "ocpdiag/core/results/results_recovery.h"
+
+ABSL_FLAG(std::string, output, "",
+          "Path of the recovered results file. Defaults to the input path "
+          "with a .recovered suffix.");
+
+int main(int argc, char* argv[]) {
+  absl::SetProgramUsageMessage(
+      "Recovers the binary results file of a test whose process died.\n"
+      "Usage: recover_results [--output=FILE] FILE");
+  std::vector<char*> inputs = absl::ParseCommandLine(argc, argv);
+  if (inputs.size() != 2) {
+    std::cerr << "Expected exactly one input file" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::string input = inputs[1];
+  std::string output = absl::GetFlag(FLAGS_output);
+  if (output.empty()) output = input + ".recovered";
+  if (absl::Status status = ocpdiag::results::RecoverResults(input, output);
+      !status.ok()) {
+    std::cerr << status.ToString() << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "Recovered results written to " << output << std::endl;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,174 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/results_recovery.h"
+
+#include <signal.h>
+
+#include <filesystem>  //
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/log/check.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/crash_journal.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/testing/file_utils.h"
+#include "ocpdiag/core/testing/proto_matchers.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+#include "riegeli/bytes/fd_reader.h"
+#include "riegeli/records/record_reader.h"
+
+namespace ocpdiag::results {
+
+using ::ocpdiag::testing::EqualsProto;
+using ::ocpdiag::testing::IsOk;
+using ::ocpdiag::testing::Partially;
+using ::ocpdiag::testing::StatusIs;
+using ::testing::ElementsAre;
+using ::testing::HasSubstr;
+using ::testing::SizeIs;
+
+namespace {
+
+std::string GetTempFilepath(absl::string_view name) {
+  std::string filepath = testutils::MkTempFileOrDie(name);
+  if (std::filesystem::exists(filepath))
+    CHECK(std::filesystem::remove(filepath)) << "Cannot remove temp file";
+  return filepath;
+}
+
+std::vector<ocpdiag_results_v2_pb::OutputArtifact> ReadRecords(
+    absl::string_view path) {
+  riegeli::RecordReader<riegeli::FdReader<>> reader(riegeli::FdReader<>{path});
+  std::vector<ocpdiag_results_v2_pb::OutputArtifact> artifacts;
+  ocpdiag_results_v2_pb::OutputArtifact artifact;
+  while (reader.ReadRecord(artifact)) artifacts.push_back(artifact);
+  CHECK(reader.Close()) << reader.status();
+  return artifacts;
+}
+
+// Writes a test step start, which is flushed, and a measurement, which is not,
+// then terminates the process with `signal`.
+void WriteResultsAndDie(absl::string_view path, int signal) {
+  internal::ArtifactWriter writer(
+      path, /*output_stream=*/nullptr,
+      {.flush_each_minute = false, .crash_journal = true});
+  ocpdiag_results_v2_pb::TestStepArtifact step;
+  step.set_test_step_id("0");
+  step.mutable_test_step_start()->set_name("step");
+  writer.Write(step);
+  writer.Flush();
+  step.mutable_measurement()->set_name("fan-speed");
+  writer.Write(step);
+  raise(signal);
+}
+
+TEST(ResultsRecoveryTest, RecoversTheResultsOfACrashedProcess) {
+  std::string path = GetTempFilepath("crashed_results");
+  EXPECT_EXIT(WriteResultsAndDie(path, SIGSEGV),
+              ::testing::KilledBySignal(SIGSEGV), "");
+
+  std::string output_path = absl::StrCat(path, ".recovered");
+  ASSERT_THAT(RecoverResults(path, output_path), IsOk());
+  std::vector<ocpdiag_results_v2_pb::OutputArtifact> artifacts =
+      ReadRecords(output_path);
+  ASSERT_THAT(artifacts, SizeIs(5));
+  EXPECT_THAT(artifacts[0], Partially(EqualsProto(R"pb(
+                test_step_artifact {
+                  test_step_id: "0"
+                  test_step_start { name: "step" }
+                }
+                sequence_number: 0
+              )pb")));
+  EXPECT_THAT(artifacts[1], Partially(EqualsProto(R"pb(
+                test_step_artifact {
+                  test_step_id: "0"
+                  measurement { name: "fan-speed" }
+                }
+                sequence_number: 1
+              )pb")));
+  EXPECT_THAT(artifacts[2], Partially(EqualsProto(R"pb(
+                test_step_artifact {
+                  test_step_id: "0"
+                  test_step_end { status: ERROR }
+                }
+                sequence_number: 2
+              )pb")));
+  EXPECT_THAT(artifacts[3], Partially(EqualsProto(R"pb(
+                test_run_artifact {
+                  error { symptom: "ocpdiag-process-terminated" }
+                }
+                sequence_number: 3
+              )pb")));
+  EXPECT_THAT(artifacts[3].test_run_artifact().error().message(),
+              HasSubstr(absl::StrCat("signal ", SIGSEGV)));
+  EXPECT_THAT(artifacts[4], Partially(EqualsProto(R"pb(
+                test_run_artifact {
+                  test_run_end { status: ERROR result: NOT_APPLICABLE }
+                }
+                sequence_number: 4
+              )pb")));
+  EXPECT_GE(artifacts[4].timestamp().seconds(),
+            artifacts[1].timestamp().seconds());
+}
+
+TEST(ResultsRecoveryTest, EndsTheRunOfAKilledProcess) {
+  std::string path = GetTempFilepath("killed_results");
+  EXPECT_EXIT(WriteResultsAndDie(path, SIGKILL),
+              ::testing::KilledBySignal(SIGKILL), "");
+
+  std::string output_path = absl::StrCat(path, ".recovered");
+  ASSERT_THAT(RecoverResults(path, output_path), IsOk());
+  std::vector<ocpdiag_results_v2_pb::OutputArtifact> artifacts =
+      ReadRecords(output_path);
+  ASSERT_THAT(artifacts, SizeIs(5));
+  EXPECT_THAT(artifacts[1].test_step_artifact().measurement().name(),
+              "fan-speed");
+  EXPECT_THAT(artifacts[3].test_run_artifact().error().message(),
+              HasSubstr("without ending the test run"));
+  EXPECT_THAT(artifacts[4], Partially(EqualsProto(R"pb(
+                test_run_artifact { test_run_end { status: ERROR } }
+                sequence_number: 4
+              )pb")));
+}
+
+TEST(ResultsRecoveryTest, CopiesTheResultsOfAnEndedRun) {
+  std::string path = GetTempFilepath("ended_results");
+  {
+    internal::ArtifactWriter writer(
+        path, /*output_stream=*/nullptr,
+        {.flush_each_minute = false, .crash_journal = true});
+    ocpdiag_results_v2_pb::TestRunArtifact run;
+    run.mutable_test_run_end()->set_status(
+        ocpdiag_results_v2_pb::TestRunEnd::COMPLETE);
+    writer.Write(run);
+  }
+  EXPECT_FALSE(std::filesystem::exists(
+      absl::StrCat(path, internal::CrashJournal::kFileSuffix)));
+
+  std::string output_path = absl::StrCat(path, ".recovered");
+  ASSERT_THAT(RecoverResults(path, output_path), IsOk());
+  EXPECT_THAT(ReadRecords(output_path),
+              ElementsAre(Partially(EqualsProto(R"pb(
+                test_run_artifact { test_run_end { status: COMPLETE } }
+              )pb"))));
+}
+
+TEST(ResultsRecoveryTest, MissingResultsFileIsAnError) {
+  std::string path = GetTempFilepath("missing_results");
+  EXPECT_THAT(RecoverResults(path, absl::StrCat(path, ".recovered")),
+              StatusIs(absl::StatusCode::kNotFound));
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results
@@ -0,0 +1,323 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/shm_ring.h"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+constexpr char kMagic[8] = {'O', 'C', 'P', 'R', 'I', 'N', 'G', '1'};
+
+// How often a blocked sink checks that the reader is still alive.
+constexpr absl::Duration kLivenessCheckInterval = absl::Milliseconds(100);
+
+enum WriterState : uint32_t { kNoWriter = 0, kAttached = 1, kClosed = 2 };
+
+void FutexWait(std::atomic<uint32_t>& word, uint32_t value,
+               absl::Duration timeout) {
+  timespec ts = absl::ToTimespec(timeout);
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, value,
+          &ts, nullptr, 0);
+}
+
+void FutexWake(std::atomic<uint32_t>& word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX,
+          nullptr, nullptr, 0);
+}
+
+bool IsAlive(pid_t pid) { return kill(pid, 0) == 0 || errno != ESRCH; }
+
+absl::Status ErrnoError(absl::string_view what, absl::string_view name) {
+  return absl::InternalError(
+      absl::StrCat("Cannot ", what, " ", name, ": ", std::strerror(errno)));
+}
+
+}  // namespace
+
+// The shared memory segment: a header followed by the ring's data, in which
+// each artifact is serialized after its 32-bit size. Positions only grow, and
+// are taken modulo the capacity.
+class ShmRing {
+ public:
+  struct Header {
+    char magic[8];
+    uint64_t capacity;
+    pid_t reader_pid;
+    pid_t writer_pid;
+    std::atomic<uint32_t> writer_state;
+    std::atomic<uint32_t> reader_closed;
+
+    // Written by the writer, on a cache line of their own.
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint32_t> data_seq;  // Futex bumped as head moves
+    std::atomic<uint32_t> writer_waiting;
+
+    // Written by the reader.
+    alignas(64) std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> space_seq;  // Futex bumped as tail moves
+    std::atomic<uint32_t> reader_waiting;
+  };
+
+  static absl::StatusOr<std::unique_ptr<ShmRing>> Create(
+      absl::string_view name, size_t capacity) {
+    if (capacity < 8 || (capacity & (capacity - 1)) != 0) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "The capacity of a ring must be a power of two, not ", capacity));
+    }
+    std::string shm_name(name);
+    int fd = shm_open(shm_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) return ErrnoError("create", name);
+    size_t size = sizeof(Header) + capacity;
+    if (ftruncate(fd, size) != 0) {
+      absl::Status status = ErrnoError("resize", name);
+      close(fd);
+      shm_unlink(shm_name.c_str());
+      return status;
+    }
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fd, /*offset=*/0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      absl::Status status = ErrnoError("map", name);
+      shm_unlink(shm_name.c_str());
+      return status;
+    }
+    Header* header = new (mapping) Header{};
+    header->capacity = capacity;
+    header->reader_pid = getpid();
+    std::memcpy(header->magic, kMagic, sizeof(kMagic));
+    return std::unique_ptr<ShmRing>(
+        new ShmRing(std::move(shm_name), header, size, /*owner=*/true));
+  }
+
+  static absl::StatusOr<std::unique_ptr<ShmRing>> Open(absl::string_view name) {
+    std::string shm_name(name);
+    int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+    if (fd < 0) return ErrnoError("open", name);
+    struct stat stat;
+    if (fstat(fd, &stat) != 0) {
+      absl::Status status = ErrnoError("stat", name);
+      close(fd);
+      return status;
+    }
+    size_t size = stat.st_size;
+    void* mapping = size < sizeof(Header)
+                        ? MAP_FAILED
+                        : mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED, fd, /*offset=*/0);
+    close(fd);
+    if (mapping == MAP_FAILED) return ErrnoError("map", name);
+    auto ring = std::unique_ptr<ShmRing>(new ShmRing(
+        std::move(shm_name), static_cast<Header*>(mapping), size,
+        /*owner=*/false));
+    Header& header = ring->header();
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+        header.capacity != size - sizeof(Header)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat(name, " is not a results ring"));
+    }
+    uint32_t no_writer = kNoWriter;
+    if (!header.writer_state.compare_exchange_strong(no_writer, kAttached)) {
+      return absl::FailedPreconditionError(
+          absl::StrCat(name, " already had a writer"));
+    }
+    header.writer_pid = getpid();
+    return ring;
+  }
+
+  ~ShmRing() {
+    munmap(header_, size_);
+    if (owner_) shm_unlink(name_.c_str());
+  }
+
+  Header& header() { return *header_; }
+  uint64_t capacity() const { return header_->capacity; }
+
+  // Returns where the `size` bytes at `pos` are, or null if they wrap around
+  // the end of the ring.
+  char* Contiguous(uint64_t pos, size_t size) {
+    uint64_t offset = pos & (capacity() - 1);
+    return offset + size <= capacity() ? data_ + offset : nullptr;
+  }
+
+  void CopyIn(uint64_t pos, const void* src, size_t size) {
+    uint64_t offset = pos & (capacity() - 1);
+    size_t first = std::min<size_t>(size, capacity() - offset);
+    std::memcpy(data_ + offset, src, first);
+    std::memcpy(data_, static_cast<const char*>(src) + first, size - first);
+  }
+
+  void CopyOut(uint64_t pos, void* dst, size_t size) {
+    uint64_t offset = pos & (capacity() - 1);
+    size_t first = std::min<size_t>(size, capacity() - offset);
+    std::memcpy(dst, data_ + offset, first);
+    std::memcpy(static_cast<char*>(dst) + first, data_, size - first);
+  }
+
+ private:
+  ShmRing(std::string name, Header* header, size_t size, bool owner)
+      : name_(std::move(name)),
+        header_(header),
+        data_(reinterpret_cast<char*>(header + 1)),
+        size_(size),
+        owner_(owner) {}
+
+  std::string name_;
+  Header* header_;
+  char* data_;
+  size_t size_;
+  bool owner_;
+};
+
+absl::StatusOr<std::unique_ptr<ShmRingSink>> ShmRingSink::Open(
+    absl::string_view name, bool block_when_full) {
+  absl::StatusOr<std::unique_ptr<ShmRing>> ring = ShmRing::Open(name);
+  if (!ring.ok()) return ring.status();
+  return std::unique_ptr<ShmRingSink>(
+      new ShmRingSink(*std::move(ring), block_when_full));
+}
+
+ShmRingSink::ShmRingSink(std::unique_ptr<ShmRing> ring, bool block_when_full)
+    : ring_(std::move(ring)), block_when_full_(block_when_full) {}
+
+ShmRingSink::~ShmRingSink() {
+  ShmRing::Header& header = ring_->header();
+  header.writer_state.store(kClosed);
+  header.data_seq.fetch_add(1);
+  FutexWake(header.data_seq);
+}
+
+void ShmRingSink::Write(const ocpdiag_results_v2_pb::OutputArtifact& artifact) {
+  ShmRing::Header& header = ring_->header();
+  uint32_t size = artifact.ByteSizeLong();
+  uint64_t record_size = sizeof(size) + size;
+  uint64_t head = header.head.load(std::memory_order_relaxed);
+  auto is_full = [&] {
+    return head + record_size - header.tail.load() > ring_->capacity();
+  };
+  while (is_full()) {
+    if (record_size > ring_->capacity() || !block_when_full_ ||
+        header.reader_closed.load() || !IsAlive(header.reader_pid)) {
+      ++dropped_artifacts_;
+      return;
+    }
+    // The reader wakes the writer if it sees it waiting, so it either sees
+    // the flag or the writer sees the room it made.
+    uint32_t seq = header.space_seq.load();
+    header.writer_waiting.store(1);
+    if (is_full()) FutexWait(header.space_seq, seq, kLivenessCheckInterval);
+    header.writer_waiting.store(0);
+  }
+
+  ring_->CopyIn(head, &size, sizeof(size));
+  if (char* dest = ring_->Contiguous(head + sizeof(size), size)) {
+    artifact.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t*>(dest));
+  } else {
+    scratch_.resize(size);
+    artifact.SerializeWithCachedSizesToArray(
+        reinterpret_cast<uint8_t*>(scratch_.data()));
+    ring_->CopyIn(head + sizeof(size), scratch_.data(), size);
+  }
+  header.head.store(head + record_size);
+  header.data_seq.fetch_add(1);
+  if (header.reader_waiting.load()) FutexWake(header.data_seq);
+}
+
+absl::StatusOr<std::unique_ptr<ShmRingReader>> ShmRingReader::Create(
+    absl::string_view name, size_t capacity) {
+  absl::StatusOr<std::unique_ptr<ShmRing>> ring =
+      ShmRing::Create(name, capacity);
+  if (!ring.ok()) return ring.status();
+  return std::unique_ptr<ShmRingReader>(new ShmRingReader(*std::move(ring)));
+}
+
+ShmRingReader::ShmRingReader(std::unique_ptr<ShmRing> ring)
+    : ring_(std::move(ring)) {}
+
+ShmRingReader::~ShmRingReader() {
+  ShmRing::Header& header = ring_->header();
+  header.reader_closed.store(1);
+  header.space_seq.fetch_add(1);
+  FutexWake(header.space_seq);
+}
+
+ShmRingReader::Result ShmRingReader::Read(
+    ocpdiag_results_v2_pb::OutputArtifact& artifact, absl::Duration timeout) {
+  ShmRing::Header& header = ring_->header();
+  absl::Time deadline = absl::Now() + timeout;
+  while (true) {
+    uint64_t tail = header.tail.load(std::memory_order_relaxed);
+    if (header.head.load() != tail) {
+      uint32_t size;
+      ring_->CopyOut(tail, &size, sizeof(size));
+      const char* src = ring_->Contiguous(tail + sizeof(size), size);
+      if (src == nullptr) {
+        scratch_.resize(size);
+        ring_->CopyOut(tail + sizeof(size), scratch_.data(), size);
+        src = scratch_.data();
+      }
+      bool parsed = artifact.ParseFromArray(src, size);
+      header.tail.store(tail + sizeof(size) + size);
+      header.space_seq.fetch_add(1);
+      if (header.writer_waiting.load()) FutexWake(header.space_seq);
+      if (parsed) return Result::kArtifact;
+      std::cerr << "Skipping an artifact that cannot be parsed" << std::endl;
+      continue;
+    }
+
+    // The writer closes the ring after writing its last artifact, so the ring
+    // is only drained if it is still empty once closed.
+    uint32_t state = header.writer_state.load();
+    if ((state == kClosed ||
+         (state == kAttached && !IsAlive(header.writer_pid))) &&
+        header.head.load() == tail) {
+      return Result::kClosed;
+    }
+    absl::Duration remaining = deadline - absl::Now();
+    if (remaining <= absl::ZeroDuration()) return Result::kTimeout;
+    uint32_t seq = header.data_seq.load();
+    header.reader_waiting.store(1);
+    if (header.head.load() == tail && header.writer_state.load() != kClosed) {
+      FutexWait(header.data_seq, seq,
+                state == kAttached ? std::min(remaining, kLivenessCheckInterval)
+                                   : remaining);
+    }
+    header.reader_waiting.store(0);
+  }
+}
+
+}  // namespace ocpdiag::results::internal
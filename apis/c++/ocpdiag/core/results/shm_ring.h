@@ -0,0 +1,86 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_SHM_RING_H_
+#define OCPDIAG_CORE_RESULTS_SHM_RING_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "absl/status/statusor.h"
+#include "absl/strings/string_view.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/artifact_sink.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+// The artifacts of a test can be handed to a collector process through a ring
+// buffer in a POSIX shared memory segment. The collector creates the segment
+// with a ShmRingReader and passes its name to the test, which attaches a
+// ShmRingSink to it, e.g. with --ocpdiag_results_shm_ring. Each artifact is
+// serialized straight into the ring, unless it wraps around its end, and the
+// reader is woken with a futex only when it waits for more. A ring has a
+// single writer and a single reader.
+class ShmRing;
+
+// Writes the artifacts to a ring created by a ShmRingReader.
+class ShmRingSink : public ArtifactSink {
+ public:
+  // Attaches to the ring named `name`. Once it is full, `Write` waits for the
+  // reader unless `block_when_full` is false, in which case artifacts are
+  // dropped until there is room. Artifacts are dropped once the reader is
+  // gone.
+  static absl::StatusOr<std::unique_ptr<ShmRingSink>> Open(
+      absl::string_view name, bool block_when_full = true);
+  ~ShmRingSink() override;
+
+  void Write(const ocpdiag_results_v2_pb::OutputArtifact& artifact) override;
+
+  // Returns the number of artifacts dropped so far.
+  int64_t dropped_artifacts() const { return dropped_artifacts_; }
+
+ private:
+  ShmRingSink(std::unique_ptr<ShmRing> ring, bool block_when_full);
+
+  std::unique_ptr<ShmRing> ring_;
+  const bool block_when_full_;
+  std::string scratch_;
+  int64_t dropped_artifacts_ = 0;
+};
+
+// Creates a ring and reads the artifacts written to it by a ShmRingSink. This
+// is the reference implementation of a collector.
+class ShmRingReader {
+ public:
+  static constexpr size_t kDefaultCapacity = 4 << 20;
+
+  // Creates a ring of `capacity` bytes, a power of two, in a new shared
+  // memory segment named `name`, e.g. "/ocpdiag-<pid>". The segment is
+  // removed when the reader is destroyed.
+  static absl::StatusOr<std::unique_ptr<ShmRingReader>> Create(
+      absl::string_view name, size_t capacity = kDefaultCapacity);
+  ~ShmRingReader();
+
+  enum class Result { kArtifact, kTimeout, kClosed };
+
+  // Reads the next artifact, waiting up to `timeout` for it. Returns kClosed
+  // once the sink is destroyed and every artifact was read.
+  Result Read(ocpdiag_results_v2_pb::OutputArtifact& artifact,
+              absl::Duration timeout);
+
+ private:
+  explicit ShmRingReader(std::unique_ptr<ShmRing> ring);
+
+  std::unique_ptr<ShmRing> ring_;
+  std::string scratch_;
+};
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_SHM_RING_H_
@@ -0,0 +1,135 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/shm_ring.h"
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>  //
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/testing/status_matchers.h"
+
+namespace ocpdiag::results::internal {
+
+using ::ocpdiag::testing::IsOk;
+using ::ocpdiag::testing::StatusIs;
+using ::ocpdiag_results_v2_pb::OutputArtifact;
+
+namespace {
+
+std::string RingName(absl::string_view test) {
+  return absl::StrCat("/ocpdiag-shm-ring-test-", getpid(), "-", test);
+}
+
+OutputArtifact MakeArtifact(int i, int padding = 0) {
+  OutputArtifact artifact;
+  artifact.set_sequence_number(i);
+  artifact.mutable_test_step_artifact()->mutable_log()->set_message(
+      absl::StrCat("log ", i, std::string(padding, '.')));
+  return artifact;
+}
+
+TEST(ShmRingTest, ArtifactsAreReadInOrderUntilTheSinkCloses) {
+  std::string name = RingName("in-order");
+  absl::StatusOr<std::unique_ptr<ShmRingReader>> reader =
+      ShmRingReader::Create(name, /*capacity=*/1024);
+  ASSERT_THAT(reader.status(), IsOk());
+
+  // The artifacts wrap around the ring many times, and the writer waits for
+  // the reader whenever it is full.
+  constexpr int kArtifacts = 1000;
+  std::thread writer([&] {
+    absl::StatusOr<std::unique_ptr<ShmRingSink>> sink = ShmRingSink::Open(name);
+    ASSERT_THAT(sink.status(), IsOk());
+    for (int i = 0; i < kArtifacts; i++) (*sink)->Write(MakeArtifact(i, i % 7));
+    EXPECT_EQ((*sink)->dropped_artifacts(), 0);
+  });
+
+  OutputArtifact artifact;
+  for (int i = 0; i < kArtifacts; i++) {
+    ASSERT_EQ((*reader)->Read(artifact, absl::Seconds(10)),
+              ShmRingReader::Result::kArtifact);
+    EXPECT_EQ(artifact.sequence_number(), i);
+    EXPECT_EQ(artifact.test_step_artifact().log().message(),
+              MakeArtifact(i, i % 7).test_step_artifact().log().message());
+  }
+  writer.join();
+  EXPECT_EQ((*reader)->Read(artifact, absl::Seconds(10)),
+            ShmRingReader::Result::kClosed);
+}
+
+TEST(ShmRingTest, ReadTimesOutWithoutArtifacts) {
+  std::string name = RingName("timeout");
+  absl::StatusOr<std::unique_ptr<ShmRingReader>> reader =
+      ShmRingReader::Create(name, /*capacity=*/1024);
+  ASSERT_THAT(reader.status(), IsOk());
+  absl::StatusOr<std::unique_ptr<ShmRingSink>> sink = ShmRingSink::Open(name);
+  ASSERT_THAT(sink.status(), IsOk());
+
+  OutputArtifact artifact;
+  EXPECT_EQ((*reader)->Read(artifact, absl::Milliseconds(10)),
+            ShmRingReader::Result::kTimeout);
+}
+
+TEST(ShmRingTest, NonBlockingSinkDropsWhenFull) {
+  std::string name = RingName("drops");
+  absl::StatusOr<std::unique_ptr<ShmRingReader>> reader =
+      ShmRingReader::Create(name, /*capacity=*/256);
+  ASSERT_THAT(reader.status(), IsOk());
+  absl::StatusOr<std::unique_ptr<ShmRingSink>> sink =
+      ShmRingSink::Open(name, /*block_when_full=*/false);
+  ASSERT_THAT(sink.status(), IsOk());
+
+  // The ring fills up, and an artifact larger than the ring never fits.
+  for (int i = 0; i < 100; i++) (*sink)->Write(MakeArtifact(i));
+  (*sink)->Write(MakeArtifact(100, /*padding=*/1000));
+  int64_t dropped = (*sink)->dropped_artifacts();
+  EXPECT_GT(dropped, 1);
+  sink->reset();
+
+  OutputArtifact artifact;
+  int read = 0;
+  while ((*reader)->Read(artifact, absl::Seconds(1)) ==
+         ShmRingReader::Result::kArtifact) {
+    EXPECT_EQ(artifact.sequence_number(), read++);
+  }
+  EXPECT_EQ(read, 101 - dropped);
+}
+
+TEST(ShmRingTest, RingHasASingleWriter) {
+  std::string name = RingName("single-writer");
+  absl::StatusOr<std::unique_ptr<ShmRingReader>> reader =
+      ShmRingReader::Create(name);
+  ASSERT_THAT(reader.status(), IsOk());
+  absl::StatusOr<std::unique_ptr<ShmRingSink>> sink = ShmRingSink::Open(name);
+  ASSERT_THAT(sink.status(), IsOk());
+  EXPECT_THAT(ShmRingSink::Open(name).status(),
+              StatusIs(absl::StatusCode::kFailedPrecondition));
+}
+
+TEST(ShmRingTest, CapacityMustBeAPowerOfTwo) {
+  EXPECT_THAT(ShmRingReader::Create(RingName("capacity"), 1000).status(),
+              StatusIs(absl::StatusCode::kInvalidArgument));
+}
+
+TEST(ShmRingTest, MissingRingIsAnError) {
+  EXPECT_THAT(ShmRingSink::Open(RingName("missing")).status(),
+              StatusIs(absl::StatusCode::kInternal));
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
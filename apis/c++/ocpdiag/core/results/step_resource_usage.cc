@@ -0,0 +1,165 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/step_resource_usage.h"
+
+#include <linux/perf_event.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <thread>  //
+
+#include "google/protobuf/struct.pb.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+absl::Duration ReadClock(clockid_t clock) {
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return absl::DurationFromTimespec(ts);
+}
+
+int OpenSoftwarePerfCounter(uint64_t config) {
+  struct perf_event_attr attr;
+  std::memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.config = config;
+  // Count the calling thread on any CPU.
+  return syscall(SYS_perf_event_open, &attr, /*pid=*/0, /*cpu=*/-1,
+                 /*group_fd=*/-1, /*flags=*/0);
+}
+
+google::protobuf::Value NumberValue(double number) {
+  google::protobuf::Value value;
+  value.set_number_value(number);
+  return value;
+}
+
+}  // namespace
+
+StepResourceTracker::StepResourceTracker(bool enable_perf_counters)
+    : thread_id_(std::this_thread::get_id()) {
+  perf_fds_.fill(-1);
+  if (enable_perf_counters) OpenPerfCounters();
+  getrusage(RUSAGE_SELF, &start_rusage_);
+  start_thread_cpu_time_ = ReadClock(CLOCK_THREAD_CPUTIME_ID);
+  start_wall_time_ = ReadClock(CLOCK_MONOTONIC);
+}
+
+StepResourceTracker::~StepResourceTracker() {
+  for (int fd : perf_fds_) {
+    if (fd >= 0) close(fd);
+  }
+}
+
+void StepResourceTracker::OpenPerfCounters() {
+  constexpr uint64_t kConfigs[kNumPerfCounters] = {
+      PERF_COUNT_SW_TASK_CLOCK,
+      PERF_COUNT_SW_CONTEXT_SWITCHES,
+      PERF_COUNT_SW_CPU_MIGRATIONS,
+      PERF_COUNT_SW_PAGE_FAULTS,
+  };
+  for (int i = 0; i < kNumPerfCounters; i++) {
+    perf_fds_[i] = OpenSoftwarePerfCounter(kConfigs[i]);
+    // perf_event_open is commonly restricted by perf_event_paranoid or a
+    // seccomp policy, in which case the counters are silently left out.
+    if (perf_fds_[i] < 0) return;
+  }
+}
+
+std::optional<StepResourceUsage::PerfCounters>
+StepResourceTracker::ReadPerfCounters() const {
+  std::array<uint64_t, kNumPerfCounters> values;
+  for (int i = 0; i < kNumPerfCounters; i++) {
+    if (perf_fds_[i] < 0 ||
+        read(perf_fds_[i], &values[i], sizeof(values[i])) !=
+            sizeof(values[i])) {
+      return std::nullopt;
+    }
+  }
+  return StepResourceUsage::PerfCounters{
+      .task_clock = absl::Nanoseconds(values[kTaskClock]),
+      .context_switches = static_cast<int64_t>(values[kContextSwitches]),
+      .cpu_migrations = static_cast<int64_t>(values[kCpuMigrations]),
+      .page_faults = static_cast<int64_t>(values[kPageFaults]),
+  };
+}
+
+StepResourceUsage StepResourceTracker::Finish() const {
+  StepResourceUsage usage;
+  usage.wall_time = ReadClock(CLOCK_MONOTONIC) - start_wall_time_;
+  bool same_thread = std::this_thread::get_id() == thread_id_;
+  if (same_thread) {
+    usage.thread_cpu_time =
+        ReadClock(CLOCK_THREAD_CPUTIME_ID) - start_thread_cpu_time_;
+    usage.perf_counters = ReadPerfCounters();
+  }
+
+  struct rusage end_rusage;
+  getrusage(RUSAGE_SELF, &end_rusage);
+  usage.user_cpu_time = absl::DurationFromTimeval(end_rusage.ru_utime) -
+                        absl::DurationFromTimeval(start_rusage_.ru_utime);
+  usage.system_cpu_time = absl::DurationFromTimeval(end_rusage.ru_stime) -
+                          absl::DurationFromTimeval(start_rusage_.ru_stime);
+  usage.max_rss_kb = end_rusage.ru_maxrss;
+  usage.max_rss_growth_kb = end_rusage.ru_maxrss - start_rusage_.ru_maxrss;
+  usage.minor_page_faults = end_rusage.ru_minflt - start_rusage_.ru_minflt;
+  usage.major_page_faults = end_rusage.ru_majflt - start_rusage_.ru_majflt;
+  usage.voluntary_context_switches =
+      end_rusage.ru_nvcsw - start_rusage_.ru_nvcsw;
+  usage.involuntary_context_switches =
+      end_rusage.ru_nivcsw - start_rusage_.ru_nivcsw;
+  return usage;
+}
+
+google::protobuf::Struct ResourceUsageToProto(const StepResourceUsage& usage) {
+  google::protobuf::Struct proto;
+  auto* fields = proto.mutable_fields();
+  (*fields)["wallTimeNs"] =
+      NumberValue(absl::ToInt64Nanoseconds(usage.wall_time));
+  if (usage.thread_cpu_time.has_value()) {
+    (*fields)["threadCpuTimeNs"] =
+        NumberValue(absl::ToInt64Nanoseconds(*usage.thread_cpu_time));
+  }
+  (*fields)["userCpuTimeNs"] =
+      NumberValue(absl::ToInt64Nanoseconds(usage.user_cpu_time));
+  (*fields)["systemCpuTimeNs"] =
+      NumberValue(absl::ToInt64Nanoseconds(usage.system_cpu_time));
+  (*fields)["maxRssKb"] = NumberValue(usage.max_rss_kb);
+  (*fields)["maxRssGrowthKb"] = NumberValue(usage.max_rss_growth_kb);
+  (*fields)["minorPageFaults"] = NumberValue(usage.minor_page_faults);
+  (*fields)["majorPageFaults"] = NumberValue(usage.major_page_faults);
+  (*fields)["voluntaryContextSwitches"] =
+      NumberValue(usage.voluntary_context_switches);
+  (*fields)["involuntaryContextSwitches"] =
+      NumberValue(usage.involuntary_context_switches);
+
+  if (usage.perf_counters.has_value()) {
+    google::protobuf::Value perf;
+    auto* perf_fields = perf.mutable_struct_value()->mutable_fields();
+    (*perf_fields)["taskClockNs"] = NumberValue(
+        absl::ToInt64Nanoseconds(usage.perf_counters->task_clock));
+    (*perf_fields)["contextSwitches"] =
+        NumberValue(usage.perf_counters->context_switches);
+    (*perf_fields)["cpuMigrations"] =
+        NumberValue(usage.perf_counters->cpu_migrations);
+    (*perf_fields)["pageFaults"] =
+        NumberValue(usage.perf_counters->page_faults);
+    (*fields)["perfCounters"] = perf;
+  }
+  return proto;
+}
+
+}  // namespace ocpdiag::results::internal
@@ -0,0 +1,91 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_STEP_RESOURCE_USAGE_H_
+#define OCPDIAG_CORE_RESULTS_STEP_RESOURCE_USAGE_H_
+
+#include <sys/resource.h>
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <thread>  //
+
+#include "google/protobuf/struct.pb.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::results::internal {
+
+// Resource usage accumulated between the start and end of a test step.
+struct StepResourceUsage {
+  absl::Duration wall_time;  // Monotonic clock
+
+  // CPU time of the thread that started the step. Only set when the step is
+  // started and ended on the same thread.
+  std::optional<absl::Duration> thread_cpu_time;
+
+  // Process-wide getrusage deltas. Steps that run concurrently see each
+  // other's usage.
+  absl::Duration user_cpu_time;
+  absl::Duration system_cpu_time;
+  int64_t max_rss_kb = 0;  // High-water mark at the end of the step
+  int64_t max_rss_growth_kb = 0;
+  int64_t minor_page_faults = 0;
+  int64_t major_page_faults = 0;
+  int64_t voluntary_context_switches = 0;
+  int64_t involuntary_context_switches = 0;
+
+  // Software perf_event counters for the thread that started the step. Only
+  // set when requested, when the kernel allows perf_event_open, and when the
+  // step is started and ended on the same thread.
+  struct PerfCounters {
+    absl::Duration task_clock;
+    int64_t context_switches = 0;
+    int64_t cpu_migrations = 0;
+    int64_t page_faults = 0;
+  };
+  std::optional<PerfCounters> perf_counters;
+};
+
+// Samples resource usage on construction and reports the difference when
+// Finish() is called. Sampling is a handful of system calls, so trackers are
+// only created when per-step resource capture is enabled.
+class StepResourceTracker {
+ public:
+  explicit StepResourceTracker(bool enable_perf_counters = false);
+  StepResourceTracker(const StepResourceTracker&) = delete;
+  StepResourceTracker& operator=(const StepResourceTracker&) = delete;
+  ~StepResourceTracker();
+
+  // Returns the resources used since the tracker was created.
+  StepResourceUsage Finish() const;
+
+ private:
+  enum PerfCounter {
+    kTaskClock = 0,
+    kContextSwitches,
+    kCpuMigrations,
+    kPageFaults,
+    kNumPerfCounters,
+  };
+
+  void OpenPerfCounters();
+  std::optional<StepResourceUsage::PerfCounters> ReadPerfCounters() const;
+
+  std::thread::id thread_id_;
+  absl::Duration start_wall_time_;
+  absl::Duration start_thread_cpu_time_;
+  struct rusage start_rusage_;
+  std::array<int, kNumPerfCounters> perf_fds_;
+};
+
+// Converts the resource usage into a generic protobuf struct suitable for the
+// content of an Extension artifact.
+google::protobuf::Struct ResourceUsageToProto(const StepResourceUsage& usage);
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_STEP_RESOURCE_USAGE_H_
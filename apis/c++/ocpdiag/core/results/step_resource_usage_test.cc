@@ -0,0 +1,98 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/step_resource_usage.h"
+
+#include <time.h>
+
+#include <thread>  //
+#include <vector>
+
+#include "google/protobuf/struct.pb.h"
+#include "gtest/gtest.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+TEST(StepResourceTrackerTest, WallTimeCoversSleep) {
+  StepResourceTracker tracker;
+  absl::SleepFor(absl::Milliseconds(20));
+  StepResourceUsage usage = tracker.Finish();
+  EXPECT_GE(usage.wall_time, absl::Milliseconds(20));
+  ASSERT_TRUE(usage.thread_cpu_time.has_value());
+  EXPECT_LT(*usage.thread_cpu_time, usage.wall_time);
+  EXPECT_FALSE(usage.perf_counters.has_value());
+}
+
+absl::Duration ThreadCpuTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return absl::DurationFromTimespec(ts);
+}
+
+TEST(StepResourceTrackerTest, CpuWorkIsCounted) {
+  StepResourceTracker tracker;
+  // Spin on the thread's own CPU time so the test holds up on loaded machines.
+  volatile int64_t sink = 0;
+  absl::Duration deadline = ThreadCpuTime() + absl::Milliseconds(10);
+  while (ThreadCpuTime() < deadline) sink = sink + 1;
+  StepResourceUsage usage = tracker.Finish();
+  EXPECT_GE(*usage.thread_cpu_time, absl::Milliseconds(10));
+  EXPECT_GT(usage.user_cpu_time + usage.system_cpu_time, absl::ZeroDuration());
+}
+
+TEST(StepResourceTrackerTest, MemoryGrowthIsCounted) {
+  StepResourceTracker tracker;
+  std::vector<char> buffer(64 << 20, 1);
+  StepResourceUsage usage = tracker.Finish();
+  EXPECT_GT(usage.minor_page_faults, 0);
+  EXPECT_GT(usage.max_rss_kb, 0);
+  EXPECT_GE(usage.max_rss_growth_kb, 0);
+}
+
+TEST(StepResourceTrackerTest, ThreadCountersAreOmittedOnOtherThreads) {
+  StepResourceTracker tracker(/*enable_perf_counters=*/true);
+  StepResourceUsage usage;
+  std::thread([&] { usage = tracker.Finish(); }).join();
+  EXPECT_FALSE(usage.thread_cpu_time.has_value());
+  EXPECT_FALSE(usage.perf_counters.has_value());
+}
+
+TEST(StepResourceTrackerTest, PerfCountersAreReadWhenAvailable) {
+  StepResourceTracker tracker(/*enable_perf_counters=*/true);
+  std::vector<char> buffer(8 << 20, 1);
+  StepResourceUsage usage = tracker.Finish();
+  // perf_event_open may not be permitted in the test environment.
+  if (!usage.perf_counters.has_value()) GTEST_SKIP();
+  EXPECT_GT(usage.perf_counters->task_clock, absl::ZeroDuration());
+  EXPECT_GT(usage.perf_counters->page_faults, 0);
+}
+
+TEST(StepResourceUsageTest, ConvertsToProto) {
+  StepResourceUsage usage = {
+      .wall_time = absl::Microseconds(5),
+      .minor_page_faults = 3,
+      .perf_counters = StepResourceUsage::PerfCounters{.context_switches = 2},
+  };
+  google::protobuf::Struct proto = ResourceUsageToProto(usage);
+  const auto& fields = proto.fields();
+  EXPECT_EQ(fields.at("wallTimeNs").number_value(), 5000);
+  EXPECT_EQ(fields.at("minorPageFaults").number_value(), 3);
+  EXPECT_EQ(fields.count("threadCpuTimeNs"), 0);
+  EXPECT_EQ(fields.at("perfCounters")
+                .struct_value()
+                .fields()
+                .at("contextSwitches")
+                .number_value(),
+            2);
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal
@@ -6,24 +6,94 @@
 
 #include "ocpdiag/core/results/struct_validators.h"
 
+#include <atomic>
+#include <string>
 #include <variant>
 
+#include "absl/flags/flag.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/string_view.h"
 #include "ocpdiag/core/results/structs.h"
 #include "ocpdiag/core/results/variant.h"
 
+#ifndef OCPDIAG_STRUCT_VALIDATION_DEFAULT
+#define OCPDIAG_STRUCT_VALIDATION_DEFAULT kFull
+#endif
+
+ABSL_FLAG(ocpdiag::results::StructValidation, ocpdiag_struct_validation,
+          ocpdiag::results::StructValidation::OCPDIAG_STRUCT_VALIDATION_DEFAULT,
+          "How much the structs given to the results API are validated: "
+          "\"full\", \"first_use\" (only the first struct of each type) or "
+          "\"none\".");
+
 namespace ocpdiag::results {
 
+bool AbslParseFlag(absl::string_view text, StructValidation* validation,
+                   std::string* error) {
+  if (text == "full") {
+    *validation = StructValidation::kFull;
+  } else if (text == "first_use") {
+    *validation = StructValidation::kFirstUse;
+  } else if (text == "none") {
+    *validation = StructValidation::kNone;
+  } else {
+    *error = "must be one of \"full\", \"first_use\" or \"none\"";
+    return false;
+  }
+  return true;
+}
+
+std::string AbslUnparseFlag(StructValidation validation) {
+  switch (validation) {
+    case StructValidation::kFull:
+      return "full";
+    case StructValidation::kFirstUse:
+      return "first_use";
+    case StructValidation::kNone:
+      return "none";
+  }
+  return absl::StrCat(static_cast<int>(validation));
+}
+
+namespace {
+
+// Returns whether a struct of type T should be validated. The flag is read on
+// every call, which is a relaxed atomic load for enums.
+template <typename T>
+bool ShouldValidate() {
+  static std::atomic<bool> validated = false;
+  switch (absl::GetFlag(FLAGS_ocpdiag_struct_validation)) {
+    case StructValidation::kFirstUse:
+      // Loaded first so that later calls do not write to the cache line.
+      return !validated.load(std::memory_order_relaxed) &&
+             !validated.exchange(true, std::memory_order_relaxed);
+    case StructValidation::kNone:
+      return false;
+    default:
+      return true;
+  }
+}
+
+void ValidateFieldsOrDie(const Measurement& measurement) {
+  CHECK(!measurement.name.empty())
+      << "Must specify the name field of the measurement struct";
+  if (measurement.subcomponent.has_value())
+    ValidateStructOrDie(*measurement.subcomponent);
+}
+
+}  // namespace
+
 void ValidateStructOrDie(const Validator& validator) {
+  if (!ShouldValidate<Validator>()) return;
   absl::string_view identifier = validator.name;
   if (identifier.empty()) identifier = "Unnamed Validator";
   CHECK(!validator.value.empty())
       << "At least one value must be specified for validator: " << identifier;
-  int type_index = validator.value[0].index();
+  VariantKind kind = KindOf(validator.value[0]);
   for (const Variant& variant : validator.value) {
-    CHECK(variant.index() == type_index)
+    CHECK(KindOf(variant) == kind)
         << "All values must be of the same type for validator: " << identifier;
   }
 
@@ -42,7 +112,7 @@ void ValidateStructOrDie(const Validator& validator) {
           << "Must specify exactly one value for numerical comparison type "
              "validator: "
           << identifier;
-      CHECK(std::holds_alternative<double>(validator.value[0]))
+      CHECK(IsNumeric(validator.value[0]))
           << "Value must be numerical for numerical comparison validator: "
           << identifier;
       break;
@@ -55,7 +125,7 @@ void ValidateStructOrDie(const Validator& validator) {
     case ValidatorType::kInSet:
     case ValidatorType::kNotInSet:
       CHECK(std::holds_alternative<std::string>(validator.value[0]) ||
-            std::holds_alternative<double>(validator.value[0]))
+            IsNumeric(validator.value[0]))
           << "Value must be a string or numerical type for set validator: "
           << identifier;
       break;
@@ -66,52 +136,59 @@ void ValidateStructOrDie(const Validator& validator) {
 }
 
 void ValidateStructOrDie(const HardwareInfo& hardware_info) {
+  if (!ShouldValidate<HardwareInfo>()) return;
   CHECK(!hardware_info.name.empty())
       << "Must specify the name field of the hardware info struct";
 }
 
 void ValidateStructOrDie(const SoftwareInfo& software_info) {
+  if (!ShouldValidate<SoftwareInfo>()) return;
   CHECK(!software_info.name.empty())
       << "Must specify the name field of the software info struct";
 }
 
 void ValidateStructOrDie(const PlatformInfo& platform_info) {
+  if (!ShouldValidate<PlatformInfo>()) return;
   CHECK(!platform_info.info.empty())
       << "Must specify the info field of the platform info struct";
 }
 
 void ValidateStructOrDie(const Subcomponent& subcomponent) {
+  if (!ShouldValidate<Subcomponent>()) return;
   CHECK(!subcomponent.name.empty())
       << "Must specify the name field of the subcomponent struct";
 }
 
 void ValidateStructOrDie(
     const MeasurementSeriesStart& measurement_series_start) {
+  if (!ShouldValidate<MeasurementSeriesStart>()) return;
   CHECK(!measurement_series_start.name.empty())
       << "Must specify the name field of the measurement series start struct";
   if (measurement_series_start.subcomponent.has_value())
     ValidateStructOrDie(*measurement_series_start.subcomponent);
 
   if (measurement_series_start.validators.empty()) return;
-  int type_index = measurement_series_start.validators[0].value[0].index();
   for (const Validator& validator : measurement_series_start.validators) {
     ValidateStructOrDie(validator);
-    CHECK(type_index == -1 || type_index == validator.value[0].index())
+    CHECK(KindOf(validator.value[0]) ==
+          KindOf(measurement_series_start.validators[0].value[0]))
         << "All validators must be the same type for measurement series start: "
         << measurement_series_start.name;
   }
 }
 
-void ValidateStructOrDie(const Measurement& measurement) {
-  CHECK(!measurement.name.empty())
-      << "Must specify the name field of the measurement struct";
-  if (measurement.subcomponent.has_value())
-    ValidateStructOrDie(*measurement.subcomponent);
+void ValidateStructExceptValidatorsOrDie(const Measurement& measurement) {
+  if (!ShouldValidate<Measurement>()) return;
+  ValidateFieldsOrDie(measurement);
+}
 
-  int type_index = measurement.value.index();
+void ValidateStructOrDie(const Measurement& measurement) {
+  if (!ShouldValidate<Measurement>()) return;
+  ValidateFieldsOrDie(measurement);
+  VariantKind kind = KindOf(measurement.value);
   for (const Validator& validator : measurement.validators) {
     ValidateStructOrDie(validator);
-    CHECK(type_index == validator.value[0].index())
+    CHECK(KindOf(validator.value[0]) == kind)
         << "All validators and the value must be the same type for "
            "measurement: "
         << measurement.name;
@@ -119,6 +196,7 @@ void ValidateStructOrDie(const Measurement& measurement) {
 }
 
 void ValidateStructOrDie(const Diagnosis& diagnosis) {
+  if (!ShouldValidate<Diagnosis>()) return;
   CHECK(!diagnosis.verdict.empty())
       << "Must specify the verdict field of the diagnosis struct";
   CHECK(diagnosis.type != DiagnosisType::kUnknown)
@@ -128,15 +206,18 @@ void ValidateStructOrDie(const Diagnosis& diagnosis) {
 }
 
 void ValidateStructOrDie(const Error& error) {
+  if (!ShouldValidate<Error>()) return;
   CHECK(!error.symptom.empty())
       << "Must specify the symptom field of the error struct";
 }
 
 void ValidateStructOrDie(const Log& log) {
+  if (!ShouldValidate<Log>()) return;
   CHECK(!log.message.empty()) << "Must specify the message field of the log";
 }
 
 void ValidateStructOrDie(const File& file) {
+  if (!ShouldValidate<File>()) return;
   CHECK(!file.display_name.empty())
       << "Must specify the display name of the file struct";
   CHECK(!file.uri.empty()) << "Must specify the URI of the file struct: "
@@ -146,6 +227,7 @@ void ValidateStructOrDie(const File& file) {
 }
 
 void ValidateStructOrDie(const TestRunStart& test_run_info) {
+  if (!ShouldValidate<TestRunStart>()) return;
   CHECK(!test_run_info.name.empty())
       << "Must specify the name of the test run info";
   CHECK(!test_run_info.version.empty())
@@ -157,6 +239,7 @@ void ValidateStructOrDie(const TestRunStart& test_run_info) {
 }
 
 void ValidateStructOrDie(const Extension& extension) {
+  if (!ShouldValidate<Extension>()) return;
   CHECK(!extension.name.empty()) << "Must specify the name of the extension";
   CHECK(!extension.content_json.empty())
       << "Must specify the content of the extension";
@@ -9,17 +9,50 @@
 #ifndef OCPDIAG_CORE_RESULTS_OCP_STRUCT_VALIDATORS_H_
 #define OCPDIAG_CORE_RESULTS_OCP_STRUCT_VALIDATORS_H_
 
+#include <string>
+
+#include "absl/flags/declare.h"
+#include "absl/strings/string_view.h"
 #include "ocpdiag/core/results/structs.h"
 
 namespace ocpdiag::results {
 
+// How much the structs given to the results API are validated.
+enum class StructValidation {
+  // Every struct is validated.
+  kFull,
+  // Only the first struct of each type is validated, which catches fields that
+  // a test never sets at its start.
+  kFirstUse,
+  // Structs are not validated, for trusted binaries whose output has been
+  // qualified.
+  kNone,
+};
+
+bool AbslParseFlag(absl::string_view text, StructValidation* validation,
+                   std::string* error);
+std::string AbslUnparseFlag(StructValidation validation);
+
+}  // namespace ocpdiag::results
+
+ABSL_DECLARE_FLAG(ocpdiag::results::StructValidation,
+                  ocpdiag_struct_validation);
+
+namespace ocpdiag::results {
+
+// The functions below validate according to --ocpdiag_struct_validation.
+
 void ValidateStructOrDie(const Validator& validator);
 void ValidateStructOrDie(const HardwareInfo& hardware_info);
 void ValidateStructOrDie(const SoftwareInfo& software_info);
 void ValidateStructOrDie(const PlatformInfo& platform_info);
+void ValidateStructOrDie(const Subcomponent& subcomponent);
 void ValidateStructOrDie(
     const MeasurementSeriesStart& measurement_series_start);
 void ValidateStructOrDie(const Measurement& measurement);
+// Validates all the fields of the measurement except for its validators, for
+// callers that validate them once with a CompiledValidatorSet.
+void ValidateStructExceptValidatorsOrDie(const Measurement& measurement);
 void ValidateStructOrDie(const Diagnosis& diagnosis);
 void ValidateStructOrDie(const Error& error);
 void ValidateStructOrDie(const Log& log);
@@ -6,8 +6,13 @@
 
 #include "ocpdiag/core/results/struct_validators.h"
 
+#include <cstdint>
+#include <string>
+
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/reflection.h"
 #include "ocpdiag/core/results/structs.h"
 
 namespace ocpdiag::results {
@@ -36,6 +41,18 @@ INSTANTIATE_TEST_SUITE_P(ValidValidatorsPass, ValidValidatorStructTest,
                                 Validator({
                                     .type = ValidatorType::kNotInSet,
                                     .value = {"Bad", "values"},
+                                }),
+                                Validator({
+                                    .type = ValidatorType::kGreaterThan,
+                                    .value = {uint64_t{1} << 63},
+                                }),
+                                Validator({
+                                    .type = ValidatorType::kInSet,
+                                    .value = {-1, 0, 1},
+                                }),
+                                Validator({
+                                    .type = ValidatorType::kInSet,
+                                    .value = {-1, uint64_t{1} << 63, 0.5},
                                 })));
 
 struct InvalidValidatorTestCase {
@@ -187,6 +204,21 @@ TEST(ValidateMeasurementTest, ValidMeasurementPasses) {
   ValidateStructOrDie(Measurement({.name = "Fake name", .value = {100.}}));
 }
 
+TEST(ValidateMeasurementTest, IntegerAndDoubleValuesMix) {
+  ValidateStructOrDie(Measurement({
+      .name = "ecc-errors",
+      .validators = {{.type = ValidatorType::kLessThan, .value = {10.5}},
+                     {.type = ValidatorType::kGreaterThanOrEqual,
+                      .value = {uint64_t{0}}}},
+      .value = int64_t{3},
+  }));
+  ValidateStructOrDie(MeasurementSeriesStart({
+      .name = "replay-count",
+      .validators = {{.type = ValidatorType::kLessThan, .value = {int64_t{7}}},
+                     {.type = ValidatorType::kGreaterThan, .value = {-0.5}}},
+  }));
+}
+
 struct InvalidMeasurementTestCase {
   Measurement measurement;
   std::string want_error_regex;
@@ -369,4 +401,42 @@ INSTANTIATE_TEST_SUITE_P(
                {.extension = {.name = "No content JSON"},
                 .want_error_regex = "content of the extension"})));
 
+TEST(StructValidationFlagTest, NoneSkipsValidation) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_struct_validation, StructValidation::kNone);
+  ValidateStructOrDie(Extension({.name = "No content JSON"}));
+  ValidateStructOrDie(Measurement({.value = 1.}));
+}
+
+TEST(StructValidationFlagTest, FirstUseOnlyValidatesTheFirstStruct) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_struct_validation,
+                StructValidation::kFirstUse);
+  ValidateStructOrDie(PlatformInfo({.info = "platform"}));
+  ValidateStructOrDie(PlatformInfo());
+}
+
+TEST(StructValidationFlagDeathTest, FirstUseValidatesTheFirstStruct) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_struct_validation,
+                StructValidation::kFirstUse);
+  EXPECT_DEATH(ValidateStructOrDie(SoftwareInfo()), "name field");
+}
+
+TEST(StructValidationFlagTest, ParsesAndUnparses) {
+  for (StructValidation validation :
+       {StructValidation::kFull, StructValidation::kFirstUse,
+        StructValidation::kNone}) {
+    StructValidation parsed;
+    std::string error;
+    ASSERT_TRUE(
+        AbslParseFlag(AbslUnparseFlag(validation), &parsed, &error));
+    EXPECT_EQ(parsed, validation);
+  }
+  StructValidation parsed;
+  std::string error;
+  EXPECT_FALSE(AbslParseFlag("some", &parsed, &error));
+  EXPECT_THAT(error, ::testing::HasSubstr("first_use"));
+}
+
 }  // namespace ocpdiag::results
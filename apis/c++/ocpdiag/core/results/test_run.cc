@@ -6,7 +6,17 @@
 
 #include "ocpdiag/core/results/test_run.h"
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
 #include <memory>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "absl/base/attributes.h"
 #include "absl/base/const_init.h"
@@ -15,15 +25,28 @@
 #include "absl/log/check.h"
 #include "absl/log/log.h"
 #include "absl/log/log_sink_registry.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_join.h"
+#include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/artifact_sink.h"
 #include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/buffered_line_writer.h"
+#include "ocpdiag/core/results/clock.h"
+#include "ocpdiag/core/results/collector_sink.h"
 #include "ocpdiag/core/results/dut_info.h"
+#include "ocpdiag/core/results/flush_policy.h"
 #include "ocpdiag/core/results/log_sink.h"
 #include "ocpdiag/core/results/proto_converters.h"
 #include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/results_dictionary.h"
+#include "ocpdiag/core/results/shm_ring.h"
 #include "ocpdiag/core/results/struct_validators.h"
 #include "ocpdiag/core/results/structs.h"
 #include "ocpdiag/core/results/test_result_calculator.h"
+#include "ocpdiag/core/results/writer_metrics.h"
+#include "google/protobuf/struct.pb.h"
 
 ABSL_FLAG(bool, ocpdiag_copy_results_to_stdout, true,
           "Prints human-readable JSONL result artifacts to stdout");
@@ -36,26 +59,227 @@ ABSL_FLAG(bool, ocpdiag_log_to_results, true,
           "If set to true, the Abseil logger will be directed to OCPDiag "
           "results in addition to the Abseil default logging destination.");
 
+ABSL_FLAG(std::string, ocpdiag_results_clock, "realtime",
+          "Clock used to timestamp result artifacts: \"realtime\", "
+          "\"coarse\" (CLOCK_REALTIME_COARSE, cheaper but with tick "
+          "resolution), or \"tsc\" (calibrated CPU timestamp counter).");
+
+ABSL_FLAG(bool, ocpdiag_emit_writer_metrics, false,
+          "If set to true, the artifact writer's self-instrumentation metrics "
+          "are emitted as an extension artifact in a final test step before "
+          "the TestRunEnd artifact.");
+
+ABSL_FLAG(bool, ocpdiag_intern_results_strings, false,
+          "If set to true, the names, units, hardware info ids, verdicts and "
+          "subcomponents that artifacts repeat are written once to the binary "
+          "results file and referenced by id. Such files are read with "
+          "OutputContainer or the results tools.");
+
+ABSL_FLAG(std::string, ocpdiag_results_dictionary, "",
+          "Path of a zstd dictionary trained by train_results_dictionary. If "
+          "set, each record of the binary results file is compressed with it "
+          "on its own. Readers find the dictionary by the id in the file's "
+          "metadata, in --ocpdiag_results_dictionary_dir.");
+
+ABSL_FLAG(bool, ocpdiag_crash_safe_results, false,
+          "If set to true, the artifacts not yet flushed to the binary results "
+          "file are also kept in a memory-mapped journal next to it, and a "
+          "crash or SIGTERM adds a TestRunEnd artifact with the error status "
+          "to it. If the process dies, recover_results rebuilds the results "
+          "file from both.");
+
+ABSL_FLAG(absl::Duration, ocpdiag_results_flush_interval, absl::Minutes(1),
+          "Longest time a result artifact is left unflushed. Use \"inf\" to "
+          "only flush by the other triggers.");
+
+ABSL_FLAG(int64_t, ocpdiag_results_flush_bytes, 0,
+          "If positive, result artifacts are flushed once this many bytes of "
+          "them are unflushed.");
+
+ABSL_FLAG(int64_t, ocpdiag_results_flush_artifacts, 0,
+          "If positive, result artifacts are flushed once this many of them "
+          "are unflushed.");
+
+ABSL_FLAG(bool, ocpdiag_results_flush_on_error, false,
+          "If set to true, result artifacts are flushed right after errors "
+          "and logs of ERROR severity or above.");
+
+ABSL_FLAG(absl::Duration, ocpdiag_results_group_commit_window,
+          absl::ZeroDuration(),
+          "Test steps and measurement series flush the result artifacts when "
+          "they start and end, at most once per this window. Use \"inf\" to "
+          "only flush by the other triggers.");
+
+ABSL_FLAG(bool, ocpdiag_results_fsync, true,
+          "If set to true, flushes wait for the binary results file to reach "
+          "the disk.");
+
+ABSL_FLAG(bool, ocpdiag_results_async_io, false,
+          "If set to true, the binary results file is written through "
+          "io_uring, or a pool of threads where it is unavailable, so that "
+          "only flushes wait for the disk.");
+
+ABSL_FLAG(std::string, ocpdiag_results_shm_ring, "",
+          "Name of a shared memory ring created by a results collector, e.g. "
+          "with ShmRingReader. If set, the result artifacts are written to it "
+          "rather than to the binary results file, and flushed to it by the "
+          "flush flags. It cannot be combined with the flags of the binary "
+          "results file, or with --ocpdiag_results_collector_socket.");
+
+ABSL_FLAG(std::string, ocpdiag_results_collector_socket, "",
+          "UNIX socket of a results collector, such as collect_results. If "
+          "set, the result artifacts are streamed to it rather than written "
+          "to the binary results file, and flushed to it by the flush flags. "
+          "It cannot be combined with the flags of the binary results file.");
+
+ABSL_FLAG(int64_t, ocpdiag_results_output_budget_bytes, 0,
+          "If positive, the JSONL results copied to stdout, the shared memory "
+          "ring and the results collector are each written by a thread of "
+          "their own, with up to this many bytes of artifacts queued for it, "
+          "so that a slow consumer never blocks the test. Past that, lower "
+          "priority artifacts such as debug logs are dropped first, and a "
+          "warning before the TestRunEnd artifact accounts for them.");
+
+ABSL_FLAG(int64_t, ocpdiag_results_stdout_buffer_size, 0,
+          "If positive, the JSONL results copied to stdout are buffered up to "
+          "this size and written in whole lines when the buffer is full and "
+          "when results are flushed, rather than through std::cout. They may "
+          "then reach stdout as late as the results file does.");
+
+ABSL_FLAG(bool, ocpdiag_results_stdout_block_when_full, true,
+          "If set to false, the JSONL results copied to stdout are kept "
+          "buffered while stdout is a full pipe or socket, and dropped past "
+          "1 MiB, rather than blocking the test.");
+
 namespace ocpdiag::results {
 
 namespace {
 
+constexpr absl::string_view kWriterMetricsStepName = "ocpdiag-writer-metrics";
+constexpr absl::string_view kWriterMetricsExtensionName =
+    "ocpdiag.results.ArtifactWriterMetrics";
+
 ABSL_CONST_INIT absl::Mutex initialization_mutex(absl::kConstInit);
 bool initialized ABSL_GUARDED_BY(initialization_mutex) = false;
 
+// Returns the stream that the JSONL results are copied to, if any. A buffered
+// stream is created in `buffered_stdout`, which must outlive the writer.
+std::ostream* GetStdoutFromFlags(
+    std::unique_ptr<std::ostream>& buffered_stdout) {
+  if (!absl::GetFlag(FLAGS_ocpdiag_copy_results_to_stdout)) return nullptr;
+  int64_t buffer_size = absl::GetFlag(FLAGS_ocpdiag_results_stdout_buffer_size);
+  if (buffer_size <= 0) return &std::cout;
+  buffered_stdout = std::make_unique<internal::BufferedLineStream>(
+      STDOUT_FILENO,
+      internal::BufferedLineWriterOptions{
+          .buffer_size = static_cast<size_t>(buffer_size),
+          .block_when_full =
+              absl::GetFlag(FLAGS_ocpdiag_results_stdout_block_when_full)});
+  return buffered_stdout.get();
+}
+
+internal::FlushPolicy GetFlushPolicyFromFlags() {
+  return {
+      .interval = absl::GetFlag(FLAGS_ocpdiag_results_flush_interval),
+      .max_unflushed_bytes = absl::GetFlag(FLAGS_ocpdiag_results_flush_bytes),
+      .max_unflushed_artifacts =
+          absl::GetFlag(FLAGS_ocpdiag_results_flush_artifacts),
+      .flush_on_error = absl::GetFlag(FLAGS_ocpdiag_results_flush_on_error),
+      .group_commit_window =
+          absl::GetFlag(FLAGS_ocpdiag_results_group_commit_window),
+      .fsync = absl::GetFlag(FLAGS_ocpdiag_results_fsync),
+  };
+}
+
+// Fails if a flag of the binary results file is set along with `sink_flag`,
+// whose sink replaces the file, rather than ignoring it.
+void CheckNoFileFlags(absl::string_view sink_flag) {
+  std::vector<absl::string_view> file_flags;
+  if (!absl::GetFlag(FLAGS_ocpdiag_binary_results_filepath).empty())
+    file_flags.push_back("--ocpdiag_binary_results_filepath");
+  if (absl::GetFlag(FLAGS_ocpdiag_intern_results_strings))
+    file_flags.push_back("--ocpdiag_intern_results_strings");
+  if (!absl::GetFlag(FLAGS_ocpdiag_results_dictionary).empty())
+    file_flags.push_back("--ocpdiag_results_dictionary");
+  if (absl::GetFlag(FLAGS_ocpdiag_crash_safe_results))
+    file_flags.push_back("--ocpdiag_crash_safe_results");
+  if (absl::GetFlag(FLAGS_ocpdiag_results_async_io))
+    file_flags.push_back("--ocpdiag_results_async_io");
+  CHECK(file_flags.empty())
+      << sink_flag << " replaces the binary results file, so it cannot be "
+      << "combined with " << absl::StrJoin(file_flags, ", ");
+}
+
+std::unique_ptr<internal::ArtifactWriter> CreateArtifactWriterFromFlags(
+    std::unique_ptr<std::ostream>& buffered_stdout) {
+  Clock& clock = GetClockByName(absl::GetFlag(FLAGS_ocpdiag_results_clock));
+  size_t output_budget_bytes = std::max<int64_t>(
+      absl::GetFlag(FLAGS_ocpdiag_results_output_budget_bytes), 0);
+  std::string shm_ring = absl::GetFlag(FLAGS_ocpdiag_results_shm_ring);
+  std::string collector_socket =
+      absl::GetFlag(FLAGS_ocpdiag_results_collector_socket);
+  if (!shm_ring.empty()) {
+    CHECK(collector_socket.empty())
+        << "--ocpdiag_results_shm_ring and --ocpdiag_results_collector_socket "
+           "cannot be combined";
+    CheckNoFileFlags("--ocpdiag_results_shm_ring");
+    absl::StatusOr<std::unique_ptr<internal::ShmRingSink>> sink =
+        internal::ShmRingSink::Open(shm_ring);
+    CHECK(sink.ok()) << "Cannot attach to the results ring: " << sink.status();
+    return std::make_unique<internal::ArtifactWriter>(
+        std::shared_ptr<internal::ArtifactSink>(*std::move(sink)),
+        GetStdoutFromFlags(buffered_stdout),
+        internal::ArtifactWriter::Options{
+            .clock = &clock,
+            .flush_policy = GetFlushPolicyFromFlags(),
+            .output_budget_bytes = output_budget_bytes});
+  }
+  if (!collector_socket.empty()) {
+    CheckNoFileFlags("--ocpdiag_results_collector_socket");
+    absl::StatusOr<std::unique_ptr<internal::CollectorSink>> sink =
+        internal::CollectorSink::Connect(collector_socket);
+    CHECK(sink.ok()) << "Cannot stream results to the collector: "
+                     << sink.status();
+    return std::make_unique<internal::ArtifactWriter>(
+        std::shared_ptr<internal::ArtifactSink>(*std::move(sink)),
+        GetStdoutFromFlags(buffered_stdout),
+        internal::ArtifactWriter::Options{
+            .clock = &clock,
+            .flush_policy = GetFlushPolicyFromFlags(),
+            .output_budget_bytes = output_budget_bytes});
+  }
+  std::shared_ptr<const internal::ResultsDictionary> dictionary;
+  if (std::string path = absl::GetFlag(FLAGS_ocpdiag_results_dictionary);
+      !path.empty()) {
+    absl::StatusOr<std::shared_ptr<const internal::ResultsDictionary>>
+        loaded = internal::ResultsDictionary::Load(path);
+    CHECK(loaded.ok()) << "Cannot load the results dictionary: "
+                       << loaded.status();
+    dictionary = *std::move(loaded);
+  }
+  return std::make_unique<internal::ArtifactWriter>(
+      absl::GetFlag(FLAGS_ocpdiag_binary_results_filepath),
+      GetStdoutFromFlags(buffered_stdout),
+      internal::ArtifactWriter::Options{
+          .clock = &clock,
+          .intern_strings = absl::GetFlag(FLAGS_ocpdiag_intern_results_strings),
+          .crash_journal = absl::GetFlag(FLAGS_ocpdiag_crash_safe_results),
+          .flush_policy = GetFlushPolicyFromFlags(),
+          .async_file_io = absl::GetFlag(FLAGS_ocpdiag_results_async_io),
+          .output_budget_bytes = output_budget_bytes,
+          .dictionary = std::move(dictionary),
+      });
+}
+
 }  // namespace
 
 TestRun::TestRun(const TestRunStart& test_run_start,
                  std::unique_ptr<internal::ArtifactWriter> writer)
     : test_run_start_(test_run_start),
-      writer_(writer == nullptr
-                  ? std::make_unique<internal::ArtifactWriter>(
-                        absl::GetFlag(FLAGS_ocpdiag_binary_results_filepath),
-                        absl::GetFlag(FLAGS_ocpdiag_copy_results_to_stdout)
-                            ? &std::cout
-                            : nullptr)
-                  : std::move(writer)),
+      writer_(writer == nullptr ? CreateArtifactWriterFromFlags(stdout_)
+                                : std::move(writer)),
       result_calculator_(std::make_unique<TestResultCalculator>()),
+      validator_cache_(std::make_unique<internal::ValidatorCache>()),
       log_sink_(*writer_) {
   CheckAndSetInitializationGuard();
   RegisterLogSink();
@@ -90,7 +314,7 @@ void TestRun::AddPreStartError(const Error& error) {
   ValidateStructOrDie(error);
   ocpdiag_results_v2_pb::TestRunArtifact run_proto;
   *run_proto.mutable_error() = internal::StructToProto(error);
-  writer_->Write(run_proto);
+  writer_->Write(std::move(run_proto));
   result_calculator_->NotifyError();
 }
 
@@ -102,7 +326,7 @@ void TestRun::AddPreStartLog(const Log& log) {
   ValidateStructOrDie(log);
   ocpdiag_results_v2_pb::TestRunArtifact run_proto;
   *run_proto.mutable_log() = internal::StructToProto(log);
-  writer_->Write(run_proto);
+  writer_->Write(std::move(run_proto));
 
   // If the log is fatal, re-log the message to let Abseil handle exiting the
   // program
@@ -131,6 +355,8 @@ void TestRun::End() {
   absl::MutexLock lock(&mutex_);
   if (!started_) EmitStart();
   result_calculator_->Finalize();
+  if (absl::GetFlag(FLAGS_ocpdiag_emit_writer_metrics)) EmitWriterMetrics();
+  EmitDroppedArtifacts();
   EmitEnd();
 }
 
@@ -140,8 +366,41 @@ void TestRun::EmitStart() {
   if (dut_info_ != nullptr)
     *start_proto.mutable_dut_info() = internal::DutInfoToProto(*dut_info_);
   ocpdiag_results_v2_pb::TestRunArtifact run_proto;
-  *run_proto.mutable_test_run_start() = start_proto;
-  writer_->Write(run_proto);
+  *run_proto.mutable_test_run_start() = std::move(start_proto);
+  writer_->Write(std::move(run_proto));
+}
+
+void TestRun::EmitWriterMetrics() {
+  // The snapshot is taken before this step is written, so it covers every
+  // artifact emitted by the test itself.
+  google::protobuf::Struct content =
+      internal::MetricsToProto(writer_->GetMetrics());
+  ocpdiag_results_v2_pb::TestStepArtifact step_proto;
+  step_proto.set_test_step_id(GetNextStepId());
+
+  step_proto.mutable_test_step_start()->set_name(
+      std::string(kWriterMetricsStepName));
+  writer_->Write(step_proto);
+
+  ocpdiag_results_v2_pb::Extension* extension_proto =
+      step_proto.mutable_extension();
+  extension_proto->set_name(std::string(kWriterMetricsExtensionName));
+  *extension_proto->mutable_content() = std::move(content);
+  writer_->Write(step_proto);
+
+  step_proto.mutable_test_step_end()->set_status(
+      ocpdiag_results_v2_pb::TestRunEnd::COMPLETE);
+  writer_->Write(step_proto);
+}
+
+void TestRun::EmitDroppedArtifacts() {
+  for (std::string& description : writer_->DescribeDroppedArtifacts()) {
+    ocpdiag_results_v2_pb::TestRunArtifact run_proto;
+    ocpdiag_results_v2_pb::Log* log_proto = run_proto.mutable_log();
+    log_proto->set_severity(ocpdiag_results_v2_pb::Log::WARNING);
+    log_proto->set_message(std::move(description));
+    writer_->Write(std::move(run_proto));
+  }
 }
 
 void TestRun::EmitEnd() {
@@ -152,7 +411,7 @@ void TestRun::EmitEnd() {
       result_calculator_->status()));
   end_proto->set_result(ocpdiag_results_v2_pb::TestRunEnd::TestResult(
       result_calculator_->result()));
-  writer_->Write(run_proto);
+  writer_->Write(std::move(run_proto));
   writer_->Flush();
 }
 
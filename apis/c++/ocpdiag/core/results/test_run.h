@@ -6,14 +6,19 @@
 
 #ifndef OCPDIAG_CORE_RESULTS_OCP_TEST_RUN_H_
 #define OCPDIAG_CORE_RESULTS_OCP_TEST_RUN_H_
+#include <cstdint>
 #include <memory>
+#include <ostream>
 #include <string>
 
 #include "absl/base/thread_annotations.h"
 #include "absl/flags/declare.h"
 #include "absl/strings/str_cat.h"
 #include "absl/synchronization/mutex.h"
+#include "absl/time/time.h"
 #include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/clock.h"
+#include "ocpdiag/core/results/compiled_validators.h"
 #include "ocpdiag/core/results/dut_info.h"
 #include "ocpdiag/core/results/int_incrementer.h"
 #include "ocpdiag/core/results/log_sink.h"
@@ -23,6 +28,22 @@
 ABSL_DECLARE_FLAG(bool, ocpdiag_copy_results_to_stdout);
 ABSL_DECLARE_FLAG(std::string, ocpdiag_binary_results_filepath);
 ABSL_DECLARE_FLAG(bool, ocpdiag_log_to_results);
+ABSL_DECLARE_FLAG(std::string, ocpdiag_results_clock);
+ABSL_DECLARE_FLAG(bool, ocpdiag_emit_writer_metrics);
+ABSL_DECLARE_FLAG(bool, ocpdiag_intern_results_strings);
+ABSL_DECLARE_FLAG(std::string, ocpdiag_results_dictionary);
+ABSL_DECLARE_FLAG(bool, ocpdiag_crash_safe_results);
+ABSL_DECLARE_FLAG(absl::Duration, ocpdiag_results_flush_interval);
+ABSL_DECLARE_FLAG(int64_t, ocpdiag_results_flush_bytes);
+ABSL_DECLARE_FLAG(int64_t, ocpdiag_results_flush_artifacts);
+ABSL_DECLARE_FLAG(bool, ocpdiag_results_flush_on_error);
+ABSL_DECLARE_FLAG(absl::Duration, ocpdiag_results_group_commit_window);
+ABSL_DECLARE_FLAG(bool, ocpdiag_results_fsync);
+ABSL_DECLARE_FLAG(bool, ocpdiag_results_async_io);
+ABSL_DECLARE_FLAG(std::string, ocpdiag_results_shm_ring);
+ABSL_DECLARE_FLAG(std::string, ocpdiag_results_collector_socket);
+ABSL_DECLARE_FLAG(int64_t, ocpdiag_results_stdout_buffer_size);
+ABSL_DECLARE_FLAG(bool, ocpdiag_results_stdout_block_when_full);
 
 namespace ocpdiag::results {
 
@@ -89,23 +110,38 @@ class TestRun {
   // Returns the artifact writer. This is intended for internal use only.
   internal::ArtifactWriter& GetArtifactWriter() { return *writer_; }
 
+  // Returns the clock used to timestamp this run's artifacts. To substitute a
+  // clock, e.g. a FakeClock in tests, pass it to the ArtifactWriter given to
+  // the constructor.
+  Clock& GetClock() { return writer_->GetClock(); }
+
   // Returns the test result caclculator. This is intended for internal use
   // only.
   TestResultCalculator& GetResultCalculator() { return *result_calculator_; }
 
+  // Returns the cache of the validators of the measurements added to the run.
+  // This is intended for internal use only.
+  internal::ValidatorCache& GetValidatorCache() { return *validator_cache_; }
+
  private:
   void CheckAndSetInitializationGuard();
   void RegisterLogSink();
   void EmitSchemaVersion();
   void End();
   void EmitStart() ABSL_SHARED_LOCKS_REQUIRED(mutex_);
+  void EmitWriterMetrics() ABSL_SHARED_LOCKS_REQUIRED(mutex_);
+  void EmitDroppedArtifacts() ABSL_SHARED_LOCKS_REQUIRED(mutex_);
   void EmitEnd() ABSL_SHARED_LOCKS_REQUIRED(mutex_);
   void DeregisterLogSink();
   void UnsetInitializationGuard();
 
   TestRunStart test_run_start_;
+  // The buffered stdout that the writer copies the results to, if any, which
+  // outlives it.
+  std::unique_ptr<std::ostream> stdout_;
   std::unique_ptr<internal::ArtifactWriter> writer_;
   std::unique_ptr<TestResultCalculator> result_calculator_;
+  std::unique_ptr<internal::ValidatorCache> validator_cache_;
   internal::LogSink log_sink_;
   std::unique_ptr<DutInfo> dut_info_;
   internal::IntIncrementer step_id_;
@@ -8,7 +8,10 @@
 
 #include <memory>
 
+#include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/reflection.h"
 #include "ocpdiag/core/results/artifact_writer.h"
 #include "ocpdiag/core/results/dut_info.h"
 #include "ocpdiag/core/results/output_receiver.h"
@@ -18,6 +21,8 @@ namespace ocpdiag::results {
 
 namespace {
 
+using ::testing::HasSubstr;
+
 TestRunStart GetExampleTestRunStart() {
   return {
       .name = "mlc_test",
@@ -53,6 +58,35 @@ TEST(TestRunTest, SequentialInitilizationSucceeds) {
   TestRun second_test_run(GetExampleTestRunStart());
 }
 
+TEST(TestRunDeathTest, CollectorSocketWithFileFlagsCausesDeath) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_results_collector_socket, "/tmp/collector");
+  absl::SetFlag(&FLAGS_ocpdiag_binary_results_filepath, "/tmp/results");
+  absl::SetFlag(&FLAGS_ocpdiag_crash_safe_results, true);
+  EXPECT_DEATH(TestRun test_run(GetExampleTestRunStart()),
+               "--ocpdiag_results_collector_socket replaces the binary results "
+               "file, so it cannot be combined with "
+               "--ocpdiag_binary_results_filepath, "
+               "--ocpdiag_crash_safe_results");
+}
+
+TEST(TestRunDeathTest, ShmRingWithFileFlagsCausesDeath) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_results_shm_ring, "/ocpdiag-results");
+  absl::SetFlag(&FLAGS_ocpdiag_results_async_io, true);
+  EXPECT_DEATH(TestRun test_run(GetExampleTestRunStart()),
+               "--ocpdiag_results_shm_ring replaces the binary results file, "
+               "so it cannot be combined with --ocpdiag_results_async_io");
+}
+
+TEST(TestRunDeathTest, ShmRingWithCollectorSocketCausesDeath) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_results_shm_ring, "/ocpdiag-results");
+  absl::SetFlag(&FLAGS_ocpdiag_results_collector_socket, "/tmp/collector");
+  EXPECT_DEATH(TestRun test_run(GetExampleTestRunStart()),
+               "cannot be combined");
+}
+
 TEST(TestRunDeathTest, InitializingSecondTestRunCausesDeath) {
   TestRunStart start = GetExampleTestRunStart();
   TestRun first_test_run(start);
@@ -177,6 +211,27 @@ TEST(TestRunTest, IdsIncrementProperly) {
   EXPECT_EQ(test_run.GetNextMeasurementSeriesId(), "1");
 }
 
+TEST(TestRunTest, WriterMetricsAreEmittedWhenEnabled) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_emit_writer_metrics, true);
+  OutputReceiver receiver;
+  {
+    TestRun test_run(GetExampleTestRunStart(), receiver.MakeArtifactWriter());
+    test_run.StartAndRegisterDutInfo(std::make_unique<DutInfo>("dut", "id"));
+  }
+
+  ASSERT_EQ(receiver.GetOutputModel().test_steps.size(), 1);
+  const TestStepModel& step = receiver.GetOutputModel().test_steps[0];
+  EXPECT_EQ(step.start.name, "ocpdiag-writer-metrics");
+  ASSERT_EQ(step.extensions.size(), 1);
+  EXPECT_EQ(step.extensions[0].name, "ocpdiag.results.ArtifactWriterMetrics");
+  EXPECT_THAT(step.extensions[0].content_json,
+              HasSubstr("\"testRunArtifact.testRunStart\""));
+  EXPECT_EQ(step.end.status, TestStatus::kComplete);
+  EXPECT_EQ(receiver.GetOutputModel().test_run.end.status,
+            TestStatus::kComplete);
+}
+
 TEST(TestRunTest, ResultCalculatorOutputIsPropagatedProperly) {
   TestRun test_run(GetExampleTestRunStart());
   EXPECT_EQ(test_run.Result(), test_run.GetResultCalculator().result());
@@ -6,24 +6,68 @@
 
 #include "ocpdiag/core/results/test_step.h"
 
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "google/protobuf/arena.h"
+#include "absl/flags/flag.h"
 #include "absl/log/check.h"
 #include "absl/log/log.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
 #include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/compiled_validators.h"
+#include "ocpdiag/core/results/measurement_template.h"
 #include "ocpdiag/core/results/proto_converters.h"
 #include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/step_resource_usage.h"
 #include "ocpdiag/core/results/struct_validators.h"
 #include "ocpdiag/core/results/structs.h"
 #include "ocpdiag/core/results/test_run.h"
+#include "ocpdiag/core/results/variant.h"
+
+ABSL_FLAG(bool, ocpdiag_capture_step_resource_usage, false,
+          "If set to true, each test step measures its wall time, CPU time and "
+          "resource usage, and emits them as an extension artifact before the "
+          "TestStepEnd artifact.");
+
+ABSL_FLAG(bool, ocpdiag_capture_step_perf_counters, false,
+          "If set to true along with ocpdiag_capture_step_resource_usage, "
+          "software perf_event counters are added to the step resource usage "
+          "when the kernel permits it.");
 
 namespace ocpdiag::results {
 
+namespace {
+
+constexpr absl::string_view kResourceUsageExtensionName =
+    "ocpdiag.results.StepResourceUsage";
+
+// The artifacts of measurement templates are built on an arena whose first
+// block is on the stack, which holds a typical measurement, so that building
+// one and handing it to the writer allocates nothing on the heap.
+constexpr size_t kArtifactArenaBlockSize = 4096;
+
+google::protobuf::ArenaOptions ArtifactArenaOptions(
+    char (&initial_block)[kArtifactArenaBlockSize]) {
+  google::protobuf::ArenaOptions options;
+  options.initial_block = initial_block;
+  options.initial_block_size = kArtifactArenaBlockSize;
+  return options;
+}
+
+}  // namespace
+
 TestStep::TestStep(absl::string_view name, TestRun& test_run)
     : test_run_(test_run), id_(test_run.GetNextStepId()), name_(name) {
   CHECK(test_run.Started())
       << "TestSteps must be created after the test run has started";
   EmitStart();
+  if (absl::GetFlag(FLAGS_ocpdiag_capture_step_resource_usage)) {
+    resource_tracker_ = std::make_unique<internal::StepResourceTracker>(
+        absl::GetFlag(FLAGS_ocpdiag_capture_step_perf_counters));
+  }
 }
 
 void TestStep::EmitStart() {
@@ -33,16 +77,58 @@ void TestStep::EmitStart() {
       step_proto.mutable_test_step_start();
   start_proto->set_name(name_);
   AssignIdAndEmitArtifact(step_proto);
-  GetArtifactWriter().Flush();
+  GetArtifactWriter().FlushAtBoundary();
+}
+
+std::shared_ptr<const CompiledValidatorSet> TestStep::ValidateMeasurementOrDie(
+    const Measurement& measurement) {
+  // Measurements are often repeated with the same validators, which are only
+  // validated and converted the first time.
+  ValidateStructExceptValidatorsOrDie(measurement);
+  std::shared_ptr<const CompiledValidatorSet> validators =
+      test_run_.GetValidatorCache().Compile(measurement.validators);
+  validators->CheckValueTypeOrDie(measurement.value, measurement.name);
+  return validators;
 }
 
 void TestStep::AddMeasurement(const Measurement& measurement) {
-  ValidateStructOrDie(measurement);
+  std::shared_ptr<const CompiledValidatorSet> validators =
+      ValidateMeasurementOrDie(measurement);
   ocpdiag_results_v2_pb::TestStepArtifact proto;
-  *proto.mutable_measurement() = internal::StructToProto(measurement);
+  *proto.mutable_measurement() =
+      internal::StructToProto(measurement, validators->protos());
   CheckEndedAndEmitArtifact(proto);
 }
 
+void TestStep::AddMeasurement(Measurement&& measurement) {
+  std::shared_ptr<const CompiledValidatorSet> validators =
+      ValidateMeasurementOrDie(measurement);
+  ocpdiag_results_v2_pb::TestStepArtifact proto;
+  *proto.mutable_measurement() =
+      internal::StructToProto(std::move(measurement), validators->protos());
+  CheckEndedAndEmitArtifact(proto);
+}
+
+void TestStep::AddMeasurement(const MeasurementTemplate& measurement,
+                              const Variant& value) {
+  alignas(std::max_align_t) char initial_block[kArtifactArenaBlockSize];
+  google::protobuf::Arena arena(ArtifactArenaOptions(initial_block));
+  auto* proto = google::protobuf::Arena::CreateMessage<
+      ocpdiag_results_v2_pb::TestStepArtifact>(&arena);
+  measurement.ToProto(value, *proto->mutable_measurement());
+  CheckEndedAndEmitArtifact(*proto);
+}
+
+void TestStep::AddMeasurement(const MeasurementTemplate& measurement,
+                              Variant&& value) {
+  alignas(std::max_align_t) char initial_block[kArtifactArenaBlockSize];
+  google::protobuf::Arena arena(ArtifactArenaOptions(initial_block));
+  auto* proto = google::protobuf::Arena::CreateMessage<
+      ocpdiag_results_v2_pb::TestStepArtifact>(&arena);
+  measurement.ToProto(std::move(value), *proto->mutable_measurement());
+  CheckEndedAndEmitArtifact(*proto);
+}
+
 void TestStep::AddDiagnosis(const Diagnosis& diagnosis) {
   ValidateStructOrDie(diagnosis);
   if (diagnosis.type == DiagnosisType::kFail)
@@ -127,19 +213,31 @@ void TestStep::End() {
   EmitEnd();
 }
 
+void TestStep::EmitResourceUsage() {
+  if (resource_tracker_ == nullptr) return;
+  ocpdiag_results_v2_pb::TestStepArtifact step_proto;
+  ocpdiag_results_v2_pb::Extension* extension_proto =
+      step_proto.mutable_extension();
+  extension_proto->set_name(std::string(kResourceUsageExtensionName));
+  *extension_proto->mutable_content() =
+      internal::ResourceUsageToProto(resource_tracker_->Finish());
+  AssignIdAndEmitArtifact(step_proto);
+}
+
 void TestStep::EmitEnd() {
+  EmitResourceUsage();
   ocpdiag_results_v2_pb::TestStepArtifact step_proto;
   ocpdiag_results_v2_pb::TestStepEnd* end_proto =
       step_proto.mutable_test_step_end();
   end_proto->set_status(ocpdiag_results_v2_pb::TestRunEnd::TestStatus(status_));
   AssignIdAndEmitArtifact(step_proto);
-  GetArtifactWriter().Flush();
+  GetArtifactWriter().FlushAtBoundary();
 }
 
 void TestStep::AssignIdAndEmitArtifact(
     ocpdiag_results_v2_pb::TestStepArtifact& artifact) {
   artifact.set_test_step_id(id_);
-  GetArtifactWriter().Write(artifact);
+  GetArtifactWriter().Write(std::move(artifact));
 }
 
 internal::ArtifactWriter& TestStep::GetArtifactWriter() {
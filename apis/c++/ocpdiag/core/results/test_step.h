@@ -7,20 +7,33 @@
 #ifndef OCPDIAG_CORE_RESULTS_OCP_TEST_STEP_H_
 #define OCPDIAG_CORE_RESULTS_OCP_TEST_STEP_H_
 
+#include <memory>
 #include <string>
 
 #include "absl/base/thread_annotations.h"
+#include "absl/flags/declare.h"
 #include "absl/strings/string_view.h"
 #include "absl/synchronization/mutex.h"
 #include "ocpdiag/core/results/artifact_writer.h"
+#include "ocpdiag/core/results/compiled_validators.h"
+#include "ocpdiag/core/results/measurement_template.h"
 #include "ocpdiag/core/results/results.pb.h"
+#include "ocpdiag/core/results/step_resource_usage.h"
 #include "ocpdiag/core/results/structs.h"
 #include "ocpdiag/core/results/test_run.h"
+#include "ocpdiag/core/results/variant.h"
+
+ABSL_DECLARE_FLAG(bool, ocpdiag_capture_step_resource_usage);
+ABSL_DECLARE_FLAG(bool, ocpdiag_capture_step_perf_counters);
 
 namespace ocpdiag::results {
 
 // A logical subdivision of the TestRun used to emit most of artifacts created
 // during the test.
+//
+// When --ocpdiag_capture_step_resource_usage is set, each step also measures
+// its wall time, CPU time and getrusage deltas, and emits them as an Extension
+// artifact just before the TestStepEnd artifact.
 class TestStep {
  public:
   TestStep(absl::string_view name, TestRun& test_run);
@@ -28,8 +41,16 @@ class TestStep {
   TestStep& operator=(const TestStep&) = delete;
   ~TestStep() { End(); }
 
-  // Adds a measurement to the test step.
+  // Adds a measurement to the test step. The rvalue overload moves a string
+  // value into the emitted artifact instead of copying it.
   void AddMeasurement(const Measurement& measurement);
+  void AddMeasurement(Measurement&& measurement);
+
+  // Adds a measurement of the template with `value`. Unlike the above, the
+  // fixed fields of the measurement are not validated and converted again.
+  void AddMeasurement(const MeasurementTemplate& measurement,
+                      const Variant& value);
+  void AddMeasurement(const MeasurementTemplate& measurement, Variant&& value);
 
   // Adds a diagnosis to the test step. A fail diagnosis will cause the test run
   // as a whole to gain the fail result.
@@ -74,9 +95,15 @@ class TestStep {
 
  private:
   void EmitStart();
+  // Validates the measurement and returns its compiled validators, after
+  // checking the type of its value against them.
+  std::shared_ptr<const CompiledValidatorSet> ValidateMeasurementOrDie(
+      const Measurement& measurement);
   void CheckEndedAndEmitArtifact(
       ocpdiag_results_v2_pb::TestStepArtifact& artifact);
+  void EmitResourceUsage() ABSL_SHARED_LOCKS_REQUIRED(mutex_);
   void EmitEnd() ABSL_SHARED_LOCKS_REQUIRED(mutex_);
+  // Moves the artifact to the artifact writer, leaving it empty.
   void AssignIdAndEmitArtifact(
       ocpdiag_results_v2_pb::TestStepArtifact& artifact);
   internal::ArtifactWriter& GetArtifactWriter();
@@ -87,6 +114,7 @@ class TestStep {
   mutable absl::Mutex mutex_;
   TestStatus status_ ABSL_GUARDED_BY(mutex_) = TestStatus::kUnknown;
   bool ended_ ABSL_GUARDED_BY(mutex_) = false;
+  std::unique_ptr<internal::StepResourceTracker> resource_tracker_;
 };
 
 }  // namespace ocpdiag::results
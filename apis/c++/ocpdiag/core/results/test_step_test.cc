@@ -8,9 +8,14 @@
 
 #include <memory>
 #include <string>
+#include <utility>
 
+#include "gmock/gmock.h"
 #include "gtest/gtest.h"
+#include "absl/flags/flag.h"
+#include "absl/flags/reflection.h"
 #include "ocpdiag/core/results/dut_info.h"
+#include "ocpdiag/core/results/measurement_template.h"
 #include "ocpdiag/core/results/output_receiver.h"
 #include "ocpdiag/core/results/structs.h"
 #include "ocpdiag/core/results/test_run.h"
@@ -19,6 +24,8 @@ namespace ocpdiag::results {
 
 namespace {
 
+using ::testing::HasSubstr;
+
 TestRun MakeTestRun(OutputReceiver& receiver) {
   return TestRun(
       {
@@ -80,6 +87,69 @@ TEST_F(TestStepTest, MeasurementIsEmittedProperly) {
   EXPECT_EQ(model.measurements[0].value, measurement.value);
 }
 
+TEST_F(TestStepTest, RepeatedMeasurementsKeepTheirValidators) {
+  Measurement measurement = {
+      .name = "Fake measurement",
+      .validators = {{.type = ValidatorType::kLessThan, .value = {200.}}},
+      .value = 132.,
+  };
+  step_.AddMeasurement(measurement);
+  measurement.value = 133.;
+  step_.AddMeasurement(measurement);
+  run_.GetArtifactWriter().Flush();
+
+  TestStepModel model = receiver_.GetOutputModel().test_steps[0];
+  ASSERT_EQ(model.measurements.size(), 2);
+  for (const MeasurementOutput& output : model.measurements)
+    EXPECT_EQ(output.validators, measurement.validators);
+  EXPECT_EQ(model.measurements[1].value, Variant(133.));
+}
+
+TEST_F(TestStepDeathTest, MeasurementOfTheWrongValueTypeCausesDeath) {
+  Measurement measurement = {
+      .name = "Fake measurement",
+      .validators = {{.type = ValidatorType::kLessThan, .value = {200.}}},
+      .value = 132.,
+  };
+  step_.AddMeasurement(measurement);
+  measurement.value = "fast";
+  EXPECT_DEATH(step_.AddMeasurement(measurement), "must be the same type");
+}
+
+TEST_F(TestStepTest, TemplateMeasurementIsEmittedProperly) {
+  MeasurementTemplate measurement_template({
+      .name = "Fake measurement",
+      .unit = "RPM",
+      .subcomponent = RegisteredSubcomponent({.name = "FAN1"}),
+  });
+  step_.AddMeasurement(measurement_template, 132.);
+  step_.AddMeasurement(measurement_template, 133.);
+  run_.GetArtifactWriter().Flush();
+
+  TestStepModel model = receiver_.GetOutputModel().test_steps[0];
+  ASSERT_EQ(model.measurements.size(), 2);
+  EXPECT_EQ(model.measurements[0].name, "Fake measurement");
+  EXPECT_EQ(model.measurements[0].unit, "RPM");
+  ASSERT_TRUE(model.measurements[0].subcomponent.has_value());
+  EXPECT_EQ(model.measurements[0].subcomponent->name, "FAN1");
+  EXPECT_EQ(model.measurements[0].value, Variant(132.));
+  EXPECT_EQ(model.measurements[1].value, Variant(133.));
+}
+
+TEST_F(TestStepTest, MovedStringMeasurementsAreEmittedProperly) {
+  MeasurementTemplate measurement_template({.name = "link-state"});
+  std::string state = "10Gbps";
+  step_.AddMeasurement(measurement_template, std::move(state));
+  step_.AddMeasurement(Measurement{.name = "link-state", .value = "25Gbps"});
+  run_.GetArtifactWriter().Flush();
+
+  TestStepModel model = receiver_.GetOutputModel().test_steps[0];
+  ASSERT_EQ(model.measurements.size(), 2);
+  EXPECT_EQ(model.measurements[0].value, Variant("10Gbps"));
+  EXPECT_EQ(model.measurements[1].name, "link-state");
+  EXPECT_EQ(model.measurements[1].value, Variant("25Gbps"));
+}
+
 TEST_F(TestStepDeathTest, AddingInvalidMeasurementCausesDeath) {
   EXPECT_DEATH(step_.AddMeasurement({.value = 100.}), "");
 }
@@ -255,6 +325,32 @@ TEST(TestStepDestructionTest, DestructorEmitsTestStepEndProperly) {
             TestStatus::kComplete);
 }
 
+TEST(TestStepResourceUsageTest, ResourceUsageIsEmittedBeforeEnd) {
+  absl::FlagSaver flag_saver;
+  absl::SetFlag(&FLAGS_ocpdiag_capture_step_resource_usage, true);
+  OutputReceiver receiver;
+  TestRun run = MakeTestRun(receiver);
+  StartTestRun(run);
+  { TestStep step("name", run); }
+
+  ASSERT_EQ(receiver.GetOutputModel().test_steps.size(), 1);
+  const TestStepModel& step = receiver.GetOutputModel().test_steps[0];
+  ASSERT_EQ(step.extensions.size(), 1);
+  EXPECT_EQ(step.extensions[0].name, "ocpdiag.results.StepResourceUsage");
+  EXPECT_THAT(step.extensions[0].content_json, HasSubstr("\"wallTimeNs\""));
+  EXPECT_EQ(step.end.status, TestStatus::kComplete);
+}
+
+TEST(TestStepResourceUsageTest, ResourceUsageIsNotEmittedByDefault) {
+  OutputReceiver receiver;
+  TestRun run = MakeTestRun(receiver);
+  StartTestRun(run);
+  { TestStep step("name", run); }
+
+  ASSERT_EQ(receiver.GetOutputModel().test_steps.size(), 1);
+  EXPECT_TRUE(receiver.GetOutputModel().test_steps[0].extensions.empty());
+}
+
 }  // namespace
 
 }  // namespace ocpdiag::results
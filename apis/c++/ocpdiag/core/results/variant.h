@@ -7,7 +7,10 @@
 #ifndef OCPDIAG_CORE_RESULTS_OCP_VARIANT_H_
 #define OCPDIAG_CORE_RESULTS_OCP_VARIANT_H_
 
+#include <cstdint>
 #include <string>
+#include <type_traits>
+#include <utility>
 #include <variant>
 
 #include "absl/strings/string_view.h"
@@ -17,16 +20,62 @@ namespace ocpdiag::results {
 // This class exists as a solution to an issue in the std::variant class in
 // C++17.
 //
-class Variant : public std::variant<std::string, double, bool> {
+// Integral values are held as int64_t or uint64_t, depending on their
+// signedness, so that counters keep their exact value. Strings are held in a
+// std::string, which stores short strings such as link or firmware states
+// inline; longer strings can be moved in, and moved out by the rvalue overloads
+// that add measurements.
+class Variant
+    : public std::variant<std::string, double, bool, int64_t, uint64_t> {
  public:
-  Variant(const char* value)
-      : std::variant<std::string, double, bool>(std::string(value)) {}
-  Variant(absl::string_view value)
-      : std::variant<std::string, double, bool>(std::string(value)) {}
-  Variant(bool value) : std::variant<std::string, double, bool>(value) {}
-  Variant(double value) : std::variant<std::string, double, bool>(value) {}
+  using Base = std::variant<std::string, double, bool, int64_t, uint64_t>;
+
+  Variant(const char* value) : Base(std::string(value)) {}
+  Variant(absl::string_view value) : Base(std::string(value)) {}
+  Variant(std::string&& value) : Base(std::move(value)) {}
+  Variant(bool value) : Base(value) {}
+  Variant(double value) : Base(value) {}
+  template <typename T,
+            std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>,
+                             int> = 0>
+  Variant(T value)
+      : Base(std::is_signed_v<T> ? Base(static_cast<int64_t>(value))
+                                 : Base(static_cast<uint64_t>(value))) {}
+
+  template <typename H>
+  friend H AbslHashValue(H h, const Variant& value) {
+    return H::combine(std::move(h), static_cast<const Base&>(value));
+  }
 };
 
+// Returns whether the value is a double or an integer.
+inline bool IsNumeric(const Variant& value) {
+  return std::holds_alternative<double>(value) ||
+         std::holds_alternative<int64_t>(value) ||
+         std::holds_alternative<uint64_t>(value);
+}
+
+// The kinds of value that a measurement and its validators must agree on.
+// Doubles and integers of either signedness are all numeric, so that, e.g., a
+// counter can be checked against a limit given as a double.
+enum class VariantKind { kString, kNumeric, kBool };
+
+inline VariantKind KindOf(const Variant& value) {
+  if (IsNumeric(value)) return VariantKind::kNumeric;
+  if (std::holds_alternative<bool>(value)) return VariantKind::kBool;
+  return VariantKind::kString;
+}
+
+// Returns the numeric value as a double, which may round integers beyond 2^53.
+// The value must be numeric.
+inline double NumericAsDouble(const Variant& value) {
+  if (const int64_t* i = std::get_if<int64_t>(&value); i != nullptr)
+    return static_cast<double>(*i);
+  if (const uint64_t* u = std::get_if<uint64_t>(&value); u != nullptr)
+    return static_cast<double>(*u);
+  return std::get<double>(value);
+}
+
 }  // namespace ocpdiag::results
 
 #endif  // OCPDIAG_CORE_RESULTS_OCP_VARIANT_H_
@@ -6,6 +6,12 @@
 
 #include "ocpdiag/core/results/variant.h"
 
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <utility>
+#include <variant>
+
 #include "gtest/gtest.h"
 
 namespace ocpdiag::results {
@@ -30,6 +36,16 @@ TEST(TestVariant, StringStoresAsString) {
   EXPECT_EQ(std::get_if<double>(&variant), nullptr);
 }
 
+TEST(TestVariant, MovedStringIsNotCopied) {
+  std::string str(64, 'x');
+  const char* data = str.data();
+  Variant variant(std::move(str));
+  std::string* output = std::get_if<std::string>(&variant);
+  ASSERT_NE(output, nullptr);
+  EXPECT_EQ(*output, std::string(64, 'x'));
+  EXPECT_EQ(output->data(), data);
+}
+
 TEST(TestVariant, BoolStoresAsBool) {
   Variant variant(true);
   bool* output = std::get_if<bool>(&variant);
@@ -48,4 +64,32 @@ TEST(TestVariant, DoubleStoresAsDouble) {
   EXPECT_EQ(std::get_if<bool>(&variant), nullptr);
 }
 
+TEST(TestVariant, SignedIntegerStoresAsInt64) {
+  Variant variant(-3);
+  int64_t* output = std::get_if<int64_t>(&variant);
+  ASSERT_NE(output, nullptr);
+  EXPECT_EQ(*output, -3);
+  EXPECT_EQ(std::get_if<double>(&variant), nullptr);
+  EXPECT_EQ(Variant(int64_t{1} << 62), Variant(int64_t{1} << 62));
+}
+
+TEST(TestVariant, UnsignedIntegerStoresAsUint64) {
+  Variant variant(std::numeric_limits<uint64_t>::max());
+  uint64_t* output = std::get_if<uint64_t>(&variant);
+  ASSERT_NE(output, nullptr);
+  EXPECT_EQ(*output, std::numeric_limits<uint64_t>::max());
+  EXPECT_TRUE(std::holds_alternative<uint64_t>(Variant(7u)));
+}
+
+TEST(TestVariant, NumericValuesConvertToDouble) {
+  EXPECT_TRUE(IsNumeric(Variant(1.5)));
+  EXPECT_TRUE(IsNumeric(Variant(-2)));
+  EXPECT_TRUE(IsNumeric(Variant(2u)));
+  EXPECT_FALSE(IsNumeric(Variant(true)));
+  EXPECT_FALSE(IsNumeric(Variant("1")));
+  EXPECT_EQ(NumericAsDouble(Variant(1.5)), 1.5);
+  EXPECT_EQ(NumericAsDouble(Variant(-2)), -2.);
+  EXPECT_EQ(NumericAsDouble(Variant(uint64_t{1} << 60)), 0x1p60);
+}
+
 }  // namespace ocpdiag::results
@@ -0,0 +1,169 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/writer_metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "google/protobuf/descriptor.h"
+#include "google/protobuf/struct.pb.h"
+#include "absl/numeric/bits.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+constexpr int kFirstTestRunIdx = 1;
+constexpr int kFirstTestStepIdx = 5;
+constexpr int kUnknownIdx = 16;
+
+int ArtifactTypeIndex(const ocpdiag_results_v2_pb::OutputArtifact& artifact) {
+  switch (artifact.artifact_case()) {
+    case ocpdiag_results_v2_pb::OutputArtifact::kSchemaVersion:
+      return 0;
+    case ocpdiag_results_v2_pb::OutputArtifact::kTestRunArtifact:
+      if (artifact.test_run_artifact().artifact_case() ==
+          ocpdiag_results_v2_pb::TestRunArtifact::ARTIFACT_NOT_SET)
+        return kUnknownIdx;
+      return kFirstTestRunIdx + artifact.test_run_artifact().artifact_case() -
+             1;
+    case ocpdiag_results_v2_pb::OutputArtifact::kTestStepArtifact:
+      if (artifact.test_step_artifact().artifact_case() ==
+          ocpdiag_results_v2_pb::TestStepArtifact::ARTIFACT_NOT_SET)
+        return kUnknownIdx;
+      return kFirstTestStepIdx + artifact.test_step_artifact().artifact_case() -
+             1;
+    default:
+      return kUnknownIdx;
+  }
+}
+
+std::string ArtifactTypeName(int idx) {
+  if (idx == 0) return "schemaVersion";
+  if (idx >= kFirstTestRunIdx && idx < kFirstTestStepIdx) {
+    return absl::StrCat(
+        "testRunArtifact.",
+        ocpdiag_results_v2_pb::TestRunArtifact::descriptor()
+            ->FindFieldByNumber(idx - kFirstTestRunIdx + 1)
+            ->json_name());
+  }
+  if (idx >= kFirstTestStepIdx && idx < kUnknownIdx) {
+    return absl::StrCat(
+        "testStepArtifact.",
+        ocpdiag_results_v2_pb::TestStepArtifact::descriptor()
+            ->FindFieldByNumber(idx - kFirstTestStepIdx + 1)
+            ->json_name());
+  }
+  return "unknown";
+}
+
+google::protobuf::Value NumberValue(double number) {
+  google::protobuf::Value value;
+  value.set_number_value(number);
+  return value;
+}
+
+google::protobuf::Value HistogramToProto(const LatencyHistogram& histogram) {
+  google::protobuf::Value value;
+  auto* fields = value.mutable_struct_value()->mutable_fields();
+  (*fields)["count"] = NumberValue(histogram.count());
+  (*fields)["meanNs"] =
+      NumberValue(absl::ToInt64Nanoseconds(histogram.Mean()));
+  (*fields)["p50Ns"] =
+      NumberValue(absl::ToInt64Nanoseconds(histogram.Percentile(50)));
+  (*fields)["p99Ns"] =
+      NumberValue(absl::ToInt64Nanoseconds(histogram.Percentile(99)));
+  (*fields)["maxNs"] = NumberValue(absl::ToInt64Nanoseconds(histogram.max()));
+  (*fields)["sumNs"] = NumberValue(absl::ToInt64Nanoseconds(histogram.sum()));
+  return value;
+}
+
+}  // namespace
+
+void LatencyHistogram::Record(absl::Duration duration) {
+  int64_t ns = std::max<int64_t>(absl::ToInt64Nanoseconds(duration), 0);
+  int bucket = ns <= 1 ? 0 : absl::bit_width(static_cast<uint64_t>(ns)) - 1;
+  buckets_[std::min(bucket, kNumBuckets - 1)]++;
+  count_++;
+  sum_ns_ += ns;
+  max_ns_ = std::max(max_ns_, ns);
+}
+
+absl::Duration LatencyHistogram::Mean() const {
+  if (count_ == 0) return absl::ZeroDuration();
+  return absl::Nanoseconds(sum_ns_ / count_);
+}
+
+absl::Duration LatencyHistogram::Percentile(double percentile) const {
+  if (count_ == 0) return absl::ZeroDuration();
+  int64_t rank = std::max<int64_t>(
+      static_cast<int64_t>(std::ceil(percentile / 100.0 * count_)), 1);
+  int64_t seen = 0;
+  for (int i = 0; i < kNumBuckets; i++) {
+    seen += buckets_[i];
+    if (seen >= rank) {
+      return std::min(absl::Nanoseconds(int64_t{1} << (i + 1)), max());
+    }
+  }
+  return max();
+}
+
+void WriterMetricsRecorder::RecordArtifact(
+    const ocpdiag_results_v2_pb::OutputArtifact& artifact,
+    int64_t binary_bytes, int64_t json_bytes) {
+  ArtifactTypeMetrics& type_metrics = artifacts_[ArtifactTypeIndex(artifact)];
+  type_metrics.count++;
+  type_metrics.binary_bytes += binary_bytes;
+  type_metrics.json_bytes += json_bytes;
+  uncompressed_bytes_ += binary_bytes;
+}
+
+ArtifactWriterMetrics WriterMetricsRecorder::Snapshot(
+    int64_t compressed_bytes) const {
+  ArtifactWriterMetrics metrics;
+  for (int i = 0; i < kNumArtifactTypes; i++) {
+    if (artifacts_[i].count == 0) continue;
+    metrics.artifacts[ArtifactTypeName(i)] = artifacts_[i];
+  }
+  metrics.serialization_time = serialization_time_;
+  metrics.write_latency = write_latency_;
+  metrics.mutex_wait = mutex_wait_;
+  metrics.flush_duration = flush_duration_;
+  metrics.uncompressed_bytes = uncompressed_bytes_;
+  metrics.compressed_bytes = compressed_bytes;
+  return metrics;
+}
+
+google::protobuf::Struct MetricsToProto(const ArtifactWriterMetrics& metrics) {
+  google::protobuf::Struct proto;
+  auto* fields = proto.mutable_fields();
+
+  google::protobuf::Value artifacts;
+  for (const auto& [name, type_metrics] : metrics.artifacts) {
+    google::protobuf::Value value;
+    auto* type_fields = value.mutable_struct_value()->mutable_fields();
+    (*type_fields)["count"] = NumberValue(type_metrics.count);
+    (*type_fields)["binaryBytes"] = NumberValue(type_metrics.binary_bytes);
+    (*type_fields)["jsonBytes"] = NumberValue(type_metrics.json_bytes);
+    (*artifacts.mutable_struct_value()->mutable_fields())[name] = value;
+  }
+  (*fields)["artifacts"] = artifacts;
+  (*fields)["serializationTime"] = HistogramToProto(metrics.serialization_time);
+  (*fields)["writeLatency"] = HistogramToProto(metrics.write_latency);
+  (*fields)["mutexWait"] = HistogramToProto(metrics.mutex_wait);
+  (*fields)["flushDuration"] = HistogramToProto(metrics.flush_duration);
+  (*fields)["uncompressedBytes"] = NumberValue(metrics.uncompressed_bytes);
+  (*fields)["compressedBytes"] = NumberValue(metrics.compressed_bytes);
+  return proto;
+}
+
+}  // namespace ocpdiag::results::internal
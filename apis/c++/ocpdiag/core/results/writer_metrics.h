@@ -0,0 +1,123 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#ifndef OCPDIAG_CORE_RESULTS_WRITER_METRICS_H_
+#define OCPDIAG_CORE_RESULTS_WRITER_METRICS_H_
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "google/protobuf/struct.pb.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+// Histogram of durations with power-of-two nanosecond buckets. Bucket i counts
+// samples in [2^i, 2^(i+1)) ns, with sub-nanosecond samples counted in bucket
+// zero. Recording is a handful of integer operations, so it is cheap enough to
+// use on every artifact. This class is not thread-safe.
+class LatencyHistogram {
+ public:
+  static constexpr int kNumBuckets = 40;  // Up to ~18 minutes
+
+  void Record(absl::Duration duration);
+
+  int64_t count() const { return count_; }
+  absl::Duration sum() const { return absl::Nanoseconds(sum_ns_); }
+  absl::Duration max() const { return absl::Nanoseconds(max_ns_); }
+  absl::Duration Mean() const;
+
+  // Returns an upper bound for the given percentile (0-100), accurate to within
+  // a factor of two.
+  absl::Duration Percentile(double percentile) const;
+
+  const std::array<int64_t, kNumBuckets>& buckets() const { return buckets_; }
+
+ private:
+  int64_t count_ = 0;
+  int64_t sum_ns_ = 0;
+  int64_t max_ns_ = 0;
+  std::array<int64_t, kNumBuckets> buckets_ = {};
+};
+
+// Counters for a single kind of artifact, such as "testStepArtifact.log".
+struct ArtifactTypeMetrics {
+  int64_t count = 0;
+  int64_t binary_bytes = 0;  // Serialized protobuf size
+  int64_t json_bytes = 0;    // JSONL line size, excluding the newline
+};
+
+// A point-in-time snapshot of the ArtifactWriter's self-instrumentation.
+struct ArtifactWriterMetrics {
+  // Keyed by "<outputArtifactField>[.<artifactField>]", using the JSON names of
+  // the artifact oneof fields, e.g. "testStepArtifact.measurement".
+  std::map<std::string, ArtifactTypeMetrics> artifacts;
+
+  // Time spent converting artifacts to their binary and JSON forms.
+  LatencyHistogram serialization_time;
+
+  // Total time spent inside ArtifactWriter::Write, including mutex waits.
+  LatencyHistogram write_latency;
+
+  // Time spent waiting to acquire the writer's mutex.
+  LatencyHistogram mutex_wait;
+
+  // File flushes, whether periodic or requested.
+  LatencyHistogram flush_duration;
+
+  // Bytes of serialized records handed to the record writer, and bytes the
+  // record writer has passed on to the file after compression. The compressed
+  // size lags behind while records are buffered in the current chunk.
+  int64_t uncompressed_bytes = 0;
+  int64_t compressed_bytes = 0;
+};
+
+// Accumulates the ArtifactWriter's self-instrumentation. Per-type counters are
+// kept in a fixed array indexed by the artifact oneof cases, so recording an
+// artifact does not allocate or hash. This class is not thread-safe; the
+// ArtifactWriter guards it with its own mutex.
+class WriterMetricsRecorder {
+ public:
+  void RecordArtifact(const ocpdiag_results_v2_pb::OutputArtifact& artifact,
+                      int64_t binary_bytes, int64_t json_bytes);
+  void RecordSerialization(absl::Duration duration) {
+    serialization_time_.Record(duration);
+  }
+  void RecordWrite(absl::Duration duration) { write_latency_.Record(duration); }
+  void RecordMutexWait(absl::Duration duration) {
+    mutex_wait_.Record(duration);
+  }
+  void RecordFlush(absl::Duration duration) {
+    flush_duration_.Record(duration);
+  }
+
+  // Returns a snapshot of all metrics recorded so far, along with the number
+  // of bytes the record writer has passed on to the output file.
+  ArtifactWriterMetrics Snapshot(int64_t compressed_bytes) const;
+
+ private:
+  // Schema version, 4 test run artifact cases, 11 test step artifact cases and
+  // one slot for unset artifacts.
+  static constexpr int kNumArtifactTypes = 17;
+
+  std::array<ArtifactTypeMetrics, kNumArtifactTypes> artifacts_ = {};
+  LatencyHistogram serialization_time_;
+  LatencyHistogram write_latency_;
+  LatencyHistogram mutex_wait_;
+  LatencyHistogram flush_duration_;
+  int64_t uncompressed_bytes_ = 0;
+};
+
+// Converts a metrics snapshot into a generic protobuf struct suitable for the
+// content of an Extension artifact.
+google::protobuf::Struct MetricsToProto(const ArtifactWriterMetrics& metrics);
+
+}  // namespace ocpdiag::results::internal
+
+#endif  // OCPDIAG_CORE_RESULTS_WRITER_METRICS_H_
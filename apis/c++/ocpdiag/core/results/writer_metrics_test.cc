@@ -0,0 +1,109 @@
+// Copyright 2022 Google LLC
+//
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file or at
+// https://opensource.org/licenses/MIT.
+
+#include "ocpdiag/core/results/writer_metrics.h"
+
+#include "google/protobuf/struct.pb.h"
+#include "gtest/gtest.h"
+#include "absl/time/time.h"
+#include "ocpdiag/core/results/results.pb.h"
+
+namespace ocpdiag::results::internal {
+
+namespace {
+
+TEST(LatencyHistogramTest, EmptyHistogramReturnsZero) {
+  LatencyHistogram histogram;
+  EXPECT_EQ(histogram.count(), 0);
+  EXPECT_EQ(histogram.Mean(), absl::ZeroDuration());
+  EXPECT_EQ(histogram.Percentile(50), absl::ZeroDuration());
+}
+
+TEST(LatencyHistogramTest, RecordsIntoPowerOfTwoBuckets) {
+  LatencyHistogram histogram;
+  histogram.Record(absl::Nanoseconds(1));
+  histogram.Record(absl::Nanoseconds(5));
+  histogram.Record(absl::Nanoseconds(7));
+  histogram.Record(absl::Microseconds(1));
+  histogram.Record(-absl::Nanoseconds(3));
+
+  EXPECT_EQ(histogram.count(), 5);
+  EXPECT_EQ(histogram.buckets()[0], 2);
+  EXPECT_EQ(histogram.buckets()[2], 2);
+  EXPECT_EQ(histogram.buckets()[9], 1);
+  EXPECT_EQ(histogram.sum(), absl::Nanoseconds(1013));
+  EXPECT_EQ(histogram.max(), absl::Microseconds(1));
+}
+
+TEST(LatencyHistogramTest, LargeDurationsAreClampedToLastBucket) {
+  LatencyHistogram histogram;
+  histogram.Record(absl::Hours(10));
+  EXPECT_EQ(histogram.buckets()[LatencyHistogram::kNumBuckets - 1], 1);
+}
+
+TEST(LatencyHistogramTest, PercentilesAreBoundedByBucketsAndMax) {
+  LatencyHistogram histogram;
+  for (int i = 0; i < 90; i++) histogram.Record(absl::Nanoseconds(100));
+  for (int i = 0; i < 10; i++) histogram.Record(absl::Nanoseconds(5000));
+
+  EXPECT_EQ(histogram.Percentile(50), absl::Nanoseconds(128));
+  EXPECT_EQ(histogram.Percentile(90), absl::Nanoseconds(128));
+  EXPECT_EQ(histogram.Percentile(99), absl::Nanoseconds(5000));
+  EXPECT_EQ(histogram.Mean(), absl::Nanoseconds(590));
+}
+
+TEST(WriterMetricsRecorderTest, ArtifactsAreKeyedByType) {
+  WriterMetricsRecorder recorder;
+  ocpdiag_results_v2_pb::OutputArtifact artifact;
+  artifact.mutable_test_run_artifact()->mutable_test_run_start();
+  recorder.RecordArtifact(artifact, 10, 20);
+  artifact.mutable_test_step_artifact()->mutable_extension();
+  recorder.RecordArtifact(artifact, 3, 4);
+  recorder.RecordArtifact(artifact, 5, 6);
+  artifact.Clear();
+  recorder.RecordArtifact(artifact, 1, 1);
+
+  ArtifactWriterMetrics metrics = recorder.Snapshot(7);
+  ASSERT_EQ(metrics.artifacts.size(), 3);
+  EXPECT_EQ(metrics.artifacts["testRunArtifact.testRunStart"].count, 1);
+  EXPECT_EQ(metrics.artifacts["testStepArtifact.extension"].count, 2);
+  EXPECT_EQ(metrics.artifacts["testStepArtifact.extension"].binary_bytes, 8);
+  EXPECT_EQ(metrics.artifacts["testStepArtifact.extension"].json_bytes, 10);
+  EXPECT_EQ(metrics.artifacts["unknown"].count, 1);
+  EXPECT_EQ(metrics.uncompressed_bytes, 19);
+  EXPECT_EQ(metrics.compressed_bytes, 7);
+}
+
+TEST(WriterMetricsRecorderTest, MetricsConvertToProto) {
+  WriterMetricsRecorder recorder;
+  ocpdiag_results_v2_pb::OutputArtifact artifact;
+  artifact.mutable_schema_version();
+  recorder.RecordArtifact(artifact, 4, 30);
+  recorder.RecordWrite(absl::Microseconds(2));
+
+  google::protobuf::Struct proto = MetricsToProto(recorder.Snapshot(0));
+  const auto& fields = proto.fields();
+  EXPECT_EQ(fields.at("artifacts")
+                .struct_value()
+                .fields()
+                .at("schemaVersion")
+                .struct_value()
+                .fields()
+                .at("jsonBytes")
+                .number_value(),
+            30);
+  EXPECT_EQ(fields.at("writeLatency")
+                .struct_value()
+                .fields()
+                .at("maxNs")
+                .number_value(),
+            2000);
+  EXPECT_EQ(fields.at("uncompressedBytes").number_value(), 4);
+}
+
+}  // namespace
+
+}  // namespace ocpdiag::results::internal